@@ -0,0 +1,213 @@
+#include "pch.h"
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <array>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#include "mesh/mesh_optimizer.h"
+
+// Benchmark of the mesh optimizer passes the importer runs, on synthetic meshes with
+// their triangles shuffled, which is about as bad an order as an OBJ can come in:
+//
+//  grid    a height field of N x N quads, the regular case every optimizer aims at
+//  sphere  a UV sphere of N x N quads, closed, so the overdraw order matters
+//
+// Prints the time of every pass and the ACMR/ATVR after it, and checks that each
+// pass kept the triangles (winding included) that it was given.
+//
+//  MeshOptimizerBench [--size N] [--threshold T]
+
+namespace {
+    const uint32_t DEFAULT_SIZE = 512;
+    const float DEFAULT_THRESHOLD = 1.05f;
+    const float PI = 3.14159265358979f;
+
+    typedef std::chrono::high_resolution_clock Clock;
+
+    struct Options {
+        uint32_t size = DEFAULT_SIZE;
+        float threshold = DEFAULT_THRESHOLD;
+    };
+
+    // the same size as the application's vertex
+    struct BenchVertex {
+        float pos[3];
+        float color[3];
+        float texCoord[2];
+    };
+
+    struct Mesh {
+        std::string name{};
+        std::vector<BenchVertex> vertices{};
+        std::vector<uint32_t> indices{};
+    };
+
+    Options parseOptions(int argc, char** argv) {
+        Options options{};
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--size" && i + 1 < argc) {
+                options.size = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+            } else if (arg == "--threshold" && i + 1 < argc) {
+                options.threshold = std::strtof(argv[++i], nullptr);
+            } else {
+                throw std::runtime_error("usage: MeshOptimizerBench [--size N] [--threshold T]");
+            }
+        }
+        if (options.size < 2) {
+            throw std::runtime_error("--size must be at least 2");
+        }
+        return options;
+    }
+
+    // (size + 1)^2 vertices, position(u, v) for u and v in [0, 1]
+    template<typename Fn>
+    Mesh createPatch(const std::string& name, uint32_t size, Fn position) {
+        Mesh mesh{};
+        mesh.name = name;
+        for (uint32_t y = 0; y <= size; y++) {
+            for (uint32_t x = 0; x <= size; x++) {
+                float u = static_cast<float>(x) / size;
+                float v = static_cast<float>(y) / size;
+                BenchVertex vertex{};
+                position(u, v, vertex.pos);
+                vertex.color[0] = vertex.color[1] = vertex.color[2] = 1.0f;
+                vertex.texCoord[0] = u;
+                vertex.texCoord[1] = v;
+                mesh.vertices.push_back(vertex);
+            }
+        }
+
+        for (uint32_t y = 0; y < size; y++) {
+            for (uint32_t x = 0; x < size; x++) {
+                uint32_t a = y * (size + 1) + x;
+                uint32_t b = a + 1;
+                uint32_t c = a + size + 1;
+                uint32_t d = c + 1;
+                mesh.indices.insert(mesh.indices.end(), { a, b, d, a, d, c });
+            }
+        }
+        return mesh;
+    }
+
+    void shuffleTriangles(Mesh& mesh) {
+        std::vector<std::array<uint32_t, 3>> triangles(mesh.indices.size() / 3);
+        for (size_t t = 0; t < triangles.size(); t++) {
+            triangles[t] = { mesh.indices[t * 3], mesh.indices[t * 3 + 1], mesh.indices[t * 3 + 2] };
+        }
+        std::shuffle(triangles.begin(), triangles.end(), std::mt19937(1));
+        for (size_t t = 0; t < triangles.size(); t++) {
+            std::copy(triangles[t].begin(), triangles[t].end(), mesh.indices.begin() + t * 3);
+        }
+    }
+
+    // every triangle by its vertices' values, starting at the lowest so that rotations
+    // compare equal but flipped windings don't
+    std::vector<std::array<const BenchVertex*, 3>> canonicalTriangles(const Mesh& mesh) {
+        auto less = [](const BenchVertex* a, const BenchVertex* b) {
+            return std::lexicographical_compare(a->pos, a->pos + 3, b->pos, b->pos + 3) ||
+                (std::equal(a->pos, a->pos + 3, b->pos) &&
+                    std::lexicographical_compare(a->texCoord, a->texCoord + 2, b->texCoord, b->texCoord + 2));
+        };
+
+        std::vector<std::array<const BenchVertex*, 3>> triangles(mesh.indices.size() / 3);
+        for (size_t t = 0; t < triangles.size(); t++) {
+            auto& triangle = triangles[t];
+            for (uint32_t k = 0; k < 3; k++) {
+                triangle[k] = &mesh.vertices[mesh.indices[t * 3 + k]];
+            }
+            std::rotate(triangle.begin(), std::min_element(triangle.begin(), triangle.end(), less), triangle.end());
+        }
+        std::sort(triangles.begin(), triangles.end(), [&](const auto& a, const auto& b) {
+            return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), less);
+        });
+        return triangles;
+    }
+
+    bool sameTriangles(const Mesh& a, const Mesh& b) {
+        auto x = canonicalTriangles(a);
+        auto y = canonicalTriangles(b);
+        return std::equal(x.begin(), x.end(), y.begin(), y.end(), [](const auto& p, const auto& q) {
+            for (uint32_t k = 0; k < 3; k++) {
+                if (!std::equal(p[k]->pos, p[k]->pos + 3, q[k]->pos) || !std::equal(p[k]->texCoord, p[k]->texCoord + 2, q[k]->texCoord)) {
+                    return false;
+                }
+            }
+            return true;
+        });
+    }
+
+    void printStep(const std::string& step, double ms, const Mesh& mesh) {
+        VertexCacheStats stats = analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+        std::cout << "  " << std::left << std::setw(14) << step << std::right << std::setw(9) << ms << " ms  ";
+        stats.print(std::cout);
+        std::cout << std::endl;
+    }
+
+    void run(Mesh mesh, float threshold) {
+        shuffleTriangles(mesh);
+        const Mesh original = mesh;
+        std::cout << mesh.name << ": " << mesh.indices.size() / 3 << " triangles, " << mesh.vertices.size() << " vertices" << std::endl;
+        printStep("shuffled", 0.0, mesh);
+
+        auto time = [](auto fn) {
+            auto start = Clock::now();
+            fn();
+            return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        };
+
+        double ms = time([&] { optimizeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size()); });
+        printStep("vertex cache", ms, mesh);
+
+        ms = time([&] {
+            optimizeOverdraw(mesh.indices.data(), mesh.indices.size(), mesh.vertices[0].pos, mesh.vertices.size(), sizeof(BenchVertex), threshold);
+        });
+        printStep("overdraw", ms, mesh);
+
+        std::vector<BenchVertex> unordered = mesh.vertices;
+        ms = time([&] {
+            uint32_t count = optimizeVertexFetch(mesh.vertices.data(), mesh.indices.data(), mesh.indices.size(), unordered.data(),
+                unordered.size(), sizeof(BenchVertex));
+            mesh.vertices.resize(count);
+        });
+        printStep("vertex fetch", ms, mesh);
+
+        if (!sameTriangles(original, mesh)) {
+            throw std::runtime_error(mesh.name + ": the optimized mesh has other triangles than the input");
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    try {
+        Options options = parseOptions(argc, argv);
+        std::cout << std::fixed << std::setprecision(3);
+
+        run(createPatch("grid", options.size, [](float u, float v, float* pos) {
+            pos[0] = u;
+            pos[1] = v;
+            pos[2] = 0.1f * std::sin(6.0f * u) * std::cos(6.0f * v);
+        }), options.threshold);
+
+        run(createPatch("sphere", options.size, [](float u, float v, float* pos) {
+            float theta = 2.0f * PI * u;
+            float phi = PI * v;
+            pos[0] = std::sin(phi) * std::cos(theta);
+            pos[1] = std::cos(phi);
+            pos[2] = std::sin(phi) * std::sin(theta);
+        }), options.threshold);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,677 @@
+#include "pch.h"
+#include <vulkan/vulkan.h>
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <optional>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include "memory/allocator.h"
+#include "memory/memory_types.h"
+#include "transfer/staging_ring.h"
+#include "transfer/upload_batch.h"
+#include "transfer/compute_mips.h"
+#include "transfer/mip_generator.h"
+#include "sync/state_tracker.h"
+
+// Headless benchmark of the upload paths, end to end on the host clock: the time
+// from handing the data over until the GPU has finished with it.
+//
+//  staging_buffer  StagingRing::uploadBuffer into a device local buffer
+//  staging_image   StagingRing::uploadImage into level 0 of an optimal image
+//  mip_blit        recordMipChains with blits
+//  mip_compute     recordMipChains with ComputeMipGenerator, if the shader is compiled
+//  mip_cpu         generateMipLevels on every hardware thread
+//  direct          memcpy into a mapped DirectUpload buffer (device local on ReBAR/UMA)
+//
+// No window or surface is created, so it runs on any ICD, lavapipe included. The
+// results are written as JSON, to stdout or to the path given:
+//
+//  UploadBench [output.json] [--iterations N] [--device INDEX]
+
+namespace {
+    // the same ring the application uploads through; bigger buffers go in chunks
+    const VkDeviceSize STAGING_RING_SIZE = 4 * 1024 * 1024;
+    const std::vector<VkDeviceSize> BUFFER_SIZES = { 4 * 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024 };
+    const std::vector<uint32_t> IMAGE_SIZES = { 256, 1024, 2048 };
+    const uint32_t DEFAULT_ITERATIONS = 50;
+    // runs before the measured ones, to get lazy allocations and caches out of the way
+    const uint32_t WARMUP_ITERATIONS = 3;
+    // relative to the Vulkan directory, like the application's paths
+    const std::string MIPGEN_SHADER_PATH = "src/shaders/mipgen.spv";
+    const VkPipelineStageFlags DST_STAGE_MASK = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+    typedef std::chrono::high_resolution_clock Clock;
+
+    struct Options {
+        std::string outputPath{};
+        uint32_t iterations = DEFAULT_ITERATIONS;
+        std::optional<uint32_t> deviceIndex{};
+    };
+
+    struct Result {
+        std::string path{};
+        // bytes moved (or generated, for mips) by one iteration
+        VkDeviceSize bytes = 0;
+        // images only
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<double> milliseconds{};
+    };
+
+    // nearest rank, on sorted samples
+    double percentile(const std::vector<double>& sorted, double p) {
+        size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+        return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+    }
+
+    double elapsedMilliseconds(Clock::time_point begin) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+    }
+
+    uint32_t mipLevelCount(uint32_t width, uint32_t height) {
+        return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+    }
+
+    Options parseOptions(int argc, char** argv) {
+        Options options{};
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--iterations" && i + 1 < argc) {
+                options.iterations = std::max(1, std::atoi(argv[++i]));
+            } else if (arg == "--device" && i + 1 < argc) {
+                options.deviceIndex = static_cast<uint32_t>(std::atoi(argv[++i]));
+            } else if (!arg.empty() && arg[0] != '-') {
+                options.outputPath = arg;
+            } else {
+                throw std::runtime_error("usage: UploadBench [output.json] [--iterations N] [--device INDEX]");
+            }
+        }
+        return options;
+    }
+}
+
+class UploadBenchmark {
+public:
+    void Run(const Options& options) {
+        this->options = options;
+
+        init();
+        benchmarkStagingBuffers();
+        benchmarkStagingImages();
+        benchmarkMipChains();
+        benchmarkCpuMipChains();
+        benchmarkDirectWrites();
+
+        if (options.outputPath.empty()) {
+            writeJson(std::cout);
+        } else {
+            std::ofstream file(options.outputPath);
+            if (!file) {
+                throw std::runtime_error("failed to open " + options.outputPath);
+            }
+            writeJson(file);
+        }
+
+        cleanup();
+    }
+
+private:
+    void init() {
+        createInstance();
+        pickPhysicalDevice();
+        createLogicalDevice();
+
+        memoryTypes.init(physicalDevice);
+        allocator.init(physicalDevice, device);
+
+        // the ring's own family is also the destination, so nothing is handed over;
+        // the uploads are measured on the queue the application would use for them
+        createBuffer(STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryUsage::Upload, stagingRingBuffer, stagingRingAllocation);
+        stagingRing.init(device, transferQueue, transferFamily, transferQueue, transferFamily,
+            stagingRingBuffer, allocator.map(stagingRingAllocation), STAGING_RING_SIZE);
+
+        // mip chains are recorded on the graphics queue, blits need it
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        poolInfo.queueFamilyIndex = graphicsFamily;
+        VkResult err = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
+        if (err != VK_SUCCESS) {
+            std::cerr << "Error creating command pool: " << err << std::endl;
+            throw std::runtime_error("error creating command pool.");
+        }
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+        err = vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+        if (err != VK_SUCCESS) {
+            std::cerr << "Error allocating command buffer: " << err << std::endl;
+            throw std::runtime_error("error allocating command buffer.");
+        }
+
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        err = vkCreateFence(device, &fenceInfo, nullptr, &fence);
+        if (err != VK_SUCCESS) {
+            std::cerr << "Error creating fence: " << err << std::endl;
+            throw std::runtime_error("error creating fence.");
+        }
+
+        // optional, like in the application; the compute results are left out without it
+        computeMips.init(physicalDevice, device, MIPGEN_SHADER_PATH, 1);
+    }
+
+    void cleanup() {
+        computeMips.destroy();
+        vkDestroyFence(device, fence, nullptr);
+        vkDestroyCommandPool(device, commandPool, nullptr);
+
+        stagingRing.destroy();
+        vkDestroyBuffer(device, stagingRingBuffer, nullptr);
+        allocator.unmap(stagingRingAllocation);
+        allocator.free(stagingRingAllocation);
+
+        allocator.destroy();
+        vkDestroyDevice(device, nullptr);
+        vkDestroyInstance(instance, nullptr);
+    }
+
+    void createInstance() {
+        VkApplicationInfo appInfo{};
+        appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+        appInfo.pApplicationName = "UploadBench";
+        appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+        appInfo.pEngineName = "Custom";
+        appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+        // timeline semaphores and synchronization2, as in the application
+        appInfo.apiVersion = VK_API_VERSION_1_3;
+
+        // no surface, so no instance extensions at all
+        VkInstanceCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        createInfo.pApplicationInfo = &appInfo;
+
+        VkResult err = vkCreateInstance(&createInfo, nullptr, &instance);
+        if (err != VK_SUCCESS) {
+            std::cerr << "Error creating instance: " << err << std::endl;
+            throw std::runtime_error("error creating instance.");
+        }
+    }
+
+    void pickPhysicalDevice() {
+        uint32_t deviceCount = 0;
+        vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+        std::vector<VkPhysicalDevice> devices(deviceCount);
+        vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+
+        if (options.deviceIndex.has_value()) {
+            if (options.deviceIndex.value() >= deviceCount) {
+                throw std::runtime_error("no physical device with that index.");
+            }
+            devices = { devices[options.deviceIndex.value()] };
+        }
+
+        // discrete over integrated over the rest (lavapipe is a CPU device)
+        auto typeScore = [](VkPhysicalDeviceType type) {
+            switch (type) {
+            case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+                return 3;
+            case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+                return 2;
+            default:
+                return 1;
+            }
+        };
+
+        int bestScore = 0;
+        for (auto candidate : devices) {
+            VkPhysicalDeviceProperties properties{};
+            vkGetPhysicalDeviceProperties(candidate, &properties);
+            if (properties.apiVersion < VK_API_VERSION_1_3 || !findQueueFamilies(candidate)) {
+                continue;
+            }
+
+            int score = typeScore(properties.deviceType);
+            if (score > bestScore) {
+                bestScore = score;
+                physicalDevice = candidate;
+                deviceProperties = properties;
+            }
+        }
+
+        if (physicalDevice == VK_NULL_HANDLE) {
+            throw std::runtime_error("failed to find a Vulkan 1.3 device with a graphics queue.");
+        }
+        findQueueFamilies(physicalDevice);
+    }
+
+    // the same picks as the application, minus presentation: any graphics family, and
+    // the family most dedicated to transfers for the ring
+    bool findQueueFamilies(VkPhysicalDevice candidate) {
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(candidate, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(candidate, &queueFamilyCount, queueFamilies.data());
+
+        auto transferScore = [](VkQueueFlags flags) {
+            if (flags & VK_QUEUE_GRAPHICS_BIT) {
+                return 1;
+            }
+            if (flags & VK_QUEUE_COMPUTE_BIT) {
+                return 2;
+            }
+            if (flags & VK_QUEUE_TRANSFER_BIT) {
+                return 3;
+            }
+            return 0;
+        };
+
+        std::optional<uint32_t> graphics{};
+        std::optional<uint32_t> transfer{};
+        int bestTransferScore = 0;
+        for (uint32_t i = 0; i < queueFamilyCount; i++) {
+            if (queueFamilies[i].queueCount == 0) {
+                continue;
+            }
+            if (!graphics.has_value() && (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+                graphics = i;
+            }
+
+            int score = transferScore(queueFamilies[i].queueFlags);
+            if (score > bestTransferScore) {
+                bestTransferScore = score;
+                transfer = i;
+            }
+        }
+
+        if (!graphics.has_value()) {
+            return false;
+        }
+        graphicsFamily = graphics.value();
+        transferFamily = transfer.value();
+        return true;
+    }
+
+    void createLogicalDevice() {
+        std::vector<uint32_t> families = { graphicsFamily };
+        if (transferFamily != graphicsFamily) {
+            families.push_back(transferFamily);
+        }
+
+        float queuePriority = 1.0f;
+        std::vector<VkDeviceQueueCreateInfo> queueCreateInfos{};
+        for (uint32_t family : families) {
+            VkDeviceQueueCreateInfo queueCreateInfo{};
+            queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            queueCreateInfo.queueFamilyIndex = family;
+            queueCreateInfo.queueCount = 1;
+            queueCreateInfo.pQueuePriorities = &queuePriority;
+            queueCreateInfos.push_back(queueCreateInfo);
+        }
+
+        VkPhysicalDeviceVulkan13Features vulkan13Features{};
+        vulkan13Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+        vulkan13Features.synchronization2 = VK_TRUE;
+
+        VkPhysicalDeviceVulkan12Features vulkan12Features{};
+        vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        vulkan12Features.timelineSemaphore = VK_TRUE;
+        vulkan12Features.pNext = &vulkan13Features;
+
+        VkPhysicalDeviceFeatures deviceFeatures{};
+
+        VkDeviceCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        createInfo.pNext = &vulkan12Features;
+        createInfo.pQueueCreateInfos = queueCreateInfos.data();
+        createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+        createInfo.pEnabledFeatures = &deviceFeatures;
+
+        VkResult err = vkCreateDevice(physicalDevice, &createInfo, nullptr, &device);
+        if (err != VK_SUCCESS) {
+            std::cerr << "Error creating logical device: " << err << std::endl;
+            throw std::runtime_error("error creating logical device.");
+        }
+
+        vkGetDeviceQueue(device, graphicsFamily, 0, &graphicsQueue);
+        vkGetDeviceQueue(device, transferFamily, 0, &transferQueue);
+    }
+
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, MemoryUsage memoryUsage, VkBuffer& buffer, Allocation& allocation) {
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VkResult err = vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
+        if (err != VK_SUCCESS) {
+            std::cerr << "Error creating buffer: " << err << std::endl;
+            throw std::runtime_error("error creating buffer.");
+        }
+
+        ResourceRequirements requirements = allocator.getBufferRequirements(buffer);
+        allocation = allocator.allocate(requirements, memoryTypes.find(requirements.memory.memoryTypeBits, memoryUsage), ResourceKind::Linear);
+
+        err = vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+        if (err != VK_SUCCESS) {
+            std::cerr << "Error binding buffer memory: " << err << std::endl;
+            throw std::runtime_error("error binding buffer memory.");
+        }
+    }
+
+    void destroyBuffer(VkBuffer buffer, Allocation& allocation) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        allocator.free(allocation);
+    }
+
+    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkImageUsageFlags usage, VkImage& image, Allocation& allocation) {
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.extent = { width, height, 1 };
+        imageInfo.mipLevels = mipLevels;
+        imageInfo.arrayLayers = 1;
+        // UNORM, so the compute path needs no view format tricks
+        imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.usage = usage;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        VkResult err = vkCreateImage(device, &imageInfo, nullptr, &image);
+        if (err != VK_SUCCESS) {
+            std::cerr << "Error creating image: " << err << std::endl;
+            throw std::runtime_error("error creating image.");
+        }
+
+        ResourceRequirements requirements = allocator.getImageRequirements(image);
+        allocation = allocator.allocate(requirements, memoryTypes.find(requirements.memory.memoryTypeBits, MemoryUsage::GpuOnly), ResourceKind::Optimal);
+
+        err = vkBindImageMemory(device, image, allocation.memory, allocation.offset);
+        if (err != VK_SUCCESS) {
+            std::cerr << "Error binding image memory: " << err << std::endl;
+            throw std::runtime_error("error binding image memory.");
+        }
+    }
+
+    void destroyImage(VkImage image, Allocation& allocation) {
+        vkDestroyImage(device, image, nullptr);
+        allocator.free(allocation);
+    }
+
+    // warmup runs first and isn't recorded
+    template<typename Fn>
+    Result measure(const std::string& path, VkDeviceSize bytes, uint32_t width, uint32_t height, Fn iteration) {
+        Result result{};
+        result.path = path;
+        result.bytes = bytes;
+        result.width = width;
+        result.height = height;
+
+        for (uint32_t i = 0; i < WARMUP_ITERATIONS + options.iterations; i++) {
+            Clock::time_point begin = Clock::now();
+            iteration();
+            double milliseconds = elapsedMilliseconds(begin);
+            if (i >= WARMUP_ITERATIONS) {
+                result.milliseconds.push_back(milliseconds);
+            }
+        }
+
+        std::cerr << path << " " << (width > 0 ? std::to_string(width) + "x" + std::to_string(height) : std::to_string(bytes) + " bytes")
+            << ": done" << std::endl;
+        return result;
+    }
+
+    std::vector<char> makeSourceData(VkDeviceSize size) {
+        std::vector<char> data(static_cast<size_t>(size));
+        for (size_t i = 0; i < data.size(); i++) {
+            data[i] = static_cast<char>(i * 7 + (i >> 12));
+        }
+        return data;
+    }
+
+    void benchmarkStagingBuffers() {
+        for (VkDeviceSize size : BUFFER_SIZES) {
+            std::vector<char> data = makeSourceData(size);
+
+            VkBuffer buffer;
+            Allocation allocation{};
+            createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, MemoryUsage::GpuOnly, buffer, allocation);
+
+            results.push_back(measure("staging_buffer", size, 0, 0, [&]() {
+                stagingRing.wait(stagingRing.uploadBuffer(buffer, 0, data.data(), size));
+            }));
+
+            destroyBuffer(buffer, allocation);
+        }
+    }
+
+    void benchmarkStagingImages() {
+        for (uint32_t extent : IMAGE_SIZES) {
+            VkDeviceSize size = static_cast<VkDeviceSize>(extent) * extent * 4;
+            std::vector<char> data = makeSourceData(size);
+
+            VkImage image;
+            Allocation allocation{};
+            createImage(extent, extent, 1, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, image, allocation);
+
+            // stays in TRANSFER_DST; every copy overwrites the whole level, and only the
+            // first one has to wait for the transition
+            ResourceStateTracker& ringStates = stagingRing.getStateTracker();
+            ringStates.addImage(image, VK_IMAGE_ASPECT_COLOR_BIT, 1, 1);
+            ringStates.useImage(stagingRing.getCommandBuffer(), image, UPLOAD_DST);
+            stagingRing.wait(stagingRing.flush());
+
+            results.push_back(measure("staging_image", size, extent, extent, [&]() {
+                stagingRing.wait(stagingRing.uploadImage(image, 0, extent, extent, 4, data.data()));
+            }));
+
+            ringStates.removeImage(image);
+            destroyImage(image, allocation);
+        }
+    }
+
+    void benchmarkMipChains() {
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProperties);
+        bool blits = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) != 0;
+        bool compute = computeMips.supports(VK_FORMAT_R8G8B8A8_UNORM);
+
+        for (uint32_t extent : IMAGE_SIZES) {
+            uint32_t mipLevels = mipLevelCount(extent, extent);
+            VkDeviceSize size = mipChainSize(extent, extent, mipLevels, 4) - static_cast<VkDeviceSize>(extent) * extent * 4;
+
+            if (blits) {
+                results.push_back(benchmarkMipChain("mip_blit", extent, mipLevels, size, VK_FORMAT_UNDEFINED));
+            }
+            if (compute) {
+                results.push_back(benchmarkMipChain("mip_compute", extent, mipLevels, size, VK_FORMAT_R8G8B8A8_UNORM));
+            }
+        }
+    }
+
+    // level 0 is left undefined: the filters take as long whatever it holds
+    Result benchmarkMipChain(const std::string& path, uint32_t extent, uint32_t mipLevels, VkDeviceSize size, VkFormat storageFormat) {
+        VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        if (storageFormat != VK_FORMAT_UNDEFINED) {
+            usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+        }
+
+        VkImage image;
+        Allocation allocation{};
+        createImage(extent, extent, mipLevels, usage, image, allocation);
+        states.addImage(image, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels, 1);
+
+        MipChain chain{};
+        chain.image = image;
+        chain.width = extent;
+        chain.height = extent;
+        chain.mipLevels = mipLevels;
+        chain.storageFormat = storageFormat;
+
+        uint64_t frame = 0;
+        Result result = measure(path, size, extent, extent, [&]() {
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+            // as if level 0 had just been copied in; what the image held doesn't matter
+            states.useImage(commandBuffer, image, UPLOAD_DST);
+            states.flush(commandBuffer);
+
+            recordMipChains(commandBuffer, states, { chain }, DST_STAGE_MASK, &computeMips);
+            vkEndCommandBuffer(commandBuffer);
+
+            VkSubmitInfo submitInfo{};
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &commandBuffer;
+            VkResult err = vkQueueSubmit(graphicsQueue, 1, &submitInfo, fence);
+            if (err != VK_SUCCESS) {
+                std::cerr << "Error submitting mip chain: " << err << std::endl;
+                throw std::runtime_error("error submitting mip chain.");
+            }
+
+            vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+            vkResetFences(device, 1, &fence);
+            vkResetCommandBuffer(commandBuffer, 0);
+            computeMips.update(++frame);
+        });
+
+        states.removeImage(image);
+        destroyImage(image, allocation);
+        return result;
+    }
+
+    void benchmarkCpuMipChains() {
+        uint32_t threadCount = std::thread::hardware_concurrency();
+
+        for (uint32_t extent : IMAGE_SIZES) {
+            uint32_t mipLevels = mipLevelCount(extent, extent);
+            VkDeviceSize levelSize = static_cast<VkDeviceSize>(extent) * extent * 4;
+            std::vector<char> source = makeSourceData(levelSize);
+            std::vector<char> data{};
+
+            // the copy of level 0 is part of it, as in the texture loaders
+            results.push_back(measure("mip_cpu", mipChainSize(extent, extent, mipLevels, 4) - levelSize, extent, extent, [&]() {
+                data.assign(source.begin(), source.end());
+                generateMipLevels(data, extent, extent, mipLevels, true, threadCount);
+            }));
+        }
+    }
+
+    void benchmarkDirectWrites() {
+        for (VkDeviceSize size : BUFFER_SIZES) {
+            std::vector<char> data = makeSourceData(size);
+
+            VkBuffer buffer;
+            Allocation allocation{};
+            createBuffer(size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, MemoryUsage::DirectUpload, buffer, allocation);
+            char* mapped = static_cast<char*>(allocator.map(allocation));
+
+            // coherent, and visible to any submission made after it
+            results.push_back(measure("direct", size, 0, 0, [&]() {
+                memcpy(mapped, data.data(), static_cast<size_t>(size));
+            }));
+
+            directDeviceLocal = (memoryTypes.getFlags(allocation.memoryTypeIndex) & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0;
+            allocator.unmap(allocation);
+            destroyBuffer(buffer, allocation);
+        }
+    }
+
+    void writeJson(std::ostream& out) const {
+        out << "{" << std::endl;
+        out << "  \"device\": {" << std::endl;
+        out << "    \"name\": \"" << deviceProperties.deviceName << "\"," << std::endl;
+        out << "    \"type\": " << deviceProperties.deviceType << "," << std::endl;
+        out << "    \"vendorId\": " << deviceProperties.vendorID << "," << std::endl;
+        out << "    \"driverVersion\": " << deviceProperties.driverVersion << "," << std::endl;
+        out << "    \"apiVersion\": \"" << VK_API_VERSION_MAJOR(deviceProperties.apiVersion) << "." << VK_API_VERSION_MINOR(deviceProperties.apiVersion)
+            << "." << VK_API_VERSION_PATCH(deviceProperties.apiVersion) << "\"," << std::endl;
+        out << "    \"unifiedMemory\": " << (memoryTypes.isUnifiedMemory() ? "true" : "false") << "," << std::endl;
+        out << "    \"dedicatedTransferQueue\": " << (transferFamily != graphicsFamily ? "true" : "false") << "," << std::endl;
+        out << "    \"directUploadDeviceLocal\": " << (directDeviceLocal ? "true" : "false") << "," << std::endl;
+        out << "    \"cpuMipGenerator\": \"" << getMipGeneratorPath() << "\"," << std::endl;
+        out << "    \"cpuThreads\": " << std::thread::hardware_concurrency() << std::endl;
+        out << "  }," << std::endl;
+        out << "  \"stagingRingSize\": " << STAGING_RING_SIZE << "," << std::endl;
+        out << "  \"iterations\": " << options.iterations << "," << std::endl;
+
+        out << "  \"results\": [" << std::endl;
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& result = results[i];
+            std::vector<double> sorted = result.milliseconds;
+            std::sort(sorted.begin(), sorted.end());
+
+            double total = 0.0;
+            for (double milliseconds : sorted) {
+                total += milliseconds;
+            }
+            double gbPerSecond = total > 0.0 ? static_cast<double>(result.bytes) * sorted.size() / (total * 1.0e6) : 0.0;
+
+            out << "    { \"path\": \"" << result.path << "\", \"bytes\": " << result.bytes
+                << ", \"width\": " << result.width << ", \"height\": " << result.height
+                << ", \"gbPerSecond\": " << gbPerSecond
+                << ", \"p50Ms\": " << percentile(sorted, 0.50) << ", \"p99Ms\": " << percentile(sorted, 0.99)
+                << ", \"minMs\": " << sorted.front() << ", \"maxMs\": " << sorted.back() << " }"
+                << (i + 1 < results.size() ? "," : "") << std::endl;
+        }
+        out << "  ]" << std::endl;
+        out << "}" << std::endl;
+    }
+
+    Options options{};
+
+    VkInstance instance = VK_NULL_HANDLE;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties deviceProperties{};
+    VkDevice device = VK_NULL_HANDLE;
+    uint32_t graphicsFamily = 0;
+    uint32_t transferFamily = 0;
+    VkQueue graphicsQueue = VK_NULL_HANDLE;
+    VkQueue transferQueue = VK_NULL_HANDLE;
+
+    MemoryTypeCache memoryTypes{};
+    DeviceAllocator allocator{};
+    VkBuffer stagingRingBuffer = VK_NULL_HANDLE;
+    Allocation stagingRingAllocation{};
+    StagingRing stagingRing{};
+    ComputeMipGenerator computeMips{};
+
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    // of commandBuffer's submissions
+    ResourceStateTracker states{};
+    VkFence fence = VK_NULL_HANDLE;
+
+    bool directDeviceLocal = false;
+    std::vector<Result> results{};
+};
+
+int main(int argc, char** argv) {
+    UploadBenchmark benchmark;
+    try {
+        benchmark.Run(parseOptions(argc, argv));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,164 @@
+#include "pch.h"
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include "mesh/vertex.h"
+#include "mesh/vertex_welder.h"
+
+// Microbenchmark of the vertex deduplication done on import: the unordered_map the
+// importer used to insert every corner into, against weldVertices on one thread and
+// on every hardware thread. The mesh is a synthetic grid triangulated the way an OBJ
+// import hands it over, one vertex per index, with a texture seam every few columns
+// so that not every shared position welds.
+//
+//  WeldBench [--grid N] [--iterations N]
+//
+// A grid of N quads per side has 6 N^2 corners and about (N + 1)^2 distinct vertices.
+
+namespace {
+    const uint32_t DEFAULT_GRID = 1024;
+    const uint32_t DEFAULT_ITERATIONS = 5;
+    const uint32_t SEAM_SPACING = 16;
+
+    typedef std::chrono::high_resolution_clock Clock;
+
+    struct Options {
+        uint32_t grid = DEFAULT_GRID;
+        uint32_t iterations = DEFAULT_ITERATIONS;
+    };
+
+    struct Welded {
+        std::vector<Vertex> vertices{};
+        std::vector<uint32_t> indices{};
+    };
+
+    uint32_t parseCount(const std::string& option, const char* value) {
+        char* end = nullptr;
+        unsigned long count = std::strtoul(value, &end, 10);
+        if (*end != '\0' || count == 0 || count > UINT32_MAX) {
+            throw std::runtime_error("invalid value for " + option + ": " + value);
+        }
+        return static_cast<uint32_t>(count);
+    }
+
+    Options parseOptions(int argc, char** argv) {
+        Options options{};
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if ((arg == "--grid" || arg == "--iterations") && i + 1 < argc) {
+                uint32_t value = parseCount(arg, argv[++i]);
+                (arg == "--grid" ? options.grid : options.iterations) = value;
+            } else {
+                throw std::runtime_error("usage: WeldBench [--grid N] [--iterations N]");
+            }
+        }
+        return options;
+    }
+
+    std::vector<Vertex> createGrid(uint32_t grid) {
+        std::vector<Vertex> corners{};
+        corners.reserve(static_cast<size_t>(grid) * grid * 6);
+
+        auto corner = [&](uint32_t x, uint32_t y, uint32_t quadX) {
+            Vertex vertex{};
+            vertex.pos = { static_cast<float>(x) / grid, static_cast<float>(y) / grid, 0.0f };
+            vertex.color = { 1.0f, 1.0f, 1.0f };
+            // the quads right of a seam start their own island of texture space
+            float u = static_cast<float>(x) / grid;
+            vertex.texCoord = { quadX % SEAM_SPACING == 0 && x == quadX ? u + 1.0f : u, static_cast<float>(y) / grid };
+            corners.push_back(vertex);
+        };
+
+        for (uint32_t y = 0; y < grid; y++) {
+            for (uint32_t x = 0; x < grid; x++) {
+                corner(x, y, x);
+                corner(x + 1, y, x);
+                corner(x + 1, y + 1, x);
+                corner(x + 1, y + 1, x);
+                corner(x, y + 1, x);
+                corner(x, y, x);
+            }
+        }
+        return corners;
+    }
+
+    // the importer's loop before weldVertices, as it was
+    void weldWithMap(const std::vector<Vertex>& corners, Welded& out) {
+        std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+        for (const auto& vertex : corners) {
+            if (uniqueVertices.count(vertex) == 0) {
+                uniqueVertices[vertex] = static_cast<uint32_t>(out.vertices.size());
+                out.vertices.push_back(vertex);
+            }
+            out.indices.push_back(uniqueVertices[vertex]);
+        }
+    }
+
+    void weldWithWelder(const std::vector<Vertex>& corners, uint32_t threadCount, Welded& out) {
+        out.vertices.resize(corners.size());
+        out.indices.resize(corners.size());
+        uint32_t count = weldVertices(corners.data(), corners.size(), sizeof(Vertex), out.vertices.data(), out.indices.data(), threadCount);
+        out.vertices.resize(count);
+    }
+
+    template<typename Fn>
+    double bestOf(uint32_t iterations, Welded& result, Fn fn) {
+        double best = 0.0;
+        for (uint32_t i = 0; i < iterations; i++) {
+            Welded welded{};
+            auto start = Clock::now();
+            fn(welded);
+            double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+            best = i == 0 ? ms : std::min(best, ms);
+            result = std::move(welded);
+        }
+        return best;
+    }
+
+    void check(const Welded& expected, const Welded& actual, const std::string& name) {
+        bool same = expected.indices == actual.indices && expected.vertices.size() == actual.vertices.size() &&
+            std::equal(expected.vertices.begin(), expected.vertices.end(), actual.vertices.begin());
+        if (!same) {
+            throw std::runtime_error("weld mismatch: " + name + " differs from the unordered_map");
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    try {
+        Options options = parseOptions(argc, argv);
+        uint32_t threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+        std::vector<Vertex> corners = createGrid(options.grid);
+
+        Welded reference{}, serial{}, threaded{};
+        double mapMs = bestOf(options.iterations, reference, [&](Welded& out) { weldWithMap(corners, out); });
+        double serialMs = bestOf(options.iterations, serial, [&](Welded& out) { weldWithWelder(corners, 1, out); });
+        double threadedMs = bestOf(options.iterations, threaded, [&](Welded& out) { weldWithWelder(corners, threadCount, out); });
+        check(reference, serial, "weldVertices");
+        check(reference, threaded, "weldVertices (threaded)");
+
+        std::cout << corners.size() << " corners, " << reference.vertices.size() << " unique vertices, best of "
+            << options.iterations << std::endl;
+        std::cout << std::fixed << std::setprecision(2);
+        std::cout << "  unordered_map          " << std::setw(9) << mapMs << " ms" << std::endl;
+        std::cout << "  weldVertices           " << std::setw(9) << serialMs << " ms  " << mapMs / serialMs << "x" << std::endl;
+        std::cout << "  weldVertices, " << std::setw(2) << threadCount << " thr   " << std::setw(9) << threadedMs << " ms  "
+            << mapMs / threadedMs << "x" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
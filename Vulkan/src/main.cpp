@@ -8,6 +8,9 @@
 #include <set>
 #include <fstream>
 #include <array>
+#include <mutex>
+#include <thread>
+#include <limits>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -27,12 +30,76 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
+#include "memory/allocator.h"
+#include "memory/host_allocator.h"
+#include "memory/memory_types.h"
+#include "memory/residency.h"
+#include "memory/transient_pool.h"
+#include "memory/defragmenter.h"
+#include "memory/memory_report.h"
+#include "mesh/geometry_buffer.h"
+#include "mesh/mesh_cache.h"
+#include "mesh/mesh_optimizer.h"
+#include "mesh/obj_parser.h"
+#include "mesh/vertex.h"
+#include "mesh/vertex_quantize.h"
+#include "mesh/vertex_welder.h"
+#include "memory/uniform_arena.h"
+#include "transfer/staging_ring.h"
+#include "transfer/upload_batch.h"
+#include "transfer/upload_streamer.h"
+#include "transfer/host_image_copy.h"
+#include "transfer/mip_generator.h"
+#include "transfer/compute_mips.h"
+#include "sync/state_tracker.h"
+
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
 const int MAX_FRAMES_IN_FLIGHT = 2;
+const VkDeviceSize UNIFORM_ARENA_SIZE = 256 * 1024;
+// the two staging rings share one allocation, so this much host-visible staging
+// memory is all we keep around
+const VkDeviceSize STAGING_RING_SIZE = 3 * 1024 * 1024;
+// the upload thread's, a few frames of its budget
+const VkDeviceSize STREAM_RING_SIZE = 1024 * 1024;
+// how much the upload thread may copy per frame
+const VkDeviceSize STREAM_BYTES_PER_FRAME = 256 * 1024;
 
 const std::string MODEL_PATH = "src/resources/viking_room.obj";
 const std::string TEXTURE_PATH = "src/resources/viking_room.png";
+// written on the first run and whenever the model or its import settings change
+const std::string MODEL_CACHE_PATH = "src/resources/viking_room.meshcache";
+// optional: without it mip chains are blitted
+const std::string MIPGEN_SHADER_PATH = "src/shaders/mipgen.spv";
+// optional: without it the model keeps float vertices
+const std::string COMPACT_VERTEX_SHADER_PATH = "src/shaders/vert_compact.spv";
+// texture images are blitted and copied into, copied out of when mips are dropped or
+// the image is moved, and sampled
+const VkImageUsageFlags TEXTURE_USAGE = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+// how the draws use the texture, which is how every path hands it to them
+const ResourceState TEXTURE_SAMPLED{ VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+// written on exit and whenever M is pressed
+const std::string MEMORY_REPORT_PATH = "memory_report.json";
+// frames between memory counter lines in the log
+const uint64_t MEMORY_COUNTER_INTERVAL = 1000;
+// false submits and waits for every upload step separately, to compare load times
+const bool BATCH_UPLOADS = true;
+// false loads the texture with the other init uploads instead of streaming it in
+const bool STREAM_TEXTURES = true;
+// on ReBAR/UMA devices, write meshes and textures straight into device local memory
+// instead of going through a staging copy
+const bool DIRECT_UPLOADS = true;
+// parse the model on every hardware thread instead of with tinyobj::LoadObj; only
+// matters when the mesh cache misses
+const bool PARALLEL_OBJ_IMPORT = true;
+// reorder the imported model for the vertex cache, overdraw and vertex fetch; baked
+// into the mesh cache, so it costs nothing once that hits
+const bool OPTIMIZE_MESH = true;
+// how much ACMR the overdraw clustering may give up; 0 skips it
+const float OVERDRAW_THRESHOLD = 1.05f;
+// draw the model with quantized CompactVertex (12 bytes) instead of Vertex (32 bytes)
+// when the compact vertex shader is there
+const bool COMPACT_VERTICES = true;
 
 const std::vector<const char*> validationLayers = {
     "VK_LAYER_KHRONOS_validation"
@@ -92,61 +159,18 @@ struct SwapchainSupportDetails {
     std::vector<VkPresentModeKHR> presentModes{};
 };
 
-struct Vertex {
-    glm::vec3 pos;
-    glm::vec3 color;
-    glm::vec2 texCoord;
-
-    static VkVertexInputBindingDescription getBindingDescription() {
-        VkVertexInputBindingDescription desc{};
-        desc.binding = 0;
-        desc.stride = sizeof(Vertex);
-        desc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-        return desc;
-    }
-
-    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
-        std::array<VkVertexInputAttributeDescription, 3> attr{};
-
-        attr[0].binding = 0;
-        attr[0].location = 0;
-        attr[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attr[0].offset = offsetof(Vertex, pos);
-
-        attr[1].binding = 0;
-        attr[1].location = 1;
-        attr[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        attr[1].offset = offsetof(Vertex, color);
-
-        attr[2].binding = 0;
-        attr[2].location = 2;
-        attr[2].format = VK_FORMAT_R32G32_SFLOAT;
-        attr[2].offset = offsetof(Vertex, texCoord);
-
-        return attr;
-    }
-
-    bool operator==(const Vertex& other) const {
-        return pos == other.pos && color == other.color && texCoord == other.texCoord;
-    }
-};
-
-namespace std {
-    template<> struct hash<Vertex> {
-        size_t operator()(Vertex const& vertex) const {
-            return ((hash<glm::vec3>()(vertex.pos) ^
-                (hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
-                    (hash<glm::vec2>()(vertex.texCoord) << 1);
-        }
-    };
-}
-
 struct MVP {
     glm::mat4 view;
     glm::mat4 proj;
 };
 
+// pushed per draw; only the compact vertex shader reads texCoordScaleBias
+struct ModelConstants {
+    glm::mat4 model;
+    // xy scale, zw bias of the texture coordinates
+    glm::vec4 texCoordScaleBias;
+};
+
 std::vector<char> readFile(const std::string& filename) {
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
@@ -183,6 +207,7 @@ private:
         window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
         glfwSetWindowUserPointer(window, this);
         glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+        glfwSetKeyCallback(window, keyCallback);
     }
 
     static void framebufferResizeCallback(GLFWwindow* window, int width, int height) {
@@ -190,6 +215,13 @@ private:
         app->framebufferResized = true;
     }
 
+    static void keyCallback(GLFWwindow* window, int key, int /*scancode*/, int action, int /*mods*/) {
+        auto app = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+        if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+            app->memoryReportRequested = true;
+        }
+    }
+
     // VULKAN CODE
 
     void createInstance() {
@@ -200,7 +232,10 @@ private:
         appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
         appInfo.pEngineName = "Custom";
         appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion = VK_API_VERSION_1_0;
+        // 1.3 for synchronization2: the resource state trackers record every barrier with
+        // vkCmdPipelineBarrier2. It also covers the 1.1 memory budget queries and the 1.2
+        // timeline semaphores uploads complete on
+        appInfo.apiVersion = VK_API_VERSION_1_3;
 
         // INSTANCE INFO
         VkInstanceCreateInfo createInfo{};
@@ -266,7 +301,7 @@ private:
             createInfo.enabledLayerCount = 0;
         }
 
-        VkResult result = vkCreateInstance(&createInfo, nullptr, &instance);
+        VkResult result = vkCreateInstance(&createInfo, hostAllocator.getCallbacks(), &instance);
         if (result != VK_SUCCESS) {
             std::cout << "Error creating instance: " << result << std::endl;
             throw std::runtime_error("error creating vulkan instance");
@@ -355,7 +390,7 @@ private:
         VkDebugUtilsMessengerCreateInfoEXT createInfo{};
         populateDebugMessengerCreateInfo(createInfo);
 
-        VkResult result = CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr, &debugMessenger);
+        VkResult result = CreateDebugUtilsMessengerEXT(instance, &createInfo, hostAllocator.getCallbacks(), &debugMessenger);
         if (result != VK_SUCCESS) {
             std::cout << "Error creating debug messenger: " << result << std::endl;
             throw std::runtime_error("error creating debug messenger");
@@ -363,7 +398,7 @@ private:
     }
 
     void createSurface() {
-        VkResult result = glfwCreateWindowSurface(instance, window, nullptr, &surface);
+        VkResult result = glfwCreateWindowSurface(instance, window, hostAllocator.getCallbacks(), &surface);
         if (result != VK_SUCCESS) {
             std::cerr << "Error creating window surface: " << result << std::endl;
             throw std::runtime_error("Error creating window surface.");
@@ -418,6 +453,9 @@ private:
         if (physicalDevice == VK_NULL_HANDLE) {
             throw std::runtime_error("failed to find suitable GPU.");
         }
+
+        memoryTypes.init(physicalDevice);
+        memoryTypes.print(std::cout);
     }
 
     bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
@@ -446,15 +484,48 @@ private:
         return true;
     }
 
+    bool isDeviceExtensionSupported(VkPhysicalDevice device, const char* extensionName) {
+        uint32_t extensionCount;
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+        for (const auto& availableExtension : availableExtensions) {
+            if (strcmp(extensionName, availableExtension.extensionName) == 0) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
     bool isDeviceSuitable(VkPhysicalDevice device) {
         VkPhysicalDeviceProperties deviceProperties;
         vkGetPhysicalDeviceProperties(device, &deviceProperties);
 
-        VkPhysicalDeviceFeatures deviceFeatures;
-        vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+        // the barriers are recorded with vkCmdPipelineBarrier2 and nothing loads the KHR
+        // entry points, see createInstance
+        if (deviceProperties.apiVersion < VK_API_VERSION_1_3) {
+            std::cout << deviceProperties.deviceName << ": skipped, Vulkan 1.3 is required and it supports "
+                << VK_API_VERSION_MAJOR(deviceProperties.apiVersion) << "." << VK_API_VERSION_MINOR(deviceProperties.apiVersion) << std::endl;
+            return false;
+        }
+
+        VkPhysicalDeviceVulkan13Features vulkan13Features{};
+        vulkan13Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+
+        VkPhysicalDeviceVulkan12Features vulkan12Features{};
+        vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        vulkan12Features.pNext = &vulkan13Features;
+
+        VkPhysicalDeviceFeatures2 deviceFeatures{};
+        deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        deviceFeatures.pNext = &vulkan12Features;
+        vkGetPhysicalDeviceFeatures2(device, &deviceFeatures);
 
         bool devicesFeaturesSupported = false;
-        if (deviceFeatures.samplerAnisotropy) {
+        if (deviceFeatures.features.samplerAnisotropy && vulkan12Features.timelineSemaphore && vulkan13Features.synchronization2) {
             devicesFeaturesSupported = true;
         }
 
@@ -487,31 +558,48 @@ private:
         std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
         vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
 
-        int i = 0;
-        for (const auto& queueFamily : queueFamilies) {
-            if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-                indices.graphicsFamily = i;
+        // how well a family suits uploads; graphics and compute queues can always
+        // transfer, even without the bit
+        auto transferScore = [](VkQueueFlags flags) {
+            if (flags & VK_QUEUE_GRAPHICS_BIT) {
+                return 1;
+            }
+            if (flags & VK_QUEUE_COMPUTE_BIT) {
+                return 2;
+            }
+            if (flags & VK_QUEUE_TRANSFER_BIT) {
+                // transfer only: the copy (DMA) engines on discrete GPUs
+                return 3;
             }
+            return 0;
+        };
 
-            if (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) {
-                indices.transferFamily = i;
+        int bestTransferScore = 0;
+        for (uint32_t i = 0; i < queueFamilyCount; i++) {
+            const auto& queueFamily = queueFamilies[i];
+            if (queueFamily.queueCount == 0) {
+                continue;
             }
 
             VkBool32 presentSupport = false;
             vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-            if (presentSupport) {
-                indices.presentFamily = i;
+
+            // a graphics family that can also present wins, so the swapchain needs no sharing
+            if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+                if (!indices.graphicsFamily.has_value() || (presentSupport && indices.graphicsFamily != indices.presentFamily)) {
+                    indices.graphicsFamily = i;
+                }
             }
 
-            if (indices.isComplete()) {
-                break;
+            if (presentSupport && (!indices.presentFamily.has_value() || indices.graphicsFamily == i)) {
+                indices.presentFamily = i;
             }
-            
-            i++;
-        }
 
-        if (!indices.transferFamily.has_value()) {
-            indices.transferFamily = indices.graphicsFamily;
+            int score = transferScore(queueFamily.queueFlags);
+            if (score > bestTransferScore) {
+                bestTransferScore = score;
+                indices.transferFamily = i;
+            }
         }
 
         return indices;
@@ -539,15 +627,39 @@ private:
         VkPhysicalDeviceFeatures deviceFeatures{};
         deviceFeatures.samplerAnisotropy = true;
 
+        // the state tracker records its barriers with vkCmdPipelineBarrier2
+        VkPhysicalDeviceVulkan13Features vulkan13Features{};
+        vulkan13Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+        vulkan13Features.synchronization2 = VK_TRUE;
+
+        // the staging ring signals upload completion on a timeline semaphore
+        VkPhysicalDeviceVulkan12Features vulkan12Features{};
+        vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        vulkan12Features.timelineSemaphore = VK_TRUE;
+        vulkan12Features.pNext = &vulkan13Features;
+
         VkDeviceCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        createInfo.pNext = &vulkan12Features;
         createInfo.pQueueCreateInfos = queueCreateInfos.data();
         createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
         createInfo.pEnabledFeatures = &deviceFeatures;
 
-        // swapchain extension support
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+        // swapchain extension support, plus the optional ones the device has
+        std::vector<const char*> extensions = deviceExtensions;
+
+        memoryBudgetSupported = isDeviceExtensionSupported(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        if (memoryBudgetSupported) {
+            extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+        }
+
+        if (DIRECT_UPLOADS) {
+            hostImageCopy.query(physicalDevice, memoryTypes);
+            hostImageCopy.enable(extensions, &vulkan13Features.pNext);
+        }
+
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+        createInfo.ppEnabledExtensionNames = extensions.data();
 
         if (enableValidationLayers) {
             createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -556,7 +668,7 @@ private:
             createInfo.enabledLayerCount = 0;
         }
 
-        VkResult result = vkCreateDevice(physicalDevice, &createInfo, nullptr, &device);
+        VkResult result = vkCreateDevice(physicalDevice, &createInfo, hostAllocator.getCallbacks(), &device);
         if (result != VK_SUCCESS) {
             std::cout << "Error creating logical device: " << result << std::endl;
             throw std::runtime_error("Error creating logical device.");
@@ -565,6 +677,9 @@ private:
         vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
         vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
         vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
+
+        hostImageCopy.load(device);
+        hostImageCopy.print(std::cout);
     }
 
     SwapchainSupportDetails querySwapchainSupport(VkPhysicalDevice device) {
@@ -658,14 +773,14 @@ private:
         createInfo.imageArrayLayers = 1;
         createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
+        // uploads never touch the swapchain images, so the transfer family doesn't count
         QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
-        std::set<uint32_t> queueFamilyIndices = { indices.graphicsFamily.value(), indices.presentFamily.value(), indices.transferFamily.value() };
+        std::set<uint32_t> queueFamilyIndices = { indices.graphicsFamily.value(), indices.presentFamily.value() };
         std::vector<uint32_t> uniqueIndices(queueFamilyIndices.begin(), queueFamilyIndices.end());
 
         if (queueFamilyIndices.size() > 1) {
-            // here we use concurrent for ease-of-use (tutorial)
-            // ownership and gaining performance by keeping exclusive
-            // and transferring ownership can be handled at a later point
+            // only on devices where no graphics family can present; everywhere else
+            // the images stay exclusive to the one family that renders and presents
             createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
             createInfo.queueFamilyIndexCount = uniqueIndices.size();
             createInfo.pQueueFamilyIndices = uniqueIndices.data();
@@ -681,7 +796,7 @@ private:
         createInfo.clipped = VK_TRUE;
         createInfo.oldSwapchain = VK_NULL_HANDLE;
 
-        VkResult err = vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapchain);
+        VkResult err = vkCreateSwapchainKHR(device, &createInfo, hostAllocator.getCallbacks(), &swapchain);
         if (err != VK_SUCCESS) {
             std::cerr << "error creating swapchain: " << err << std::endl;
             throw std::runtime_error("Error creating swapchain.");
@@ -714,7 +829,7 @@ private:
             createInfo.subresourceRange.baseArrayLayer = 0;
             createInfo.subresourceRange.layerCount = 1;
 
-            VkResult err = vkCreateImageView(device, &createInfo, nullptr, &swapchainImageViews[i]);
+            VkResult err = vkCreateImageView(device, &createInfo, hostAllocator.getCallbacks(), &swapchainImageViews[i]);
             if (err != VK_SUCCESS) {
                 std::cerr << "error creating image view for swapchain image (" << i << "): " << err << std::endl;
                 throw std::runtime_error("Error creating swapchain image views.");
@@ -729,7 +844,7 @@ private:
         createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
         
         VkShaderModule shaderModule;
-        VkResult err = vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule);
+        VkResult err = vkCreateShaderModule(device, &createInfo, hostAllocator.getCallbacks(), &shaderModule);
         if (err != VK_SUCCESS) {
             std::cerr << "error handling shader code: " << err << std::endl;
             throw std::runtime_error("Error handling shader code.");
@@ -743,7 +858,8 @@ private:
         colorAttachment.format = swapchainImageFormat;
         colorAttachment.samples = msaaSamples;
         colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        // only the resolved image is needed after the pass
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -757,7 +873,7 @@ private:
         depthAttachment.format = findDepthFormat();
         depthAttachment.samples = msaaSamples;
         depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -771,7 +887,8 @@ private:
         VkAttachmentDescription colorResolveAttachment{};
         colorResolveAttachment.format = swapchainImageFormat;
         colorResolveAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-        colorResolveAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        // every pixel is overwritten by the resolve
+        colorResolveAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         colorResolveAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
         colorResolveAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         colorResolveAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
@@ -809,7 +926,7 @@ private:
         createInfo.dependencyCount = 1;
         createInfo.pDependencies = &dependency;
 
-        VkResult err = vkCreateRenderPass(device, &createInfo, nullptr, &renderPass);
+        VkResult err = vkCreateRenderPass(device, &createInfo, hostAllocator.getCallbacks(), &renderPass);
         if (err != VK_SUCCESS) {
             std::cerr << "Error creating render pass: " << err << std::endl;
             throw std::runtime_error("error creating render pass.");
@@ -819,7 +936,7 @@ private:
     void createDescriptorSetLayout() {
         VkDescriptorSetLayoutBinding uboLayoutBinding{};
         uboLayoutBinding.binding = 0;
-        uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         uboLayoutBinding.descriptorCount = 1;
         uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
         uboLayoutBinding.pImmutableSamplers = nullptr;
@@ -841,15 +958,25 @@ private:
         layoutInfo.bindingCount = bindings.size();
         layoutInfo.pBindings = bindings.data();
         
-        VkResult err = vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout);
+        VkResult err = vkCreateDescriptorSetLayout(device, &layoutInfo, hostAllocator.getCallbacks(), &descriptorSetLayout);
         if (err != VK_SUCCESS) {
             std::cerr << "Error creating descriptor set layout: " << err << std::endl;
             throw std::runtime_error("error creating descriptor set layout.");
         }
     }
 
+    // the compact format needs its vertex shader, which like the mip shader is optional
+    void chooseVertexFormat() {
+        compactVertices = COMPACT_VERTICES && std::ifstream(COMPACT_VERTEX_SHADER_PATH, std::ios::binary).is_open();
+        if (COMPACT_VERTICES && !compactVertices) {
+            std::cout << "vertex format: " << COMPACT_VERTEX_SHADER_PATH << " not found, vertices stay float" << std::endl;
+        }
+        std::cout << "Vertex Format: " << (compactVertices ? "compact, " : "float, ")
+            << (compactVertices ? CompactVertex::Format::STRIDE : Vertex::Format::STRIDE) << " bytes per vertex" << std::endl;
+    }
+
     void createGraphicsPipeline() {
-        auto vertShaderCode = readFile("src/shaders/vert.spv");
+        auto vertShaderCode = readFile(compactVertices ? COMPACT_VERTEX_SHADER_PATH : "src/shaders/vert.spv");
         auto fragShaderCode = readFile("src/shaders/frag.spv");
 
         VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
@@ -872,8 +999,17 @@ private:
         };
 
         // vertex input function
-        auto bindingDesc = Vertex::getBindingDescription();
-        auto attributeDesc = Vertex::getAttributeDescriptions();
+        VkVertexInputBindingDescription bindingDesc{};
+        std::vector<VkVertexInputAttributeDescription> attributeDesc{};
+        if (compactVertices) {
+            auto attributes = CompactVertex::Format::getAttributeDescriptions();
+            bindingDesc = CompactVertex::Format::getBindingDescription();
+            attributeDesc.assign(attributes.begin(), attributes.end());
+        } else {
+            auto attributes = Vertex::Format::getAttributeDescriptions();
+            bindingDesc = Vertex::Format::getBindingDescription();
+            attributeDesc.assign(attributes.begin(), attributes.end());
+        }
 
         VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
         vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
@@ -983,7 +1119,7 @@ private:
         VkPushConstantRange pushConstantRange{};
         pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
         pushConstantRange.offset = 0;
-        pushConstantRange.size = sizeof(glm::mat4);
+        pushConstantRange.size = sizeof(ModelConstants);
 
         // pipeline layout
         VkPipelineLayoutCreateInfo layoutInfo{};
@@ -993,7 +1129,7 @@ private:
         layoutInfo.pushConstantRangeCount = 1;
         layoutInfo.pPushConstantRanges = &pushConstantRange;
 
-        VkResult err = vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout);
+        VkResult err = vkCreatePipelineLayout(device, &layoutInfo, hostAllocator.getCallbacks(), &pipelineLayout);
         if (err != VK_SUCCESS) {
             std::cerr << "Error creating pipeline layout: " << err << std::endl;
             throw std::runtime_error("error creating pipeline layout.");
@@ -1017,14 +1153,14 @@ private:
         pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
         pipelineInfo.basePipelineIndex = -1;
 
-        err = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline);
+        err = vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, hostAllocator.getCallbacks(), &graphicsPipeline);
         if (err != VK_SUCCESS) {
             std::cerr << "Error creating graphics pipeline: " << err << std::endl;
             throw std::runtime_error("error creating graphics pipeline.");
         }
 
-        vkDestroyShaderModule(device, fragShaderModule, nullptr);
-        vkDestroyShaderModule(device, vertShaderModule, nullptr);
+        vkDestroyShaderModule(device, fragShaderModule, hostAllocator.getCallbacks());
+        vkDestroyShaderModule(device, vertShaderModule, hostAllocator.getCallbacks());
     }
 
     void createFramebuffers() {
@@ -1046,7 +1182,7 @@ private:
             createInfo.height = swapchainExtent.height;
             createInfo.layers = 1;
 
-            VkResult err = vkCreateFramebuffer(device, &createInfo, nullptr, &swapchainFramebuffers[i]);
+            VkResult err = vkCreateFramebuffer(device, &createInfo, hostAllocator.getCallbacks(), &swapchainFramebuffers[i]);
             if (err != VK_SUCCESS) {
                 std::cerr << "error creating framebuffer: " << err << std::endl;
                 throw std::runtime_error("Error creating framebuffer.");
@@ -1062,31 +1198,163 @@ private:
         createInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
         createInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
-        VkResult err = vkCreateCommandPool(device, &createInfo, nullptr, &commandPool);
+        VkResult err = vkCreateCommandPool(device, &createInfo, hostAllocator.getCallbacks(), &commandPool);
         if (err != VK_SUCCESS) {
             std::cerr << "error creating command pool: " << err << std::endl;
             throw std::runtime_error("Error creating command pool.");
         }
+    }
 
-        VkCommandPoolCreateInfo transferCreateInfo{};
-        transferCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-        transferCreateInfo.queueFamilyIndex = queueFamilyIndices.transferFamily.value();
-        transferCreateInfo.flags = 0;
+    VkBuffer createStagingBuffer(VkDeviceSize size) {
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-        err = vkCreateCommandPool(device, &transferCreateInfo, nullptr, &transferCommandPool);
+        VkBuffer buffer;
+        VkResult err = vkCreateBuffer(device, &bufferInfo, hostAllocator.getCallbacks(), &buffer);
         if (err != VK_SUCCESS) {
-            std::cerr << "error creating command pool: " << err << std::endl;
-            throw std::runtime_error("Error creating command pool.");
+            std::cerr << "Error creating staging buffer: " << err << std::endl;
+            throw std::runtime_error("error creating staging buffer.");
+        }
+        return buffer;
+    }
+
+    // every upload goes through one of two rings, the init ring or the upload thread's,
+    // and both live in this one allocation, so it's all the host-visible staging memory
+    // we keep around, no matter how much data we load
+    void createStagingMemory() {
+        stagingRingBuffer = createStagingBuffer(STAGING_RING_SIZE);
+        streamRingBuffer = createStagingBuffer(STREAM_RING_SIZE);
+
+        VkMemoryRequirements ringRequirements{};
+        vkGetBufferMemoryRequirements(device, stagingRingBuffer, &ringRequirements);
+        VkMemoryRequirements streamRequirements{};
+        vkGetBufferMemoryRequirements(device, streamRingBuffer, &streamRequirements);
+
+        // the stream ring goes right behind the init ring
+        VkDeviceSize streamOffset = (ringRequirements.size + streamRequirements.alignment - 1) / streamRequirements.alignment * streamRequirements.alignment;
+        VkMemoryRequirements requirements{};
+        requirements.size = streamOffset + streamRequirements.size;
+        requirements.alignment = std::max(ringRequirements.alignment, streamRequirements.alignment);
+        requirements.memoryTypeBits = ringRequirements.memoryTypeBits & streamRequirements.memoryTypeBits;
+
+        stagingAllocation = allocator.allocate(requirements, memoryTypes.find(requirements.memoryTypeBits, MemoryUsage::Upload), ResourceKind::Linear);
+
+        VkResult err = vkBindBufferMemory(device, stagingRingBuffer, stagingAllocation.memory, stagingAllocation.offset);
+        if (err == VK_SUCCESS) {
+            err = vkBindBufferMemory(device, streamRingBuffer, stagingAllocation.memory, stagingAllocation.offset + streamOffset);
+        }
+        if (err != VK_SUCCESS) {
+            std::cerr << "Error binding staging buffer memory: " << err << std::endl;
+            throw std::runtime_error("error binding staging buffer memory");
+        }
+
+        memoryReport.track(&stagingAllocation, MemoryCategory::Staging, "staging rings", STAGING_RING_SIZE + STREAM_RING_SIZE);
+        stagingData = static_cast<char*>(allocator.map(stagingAllocation));
+        streamRingOffset = streamOffset;
+    }
+
+    void createStagingRing() {
+        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+        // uploads hand the resources over to the graphics family when it's a different one
+        stagingRing.init(device, transferQueue, queueFamilyIndices.transferFamily.value(), graphicsQueue, queueFamilyIndices.graphicsFamily.value(),
+            stagingRingBuffer, stagingData, STAGING_RING_SIZE, hostAllocator.getCallbacks());
+        stagingRing.setQueueMutex(&queueMutex);
+
+        // everything loaded during init goes into one batch, see submitUploads
+        uploads.init(stagingRing, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, !BATCH_UPLOADS);
+        uploads.setComputeMips(&computeMips);
+        uploads.begin();
+    }
+
+    // loads on demand after init go through the upload thread. A ring is used by one
+    // thread at a time, so the thread gets a ring of its own, next to the init ring
+    void createUploadStreamer() {
+        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+        streamer.init(device, transferQueue, queueFamilyIndices.transferFamily.value(), graphicsQueue, queueFamilyIndices.graphicsFamily.value(), queueMutex,
+            streamRingBuffer, stagingData + streamRingOffset, STREAM_RING_SIZE, STREAM_BYTES_PER_FRAME, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, hostAllocator.getCallbacks());
+        streamer.setComputeMips(&computeMips);
+    }
+
+    // mip chains are generated by compute where the shader and device allow it
+    void createComputeMips() {
+        computeMips.init(physicalDevice, device, MIPGEN_SHADER_PATH, MAX_FRAMES_IN_FLIGHT, hostAllocator.getCallbacks());
+        computeMips.print(std::cout);
+        std::cout << "CPU mip generator: " << getMipGeneratorPath() << std::endl;
+    }
+
+    void writeMemoryReport() {
+        memoryReport.print(std::cout);
+        if (memoryReport.writeJson(MEMORY_REPORT_PATH)) {
+            std::cout << "memory report written to " << MEMORY_REPORT_PATH << std::endl;
+        } else {
+            std::cerr << "Error writing memory report to " << MEMORY_REPORT_PATH << std::endl;
+        }
+    }
+
+    void createDefragmenter() {
+        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+        // the resources it moves belong to the graphics family; copying them on its queue
+        // needs no ownership transfers in either direction
+        defragmenter.init(device, graphicsQueue, queueFamilyIndices.graphicsFamily.value(), allocator, MAX_FRAMES_IN_FLIGHT, hostAllocator.getCallbacks());
+        defragmenter.setMovedCallback([this](const Allocation* allocation, VkBuffer /*oldBuffer*/, VkImage oldImage) {
+            onResourceMoved(allocation, oldImage);
+        });
+    }
+
+    // the texture is the only movable resource; its view and descriptors need patching.
+    // The moved image is in the layout it was registered with, and the next frame waits
+    // on the copies
+    void onResourceMoved(const Allocation* allocation, VkImage oldImage) {
+        if (allocation == &textureImageAllocation) {
+            graphicsStates.removeImage(oldImage);
+            graphicsStates.addImage(textureImage, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels - textureBaseMip, 1, TEXTURE_SAMPLED);
+            replaceTextureImageView();
+        }
+    }
+
+    // the old view is destroyed once the frames in flight are done with it
+    void replaceTextureImageView() {
+        VkImageView oldView = textureImageView;
+        createTextureImageView();
+        if (oldView != VK_NULL_HANDLE) {
+            defragmenter.defer([this, oldView]() {
+                vkDestroyImageView(device, oldView, hostAllocator.getCallbacks());
+            });
         }
+        textureDescriptorVersion++;
     }
 
     void createColorResources() {
-        VkFormat colorFormat = swapchainImageFormat;
+        createTransientImage(swapchainExtent.width, swapchainExtent.height,
+            msaaSamples, swapchainImageFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, colorImage);
+    }
+
+    void createDepthResources() {
+        createTransientImage(swapchainExtent.width, swapchainExtent.height,
+            msaaSamples, findDepthFormat(), VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depthImage);
+    }
 
-        createImage(swapchainExtent.width, swapchainExtent.height,
-            1, msaaSamples, colorFormat, VK_IMAGE_TILING_OPTIMAL,
-            VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, colorImage, colorImageMemory);
+    // binds the transient attachments' memory, which the views need
+    void createAttachmentViews() {
+        transientAttachments.bind();
+        transientAttachments.print(std::cout);
+
+        for (const auto& allocation : transientAttachments.getAllocations()) {
+            memoryReport.track(&allocation, MemoryCategory::Attachment, "transient attachments", allocation.size);
+        }
+
+        createColorImageView();
+        createDepthImageView();
+    }
+
+    void createColorImageView() {
+        VkFormat colorFormat = swapchainImageFormat;
 
         VkImageViewCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -1103,7 +1371,7 @@ private:
         createInfo.subresourceRange.baseArrayLayer = 0;
         createInfo.subresourceRange.layerCount = 1;
 
-        VkResult err = vkCreateImageView(device, &createInfo, nullptr, &colorImageView);
+        VkResult err = vkCreateImageView(device, &createInfo, hostAllocator.getCallbacks(), &colorImageView);
         if (err != VK_SUCCESS) {
             std::cerr << "error creating image view for color attachment image: " << err << std::endl;
             throw std::runtime_error("Error creating color attachment image view.");
@@ -1136,19 +1404,8 @@ private:
         return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
     }
 
-    void createDepthResources() {
+    void createDepthImageView() {
         VkFormat depthFormat = findDepthFormat();
-        createImage(
-            swapchainExtent.width,
-            swapchainExtent.height,
-            1,
-            msaaSamples,
-            depthFormat,
-            VK_IMAGE_TILING_OPTIMAL,
-            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-            depthImage,
-            depthImageMemory);
 
         VkImageViewCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -1165,60 +1422,51 @@ private:
         createInfo.subresourceRange.baseArrayLayer = 0;
         createInfo.subresourceRange.layerCount = 1;
 
-        VkResult err = vkCreateImageView(device, &createInfo, nullptr, &depthImageView);
+        VkResult err = vkCreateImageView(device, &createInfo, hostAllocator.getCallbacks(), &depthImageView);
         if (err != VK_SUCCESS) {
             std::cerr << "error creating image view for depth image: " << err << std::endl;
             throw std::runtime_error("Error creating depth image view.");
         }
     }
 
-    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
-        VkPhysicalDeviceMemoryProperties memProperties;
-        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-            // check that the type is available
-            // AND check if we can access it via property flags
-            if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-                return i;
-            }
-        }
-
-        throw std::runtime_error("error finding suitable buffer memory type.");
-    }
-
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& memory) {
+    // movable resources are registered with the defragmenter, which may move them to
+    // another block at any frame boundary; buffer and allocation must stay at the same address
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, MemoryUsage memoryUsage, MemoryCategory category, const std::string& name, VkBuffer& buffer, Allocation& allocation, bool movable = false) {
         VkBufferCreateInfo bufferInfo{};
         bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
         bufferInfo.size = size;
         bufferInfo.usage = usage;
         bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-        VkResult err = vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
+        if (movable) {
+            bufferInfo.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        }
+
+        VkResult err = vkCreateBuffer(device, &bufferInfo, hostAllocator.getCallbacks(), &buffer);
         if (err != VK_SUCCESS) {
             std::cerr << "Error creating buffer: " << err << std::endl;
             throw std::runtime_error("error creating buffer.");
         }
 
         // now let's get memory set up
-        VkMemoryRequirements mem{};
-        vkGetBufferMemoryRequirements(device, buffer, &mem);
+        ResourceRequirements mem = allocator.getBufferRequirements(buffer);
 
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = mem.size;
-        allocInfo.memoryTypeIndex = findMemoryType(mem.memoryTypeBits, properties);
+        allocation = allocator.allocate(mem, memoryTypes.find(mem.memory.memoryTypeBits, memoryUsage), ResourceKind::Linear);
 
-        err = vkAllocateMemory(device, &allocInfo, nullptr, &memory);
+        err = vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
         if (err != VK_SUCCESS) {
-            std::cerr << "Error allocating vertex memory: " << err << std::endl;
-            throw std::runtime_error("error allocating vertex memory");
+            std::cerr << "Error binding buffer memory: " << err << std::endl;
+            throw std::runtime_error("error binding buffer memory");
         }
 
-        vkBindBufferMemory(device, buffer, memory, 0);
+        memoryReport.track(&allocation, category, name, size);
+
+        if (movable) {
+            defragmenter.addBuffer(&buffer, &allocation, bufferInfo);
+        }
     }
 
-    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits sampleCount, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& memory) {
+    VkImageCreateInfo makeImageCreateInfo(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits sampleCount, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage) {
         VkImageCreateInfo imageInfo{};
         imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
         imageInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -1235,30 +1483,127 @@ private:
         imageInfo.samples = sampleCount;
         imageInfo.flags = 0;
 
-        VkResult err = vkCreateImage(device, &imageInfo, nullptr, &image);
+        // sRGB formats can't be storage images; storage goes through a UNORM view
+        if ((usage & VK_IMAGE_USAGE_STORAGE_BIT) && format == VK_FORMAT_R8G8B8A8_SRGB) {
+            imageInfo.flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT | VK_IMAGE_CREATE_EXTENDED_USAGE_BIT;
+        }
+        return imageInfo;
+    }
+
+    void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits sampleCount, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, MemoryUsage memoryUsage, MemoryCategory category, const std::string& name, VkImage& image, Allocation& allocation, bool movable = false) {
+        VkImageCreateInfo imageInfo = makeImageCreateInfo(width, height, mipLevels, sampleCount, format, tiling, usage);
+
+        if (movable) {
+            imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        }
+
+        VkResult err = vkCreateImage(device, &imageInfo, hostAllocator.getCallbacks(), &image);
         if (err != VK_SUCCESS) {
             std::cerr << "Error creating texture image: " << err << std::endl;
             throw std::runtime_error("error creating texture image");
         }
 
-        VkMemoryRequirements memRequirements;
-        vkGetImageMemoryRequirements(device, image, &memRequirements);
+        ResourceRequirements memRequirements = allocator.getImageRequirements(image);
+
+        // render targets are large and get recreated together with the swapchain,
+        // so they are better off in their own memory than fragmenting a shared block
+        bool isRenderTarget = usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+        ResourceKind kind = tiling == VK_IMAGE_TILING_OPTIMAL ? ResourceKind::Optimal : ResourceKind::Linear;
+
+        allocation = allocator.allocate(memRequirements, memoryTypes.find(memRequirements.memory.memoryTypeBits, memoryUsage), kind, isRenderTarget);
+
+        err = vkBindImageMemory(device, image, allocation.memory, allocation.offset);
+        if (err != VK_SUCCESS) {
+            std::cerr << "Error binding texture image memory: " << err << std::endl;
+            throw std::runtime_error("error binding texture image memory");
+        }
+
+        // the requirements are all an image needs as far as we can tell; only the
+        // allocator's alignment padding counts as waste
+        memoryReport.track(&allocation, category, name, memRequirements.memory.size);
+
+        // movable images are sampled textures, which sit in SHADER_READ_ONLY_OPTIMAL
+        // between frames
+        if (movable) {
+            defragmenter.addImage(&image, &allocation, imageInfo, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        }
+    }
 
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+    // an attachment that only lives inside the render pass; its memory comes from the
+    // transient pool, where attachments that are never live at the same time alias
+    void createTransientImage(uint32_t width, uint32_t height, VkSampleCountFlagBits sampleCount, VkFormat format, VkImageUsageFlags usage, VkImage& image) {
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.extent.width = width;
+        imageInfo.extent.height = height;
+        imageInfo.extent.depth = 1;
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.format = format;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageInfo.usage = usage | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.samples = sampleCount;
+        imageInfo.flags = 0;
 
-        err = vkAllocateMemory(device, &allocInfo, nullptr, &memory);
+        VkResult err = vkCreateImage(device, &imageInfo, hostAllocator.getCallbacks(), &image);
         if (err != VK_SUCCESS) {
-            std::cerr << "Error allocating texture image memory: " << err << std::endl;
-            throw std::runtime_error("error allocating texture image memory");
+            std::cerr << "Error creating transient attachment image: " << err << std::endl;
+            throw std::runtime_error("error creating transient attachment image");
         }
 
-        vkBindImageMemory(device, image, memory, 0);
+        // there is a single render pass, and every attachment is live for all of it
+        transientAttachments.addImage(image, 0, 0);
     }
 
     void createTextureImage() {
+        // the copy is a memcpy into memory the GPU reads in place, so there is nothing
+        // to gain from streaming it in
+        if (hostImageCopy.supports(VK_FORMAT_R8G8B8A8_SRGB, TEXTURE_USAGE)) {
+            copyTextureImage();
+            createTextureImageView();
+
+            textureResidency = residency.addTexture(textureImageAllocation.memoryTypeIndex, textureWidth, textureHeight, 4, mipLevels);
+            return;
+        }
+
+        if (!STREAM_TEXTURES) {
+            loadTextureImage();
+            createTextureImageView();
+
+            textureResidency = residency.addTexture(textureImageAllocation.memoryTypeIndex, textureWidth, textureHeight, 4, mipLevels);
+            return;
+        }
+
+        // only the header; the upload thread decodes the rest
+        int texWidth, texHeight, texChannels;
+        if (!stbi_info(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels)) {
+            throw std::runtime_error("failed to load texture image.");
+        }
+
+        textureWidth = texWidth;
+        textureHeight = texHeight;
+        mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(textureWidth, textureHeight)))) + 1;
+
+        streamTexture();
+
+        textureResidency = residency.addTexture(streamedTextureAllocation.memoryTypeIndex, textureWidth, textureHeight, 4, mipLevels);
+    }
+
+    // loads the full mip chain into the current upload batch; the pixels are kept
+    // until the batch is submitted
+    void loadTextureImage() {
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_R8G8B8A8_SRGB, &formatProperties);
+        // compute filters in the shader and doesn't need the format to support it. On a
+        // transfer family, or when neither works, the chain is generated on the CPU and
+        // uploaded whole, so the texture doesn't need the graphics queue at all
+        bool computeMipChain = !stagingRing.needsOwnershipTransfer() && computeMips.supports(VK_FORMAT_R8G8B8A8_SRGB);
+        bool cpuMipChain = stagingRing.needsOwnershipTransfer() ||
+            (!computeMipChain && !(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT));
+
         int texWidth, texHeight, texChannels;
         stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
         VkDeviceSize size = (int64_t)texWidth * (int64_t)texHeight * 4;
@@ -1271,18 +1616,55 @@ private:
         textureHeight = texHeight;
         mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(textureWidth, textureHeight)))) + 1;
 
-        createBuffer(
-            size, 
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            stagingTextureBuffer, stagingTextureBufferMemory);
+        createImage(
+            texWidth,
+            texHeight,
+            mipLevels,
+            VK_SAMPLE_COUNT_1_BIT,
+            VK_FORMAT_R8G8B8A8_SRGB,
+            VK_IMAGE_TILING_OPTIMAL,
+            computeMipChain ? TEXTURE_USAGE | VK_IMAGE_USAGE_STORAGE_BIT : TEXTURE_USAGE,
+            MemoryUsage::GpuOnly,
+            MemoryCategory::Texture,
+            TEXTURE_PATH,
+            textureImage,
+            textureImageAllocation,
+            true);
+
+        if (cpuMipChain) {
+            std::vector<char> data(reinterpret_cast<char*>(pixels), reinterpret_cast<char*>(pixels) + size);
+            stbi_image_free(pixels);
+            generateMipLevels(data, textureWidth, textureHeight, mipLevels, true, std::thread::hardware_concurrency());
+
+            uploads.addImageChain(textureImage, textureWidth, textureHeight, mipLevels, 4, data.data());
+            pendingMipChains.push_back(std::move(data));
+        } else {
+            uploads.addImage(textureImage, textureWidth, textureHeight, mipLevels, 4, pixels,
+                computeMipChain ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_UNDEFINED);
+            pendingPixels.push_back(pixels);
+        }
+        // the staging ring's acquires hand it over
+        graphicsStates.addImage(textureImage, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels, 1);
+        textureBaseMip = 0;
+        textureResidentMip = 0;
+    }
+
+    // creates the texture with its mips generated on the CPU and copies it in on the
+    // host, without staging or GPU work
+    void copyTextureImage() {
+        int texWidth, texHeight, texChannels;
+        stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+        if (!pixels) {
+            throw std::runtime_error("failed to load texture image.");
+        }
 
-        void* data;
-        vkMapMemory(device, stagingTextureBufferMemory, 0, size, 0, &data);
-        memcpy(data, pixels, static_cast<uint32_t>(size));
-        vkUnmapMemory(device, stagingTextureBufferMemory);
+        textureWidth = texWidth;
+        textureHeight = texHeight;
+        mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(textureWidth, textureHeight)))) + 1;
 
+        std::vector<char> data(reinterpret_cast<char*>(pixels), reinterpret_cast<char*>(pixels) + (size_t)texWidth * texHeight * 4);
         stbi_image_free(pixels);
+        generateMipLevels(data, textureWidth, textureHeight, mipLevels, true, std::thread::hardware_concurrency());
 
         createImage(
             texWidth,
@@ -1291,15 +1673,266 @@ private:
             VK_SAMPLE_COUNT_1_BIT,
             VK_FORMAT_R8G8B8A8_SRGB,
             VK_IMAGE_TILING_OPTIMAL,
-            VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            TEXTURE_USAGE | VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT,
+            MemoryUsage::GpuOnly,
+            MemoryCategory::Texture,
+            TEXTURE_PATH,
             textureImage,
-            textureImageMemory);
+            textureImageAllocation,
+            true);
+
+        hostImageCopy.uploadMipChain(textureImage, textureWidth, textureHeight, mipLevels, 4, data.data());
+        graphicsStates.addImage(textureImage, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels, 1, TEXTURE_SAMPLED);
+        textureBaseMip = 0;
+        textureResidentMip = 0;
+    }
+
+    // replaces the texture with one that only has levels [baseMip, mipLevels), copied
+    // from the current image, and frees the memory of the dropped levels
+    void dropTextureMips(uint32_t baseMip) {
+        uint32_t levels = mipLevels - baseMip;
+
+        // first, since a move in flight is completed here, which swaps in the moved
+        // image and its view and takes care of the ones it replaced
+        defragmenter.remove(&textureImageAllocation);
+
+        VkImage oldImage = textureImage;
+        Allocation oldAllocation = textureImageAllocation;
+        VkImageView oldView = textureImageView;
+        uint32_t oldBaseMip = textureBaseMip;
+
+        createImage(
+            std::max(textureWidth >> baseMip, 1u),
+            std::max(textureHeight >> baseMip, 1u),
+            levels,
+            VK_SAMPLE_COUNT_1_BIT,
+            VK_FORMAT_R8G8B8A8_SRGB,
+            VK_IMAGE_TILING_OPTIMAL,
+            TEXTURE_USAGE,
+            MemoryUsage::GpuOnly,
+            MemoryCategory::Texture,
+            TEXTURE_PATH,
+            textureImage,
+            textureImageAllocation,
+            true);
+
+        VkImage newImage = textureImage;
+        graphicsStates.addImage(newImage, VK_IMAGE_ASPECT_COLOR_BIT, levels, 1);
+
+        std::vector<VkImageCopy> regions(levels);
+        for (uint32_t i = 0; i < levels; i++) {
+            VkImageCopy& region = regions[i];
+            region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.srcSubresource.mipLevel = baseMip - oldBaseMip + i;
+            region.srcSubresource.baseArrayLayer = 0;
+            region.srcSubresource.layerCount = 1;
+            region.dstSubresource = region.srcSubresource;
+            region.dstSubresource.mipLevel = i;
+            region.extent.width = std::max(textureWidth >> (baseMip + i), 1u);
+            region.extent.height = std::max(textureHeight >> (baseMip + i), 1u);
+            region.extent.depth = 1;
+        }
+
+        // the graphics family owns the old image, so the copy runs at the start of this
+        // frame's command buffer rather than on the transfer queue
+        uint32_t firstCopied = baseMip - oldBaseMip;
+        frameSetup.push_back([this, oldImage, newImage, firstCopied, levels, regions](VkCommandBuffer cmd) {
+            // only the levels that are kept have to leave SHADER_READ_ONLY_OPTIMAL
+            graphicsStates.useImage(cmd, oldImage, firstCopied, levels, 0, 1, { VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL });
+            graphicsStates.useImage(cmd, newImage, { VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL });
+            graphicsStates.flush(cmd);
+
+            vkCmdCopyImage(cmd, oldImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, newImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, levels, regions.data());
+
+            graphicsStates.useImage(cmd, newImage, TEXTURE_SAMPLED);
+            graphicsStates.flush(cmd);
+            // nothing records the old image after this
+            graphicsStates.removeImage(oldImage);
+        });
+
+        // this frame and the ones in flight read the old image until they complete
+        defragmenter.defer([this, oldView, oldImage, oldAllocation]() mutable {
+            vkDestroyImageView(device, oldView, hostAllocator.getCallbacks());
+            vkDestroyImage(device, oldImage, hostAllocator.getCallbacks());
+            allocator.free(oldAllocation);
+        });
+
+        textureBaseMip = baseMip;
+        textureResidentMip = baseMip;
+
+        createTextureImageView();
+    }
+
+    // streams the texture in coarse to fine, the mip tail first. At init nothing is
+    // drawn until the tail has landed; a restore keeps the reduced chain in use until
+    // the stream is at least as sharp, see onTextureStreamed.
+    void streamTexture() {
+        // registered with the defragmenter once every level is in
+        createImage(
+            textureWidth,
+            textureHeight,
+            mipLevels,
+            VK_SAMPLE_COUNT_1_BIT,
+            VK_FORMAT_R8G8B8A8_SRGB,
+            VK_IMAGE_TILING_OPTIMAL,
+            TEXTURE_USAGE,
+            MemoryUsage::GpuOnly,
+            MemoryCategory::Texture,
+            TEXTURE_PATH + " (streaming)",
+            streamedTextureImage,
+            streamedTextureAllocation);
+        // the streamer's acquires hand the levels over
+        graphicsStates.addImage(streamedTextureImage, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels, 1);
+
+        // decoded on the upload thread, which also generates the mips
+        int width = static_cast<int>(textureWidth);
+        int height = static_cast<int>(textureHeight);
+        textureStream = streamer.requestProgressiveImage(streamedTextureImage, textureWidth, textureHeight, mipLevels, true, 0, [width, height](std::vector<char>& data) {
+            int texWidth, texHeight, texChannels;
+            stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+            if (!pixels) {
+                return false;
+            }
+
+            // the file may have changed since the image was created
+            bool matches = texWidth == width && texHeight == height;
+            if (matches) {
+                data.assign(pixels, pixels + (int64_t)texWidth * (int64_t)texHeight * 4);
+            }
+            stbi_image_free(pixels);
+            return matches;
+        });
+    }
+
+    // another level of the streamed chain is in; the view follows it down
+    void onTextureStreamed(const StreamProgress& progress) {
+        if (streamedTextureImage != VK_NULL_HANDLE) {
+            if (textureImage != VK_NULL_HANDLE && progress.baseMipLevel > textureBaseMip) {
+                return;
+            }
+            showStreamedTexture();
+        }
+
+        textureResidentMip = progress.baseMipLevel;
+        replaceTextureImageView();
+
+        if (progress.complete) {
+            // every level is in SHADER_READ_ONLY_OPTIMAL now, as the defragmenter expects
+            VkImageCreateInfo imageInfo = makeImageCreateInfo(textureWidth, textureHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL,
+                TEXTURE_USAGE);
+            defragmenter.addImage(&textureImage, &textureImageAllocation, imageInfo, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+            textureStream = 0;
+            residency.setBaseMip(textureResidency, textureBaseMip);
+
+            residency.print(std::cout);
+            streamer.print(std::cout);
+        }
+    }
+
+    // the streamed image replaces the texture, which is destroyed once the frames in
+    // flight are done with it
+    void showStreamedTexture() {
+        if (textureImage != VK_NULL_HANDLE) {
+            // first, since a move in flight is completed here, which swaps in the moved
+            // image and its view and takes care of the ones it replaced
+            defragmenter.remove(&textureImageAllocation);
+
+            VkImage oldImage = textureImage;
+            Allocation oldAllocation = textureImageAllocation;
+            VkImageView oldView = textureImageView;
+            graphicsStates.removeImage(oldImage);
+
+            defragmenter.defer([this, oldView, oldImage, oldAllocation]() mutable {
+                vkDestroyImageView(device, oldView, hostAllocator.getCallbacks());
+                vkDestroyImage(device, oldImage, hostAllocator.getCallbacks());
+                allocator.free(oldAllocation);
+            });
+            textureImageView = VK_NULL_HANDLE;
+        }
+
+        textureImage = streamedTextureImage;
+        textureImageAllocation = streamedTextureAllocation;
+        memoryReport.untrack(&streamedTextureAllocation);
+        streamedTextureImage = VK_NULL_HANDLE;
+        streamedTextureAllocation = Allocation{};
+
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(device, textureImage, &memRequirements);
+        memoryReport.track(&textureImageAllocation, MemoryCategory::Texture, TEXTURE_PATH, memRequirements.size);
+
+        textureBaseMip = 0;
+    }
+
+    // the stream never started copying, so nothing on the GPU uses the image
+    void dropStreamedTexture() {
+        std::cerr << "Error streaming " << TEXTURE_PATH << std::endl;
+
+        graphicsStates.removeImage(streamedTextureImage);
+        vkDestroyImage(device, streamedTextureImage, hostAllocator.getCallbacks());
+        memoryReport.untrack(&streamedTextureAllocation);
+        allocator.free(streamedTextureAllocation);
+        streamedTextureImage = VK_NULL_HANDLE;
+        streamedTextureAllocation = Allocation{};
+        textureStream = 0;
+    }
+
+    // once per frame: hands the upload thread its budget and swaps in what has arrived
+    void updateStreaming() {
+        std::vector<StreamId> failed{};
+        std::vector<StreamProgress> progress = streamer.update(&failed);
+
+        for (const auto& entry : progress) {
+            if (entry.id == textureStream) {
+                onTextureStreamed(entry);
+            }
+        }
+        for (StreamId id : failed) {
+            if (id == textureStream) {
+                dropStreamedTexture();
+            }
+        }
+    }
+
+    void updateResidency() {
+        // every frame draws the model, so the texture is always in use
+        residency.touch(textureResidency, frameNumber);
+
+        std::vector<ResidencyChange> changes = residency.update(frameNumber);
+        if (changes.empty()) {
+            return;
+        }
+
+        // replaced images are destroyed once the frames in flight are done with them
+        for (const auto& change : changes) {
+            // the texture settles once a restore in progress has arrived
+            if (change.texture != textureResidency || change.baseMip == textureBaseMip || textureStream != 0) {
+                continue;
+            }
+
+            if (change.baseMip > textureBaseMip) {
+                dropTextureMips(change.baseMip);
+                residency.setBaseMip(textureResidency, textureBaseMip);
+                textureDescriptorVersion++;
+            } else {
+                // brings back the full chain
+                streamTexture();
+            }
+        }
+
+        residency.print(std::cout);
     }
 
     void createTextureImageView() {
+        // the view only samples. An image made for compute mips also has storage usage,
+        // which the sRGB format doesn't support, so the view has to leave it out
+        VkImageViewUsageCreateInfo usageInfo{};
+        usageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO;
+        usageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+
         VkImageViewCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        createInfo.pNext = &usageInfo;
         createInfo.image = textureImage;
         createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
         createInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
@@ -1308,12 +1941,14 @@ private:
         createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
         createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
         createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        createInfo.subresourceRange.baseMipLevel = 0;
-        createInfo.subresourceRange.levelCount = mipLevels;
+        // the levels finer than textureResidentMip may still be streaming in; leaving them out
+        // of the view clamps sampling like a minLod would
+        createInfo.subresourceRange.baseMipLevel = textureResidentMip - textureBaseMip;
+        createInfo.subresourceRange.levelCount = mipLevels - textureResidentMip;
         createInfo.subresourceRange.baseArrayLayer = 0;
         createInfo.subresourceRange.layerCount = 1;
 
-        VkResult err = vkCreateImageView(device, &createInfo, nullptr, &textureImageView);
+        VkResult err = vkCreateImageView(device, &createInfo, hostAllocator.getCallbacks(), &textureImageView);
         if (err != VK_SUCCESS) {
             std::cerr << "error creating image view for texture: " << err << std::endl;
             throw std::runtime_error("Error creating texture image view.");
@@ -1336,28 +1971,78 @@ private:
         samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
         samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
         samplerInfo.mipLodBias = 0.0f;
+        // relative to the view, which starts at the finest resident level
         samplerInfo.minLod = 0.0f;
         samplerInfo.maxLod = static_cast<float>(mipLevels);
 
-        VkResult err = vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler);
+        VkResult err = vkCreateSampler(device, &samplerInfo, hostAllocator.getCallbacks(), &textureSampler);
         if (err != VK_SUCCESS) {
             std::cerr << "error creating sampler for texture: " << err << std::endl;
             throw std::runtime_error("Error creating texture sampler.");
         }
     }
 
+    // maps the model's cache when it matches the OBJ and the import settings; otherwise
+    // imports the OBJ and writes the cache for the next run
     void loadModel() {
+        MeshImportSettings settings{};
+        settings.vertexStride = compactVertices ? sizeof(CompactVertex) : sizeof(Vertex);
+        settings.compactVertices = compactVertices;
+        settings.optimize = OPTIMIZE_MESH;
+        settings.overdrawThreshold = OPTIMIZE_MESH ? OVERDRAW_THRESHOLD : 0.0f;
+        uint64_t sourceHash = MeshCache::hashSource(MODEL_PATH);
+
+        if (modelCache.open(MODEL_CACHE_PATH, sourceHash, settings)) {
+            model = modelCache.getMesh();
+            modelCache.print(std::cout);
+            return;
+        }
+
+        importModel(settings);
+
+        model = MeshView{};
+        model.vertices = settings.compactVertices ? static_cast<const void*>(compactVertexData.data()) : vertices.data();
+        model.vertexCount = static_cast<uint32_t>(vertices.size());
+        model.vertexStride = settings.vertexStride;
+        model.indices = indices.data();
+        model.indexCount = static_cast<uint32_t>(indices.size());
+        model.submeshes = modelSubmeshes.data();
+        model.submeshCount = static_cast<uint32_t>(modelSubmeshes.size());
+        model.bounds = modelBounds;
+        model.quantization = modelQuantization;
+
+        // not fatal: the next run just imports again
+        if (!MeshCache::write(MODEL_CACHE_PATH, sourceHash, settings, model)) {
+            std::cerr << "Warning: could not write mesh cache " << MODEL_CACHE_PATH << std::endl;
+        }
+        std::cout << "Mesh Cache: miss, imported " << MODEL_PATH << std::endl;
+    }
+
+    void importModel(const MeshImportSettings& settings) {
         tinyobj::attrib_t attrib;
         std::vector<tinyobj::shape_t> shapes;
         std::vector<tinyobj::material_t> materials;
         std::string warn, err;
-        std::unordered_map<Vertex, uint32_t> uniqueVertices{};
 
-        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str())) {
+        bool loaded = PARALLEL_OBJ_IMPORT
+            ? loadObjParallel(&attrib, &shapes, &err, MODEL_PATH)
+            : tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str());
+        if (!loaded) {
             throw std::runtime_error(warn + err);
         }
 
+        // one vertex per index first, welded below
+        size_t cornerCount = 0;
+        for (const auto& shape : shapes) {
+            cornerCount += shape.mesh.indices.size();
+        }
+        std::vector<Vertex> corners{};
+        corners.reserve(cornerCount);
+
         for (const auto& shape : shapes) {
+            Submesh submesh{};
+            submesh.firstIndex = static_cast<uint32_t>(corners.size());
+
             for (const auto& index : shape.mesh.indices) {
                 Vertex vertex{};
 
@@ -1367,98 +2052,156 @@ private:
                     attrib.vertices[3 * (int64_t) index.vertex_index + 2]
                 };
 
+                float v = attrib.texcoords[2 * (int64_t) index.texcoord_index + 1];
                 vertex.texCoord = {
                     attrib.texcoords[2 * (int64_t) index.texcoord_index + 0],
-                    1.0f - attrib.texcoords[2 * (int64_t) index.texcoord_index + 1]
+                    settings.flipTexCoordV ? 1.0f - v : v
                 };
 
                 vertex.color = { 1.0f, 1.0f, 1.0f };
 
-                if (uniqueVertices.count(vertex) == 0) {
-                    uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-                    vertices.push_back(vertex);
-                }
-
-                indices.push_back(uniqueVertices[vertex]);
+                corners.push_back(vertex);
             }
-        }
-    }
 
-    void createVertexBuffer() {
-        VkDeviceSize size = sizeof(vertices[0]) * vertices.size();
+            submesh.indexCount = static_cast<uint32_t>(corners.size()) - submesh.firstIndex;
+            modelSubmeshes.push_back(submesh);
+        }
 
-        createBuffer(
-            size, 
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            stagingVertexBuffer,
-            stagingVertexBufferMemory);
+        vertices.resize(corners.size());
+        indices.resize(corners.size());
+        uint32_t vertexCount = weldVertices(corners.data(), corners.size(), sizeof(Vertex), vertices.data(), indices.data(),
+            std::thread::hardware_concurrency());
+        vertices.resize(vertexCount);
+        vertices.shrink_to_fit();
 
-        void* data;
-        vkMapMemory(device, stagingVertexBufferMemory, 0, size, 0, &data);
-        memcpy(data, vertices.data(), (size_t) size);
+        if (settings.optimize) {
+            optimizeModel(settings);
+        }
 
-        createBuffer(
-            size,
-            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-            vertexBuffer,
-            vertexBufferMemory);
-    }
+        glm::vec3 boundsMin(std::numeric_limits<float>::max());
+        glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+        for (const auto& vertex : vertices) {
+            boundsMin = glm::min(boundsMin, vertex.pos);
+            boundsMax = glm::max(boundsMax, vertex.pos);
+        }
 
-    void createIndexBuffer() {
-        VkDeviceSize size = sizeof(indices[0]) * indices.size();
+        if (!vertices.empty()) {
+            for (int i = 0; i < 3; i++) {
+                modelBounds.min[i] = boundsMin[i];
+                modelBounds.max[i] = boundsMax[i];
+            }
+        }
 
-        createBuffer(
-            size,
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            stagingIndexBuffer,
-            stagingIndexBufferMemory);
+        if (settings.compactVertices) {
+            compactVertexData.resize(vertices.size());
+            modelQuantization = quantizeVertices(vertices.data(), vertices.size(), compactVertexData.data());
+        }
+    }
 
-        void* data;
-        vkMapMemory(device, stagingIndexBufferMemory, 0, size, 0, &data);
-        memcpy(data, indices.data(), (size_t) size);
+    // triangles stay within their submesh, so each is ordered on its own; the vertices
+    // are shared and renumbered once, in the final order
+    void optimizeModel(const MeshImportSettings& settings) {
+        if (indices.empty()) {
+            return;
+        }
+        VertexCacheStats before = analyzeVertexCache(indices.data(), indices.size(), vertices.size());
 
-        createBuffer(
-            size,
-            VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-            indexBuffer,
-            indexBufferMemory);
-    }
+        for (const auto& submesh : modelSubmeshes) {
+            uint32_t* submeshIndices = indices.data() + submesh.firstIndex;
+            optimizeVertexCache(submeshIndices, submesh.indexCount, vertices.size());
+            if (settings.overdrawThreshold > 0.0f) {
+                optimizeOverdraw(submeshIndices, submesh.indexCount, &vertices[0].pos.x, vertices.size(), sizeof(Vertex),
+                    settings.overdrawThreshold);
+            }
+        }
 
-    void createUniformBuffers() {
-        VkDeviceSize size = sizeof(MVP);
+        std::vector<Vertex> unordered = std::move(vertices);
+        vertices.resize(unordered.size());
+        uint32_t vertexCount = optimizeVertexFetch(vertices.data(), indices.data(), indices.size(), unordered.data(),
+            unordered.size(), sizeof(Vertex));
+        vertices.resize(vertexCount);
+
+        VertexCacheStats after = analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+        std::cout << "Mesh Optimizer: ";
+        before.print(std::cout);
+        std::cout << " -> ";
+        after.print(std::cout);
+        std::cout << " (FIFO " << VERTEX_CACHE_SIZE << ")" << std::endl;
+    }
+
+    void createGeometryBuffer() {
+        geometry.init(device, allocator, memoryTypes, stagingRing, model.vertexStride, GeometryBuffer::getIndexType(model.vertexCount),
+            MAX_FRAMES_IN_FLIGHT, DIRECT_UPLOADS, hostAllocator.getCallbacks());
+        // the allocations stay at the same address when the buffers grow, but what the
+        // meshes use changes; the rest of the capacity is reported as waste
+        geometry.setUsageCallback([this](const Allocation& allocation, VkDeviceSize usedBytes) {
+            const char* name = &allocation == &geometry.getVertexAllocation() ? "geometry vertices" : "geometry indices";
+            memoryReport.track(&allocation, MemoryCategory::Mesh, name, usedBytes);
+        });
+        geometry.reserve(model.vertexCount, model.indexCount);
+
+        // copied out of the cache mapping (or the imported arrays) by the time it returns
+        modelMesh = geometry.addMesh(model.vertices, model.vertexCount, model.indices, model.indexCount);
+        modelQuantization = model.quantization;
+        modelCache.close();
+        model = MeshView{};
+
+        // the GPU copy is all the draws need; holding the import on top of it would
+        // keep the mesh in memory twice (three times with compact vertices)
+        vertices.clear();
+        vertices.shrink_to_fit();
+        indices.clear();
+        indices.shrink_to_fit();
+        compactVertexData.clear();
+        compactVertexData.shrink_to_fit();
+        modelSubmeshes.clear();
+        modelSubmeshes.shrink_to_fit();
+
+        geometry.print(std::cout);
+    }
+
+    void createUniformArenas() {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 
-        uniformBuffers.resize(swapchainImages.size());
-        uniformBufferMemory.resize(swapchainImages.size());
+        // one persistently mapped arena per frame in flight; the frame's fence
+        // guarantees the GPU is done with it by the time we reset it
+        uniformArenas.resize(MAX_FRAMES_IN_FLIGHT);
 
-        for (size_t i = 0; i < swapchainImages.size(); i++) {
+        for (auto& arena : uniformArenas) {
             createBuffer(
-                size, 
+                UNIFORM_ARENA_SIZE,
                 VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                uniformBuffers[i],
-                uniformBufferMemory[i]);
+                // lands in device local memory on ReBAR/UMA, so the GPU reads the
+                // uniforms where the CPU wrote them, without a staging copy or PCIe reads
+                MemoryUsage::DynamicPerFrame,
+                MemoryCategory::Uniform,
+                "uniform arena",
+                arena.buffer,
+                arena.allocation);
+
+            arena.mapped = static_cast<char*>(allocator.map(arena.allocation));
+            arena.capacity = UNIFORM_ARENA_SIZE;
+            arena.alignment = properties.limits.minUniformBufferOffsetAlignment;
+            arena.reset();
         }
     }
 
     void createDescriptorPool() {
         std::array<VkDescriptorPoolSize, 2> poolSizes{};
-        poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        poolSizes[0].descriptorCount = static_cast<uint32_t>(swapchainImages.size());
+        poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
         poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        poolSizes[1].descriptorCount = static_cast<uint32_t>(swapchainImages.size());
+        poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
         VkDescriptorPoolCreateInfo poolInfo{};
         poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
         poolInfo.poolSizeCount = poolSizes.size();
         poolInfo.pPoolSizes = poolSizes.data();
-        poolInfo.maxSets = static_cast<uint32_t>(swapchainImages.size());
+        poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
-        VkResult err = vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool);
+        VkResult err = vkCreateDescriptorPool(device, &poolInfo, hostAllocator.getCallbacks(), &descriptorPool);
         if (err != VK_SUCCESS) {
             std::cerr << "Error creating descriptor pool: " << err << std::endl;
             throw std::runtime_error("error creating descriptor pool");
@@ -1466,23 +2209,25 @@ private:
     }
 
     void createDescriptorSets() {
-        std::vector<VkDescriptorSetLayout> layouts(swapchainImages.size(), descriptorSetLayout);
+        std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
         VkDescriptorSetAllocateInfo allocInfo{};
         allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
         allocInfo.descriptorPool = descriptorPool;
-        allocInfo.descriptorSetCount = static_cast<uint32_t>(swapchainImages.size());
+        allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
         allocInfo.pSetLayouts = layouts.data();
 
-        descriptorSets.resize(swapchainImages.size());
+        descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
         VkResult err = vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data());
         if (err != VK_SUCCESS) {
             std::cerr << "Error allocating descriptor sets: " << err << std::endl;
             throw std::runtime_error("error allocating descriptor sets");
         }
 
-        for (size_t i = 0; i < swapchainImages.size(); i++) {
+        // the UBO binding is dynamic: it points at the start of the frame's arena and
+        // each draw supplies its offset at bind time
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
             VkDescriptorBufferInfo bufferInfo{};
-            bufferInfo.buffer = uniformBuffers[i];
+            bufferInfo.buffer = uniformArenas[i].buffer;
             bufferInfo.offset = 0;
             bufferInfo.range = sizeof(MVP);
 
@@ -1497,7 +2242,7 @@ private:
             writes[0].dstSet = descriptorSets[i];
             writes[0].dstBinding = 0;
             writes[0].dstArrayElement = 0;
-            writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
             writes[0].descriptorCount = 1;
             writes[0].pBufferInfo = &bufferInfo;
 
@@ -1509,216 +2254,48 @@ private:
             writes[1].descriptorCount = 1;
             writes[1].pImageInfo = &imageInfo;
 
-            vkUpdateDescriptorSets(device, writes.size(), writes.data(), 0, nullptr);
-        }
-    }
-
-    VkCommandBuffer beginSingleTimeCommands() {
-        VkCommandBuffer commandBuffer;
-
-        VkCommandBufferAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.commandPool = transferCommandPool;
-        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandBufferCount = 1;
-
-        VkResult err = vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-        if (err != VK_SUCCESS) {
-            std::cerr << "error allocating command buffers: " << err << std::endl;
-            throw std::runtime_error("Error allocating command buffers.");
+            // until the texture's mip tail has streamed in there is nothing to point at,
+            // and nothing is drawn
+            uint32_t writeCount = textureImageView != VK_NULL_HANDLE ? 2 : 1;
+            vkUpdateDescriptorSets(device, writeCount, writes.data(), 0, nullptr);
         }
 
-        VkCommandBufferBeginInfo beginInfo{};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-        vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-        return commandBuffer;
+        descriptorSetTextureVersions.assign(MAX_FRAMES_IN_FLIGHT, textureDescriptorVersion);
     }
 
-    void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-        vkEndCommandBuffer(commandBuffer);
+    // the texture view changes when residency or defragmentation replaces the image.
+    // Sets of other frames may still be in flight, so each set is repointed at the
+    // start of its own frame, once its fence has signalled.
+    void updateTextureDescriptor(size_t i) {
+        VkDescriptorImageInfo imageInfo{};
+        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        imageInfo.imageView = textureImageView;
+        imageInfo.sampler = textureSampler;
 
-        VkSubmitInfo submitInfo{};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
-
-        vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
-        // for now, let's just block until it's done transferring
-        vkQueueWaitIdle(transferQueue);
-    }
-
-    void copyBuffer(VkCommandBuffer cmd, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-        VkBufferCopy copyRegion{};
-        copyRegion.srcOffset = 0;
-        copyRegion.dstOffset = 0;
-        copyRegion.size = size;
-        vkCmdCopyBuffer(cmd, srcBuffer, dstBuffer, 1, &copyRegion);
-    }
-
-    void copyBufferToImage(VkCommandBuffer cmd, VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-        VkBufferImageCopy region{};
-        region.bufferOffset = 0;
-        region.bufferRowLength = 0;
-        region.bufferImageHeight = 0;
-
-        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel = 0;
-        region.imageSubresource.baseArrayLayer = 0;
-        region.imageSubresource.layerCount = 1;
-
-        region.imageOffset = { 0, 0, 0 };
-        region.imageExtent = { width, height, 1 };
-
-        vkCmdCopyBufferToImage(cmd, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-    }
-
-    void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels) {
-        auto cmd = beginSingleTimeCommands();
-
-        VkImageMemoryBarrier barrier{};
-        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barrier.oldLayout = oldLayout;
-        barrier.newLayout = newLayout;
-        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.image = image;
-        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        barrier.subresourceRange.baseMipLevel = 0;
-        barrier.subresourceRange.levelCount = mipLevels;
-        barrier.subresourceRange.baseArrayLayer = 0;
-        barrier.subresourceRange.layerCount = 1;
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = 0;
-
-        VkPipelineStageFlags sourceStage;
-        VkPipelineStageFlags destinationStage;
-        if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-            barrier.srcAccessMask = 0;
-            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-            sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-            destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        } else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-            sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-            destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-        } else {
-            throw std::runtime_error("unknown layout transition.");
-        }
-
-        vkCmdPipelineBarrier(cmd, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        VkWriteDescriptorSet write{};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = descriptorSets[i];
+        write.dstBinding = 1;
+        write.dstArrayElement = 0;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        write.descriptorCount = 1;
+        write.pImageInfo = &imageInfo;
 
-        endSingleTimeCommands(cmd);
+        vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+        descriptorSetTextureVersions[i] = textureDescriptorVersion;
     }
 
-    void generateMipmaps(VkImage image, VkFormat format, int32_t texWidth, int32_t texHeight, uint32_t mipLevels) {
-        VkFormatProperties formatProperties;
-        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
-        if(!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
-            throw std::runtime_error("texture image format does not support linear blitting.");
+    // records and submits the current upload batch. Nothing waits here: the next
+    // frames' submissions wait on the token instead.
+    void submitUploads() {
+        requiredUploads = uploads.submit();
+
+        // copied into the staging ring by now
+        for (auto pixels : pendingPixels) {
+            stbi_image_free(pixels);
         }
-        
-        VkCommandBuffer cmd = beginSingleTimeCommands();
-
-        VkImageMemoryBarrier barrier{};
-        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barrier.image = image;
-        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        barrier.subresourceRange.baseArrayLayer = 0;
-        barrier.subresourceRange.layerCount = 1;
-        barrier.subresourceRange.levelCount = 1;
-
-        int32_t mipWidth = texWidth;
-        int32_t mipHeight = texHeight;
-
-        for (uint32_t i = 1; i < mipLevels; i++) {
-            barrier.subresourceRange.baseMipLevel = i - 1;
-            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
-            vkCmdPipelineBarrier(
-                cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                0,
-                0, nullptr,
-                0, nullptr,
-                1, &barrier);
-
-            VkImageBlit blit{};
-            blit.srcOffsets[0] = { 0,0,0 };
-            blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };
-            blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            blit.srcSubresource.mipLevel = i - 1;
-            blit.srcSubresource.baseArrayLayer = 0;
-            blit.srcSubresource.layerCount = 1;
-            blit.dstOffsets[0] = { 0, 0, 0 };
-            blit.dstOffsets[1] = { mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1 };
-            blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            blit.dstSubresource.mipLevel = i;
-            blit.dstSubresource.baseArrayLayer = 0;
-            blit.dstSubresource.layerCount = 1;
-
-            vkCmdBlitImage(
-                cmd, 
-                image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                1, &blit,
-                VK_FILTER_LINEAR);
-
-            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-            barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-            barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-            vkCmdPipelineBarrier(
-                cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-                0, nullptr,
-                0, nullptr,
-                1, &barrier);
-
-            if (mipWidth > 1) mipWidth /= 2;
-            if (mipHeight > 1) mipHeight /= 2;
-        }
-
-        barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-        vkCmdPipelineBarrier(
-            cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-            0, nullptr,
-            0, nullptr,
-            1, &barrier);
-
-        endSingleTimeCommands(cmd);
-    }
-
-    void copyMeshData() {
-        // NOTE(Chris): we handle multiple command "waits" here to synchro. Since it's once at the beginning, 
-        //              and it's a demo, we're ok with that. We should synchronize using semaphores/fences
-        //              in actual production code.
-        auto cmd = beginSingleTimeCommands();
-        copyBuffer(cmd, stagingVertexBuffer, vertexBuffer, sizeof(vertices[0]) * vertices.size());
-        copyBuffer(cmd, stagingIndexBuffer, indexBuffer, sizeof(indices[0]) * indices.size());
-        endSingleTimeCommands(cmd);
-
-        transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-
-        cmd = beginSingleTimeCommands();
-        copyBufferToImage(cmd, stagingTextureBuffer, textureImage, textureWidth, textureHeight);
-        endSingleTimeCommands(cmd);
-
-        generateMipmaps(textureImage, VK_FORMAT_R8G8B8A8_SRGB, textureWidth, textureHeight, mipLevels);
-        // transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels);
+        pendingPixels.clear();
+        pendingMipChains.clear();
     }
 
     void createCommandBuffers() {
@@ -1737,7 +2314,9 @@ private:
         }
     }
 
-    void prepareCommands(size_t i) {
+    // withSetup only for the command buffer about to be submitted: the setup work is
+    // recorded once
+    void prepareCommands(size_t i, uint32_t mvpOffset, bool withSetup = false) {
         vkResetCommandBuffer(commandBuffers[i], VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT);
 
         VkCommandBufferBeginInfo beginInfo{};
@@ -1749,6 +2328,10 @@ private:
             throw std::runtime_error("failed to begin recording command buffer.");
         }
 
+        if (withSetup) {
+            recordFrameSetup(commandBuffers[i]);
+        }
+
         VkRenderPassBeginInfo renderPassInfo{};
         renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
         renderPassInfo.renderPass = renderPass;
@@ -1777,12 +2360,10 @@ private:
         viewport.maxDepth = 1.0f;
         vkCmdSetViewport(commandBuffers[i], 0, 1, &viewport);
 
-        vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[i], 0, nullptr);
+        vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 1, &mvpOffset);
 
-        VkBuffer vertexBuffers[] = { vertexBuffer };
-        VkDeviceSize offsets[] = { 0 };
-        vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-        vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        // every mesh lives in the same two buffers; bind once, draw by offset
+        geometry.bind(commandBuffers[i]);
 
         static auto startTime = std::chrono::high_resolution_clock::now();
 
@@ -1790,11 +2371,21 @@ private:
         float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
         //time = 0;
 
-        glm::mat4 model = glm::rotate(glm::mat4(1.0), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-        vkCmdPushConstants(commandBuffers[i], pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(model), &model);
+        // the quantized positions are mapped back to the mesh's bounds before anything else
+        const MeshQuantization& quantization = modelQuantization;
+        glm::mat4 dequantize = glm::translate(glm::mat4(1.0), glm::vec3(quantization.positionBias[0], quantization.positionBias[1], quantization.positionBias[2]));
+        dequantize = glm::scale(dequantize, glm::vec3(quantization.positionScale[0], quantization.positionScale[1], quantization.positionScale[2]));
+
+        ModelConstants constants{};
+        constants.model = glm::rotate(glm::mat4(1.0), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)) * dequantize;
+        constants.texCoordScaleBias = glm::vec4(quantization.texCoordScale[0], quantization.texCoordScale[1],
+            quantization.texCoordBias[0], quantization.texCoordBias[1]);
+        vkCmdPushConstants(commandBuffers[i], pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(constants), &constants);
 
         //vkCmdDraw(commandBuffers[i], static_cast<uint32_t>(vertices.size()), 1, 0, 0);
-        vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+        if (textureImageView != VK_NULL_HANDLE) {
+            geometry.draw(commandBuffers[i], modelMesh);
+        }
 
         vkCmdEndRenderPass(commandBuffers[i]);
 
@@ -1805,10 +2396,24 @@ private:
         }
     }
 
+    // outside the render pass, ahead of the frame's draws
+    void recordFrameSetup(VkCommandBuffer cmd) {
+        // uploads from a dedicated transfer family are handed over here; the
+        // submission waits on the ring at the returned token
+        requiredUploads = std::max(requiredUploads, stagingRing.recordAcquires(cmd, graphicsStates));
+        uploads.recordGraphics(cmd, graphicsStates);
+        streamedUploads = std::max(streamedUploads, streamer.recordGraphics(cmd, graphicsStates));
+
+        for (auto& setup : frameSetup) {
+            setup(cmd);
+        }
+        frameSetup.clear();
+    }
+
     void prepareCommandBuffers() {
         // for now, let's show we can use the command buffers
         for (size_t i = 0; i < commandBuffers.size(); i++) {
-            prepareCommands(i);
+            prepareCommands(i, 0);
         }
     }
 
@@ -1826,19 +2431,19 @@ private:
         fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            VkResult err = vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]);
+            VkResult err = vkCreateSemaphore(device, &semaphoreInfo, hostAllocator.getCallbacks(), &imageAvailableSemaphores[i]);
             if (err != VK_SUCCESS) {
                 std::cerr << "Error creating semaphore: " << err << std::endl;
                 throw std::runtime_error("failed to create semaphore.");
             }
 
-            err = vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]);
+            err = vkCreateSemaphore(device, &semaphoreInfo, hostAllocator.getCallbacks(), &renderFinishedSemaphores[i]);
             if (err != VK_SUCCESS) {
                 std::cerr << "Error creating semaphore: " << err << std::endl;
                 throw std::runtime_error("failed to create semaphore.");
             }
 
-            err = vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]);
+            err = vkCreateFence(device, &fenceInfo, hostAllocator.getCallbacks(), &inFlightFences[i]);
             if (err != VK_SUCCESS) {
                 std::cerr << "Error creating fence: " << err << std::endl;
                 throw std::runtime_error("failed to create fence.");
@@ -1852,28 +2457,41 @@ private:
         createSurface();
         pickPhysicalDevice();
         createLogicalDevice();
+        allocator.init(physicalDevice, device, hostAllocator.getCallbacks());
+        residency.init(physicalDevice, memoryTypes, allocator, memoryBudgetSupported);
+        memoryReport.init(memoryTypes, allocator, hostAllocator);
+        transientAttachments.init(device, allocator, memoryTypes);
         createSwapchain();
         createImageViews();
         createRenderPass();
         createDescriptorSetLayout();
+        chooseVertexFormat();
         createGraphicsPipeline();
         createColorResources();
         createDepthResources();
+        createAttachmentViews();
         createFramebuffers();
         createCommandPool();
+        createComputeMips();
+        createStagingMemory();
+        createStagingRing();
+        createUploadStreamer();
+        createDefragmenter();
         createCommandBuffers();
         createTextureImage();
-        createTextureImageView();
         createTextureSampler();
         loadModel();
-        createVertexBuffer();
-        createIndexBuffer();
-        createUniformBuffers();
+        createGeometryBuffer();
+        createUniformArenas();
         createDescriptorPool();
         createDescriptorSets();
-        copyMeshData();
+        submitUploads();
         prepareCommandBuffers();
         createSyncObjects();
+
+        allocator.printStats(std::cout);
+        residency.print(std::cout);
+        hostAllocator.print(std::cout);
     }
 
     void recreateSwapchain() {
@@ -1884,7 +2502,11 @@ private:
             glfwWaitEvents();
         }
         
-        vkDeviceWaitIdle(device);
+        {
+            // the upload thread may be submitting
+            std::lock_guard<std::mutex> lock(queueMutex);
+            vkDeviceWaitIdle(device);
+        }
 
         cleanupSwapchain();
 
@@ -1895,8 +2517,8 @@ private:
         createGraphicsPipeline();
         createColorResources();
         createDepthResources();
+        createAttachmentViews();
         createFramebuffers();
-        createUniformBuffers();
         createDescriptorPool();
         createDescriptorSets();
         createCommandBuffers();
@@ -1904,40 +2526,37 @@ private:
     }
 
     void cleanupSwapchain() {
-        vkDestroyDescriptorPool(device, descriptorPool, nullptr);
-
-        for (size_t i = 0; i < swapchainImages.size(); i++) {
-            //vkUnmapMemory(device, uniformBufferMemory[i]);
-            vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-            vkFreeMemory(device, uniformBufferMemory[i], nullptr);
-        }
+        vkDestroyDescriptorPool(device, descriptorPool, hostAllocator.getCallbacks());
 
         for (auto framebuffer : swapchainFramebuffers) {
-            vkDestroyFramebuffer(device, framebuffer, nullptr);
+            vkDestroyFramebuffer(device, framebuffer, hostAllocator.getCallbacks());
         }
 
-        vkDestroyImageView(device, depthImageView, nullptr);
-        vkDestroyImage(device, depthImage, nullptr);
-        vkFreeMemory(device, depthImageMemory, nullptr);
+        vkDestroyImageView(device, depthImageView, hostAllocator.getCallbacks());
+        vkDestroyImage(device, depthImage, hostAllocator.getCallbacks());
+
+        vkDestroyImageView(device, colorImageView, hostAllocator.getCallbacks());
+        vkDestroyImage(device, colorImage, hostAllocator.getCallbacks());
 
-        vkDestroyImageView(device, colorImageView, nullptr);
-        vkDestroyImage(device, colorImage, nullptr);
-        vkFreeMemory(device, colorImageMemory, nullptr);
+        for (const auto& allocation : transientAttachments.getAllocations()) {
+            memoryReport.untrack(&allocation);
+        }
+        transientAttachments.reset();
 
         vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
 
-        vkDestroyPipeline(device, graphicsPipeline, nullptr);
-        vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-        vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
-        vkDestroyRenderPass(device, renderPass, nullptr);
+        vkDestroyPipeline(device, graphicsPipeline, hostAllocator.getCallbacks());
+        vkDestroyPipelineLayout(device, pipelineLayout, hostAllocator.getCallbacks());
+        vkDestroyDescriptorSetLayout(device, descriptorSetLayout, hostAllocator.getCallbacks());
+        vkDestroyRenderPass(device, renderPass, hostAllocator.getCallbacks());
 
         for (auto imageView : swapchainImageViews) {
-            vkDestroyImageView(device, imageView, nullptr);
+            vkDestroyImageView(device, imageView, hostAllocator.getCallbacks());
         }
-        vkDestroySwapchainKHR(device, swapchain, nullptr);
+        vkDestroySwapchainKHR(device, swapchain, hostAllocator.getCallbacks());
     }
 
-    void updateUniformBuffers(uint32_t imageIndex) {
+    uint32_t updateUniformBuffers() {
         MVP ubo{};
 
         ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
@@ -1946,15 +2565,35 @@ private:
         // glm is for OpenGL, with a swapped y-axis, so let's correct it:
         ubo.proj[1][1] *= -1;
 
-        void* data;
-        vkMapMemory(device, uniformBufferMemory[imageIndex], 0, sizeof(ubo), 0, &data);
-        memcpy(data, &ubo, sizeof(ubo));
-        vkUnmapMemory(device, uniformBufferMemory[imageIndex]);
+        return uniformArenas[currentFrame].push(ubo);
     }
 
     void drawFrame() {
         vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
 
+        updateResidency();
+        defragmenter.update(frameNumber);
+        geometry.update(frameNumber);
+        computeMips.update(frameNumber);
+        updateStreaming();
+
+        if (uploads.poll()) {
+            uploads.print(std::cout);
+        }
+
+        memoryReport.update(frameNumber);
+        if (frameNumber % MEMORY_COUNTER_INTERVAL == 0) {
+            memoryReport.printCounters(std::cout);
+        }
+        if (memoryReportRequested) {
+            memoryReportRequested = false;
+            writeMemoryReport();
+        }
+
+        if (descriptorSetTextureVersions[currentFrame] != textureDescriptorVersion) {
+            updateTextureDescriptor(currentFrame);
+        }
+
         uint32_t imageIndex;
         VkResult err = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
         if (err == VK_ERROR_OUT_OF_DATE_KHR) {
@@ -1969,39 +2608,85 @@ private:
         }
         imagesInFlight[imageIndex] = inFlightFences[currentFrame];
 
-        updateUniformBuffers(imageIndex);
+        // the fence wait above means this frame's arena is free to reuse
+        uniformArenas[currentFrame].reset();
+        uint32_t mvpOffset = updateUniformBuffers();
+
+        // uploads recorded since the last frame go out before the frame is recorded,
+        // so it can acquire them
+        stagingRing.flush();
 
         // render into command buffers
-        prepareCommands(imageIndex);
+        prepareCommands(imageIndex, mvpOffset, true);
 
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-        VkSemaphore waitSemaphores[] = {
+        std::vector<VkSemaphore> waitSemaphores = {
             imageAvailableSemaphores[currentFrame]
         };
-        VkPipelineStageFlags waitStages[] = {
+        std::vector<VkPipelineStageFlags> waitStages = {
             VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
         };
-        submitInfo.waitSemaphoreCount = 1;
-        submitInfo.pWaitSemaphores = waitSemaphores;
-        submitInfo.pWaitDstStageMask = waitStages;
+        std::vector<VkSemaphore> signalSemaphores = {
+            renderFinishedSemaphores[currentFrame]
+        };
+
+        // a pending defragmentation batch hooks into this submission
+        defragmenter.prepareSubmit(waitSemaphores, waitStages, signalSemaphores);
+
+        // binary semaphores ignore their value
+        std::vector<uint64_t> waitValues(waitSemaphores.size(), 0);
+        std::vector<uint64_t> signalValues(signalSemaphores.size(), 0);
+
+        // if the uploads this frame uses haven't landed yet, the GPU waits for them
+        // instead of us; TRANSFER for the acquires and mip blits
+        VkPipelineStageFlags uploadStages = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        if (!stagingRing.isComplete(requiredUploads)) {
+            waitSemaphores.push_back(stagingRing.getSemaphore());
+            waitStages.push_back(uploadStages);
+            waitValues.push_back(requiredUploads);
+        }
+        // streamed resources are only handed over once copied, but the wait makes
+        // the copies visible to this queue
+        if (streamedUploads > 0) {
+            waitSemaphores.push_back(streamer.getSemaphore());
+            waitStages.push_back(uploadStages);
+            waitValues.push_back(streamedUploads);
+            streamedUploads = 0;
+        }
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+        timelineInfo.pWaitSemaphoreValues = waitValues.data();
+        timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+        timelineInfo.pSignalSemaphoreValues = signalValues.data();
+        submitInfo.pNext = &timelineInfo;
+
+        submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+        submitInfo.pWaitSemaphores = waitSemaphores.data();
+        submitInfo.pWaitDstStageMask = waitStages.data();
 
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
         
-        VkSemaphore signalSemaphores[] = {
-            renderFinishedSemaphores[currentFrame]
-        };
-        submitInfo.signalSemaphoreCount = 1;
-        submitInfo.pSignalSemaphores = signalSemaphores;
+        submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+        submitInfo.pSignalSemaphores = signalSemaphores.data();
 
         vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
-        err = vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]);
-        if (err != VK_SUCCESS) {
-            std::cerr << "Error submitting rendering commands: " << err << std::endl;
-            throw std::runtime_error("error submitting rendering commands.");
+        {
+            // the upload thread's transfer queue may be this one
+            std::lock_guard<std::mutex> lock(queueMutex);
+
+            err = vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]);
+            if (err != VK_SUCCESS) {
+                std::cerr << "Error submitting rendering commands: " << err << std::endl;
+                throw std::runtime_error("error submitting rendering commands.");
+            }
+
+            defragmenter.submit();
         }
 
         VkPresentInfoKHR presentInfo{};
@@ -2009,7 +2694,7 @@ private:
 
         // wait for command buffer finished semaphore
         presentInfo.waitSemaphoreCount = 1;
-        presentInfo.pWaitSemaphores = signalSemaphores;
+        presentInfo.pWaitSemaphores = &renderFinishedSemaphores[currentFrame];
 
         VkSwapchainKHR swapchains[] = {
             swapchain
@@ -2020,7 +2705,10 @@ private:
 
         presentInfo.pResults = nullptr;
         
-        err = vkQueuePresentKHR(presentQueue, &presentInfo);
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            err = vkQueuePresentKHR(presentQueue, &presentInfo);
+        }
         if (err == VK_ERROR_OUT_OF_DATE_KHR || err == VK_SUBOPTIMAL_KHR || framebufferResized) {
             framebufferResized = false;
             recreateSwapchain();
@@ -2029,6 +2717,7 @@ private:
         }
 
         currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+        frameNumber++;
     }
 
     // MAIN APPLICATION CODE
@@ -2062,47 +2751,79 @@ private:
     }
 
     void cleanup() {
+        // stops the upload thread, so nothing else submits from here on
+        streamer.print(std::cout);
+        streamer.destroy();
+
         vkDeviceWaitIdle(device);
 
-        cleanupSwapchain();
+        writeMemoryReport();
+
+        // finishes the last batch and frees everything it was holding on to
+        defragmenter.print(std::cout);
+        defragmenter.destroy();
+
+        computeMips.print(std::cout);
+        computeMips.destroy();
 
-        vkUnmapMemory(device, stagingVertexBufferMemory);
-        vkDestroyBuffer(device, stagingVertexBuffer, nullptr);
-        vkFreeMemory(device, stagingVertexBufferMemory, nullptr);
+        graphicsStates.print(std::cout);
 
-        vkDestroyBuffer(device, vertexBuffer, nullptr);
-        vkFreeMemory(device, vertexBufferMemory, nullptr);
+        cleanupSwapchain();
 
-        vkUnmapMemory(device, stagingIndexBufferMemory);
-        vkDestroyBuffer(device, stagingIndexBuffer, nullptr);
-        vkFreeMemory(device, stagingIndexBufferMemory, nullptr);
+        for (auto& arena : uniformArenas) {
+            memoryReport.untrack(&arena.allocation);
+            allocator.unmap(arena.allocation);
+            vkDestroyBuffer(device, arena.buffer, hostAllocator.getCallbacks());
+            allocator.free(arena.allocation);
+        }
 
-        vkDestroyBuffer(device, indexBuffer, nullptr);
-        vkFreeMemory(device, indexBufferMemory, nullptr);
+        stagingRing.destroy();
+        vkDestroyBuffer(device, stagingRingBuffer, hostAllocator.getCallbacks());
+        vkDestroyBuffer(device, streamRingBuffer, hostAllocator.getCallbacks());
+        memoryReport.untrack(&stagingAllocation);
+        allocator.unmap(stagingAllocation);
+        allocator.free(stagingAllocation);
 
-        vkDestroyBuffer(device, stagingTextureBuffer, nullptr);
-        vkFreeMemory(device, stagingTextureBufferMemory, nullptr);
+        memoryReport.untrack(&geometry.getVertexAllocation());
+        memoryReport.untrack(&geometry.getIndexAllocation());
+        geometry.destroy();
 
-        vkDestroySampler(device, textureSampler, nullptr);
-        vkDestroyImageView(device, textureImageView, nullptr);
-        vkDestroyImage(device, textureImage, nullptr);
-        vkFreeMemory(device, textureImageMemory, nullptr);
+        vkDestroySampler(device, textureSampler, hostAllocator.getCallbacks());
+        // closed before the mip tail streamed in, there is none
+        if (textureImage != VK_NULL_HANDLE) {
+            vkDestroyImageView(device, textureImageView, hostAllocator.getCallbacks());
+            vkDestroyImage(device, textureImage, hostAllocator.getCallbacks());
+            memoryReport.untrack(&textureImageAllocation);
+            allocator.free(textureImageAllocation);
+        }
+
+        // a stream that never replaced the texture
+        if (streamedTextureImage != VK_NULL_HANDLE) {
+            vkDestroyImage(device, streamedTextureImage, hostAllocator.getCallbacks());
+            memoryReport.untrack(&streamedTextureAllocation);
+            allocator.free(streamedTextureAllocation);
+        }
 
         for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
-            vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-            vkDestroyFence(device, inFlightFences[i], nullptr);
+            vkDestroySemaphore(device, renderFinishedSemaphores[i], hostAllocator.getCallbacks());
+            vkDestroySemaphore(device, imageAvailableSemaphores[i], hostAllocator.getCallbacks());
+            vkDestroyFence(device, inFlightFences[i], hostAllocator.getCallbacks());
         }
 
-        vkDestroyCommandPool(device, commandPool, nullptr);
-        vkDestroyCommandPool(device, transferCommandPool, nullptr);
+        vkDestroyCommandPool(device, commandPool, hostAllocator.getCallbacks());
+
+        memoryReport.printLeaks(std::cout);
+        allocator.destroy();
 
-        vkDestroyDevice(device, nullptr); 
-        vkDestroySurfaceKHR(instance, surface, nullptr);
+        vkDestroyDevice(device, hostAllocator.getCallbacks()); 
+        vkDestroySurfaceKHR(instance, surface, hostAllocator.getCallbacks());
         if (enableValidationLayers) {
-            DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+            DestroyDebugUtilsMessengerEXT(instance, debugMessenger, hostAllocator.getCallbacks());
         }
-        vkDestroyInstance(instance, nullptr);
+        vkDestroyInstance(instance, hostAllocator.getCallbacks());
+
+        // anything still live here was leaked by us or the driver
+        hostAllocator.print(std::cout);
 
         glfwDestroyWindow(window);
         glfwTerminate();
@@ -2110,6 +2831,9 @@ private:
 
     GLFWwindow* window = nullptr;
 
+    // host memory for every Vulkan object below; must outlive the instance
+    HostAllocator hostAllocator{};
+
     // VULKAN RESOURCES
     VkInstance instance                     = VK_NULL_HANDLE;
     VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE;
@@ -2119,16 +2843,22 @@ private:
     VkQueue graphicsQueue                   = VK_NULL_HANDLE;
     VkQueue presentQueue                    = VK_NULL_HANDLE;
     VkQueue transferQueue                   = VK_NULL_HANDLE;
+    MemoryTypeCache memoryTypes{};
+    DeviceAllocator allocator{};
+    bool memoryBudgetSupported = false;
+    HostImageCopy hostImageCopy{};
+    ResidencyManager residency{};
+    TransientImagePool transientAttachments{};
+    MemoryReport memoryReport{};
+    Defragmenter defragmenter{};
     VkSwapchainKHR swapchain                = VK_NULL_HANDLE;
     std::vector<VkImage> swapchainImages{};
     VkFormat swapchainImageFormat = VK_FORMAT_UNDEFINED;
     VkExtent2D swapchainExtent{};
     std::vector<VkImageView> swapchainImageViews{};
     VkImage depthImage = VK_NULL_HANDLE;
-    VkDeviceMemory depthImageMemory = VK_NULL_HANDLE;
     VkImageView depthImageView = VK_NULL_HANDLE;
     VkImage colorImage = VK_NULL_HANDLE;
-    VkDeviceMemory colorImageMemory = VK_NULL_HANDLE;
     VkImageView colorImageView = VK_NULL_HANDLE;
     VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
     VkRenderPass renderPass = VK_NULL_HANDLE;
@@ -2137,37 +2867,79 @@ private:
     VkPipeline graphicsPipeline = VK_NULL_HANDLE;
     std::vector<VkFramebuffer> swapchainFramebuffers{};
     VkCommandPool commandPool = VK_NULL_HANDLE;
-    VkCommandPool transferCommandPool = VK_NULL_HANDLE;
-    VkBuffer stagingTextureBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory stagingTextureBufferMemory = VK_NULL_HANDLE;
+    // held around every queue submission and wait for idle, since the upload thread
+    // submits too
+    std::mutex queueMutex{};
+    // both staging rings, see createStagingMemory
+    Allocation stagingAllocation{};
+    char* stagingData = nullptr;
+    VkBuffer stagingRingBuffer = VK_NULL_HANDLE;
+    StagingRing stagingRing{};
+    UploadBatch uploads{};
+    ComputeMipGenerator computeMips{};
+    // source data of the batch being gathered, freed once it is submitted
+    std::vector<stbi_uc*> pendingPixels{};
+    std::vector<std::vector<char>> pendingMipChains{};
+    // recorded at the start of the next frame's command buffer, before the render pass
+    std::vector<std::function<void(VkCommandBuffer)>> frameSetup{};
+    // the state of the images the frame setup uses, across frames
+    ResourceStateTracker graphicsStates{};
+    // the uploads the next frame's resources depend on; drawFrame waits on it GPU side
+    UploadToken requiredUploads = 0;
+    VkBuffer streamRingBuffer = VK_NULL_HANDLE;
+    VkDeviceSize streamRingOffset = 0;
+    UploadStreamer streamer{};
+    // the same for streamed resources handed over in the frame being recorded
+    UploadToken streamedUploads = 0;
     uint32_t textureWidth;
     uint32_t textureHeight;
     uint32_t mipLevels;
+    // first level of the full chain that is resident; textureImage holds [textureBaseMip, mipLevels)
+    uint32_t textureBaseMip = 0;
+    // first level that has data, where the view starts; past textureBaseMip only while streaming
+    uint32_t textureResidentMip = 0;
+    uint32_t textureResidency = 0;
+    // bumped whenever textureImageView is replaced; see updateTextureDescriptor
+    uint32_t textureDescriptorVersion = 0;
     VkImage textureImage = VK_NULL_HANDLE;
-    VkDeviceMemory textureImageMemory = VK_NULL_HANDLE;
+    Allocation textureImageAllocation{};
     VkImageView textureImageView = VK_NULL_HANDLE;
+    // the texture is being streamed in while this is not 0: into streamedTextureImage
+    // until it replaces textureImage, then into textureImage
+    StreamId textureStream = 0;
+    VkImage streamedTextureImage = VK_NULL_HANDLE;
+    Allocation streamedTextureAllocation{};
     VkSampler textureSampler = VK_NULL_HANDLE;
+    // filled by importModel, on a cache miss, and released once the mesh is uploaded
     std::vector<Vertex> vertices{};
     std::vector<uint32_t> indices{};
-    VkBuffer vertexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory vertexBufferMemory = VK_NULL_HANDLE;
-    VkBuffer stagingVertexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory stagingVertexBufferMemory = VK_NULL_HANDLE;
-    VkBuffer indexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory indexBufferMemory = VK_NULL_HANDLE;
-    VkBuffer stagingIndexBuffer = VK_NULL_HANDLE;
-    VkDeviceMemory stagingIndexBufferMemory = VK_NULL_HANDLE;
-    std::vector<VkBuffer> uniformBuffers{};
-    std::vector<VkDeviceMemory> uniformBufferMemory{};
+    std::vector<Submesh> modelSubmeshes{};
+    MeshBounds modelBounds{};
+    // vertices quantized, with compactVertices
+    std::vector<CompactVertex> compactVertexData{};
+    // kept for drawing once the model is in the geometry buffer
+    MeshQuantization modelQuantization{};
+    MeshCache modelCache{};
+    // the model until it is in the geometry buffer, from the cache or the import
+    MeshView model{};
+    // CompactVertex rather than Vertex in the geometry buffer and the pipeline
+    bool compactVertices = false;
+    GeometryBuffer geometry{};
+    MeshHandle modelMesh{};
+    std::vector<UniformArena> uniformArenas{};
     VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
     std::vector<VkDescriptorSet> descriptorSets{};
+    // textureDescriptorVersion each set was last written with
+    std::vector<uint32_t> descriptorSetTextureVersions{};
     std::vector<VkCommandBuffer> commandBuffers{};
     std::vector<VkSemaphore> imageAvailableSemaphores{};
     std::vector<VkSemaphore> renderFinishedSemaphores{};
     std::vector<VkFence> inFlightFences{};
     std::vector<VkFence> imagesInFlight{};
     size_t currentFrame = 0;
+    uint64_t frameNumber = 0;
     bool framebufferResized = false;
+    bool memoryReportRequested = false;
 };
 
 int main() {
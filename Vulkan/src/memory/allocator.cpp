@@ -0,0 +1,759 @@
+#include "pch.h"
+#include "memory/allocator.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+namespace {
+    const VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+    const VkDeviceSize SMALL_HEAP_SIZE = 1024ull * 1024 * 1024;
+    // render targets at or above this size get their own memory
+    const VkDeviceSize DEDICATED_RENDER_TARGET_SIZE = 4ull * 1024 * 1024;
+    // keep at most this many empty blocks around per pool to avoid alloc/free thrashing
+    const size_t MAX_EMPTY_BLOCKS = 1;
+
+    const uint32_t INVALID_NODE = UINT32_MAX;
+
+    // TLSF parameters: 16 linear subdivisions per power of two
+    const uint32_t SL_BITS = 4;
+    const uint32_t SL_COUNT = 1u << SL_BITS;
+    const uint32_t FL_COUNT = 64 - SL_BITS;
+
+    uint32_t bitScanForward(uint64_t mask) {
+        uint32_t index = 0;
+        while (!(mask & 1)) {
+            mask >>= 1;
+            index++;
+        }
+        return index;
+    }
+
+    uint32_t bitScanReverse(uint64_t mask) {
+        uint32_t index = 0;
+        while (mask >>= 1) {
+            index++;
+        }
+        return index;
+    }
+
+    VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    VkDeviceSize roundUpToPowerOfTwo(VkDeviceSize value) {
+        VkDeviceSize result = 1;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+}
+
+// A single VkDeviceMemory carved up with TLSF.
+struct MemoryBlock {
+    struct Node {
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        uint32_t prevPhysical = INVALID_NODE;
+        uint32_t nextPhysical = INVALID_NODE;
+        uint32_t prevFree = INVALID_NODE;
+        uint32_t nextFree = INVALID_NODE;
+        bool free = false;
+    };
+
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    uint32_t memoryTypeIndex = 0;
+    uint32_t allocationCount = 0;
+    VkDeviceSize usedBytes = 0;
+    uint32_t mapCount = 0;
+    void* mapped = nullptr;
+
+    std::vector<Node> nodes{};
+    std::vector<uint32_t> unusedNodes{};
+
+    uint64_t flBitmap = 0;
+    uint32_t slBitmap[FL_COUNT]{};
+    uint32_t freeHeads[FL_COUNT][SL_COUNT]{};
+
+    void init(VkDeviceSize blockSize) {
+        if (blockSize == 0 || (blockSize & (blockSize - 1)) != 0) {
+            throw std::runtime_error("memory block size must be a power of two.");
+        }
+        size = blockSize;
+        for (uint32_t fl = 0; fl < FL_COUNT; fl++) {
+            for (uint32_t sl = 0; sl < SL_COUNT; sl++) {
+                freeHeads[fl][sl] = INVALID_NODE;
+            }
+        }
+
+        uint32_t root = newNode();
+        nodes[root].offset = 0;
+        nodes[root].size = blockSize;
+        insertFree(root);
+    }
+
+    static void mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl) {
+        if (size < SL_COUNT) {
+            fl = 0;
+            sl = static_cast<uint32_t>(size);
+        } else {
+            uint32_t log2 = bitScanReverse(size);
+            sl = static_cast<uint32_t>(size >> (log2 - SL_BITS)) ^ SL_COUNT;
+            fl = log2 - SL_BITS + 1;
+        }
+    }
+
+    // same as mapping, but rounds up to the next list so every node in it is big enough.
+    // a power of two is the first size of its list, so a whole block is only found
+    // for a request of its size if block sizes are powers of two
+    static void mappingSearch(VkDeviceSize size, uint32_t& fl, uint32_t& sl) {
+        if (size >= SL_COUNT) {
+            size += (1ull << (bitScanReverse(size) - SL_BITS)) - 1;
+        }
+        mapping(size, fl, sl);
+    }
+
+    uint32_t newNode() {
+        if (!unusedNodes.empty()) {
+            uint32_t index = unusedNodes.back();
+            unusedNodes.pop_back();
+            nodes[index] = Node{};
+            return index;
+        }
+        nodes.emplace_back();
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+
+    void releaseNode(uint32_t index) {
+        unusedNodes.push_back(index);
+    }
+
+    void insertFree(uint32_t index) {
+        Node& node = nodes[index];
+        uint32_t fl, sl;
+        mapping(node.size, fl, sl);
+
+        node.free = true;
+        node.prevFree = INVALID_NODE;
+        node.nextFree = freeHeads[fl][sl];
+        if (node.nextFree != INVALID_NODE) {
+            nodes[node.nextFree].prevFree = index;
+        }
+        freeHeads[fl][sl] = index;
+
+        flBitmap |= 1ull << fl;
+        slBitmap[fl] |= 1u << sl;
+    }
+
+    void removeFree(uint32_t index) {
+        Node& node = nodes[index];
+        uint32_t fl, sl;
+        mapping(node.size, fl, sl);
+
+        if (node.prevFree != INVALID_NODE) {
+            nodes[node.prevFree].nextFree = node.nextFree;
+        } else {
+            freeHeads[fl][sl] = node.nextFree;
+        }
+        if (node.nextFree != INVALID_NODE) {
+            nodes[node.nextFree].prevFree = node.prevFree;
+        }
+
+        if (freeHeads[fl][sl] == INVALID_NODE) {
+            slBitmap[fl] &= ~(1u << sl);
+            if (slBitmap[fl] == 0) {
+                flBitmap &= ~(1ull << fl);
+            }
+        }
+
+        node.free = false;
+        node.prevFree = INVALID_NODE;
+        node.nextFree = INVALID_NODE;
+    }
+
+    uint32_t findFree(VkDeviceSize searchSize) {
+        uint32_t fl, sl;
+        mappingSearch(searchSize, fl, sl);
+        if (fl >= FL_COUNT) {
+            return INVALID_NODE;
+        }
+
+        uint32_t slMap = slBitmap[fl] & (~0u << sl);
+        if (slMap == 0) {
+            uint64_t flMap = (fl + 1 < 64) ? (flBitmap & (~0ull << (fl + 1))) : 0;
+            if (flMap == 0) {
+                return INVALID_NODE;
+            }
+            fl = bitScanForward(flMap);
+            slMap = slBitmap[fl];
+        }
+        sl = bitScanForward(slMap);
+
+        return freeHeads[fl][sl];
+    }
+
+    // splits [offset, offset + size) out of a free node; returns the node of the used range
+    bool allocate(VkDeviceSize allocSize, VkDeviceSize alignment, VkDeviceSize& outOffset, uint32_t& outNode, VkDeviceSize& outPadding) {
+        // search for worst-case padding so any node we get can satisfy the alignment
+        uint32_t index = findFree(allocSize + alignment - 1);
+        if (index == INVALID_NODE) {
+            return false;
+        }
+        removeFree(index);
+
+        VkDeviceSize alignedOffset = alignUp(nodes[index].offset, alignment);
+        VkDeviceSize padding = alignedOffset - nodes[index].offset;
+
+        // front padding goes back onto the free lists as its own node
+        if (padding > 0) {
+            uint32_t front = newNode();
+            Node& node = nodes[index];
+            nodes[front].offset = node.offset;
+            nodes[front].size = padding;
+            nodes[front].prevPhysical = node.prevPhysical;
+            nodes[front].nextPhysical = index;
+            if (node.prevPhysical != INVALID_NODE) {
+                nodes[node.prevPhysical].nextPhysical = front;
+            }
+            node.prevPhysical = front;
+            node.offset += padding;
+            node.size -= padding;
+            insertFree(front);
+        }
+
+        // and so does the tail
+        if (nodes[index].size > allocSize) {
+            uint32_t back = newNode();
+            Node& node = nodes[index];
+            nodes[back].offset = node.offset + allocSize;
+            nodes[back].size = node.size - allocSize;
+            nodes[back].prevPhysical = index;
+            nodes[back].nextPhysical = node.nextPhysical;
+            if (node.nextPhysical != INVALID_NODE) {
+                nodes[node.nextPhysical].prevPhysical = back;
+            }
+            node.nextPhysical = back;
+            node.size = allocSize;
+            insertFree(back);
+        }
+
+        allocationCount++;
+        usedBytes += allocSize;
+
+        outOffset = nodes[index].offset;
+        outNode = index;
+        outPadding = padding;
+        return true;
+    }
+
+    void free(uint32_t index) {
+        allocationCount--;
+        usedBytes -= nodes[index].size;
+
+        // merge with physical neighbours that are also free
+        uint32_t prev = nodes[index].prevPhysical;
+        if (prev != INVALID_NODE && nodes[prev].free) {
+            removeFree(prev);
+            nodes[prev].size += nodes[index].size;
+            nodes[prev].nextPhysical = nodes[index].nextPhysical;
+            if (nodes[index].nextPhysical != INVALID_NODE) {
+                nodes[nodes[index].nextPhysical].prevPhysical = prev;
+            }
+            releaseNode(index);
+            index = prev;
+        }
+
+        uint32_t next = nodes[index].nextPhysical;
+        if (next != INVALID_NODE && nodes[next].free) {
+            removeFree(next);
+            nodes[index].size += nodes[next].size;
+            nodes[index].nextPhysical = nodes[next].nextPhysical;
+            if (nodes[next].nextPhysical != INVALID_NODE) {
+                nodes[nodes[next].nextPhysical].prevPhysical = index;
+            }
+            releaseNode(next);
+        }
+
+        insertFree(index);
+    }
+
+    VkDeviceSize largestFreeRange() const {
+        if (flBitmap == 0) {
+            return 0;
+        }
+        uint32_t fl = bitScanReverse(flBitmap);
+        VkDeviceSize largest = 0;
+        for (uint32_t sl = 0; sl < SL_COUNT; sl++) {
+            for (uint32_t index = freeHeads[fl][sl]; index != INVALID_NODE; index = nodes[index].nextFree) {
+                largest = std::max(largest, nodes[index].size);
+            }
+        }
+        return largest;
+    }
+};
+
+void DeviceAllocator::init(VkPhysicalDevice physicalDevice, VkDevice device, const VkAllocationCallbacks* allocationCallbacks) {
+    this->device = device;
+    this->allocationCallbacks = allocationCallbacks;
+
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    bufferImageGranularity = std::max<VkDeviceSize>(properties.limits.bufferImageGranularity, 1);
+    maxMemoryAllocationCount = properties.limits.maxMemoryAllocationCount;
+
+    pools.resize(memoryProperties.memoryTypeCount * 2);
+}
+
+void DeviceAllocator::destroy() {
+    for (auto& pool : pools) {
+        for (auto block : pool.blocks) {
+            if (block->allocationCount > 0) {
+                std::cerr << "allocator: destroying block with " << block->allocationCount << " live allocation(s)" << std::endl;
+            }
+            destroyBlock(block);
+        }
+        pool.blocks.clear();
+    }
+
+    for (auto& memory : dedicated) {
+        std::cerr << "allocator: leaked dedicated allocation of " << memory.size << " bytes" << std::endl;
+        if (memory.mapped) {
+            vkUnmapMemory(device, memory.memory);
+        }
+        vkFreeMemory(device, memory.memory, allocationCallbacks);
+    }
+    dedicated.clear();
+    deviceMemoryCount = 0;
+}
+
+VkDeviceSize DeviceAllocator::getBlockSize(uint32_t memoryTypeIndex) const {
+    uint32_t heapIndex = memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+    VkDeviceSize heapSize = memoryProperties.memoryHeaps[heapIndex].size;
+
+    // small heaps (e.g. the 256MB BAR window) get smaller blocks so one block can't eat them
+    if (heapSize <= SMALL_HEAP_SIZE) {
+        return roundUpToPowerOfTwo(heapSize / 8);
+    }
+    return roundUpToPowerOfTwo(DEFAULT_BLOCK_SIZE);
+}
+
+DeviceAllocator::Pool& DeviceAllocator::getPool(uint32_t memoryTypeIndex, ResourceKind kind) {
+    if (bufferImageGranularity <= 1) {
+        kind = ResourceKind::Linear;
+    }
+    return pools[memoryTypeIndex * 2 + static_cast<uint32_t>(kind)];
+}
+
+VkDeviceMemory DeviceAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, const VkMemoryDedicatedAllocateInfo* dedicatedInfo) {
+    if (maxMemoryAllocationCount != 0 && deviceMemoryCount >= maxMemoryAllocationCount) {
+        std::cerr << "allocator: reached maxMemoryAllocationCount (" << maxMemoryAllocationCount << ")" << std::endl;
+        throw std::runtime_error("too many device memory allocations.");
+    }
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = dedicatedInfo;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+    VkDeviceMemory memory;
+    VkResult err = vkAllocateMemory(device, &allocInfo, allocationCallbacks, &memory);
+    if (err != VK_SUCCESS) {
+        std::cerr << "Error allocating device memory (" << size << " bytes, type " << memoryTypeIndex << "): " << err << std::endl;
+        throw std::runtime_error("error allocating device memory.");
+    }
+
+    deviceMemoryCount++;
+    return memory;
+}
+
+MemoryBlock* DeviceAllocator::createBlock(uint32_t memoryTypeIndex, VkDeviceSize size) {
+    MemoryBlock* block = new MemoryBlock();
+    block->memory = allocateDeviceMemory(size, memoryTypeIndex);
+    block->memoryTypeIndex = memoryTypeIndex;
+    block->init(size);
+    return block;
+}
+
+void DeviceAllocator::destroyBlock(MemoryBlock* block) {
+    if (block->mapped) {
+        vkUnmapMemory(device, block->memory);
+    }
+    vkFreeMemory(device, block->memory, allocationCallbacks);
+    deviceMemoryCount--;
+    delete block;
+}
+
+Allocation DeviceAllocator::allocateDedicated(VkDeviceSize size, uint32_t memoryTypeIndex, const VkMemoryDedicatedAllocateInfo* dedicatedInfo) {
+    DedicatedMemory memory{};
+    memory.memory = allocateDeviceMemory(size, memoryTypeIndex, dedicatedInfo);
+    memory.size = size;
+    memory.memoryTypeIndex = memoryTypeIndex;
+    dedicated.push_back(memory);
+
+    Allocation allocation{};
+    allocation.memory = memory.memory;
+    allocation.offset = 0;
+    allocation.size = size;
+    allocation.memoryTypeIndex = memoryTypeIndex;
+    allocation.block = nullptr;
+    return allocation;
+}
+
+ResourceRequirements DeviceAllocator::getBufferRequirements(VkBuffer buffer) const {
+    VkBufferMemoryRequirementsInfo2 info{};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+    info.buffer = buffer;
+
+    VkMemoryDedicatedRequirements dedicatedRequirements{};
+    dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+    VkMemoryRequirements2 memoryRequirements{};
+    memoryRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    memoryRequirements.pNext = &dedicatedRequirements;
+    vkGetBufferMemoryRequirements2(device, &info, &memoryRequirements);
+
+    ResourceRequirements requirements{};
+    requirements.memory = memoryRequirements.memoryRequirements;
+    requirements.prefersDedicated = dedicatedRequirements.prefersDedicatedAllocation;
+    requirements.requiresDedicated = dedicatedRequirements.requiresDedicatedAllocation;
+    requirements.buffer = buffer;
+    return requirements;
+}
+
+ResourceRequirements DeviceAllocator::getImageRequirements(VkImage image) const {
+    VkImageMemoryRequirementsInfo2 info{};
+    info.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+    info.image = image;
+
+    VkMemoryDedicatedRequirements dedicatedRequirements{};
+    dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+    VkMemoryRequirements2 memoryRequirements{};
+    memoryRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    memoryRequirements.pNext = &dedicatedRequirements;
+    vkGetImageMemoryRequirements2(device, &info, &memoryRequirements);
+
+    ResourceRequirements requirements{};
+    requirements.memory = memoryRequirements.memoryRequirements;
+    requirements.prefersDedicated = dedicatedRequirements.prefersDedicatedAllocation;
+    requirements.requiresDedicated = dedicatedRequirements.requiresDedicatedAllocation;
+    requirements.image = image;
+    return requirements;
+}
+
+Allocation DeviceAllocator::allocate(const ResourceRequirements& requirements, uint32_t memoryTypeIndex, ResourceKind kind, bool preferDedicated) {
+    // the driver's word beats our size heuristics, and memory that is only ever for
+    // this one resource may as well say so, which lets the driver lay it out for it
+    if (requirements.requiresDedicated || requirements.prefersDedicated ||
+        isDedicatedSize(requirements.memory.size, memoryTypeIndex, preferDedicated)) {
+        VkMemoryDedicatedAllocateInfo dedicatedInfo{};
+        dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+        dedicatedInfo.buffer = requirements.buffer;
+        dedicatedInfo.image = requirements.image;
+        return allocateDedicated(requirements.memory.size, memoryTypeIndex, &dedicatedInfo);
+    }
+    return allocate(requirements.memory, memoryTypeIndex, kind, preferDedicated);
+}
+
+bool DeviceAllocator::isDedicatedSize(VkDeviceSize size, uint32_t memoryTypeIndex, bool preferDedicated) const {
+    // anything bigger than half a block would mostly waste it
+    return size > getBlockSize(memoryTypeIndex) / 2 || (preferDedicated && size >= DEDICATED_RENDER_TARGET_SIZE);
+}
+
+Allocation DeviceAllocator::allocate(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex, ResourceKind kind, bool preferDedicated) {
+    if (isDedicatedSize(requirements.size, memoryTypeIndex, preferDedicated)) {
+        return allocateDedicated(requirements.size, memoryTypeIndex);
+    }
+
+    VkDeviceSize blockSize = getBlockSize(memoryTypeIndex);
+    VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+
+    Allocation allocation{};
+    allocation.size = requirements.size;
+    allocation.memoryTypeIndex = memoryTypeIndex;
+
+    Pool& pool = getPool(memoryTypeIndex, kind);
+    for (auto block : pool.blocks) {
+        if (block->allocate(requirements.size, alignment, allocation.offset, allocation.node, allocation.padding)) {
+            allocation.memory = block->memory;
+            allocation.block = block;
+            return allocation;
+        }
+    }
+
+    // start small and double with every new block, so memory types that only hold a
+    // few small resources (uniforms, staging) don't pin a full-size block
+    VkDeviceSize newBlockSize = blockSize / 8;
+    for (auto other : pool.blocks) {
+        newBlockSize = std::max(newBlockSize, other->size * 2);
+    }
+    while (newBlockSize < requirements.size + alignment) {
+        newBlockSize *= 2;
+    }
+    newBlockSize = std::min(newBlockSize, blockSize);
+
+    MemoryBlock* block = createBlock(memoryTypeIndex, newBlockSize);
+    pool.blocks.push_back(block);
+    if (!block->allocate(requirements.size, alignment, allocation.offset, allocation.node, allocation.padding)) {
+        throw std::runtime_error("error sub-allocating from a new memory block.");
+    }
+    allocation.memory = block->memory;
+    allocation.block = block;
+    return allocation;
+}
+
+void DeviceAllocator::free(Allocation& allocation) {
+    if (allocation.memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    if (allocation.block == nullptr) {
+        for (size_t i = 0; i < dedicated.size(); i++) {
+            if (dedicated[i].memory == allocation.memory) {
+                if (dedicated[i].mapped) {
+                    vkUnmapMemory(device, dedicated[i].memory);
+                }
+                vkFreeMemory(device, dedicated[i].memory, allocationCallbacks);
+                deviceMemoryCount--;
+                dedicated.erase(dedicated.begin() + i);
+                break;
+            }
+        }
+        allocation = Allocation{};
+        return;
+    }
+
+    MemoryBlock* block = allocation.block;
+    block->free(allocation.node);
+
+    if (block->allocationCount == 0) {
+        for (auto& pool : pools) {
+            auto it = std::find(pool.blocks.begin(), pool.blocks.end(), block);
+            if (it == pool.blocks.end()) {
+                continue;
+            }
+
+            size_t emptyBlocks = 0;
+            for (auto other : pool.blocks) {
+                if (other->allocationCount == 0) {
+                    emptyBlocks++;
+                }
+            }
+            if (emptyBlocks > MAX_EMPTY_BLOCKS && block->mapCount == 0) {
+                pool.blocks.erase(it);
+                destroyBlock(block);
+            }
+            break;
+        }
+    }
+
+    allocation = Allocation{};
+}
+
+std::vector<const MemoryBlock*> DeviceAllocator::getDefragmentationSources() const {
+    std::vector<const MemoryBlock*> sources{};
+
+    for (const auto& pool : pools) {
+        const MemoryBlock* source = nullptr;
+        for (auto block : pool.blocks) {
+            if (block->allocationCount == 0 || block->mapCount > 0) {
+                continue;
+            }
+            if (source == nullptr || block->usedBytes < source->usedBytes) {
+                source = block;
+            }
+        }
+        if (source == nullptr) {
+            continue;
+        }
+
+        VkDeviceSize freeElsewhere = 0;
+        for (auto block : pool.blocks) {
+            if (block != source) {
+                freeElsewhere += block->size - block->usedBytes;
+            }
+        }
+
+        // free space is fragmented too, so this is only an estimate; moves that don't
+        // fit just stay where they are
+        if (source->usedBytes <= freeElsewhere) {
+            sources.push_back(source);
+        }
+    }
+
+    return sources;
+}
+
+bool DeviceAllocator::allocateForMove(const VkMemoryRequirements& requirements, const Allocation& current, const std::vector<const MemoryBlock*>& exclude, Allocation& out) {
+    if (current.block == nullptr) {
+        return false;
+    }
+
+    const Pool* owner = nullptr;
+    for (const auto& pool : pools) {
+        if (std::find(pool.blocks.begin(), pool.blocks.end(), current.block) != pool.blocks.end()) {
+            owner = &pool;
+            break;
+        }
+    }
+    if (owner == nullptr) {
+        return false;
+    }
+
+    std::vector<MemoryBlock*> targets{};
+    for (auto block : owner->blocks) {
+        if (block->memoryTypeIndex == current.memoryTypeIndex &&
+            std::find(exclude.begin(), exclude.end(), block) == exclude.end()) {
+            targets.push_back(block);
+        }
+    }
+
+    // packing into the fullest blocks first leaves the emptier ones free to drain
+    std::sort(targets.begin(), targets.end(), [](const MemoryBlock* a, const MemoryBlock* b) {
+        return a->usedBytes > b->usedBytes;
+    });
+
+    VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+    for (auto block : targets) {
+        Allocation allocation{};
+        allocation.size = requirements.size;
+        allocation.memoryTypeIndex = current.memoryTypeIndex;
+        if (block->allocate(requirements.size, alignment, allocation.offset, allocation.node, allocation.padding)) {
+            allocation.memory = block->memory;
+            allocation.block = block;
+            out = allocation;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void DeviceAllocator::releaseEmptyBlocks() {
+    for (auto& pool : pools) {
+        for (size_t i = 0; i < pool.blocks.size();) {
+            MemoryBlock* block = pool.blocks[i];
+            if (block->allocationCount == 0 && block->mapCount == 0) {
+                pool.blocks.erase(pool.blocks.begin() + i);
+                destroyBlock(block);
+            } else {
+                i++;
+            }
+        }
+    }
+}
+
+void* DeviceAllocator::mapDeviceMemory(VkDeviceMemory memory, uint32_t& mapCount, void*& mapped) {
+    if (mapCount == 0) {
+        VkResult err = vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        if (err != VK_SUCCESS) {
+            std::cerr << "Error mapping device memory: " << err << std::endl;
+            throw std::runtime_error("error mapping device memory.");
+        }
+    }
+    mapCount++;
+    return mapped;
+}
+
+void DeviceAllocator::unmapDeviceMemory(VkDeviceMemory memory, uint32_t& mapCount, void*& mapped) {
+    if (mapCount == 0) {
+        return;
+    }
+    mapCount--;
+    if (mapCount == 0) {
+        vkUnmapMemory(device, memory);
+        mapped = nullptr;
+    }
+}
+
+void* DeviceAllocator::map(const Allocation& allocation) {
+    if (allocation.block != nullptr) {
+        MemoryBlock* block = allocation.block;
+        char* data = static_cast<char*>(mapDeviceMemory(block->memory, block->mapCount, block->mapped));
+        return data + allocation.offset;
+    }
+
+    for (auto& memory : dedicated) {
+        if (memory.memory == allocation.memory) {
+            return mapDeviceMemory(memory.memory, memory.mapCount, memory.mapped);
+        }
+    }
+
+    throw std::runtime_error("mapping an unknown allocation.");
+}
+
+void DeviceAllocator::unmap(const Allocation& allocation) {
+    if (allocation.block != nullptr) {
+        MemoryBlock* block = allocation.block;
+        unmapDeviceMemory(block->memory, block->mapCount, block->mapped);
+        return;
+    }
+
+    for (auto& memory : dedicated) {
+        if (memory.memory == allocation.memory) {
+            unmapDeviceMemory(memory.memory, memory.mapCount, memory.mapped);
+            return;
+        }
+    }
+}
+
+AllocatorStats DeviceAllocator::getStats() const {
+    AllocatorStats stats{};
+    stats.memoryTypes.resize(memoryProperties.memoryTypeCount);
+    stats.deviceMemoryCount = deviceMemoryCount;
+    stats.maxDeviceMemoryCount = maxMemoryAllocationCount;
+
+    for (size_t i = 0; i < pools.size(); i++) {
+        MemoryTypeStats& typeStats = stats.memoryTypes[i / 2];
+        for (auto block : pools[i].blocks) {
+            typeStats.blockCount++;
+            typeStats.allocationCount += block->allocationCount;
+            typeStats.blockBytes += block->size;
+            typeStats.usedBytes += block->usedBytes;
+            typeStats.largestFreeRange = std::max(typeStats.largestFreeRange, block->largestFreeRange());
+        }
+    }
+
+    for (auto& memory : dedicated) {
+        MemoryTypeStats& typeStats = stats.memoryTypes[memory.memoryTypeIndex];
+        typeStats.dedicatedCount++;
+        typeStats.dedicatedBytes += memory.size;
+    }
+
+    for (auto& typeStats : stats.memoryTypes) {
+        stats.total.blockCount += typeStats.blockCount;
+        stats.total.allocationCount += typeStats.allocationCount;
+        stats.total.dedicatedCount += typeStats.dedicatedCount;
+        stats.total.blockBytes += typeStats.blockBytes;
+        stats.total.usedBytes += typeStats.usedBytes;
+        stats.total.dedicatedBytes += typeStats.dedicatedBytes;
+        stats.total.largestFreeRange = std::max(stats.total.largestFreeRange, typeStats.largestFreeRange);
+    }
+
+    return stats;
+}
+
+void DeviceAllocator::printStats(std::ostream& out) const {
+    AllocatorStats stats = getStats();
+
+    out << "Device Memory: " << stats.deviceMemoryCount << " / " << stats.maxDeviceMemoryCount << " allocations" << std::endl;
+    for (size_t i = 0; i < stats.memoryTypes.size(); i++) {
+        const MemoryTypeStats& typeStats = stats.memoryTypes[i];
+        if (typeStats.blockCount == 0 && typeStats.dedicatedCount == 0) {
+            continue;
+        }
+
+        out << "\ttype " << i
+            << " (flags 0x" << std::hex << memoryProperties.memoryTypes[i].propertyFlags << std::dec
+            << ", heap " << memoryProperties.memoryTypes[i].heapIndex << "): "
+            << typeStats.allocationCount << " sub-allocations using " << typeStats.usedBytes
+            << " / " << typeStats.blockBytes << " bytes in " << typeStats.blockCount << " block(s), "
+            << "largest free range " << typeStats.largestFreeRange << ", "
+            << typeStats.dedicatedCount << " dedicated (" << typeStats.dedicatedBytes << " bytes)" << std::endl;
+    }
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+#include <ostream>
+
+// Sub-allocating device memory allocator.
+//
+// Instead of one vkAllocateMemory per resource, we grab large blocks per memory
+// type and hand out aligned ranges from them. Placement inside a block is done
+// with a two-level segregated fit (TLSF) free list, so both allocate and free are
+// O(1) regardless of how fragmented the block is.
+//
+// Large allocations (and large render targets) get their own VkDeviceMemory, since
+// they would waste most of a block and are usually recreated as a unit anyway. So do
+// resources the driver asks for one for (VkMemoryDedicatedRequirements), and those
+// allocations are made for the resource (VkMemoryDedicatedAllocateInfo).
+// Blocks start at 1/8 of the preferred block size and grow as a pool fills up; block
+// sizes are powers of two, which the TLSF search relies on to find a whole block.
+
+struct MemoryBlock;
+
+enum class ResourceKind {
+    // buffers and VK_IMAGE_TILING_LINEAR images
+    Linear,
+    // VK_IMAGE_TILING_OPTIMAL images
+    Optimal
+};
+
+struct Allocation {
+    VkDeviceMemory memory   = VK_NULL_HANDLE;
+    VkDeviceSize offset     = 0;
+    VkDeviceSize size       = 0;
+    uint32_t memoryTypeIndex = 0;
+
+    // owning block, or nullptr for a dedicated allocation
+    MemoryBlock* block      = nullptr;
+    uint32_t node           = 0;
+    // bytes skipped in front of offset to satisfy the alignment; they stay on the
+    // free lists, but are rarely big enough to be reused
+    VkDeviceSize padding    = 0;
+};
+
+// what a buffer or image needs from its memory, see DeviceAllocator::getBufferRequirements
+struct ResourceRequirements {
+    VkMemoryRequirements memory{};
+    // the driver's word on whether the resource should get its own VkDeviceMemory
+    bool prefersDedicated = false;
+    bool requiresDedicated = false;
+    // the resource, named in the allocation if it gets its own memory; one of them is set
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkImage image = VK_NULL_HANDLE;
+};
+
+struct MemoryTypeStats {
+    uint32_t blockCount         = 0;
+    uint32_t allocationCount    = 0;
+    uint32_t dedicatedCount     = 0;
+    VkDeviceSize blockBytes     = 0;
+    VkDeviceSize usedBytes      = 0;
+    VkDeviceSize dedicatedBytes = 0;
+    VkDeviceSize largestFreeRange = 0;
+};
+
+struct AllocatorStats {
+    std::vector<MemoryTypeStats> memoryTypes{};
+    MemoryTypeStats total{};
+    // number of live VkDeviceMemory objects vs. maxMemoryAllocationCount
+    uint32_t deviceMemoryCount  = 0;
+    uint32_t maxDeviceMemoryCount = 0;
+};
+
+class DeviceAllocator {
+public:
+    void init(VkPhysicalDevice physicalDevice, VkDevice device, const VkAllocationCallbacks* allocationCallbacks = nullptr);
+    void destroy();
+
+    // vkGet*MemoryRequirements2 with VkMemoryDedicatedRequirements chained
+    ResourceRequirements getBufferRequirements(VkBuffer buffer) const;
+    ResourceRequirements getImageRequirements(VkImage image) const;
+
+    // memoryTypeIndex is picked by the caller (see MemoryTypeCache::find).
+    // preferDedicated hints that the resource is a render target or similar
+    // long-lived, large object that should get its own VkDeviceMemory; the driver
+    // preferring or requiring one always gets it.
+    Allocation allocate(const ResourceRequirements& requirements, uint32_t memoryTypeIndex, ResourceKind kind, bool preferDedicated = false);
+    // for memory that isn't for one resource, e.g. several aliased images; don't use
+    // it for a resource that requires a dedicated allocation
+    Allocation allocate(const VkMemoryRequirements& requirements, uint32_t memoryTypeIndex, ResourceKind kind, bool preferDedicated = false);
+    void free(Allocation& allocation);
+
+    // mapping is reference counted per VkDeviceMemory, since Vulkan only allows a
+    // memory object to be mapped once at a time.
+    void* map(const Allocation& allocation);
+    void unmap(const Allocation& allocation);
+
+    AllocatorStats getStats() const;
+    void printStats(std::ostream& out) const;
+
+    VkDeviceSize getBlockSize(uint32_t memoryTypeIndex) const;
+
+    // defragmentation support, see Defragmenter.
+    // blocks worth emptying: per pool, the least used non-empty block, if the pool's
+    // other blocks have room for everything in it. Mapped blocks are never picked.
+    std::vector<const MemoryBlock*> getDefragmentationSources() const;
+    // allocates from an existing block of current's pool that isn't in exclude, fullest
+    // blocks first; never creates a block. returns false if nothing fits
+    bool allocateForMove(const VkMemoryRequirements& requirements, const Allocation& current, const std::vector<const MemoryBlock*>& exclude, Allocation& out);
+    // frees every empty, unmapped block, including the spare ones kept to avoid thrashing
+    void releaseEmptyBlocks();
+
+private:
+    struct DedicatedMemory {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        uint32_t memoryTypeIndex = 0;
+        uint32_t mapCount = 0;
+        void* mapped = nullptr;
+    };
+
+    struct Pool {
+        std::vector<MemoryBlock*> blocks{};
+    };
+
+    Pool& getPool(uint32_t memoryTypeIndex, ResourceKind kind);
+    MemoryBlock* createBlock(uint32_t memoryTypeIndex, VkDeviceSize size);
+    void destroyBlock(MemoryBlock* block);
+    bool isDedicatedSize(VkDeviceSize size, uint32_t memoryTypeIndex, bool preferDedicated) const;
+    // dedicatedInfo, if not null, is chained into the VkMemoryAllocateInfo
+    VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, const VkMemoryDedicatedAllocateInfo* dedicatedInfo = nullptr);
+    Allocation allocateDedicated(VkDeviceSize size, uint32_t memoryTypeIndex, const VkMemoryDedicatedAllocateInfo* dedicatedInfo = nullptr);
+    void* mapDeviceMemory(VkDeviceMemory memory, uint32_t& mapCount, void*& mapped);
+    void unmapDeviceMemory(VkDeviceMemory memory, uint32_t& mapCount, void*& mapped);
+
+    VkDevice device = VK_NULL_HANDLE;
+    const VkAllocationCallbacks* allocationCallbacks = nullptr;
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    VkDeviceSize bufferImageGranularity = 1;
+    uint32_t maxMemoryAllocationCount = 0;
+    uint32_t deviceMemoryCount = 0;
+
+    // pools[memoryType * 2 + kind]; when bufferImageGranularity is 1 every kind shares
+    // the Linear pool, otherwise linear and optimal resources live in separate blocks
+    // so they can never end up on the same granularity page.
+    std::vector<Pool> pools{};
+    std::vector<DedicatedMemory> dedicated{};
+};
@@ -0,0 +1,407 @@
+#include "pch.h"
+#include "memory/defragmenter.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+
+void Defragmenter::init(VkDevice device, VkQueue queue, uint32_t queueFamilyIndex, DeviceAllocator& allocator, uint32_t framesInFlight, const VkAllocationCallbacks* allocationCallbacks) {
+    this->device = device;
+    this->allocationCallbacks = allocationCallbacks;
+    this->queue = queue;
+    this->allocator = &allocator;
+    this->framesInFlight = framesInFlight;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = queueFamilyIndex;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+    VkResult err = vkCreateCommandPool(device, &poolInfo, allocationCallbacks, &commandPool);
+    if (err != VK_SUCCESS) {
+        std::cerr << "error creating defragmentation command pool: " << err << std::endl;
+        throw std::runtime_error("Error creating defragmentation command pool.");
+    }
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+
+    err = vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+    if (err != VK_SUCCESS) {
+        std::cerr << "error allocating defragmentation command buffer: " << err << std::endl;
+        throw std::runtime_error("Error allocating defragmentation command buffer.");
+    }
+
+    VkFenceCreateInfo fenceInfo{};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    if (vkCreateFence(device, &fenceInfo, allocationCallbacks, &fence) != VK_SUCCESS ||
+        vkCreateSemaphore(device, &semaphoreInfo, allocationCallbacks, &graphicsDone) != VK_SUCCESS ||
+        vkCreateSemaphore(device, &semaphoreInfo, allocationCallbacks, &movesDone) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create defragmentation sync objects.");
+    }
+}
+
+void Defragmenter::destroy() {
+    finish();
+
+    for (auto& entry : deferred) {
+        entry.destroy();
+    }
+    deferred.clear();
+
+    vkDestroySemaphore(device, movesDone, allocationCallbacks);
+    vkDestroySemaphore(device, graphicsDone, allocationCallbacks);
+    vkDestroyFence(device, fence, allocationCallbacks);
+    vkDestroyCommandPool(device, commandPool, allocationCallbacks);
+}
+
+void Defragmenter::setBudget(VkDeviceSize bytesPerFrame, double millisecondsPerFrame) {
+    this->bytesPerFrame = bytesPerFrame;
+    this->millisecondsPerFrame = millisecondsPerFrame;
+}
+
+void Defragmenter::addBuffer(VkBuffer* buffer, Allocation* allocation, const VkBufferCreateInfo& createInfo) {
+    if (createInfo.sharingMode != VK_SHARING_MODE_EXCLUSIVE) {
+        throw std::runtime_error("only exclusive buffers can be defragmented.");
+    }
+
+    Resource resource{};
+    resource.active = true;
+    resource.buffer = buffer;
+    resource.allocation = allocation;
+    resource.bufferInfo = createInfo;
+    resource.bufferInfo.pNext = nullptr;
+    resource.bufferInfo.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    for (auto& slot : resources) {
+        if (!slot.active) {
+            slot = resource;
+            return;
+        }
+    }
+    resources.push_back(resource);
+}
+
+void Defragmenter::addImage(VkImage* image, Allocation* allocation, const VkImageCreateInfo& createInfo, VkImageLayout layout) {
+    if (createInfo.sharingMode != VK_SHARING_MODE_EXCLUSIVE) {
+        throw std::runtime_error("only exclusive images can be defragmented.");
+    }
+
+    Resource resource{};
+    resource.active = true;
+    resource.image = image;
+    resource.allocation = allocation;
+    resource.imageInfo = createInfo;
+    resource.imageInfo.pNext = nullptr;
+    resource.imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    resource.imageInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    resource.layout = layout;
+
+    for (auto& slot : resources) {
+        if (!slot.active) {
+            slot = resource;
+            return;
+        }
+    }
+    resources.push_back(resource);
+}
+
+uint32_t Defragmenter::findResource(const Allocation* allocation) const {
+    for (uint32_t i = 0; i < resources.size(); i++) {
+        if (resources[i].active && resources[i].allocation == allocation) {
+            return i;
+        }
+    }
+    return UINT32_MAX;
+}
+
+void Defragmenter::remove(const Allocation* allocation) {
+    uint32_t index = findResource(allocation);
+    if (index == UINT32_MAX) {
+        return;
+    }
+
+    // the copy still reads the old memory, and the owner is about to free it
+    if (resources[index].moving) {
+        finish();
+    }
+    resources[index].active = false;
+}
+
+void Defragmenter::defer(std::function<void()> destroy) {
+    Deferred entry{};
+    entry.frame = frame;
+    entry.destroy = destroy;
+    deferred.push_back(entry);
+}
+
+void Defragmenter::update(uint64_t frame) {
+    this->frame = frame;
+
+    if (inFlight && vkGetFenceStatus(device, fence) == VK_SUCCESS) {
+        completeBatch();
+    }
+
+    while (!deferred.empty() && frame >= deferred.front().frame + framesInFlight) {
+        deferred.front().destroy();
+        deferred.pop_front();
+    }
+}
+
+void Defragmenter::prepareSubmit(std::vector<VkSemaphore>& waitSemaphores, std::vector<VkPipelineStageFlags>& waitStages, std::vector<VkSemaphore>& signalSemaphores) {
+    if (waitForMoves) {
+        waitSemaphores.push_back(movesDone);
+        waitStages.push_back(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+        waitForMoves = false;
+    }
+
+    // one batch at a time; the next one is planned once this one has been swapped in
+    if (!inFlight && !recorded) {
+        recorded = recordBatch();
+    }
+    if (recorded) {
+        signalSemaphores.push_back(graphicsDone);
+    }
+}
+
+void Defragmenter::submit() {
+    if (!recorded) {
+        return;
+    }
+
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &graphicsDone;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &movesDone;
+
+    VkResult err = vkQueueSubmit(queue, 1, &submitInfo, fence);
+    if (err != VK_SUCCESS) {
+        std::cerr << "Error submitting defragmentation copies: " << err << std::endl;
+        throw std::runtime_error("error submitting defragmentation copies.");
+    }
+
+    recorded = false;
+    inFlight = true;
+    waitForMoves = true;
+}
+
+void Defragmenter::finish() {
+    if (!inFlight) {
+        return;
+    }
+
+    vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+    completeBatch();
+}
+
+bool Defragmenter::recordBatch() {
+    std::vector<const MemoryBlock*> sources = allocator->getDefragmentationSources();
+    if (sources.empty()) {
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    vkResetCommandBuffer(commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    VkDeviceSize bytes = 0;
+    for (uint32_t i = 0; i < resources.size(); i++) {
+        const Resource& resource = resources[i];
+        if (!resource.active || resource.moving) {
+            continue;
+        }
+        if (std::find(sources.begin(), sources.end(), resource.allocation->block) == sources.end()) {
+            continue;
+        }
+
+        // always make progress, even if a single resource is over budget
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (!moves.empty() && (bytes + resource.allocation->size > bytesPerFrame || elapsed > millisecondsPerFrame)) {
+            break;
+        }
+
+        if (recordMove(i, sources)) {
+            bytes += resource.allocation->size;
+        }
+    }
+
+    vkEndCommandBuffer(commandBuffer);
+    return !moves.empty();
+}
+
+bool Defragmenter::recordMove(uint32_t index, const std::vector<const MemoryBlock*>& sources) {
+    Resource& resource = resources[index];
+
+    Move move{};
+    move.resource = index;
+
+    ResourceRequirements requirements{};
+    if (resource.buffer) {
+        VkResult err = vkCreateBuffer(device, &resource.bufferInfo, allocationCallbacks, &move.buffer);
+        if (err != VK_SUCCESS) {
+            std::cerr << "Error creating buffer for defragmentation: " << err << std::endl;
+            throw std::runtime_error("error creating buffer for defragmentation.");
+        }
+        requirements = allocator->getBufferRequirements(move.buffer);
+    } else {
+        VkResult err = vkCreateImage(device, &resource.imageInfo, allocationCallbacks, &move.image);
+        if (err != VK_SUCCESS) {
+            std::cerr << "Error creating image for defragmentation: " << err << std::endl;
+            throw std::runtime_error("error creating image for defragmentation.");
+        }
+        requirements = allocator->getImageRequirements(move.image);
+    }
+
+    // blocks can only take what the driver lets share memory
+    if (requirements.requiresDedicated || !allocator->allocateForMove(requirements.memory, *resource.allocation, sources, move.allocation)) {
+        vkDestroyBuffer(device, move.buffer, allocationCallbacks);
+        vkDestroyImage(device, move.image, allocationCallbacks);
+        return false;
+    }
+
+    if (resource.buffer) {
+        vkBindBufferMemory(device, move.buffer, move.allocation.memory, move.allocation.offset);
+
+        VkBufferCopy region{};
+        region.size = resource.bufferInfo.size;
+        vkCmdCopyBuffer(commandBuffer, *resource.buffer, move.buffer, 1, &region);
+    } else {
+        vkBindImageMemory(device, move.image, move.allocation.memory, move.allocation.offset);
+        recordImageCopy(resource, move.image);
+    }
+
+    resource.moving = true;
+    moves.push_back(move);
+    return true;
+}
+
+void Defragmenter::recordImageCopy(const Resource& resource, VkImage dst) {
+    const VkImageCreateInfo& info = resource.imageInfo;
+
+    VkImageSubresourceRange range{};
+    range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    range.baseMipLevel = 0;
+    range.levelCount = info.mipLevels;
+    range.baseArrayLayer = 0;
+    range.layerCount = info.arrayLayers;
+
+    // the batch waits on the graphics submission at the transfer stage, which the
+    // layout transitions chain onto
+    VkImageMemoryBarrier barriers[2]{};
+    barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barriers[0].oldLayout = resource.layout;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].image = *resource.image;
+    barriers[0].subresourceRange = range;
+    barriers[0].srcAccessMask = 0;
+    barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    barriers[1] = barriers[0];
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].image = dst;
+    barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+
+    std::vector<VkImageCopy> regions(info.mipLevels);
+    for (uint32_t level = 0; level < info.mipLevels; level++) {
+        VkImageCopy& region = regions[level];
+        region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.srcSubresource.mipLevel = level;
+        region.srcSubresource.baseArrayLayer = 0;
+        region.srcSubresource.layerCount = info.arrayLayers;
+        region.dstSubresource = region.srcSubresource;
+        region.extent.width = std::max(info.extent.width >> level, 1u);
+        region.extent.height = std::max(info.extent.height >> level, 1u);
+        region.extent.depth = std::max(info.extent.depth >> level, 1u);
+    }
+    vkCmdCopyImage(commandBuffer, *resource.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        static_cast<uint32_t>(regions.size()), regions.data());
+
+    // back to the registered layout; the next graphics submission waits on the batch's
+    // semaphore, which makes the writes visible
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].newLayout = resource.layout;
+    barriers[0].srcAccessMask = 0;
+    barriers[0].dstAccessMask = 0;
+
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].newLayout = resource.layout;
+    barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[1].dstAccessMask = 0;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+}
+
+void Defragmenter::completeBatch() {
+    vkResetFences(device, 1, &fence);
+    inFlight = false;
+
+    for (auto& move : moves) {
+        Resource& resource = resources[move.resource];
+        resource.moving = false;
+
+        VkBuffer oldBuffer = VK_NULL_HANDLE;
+        VkImage oldImage = VK_NULL_HANDLE;
+        if (resource.buffer) {
+            oldBuffer = *resource.buffer;
+            *resource.buffer = move.buffer;
+        } else {
+            oldImage = *resource.image;
+            *resource.image = move.image;
+        }
+        Allocation oldAllocation = *resource.allocation;
+        *resource.allocation = move.allocation;
+
+        movedResources++;
+        movedBytes += oldAllocation.size;
+
+        // frames recorded before the swap may still use the old resource
+        VkDevice device = this->device;
+        DeviceAllocator* allocator = this->allocator;
+        const VkAllocationCallbacks* allocationCallbacks = this->allocationCallbacks;
+        defer([device, allocator, allocationCallbacks, oldBuffer, oldImage, oldAllocation]() mutable {
+            vkDestroyBuffer(device, oldBuffer, allocationCallbacks);
+            vkDestroyImage(device, oldImage, allocationCallbacks);
+            allocator->free(oldAllocation);
+        });
+
+        if (onMoved) {
+            onMoved(resource.allocation, oldBuffer, oldImage);
+        }
+    }
+    moves.clear();
+
+    // the source blocks are empty once the old allocations above are gone
+    DeviceAllocator* allocator = this->allocator;
+    defer([allocator]() {
+        allocator->releaseEmptyBlocks();
+    });
+}
+
+void Defragmenter::print(std::ostream& out) const {
+    out << "defragmenter: moved " << movedResources << " resource(s), " << (movedBytes >> 10) << " KiB" << std::endl;
+}
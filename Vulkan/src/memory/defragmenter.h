@@ -0,0 +1,126 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <ostream>
+
+#include "memory/allocator.h"
+
+// Incremental compaction of sub-allocated device memory.
+//
+// Movable buffers and images are registered with pointers to the handle and the
+// Allocation that own them. Every frame, the defragmenter picks the least used block
+// of each pool (see DeviceAllocator::getDefragmentationSources), and, within a byte
+// and CPU time budget, recreates resources living there in the pool's other blocks
+// and records copies into a command buffer on the queue it was given, which has to
+// be in the family that owns the resources (resources are EXCLUSIVE).
+//
+// The copy batch waits on a semaphore signalled by the frame's graphics submission,
+// and the next graphics submission waits on the batch, so nothing samples an image
+// while it's in a transfer layout. Once the batch's fence signals, the registered
+// handle and Allocation are swapped to the new resource and the moved callback runs,
+// so the owner can patch views and descriptor sets. The old resource is destroyed
+// once every frame in flight that might still use it has finished, and blocks left
+// empty are released back to the driver.
+//
+// Registered resources must not be written by the GPU outside of the defragmenter,
+// and images must be in their registered layout whenever a frame is submitted.
+class Defragmenter {
+public:
+    // called with the registered Allocation after its resource has moved, and the
+    // handle it had before; the other one is VK_NULL_HANDLE
+    using MovedCallback = std::function<void(const Allocation*, VkBuffer oldBuffer, VkImage oldImage)>;
+
+    void init(VkDevice device, VkQueue queue, uint32_t queueFamilyIndex, DeviceAllocator& allocator, uint32_t framesInFlight, const VkAllocationCallbacks* allocationCallbacks = nullptr);
+    void destroy();
+
+    void setMovedCallback(MovedCallback callback) { onMoved = callback; }
+    void setBudget(VkDeviceSize bytesPerFrame, double millisecondsPerFrame);
+
+    // the buffer/image needs TRANSFER_SRC and TRANSFER_DST usage; only color images
+    // with a single layout are supported
+    void addBuffer(VkBuffer* buffer, Allocation* allocation, const VkBufferCreateInfo& createInfo);
+    void addImage(VkImage* image, Allocation* allocation, const VkImageCreateInfo& createInfo, VkImageLayout layout);
+    // call before destroying a registered resource; waits if it's being moved
+    void remove(const Allocation* allocation);
+
+    // runs destroy once the frames in flight at the time of the call have finished
+    void defer(std::function<void()> destroy);
+
+    // start of a frame, after its fence wait and before recording: completes a
+    // finished batch (swapping handles) and destroys what is no longer in use
+    void update(uint64_t frame);
+    // right before the frame's graphics submission: plans and records the next batch,
+    // and adds the semaphores the submission has to wait on and signal
+    void prepareSubmit(std::vector<VkSemaphore>& waitSemaphores, std::vector<VkPipelineStageFlags>& waitStages, std::vector<VkSemaphore>& signalSemaphores);
+    // right after the frame's graphics submission: submits the batch
+    void submit();
+
+    // blocks until the batch in flight, if any, has completed and been swapped in
+    void finish();
+
+    void print(std::ostream& out) const;
+
+private:
+    struct Resource {
+        bool active = false;
+        bool moving = false;
+        VkBuffer* buffer = nullptr;
+        VkImage* image = nullptr;
+        Allocation* allocation = nullptr;
+        VkBufferCreateInfo bufferInfo{};
+        VkImageCreateInfo imageInfo{};
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    };
+
+    struct Move {
+        uint32_t resource = 0;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkImage image = VK_NULL_HANDLE;
+        Allocation allocation{};
+    };
+
+    struct Deferred {
+        uint64_t frame = 0;
+        std::function<void()> destroy{};
+    };
+
+    bool recordBatch();
+    bool recordMove(uint32_t resource, const std::vector<const MemoryBlock*>& sources);
+    void recordImageCopy(const Resource& resource, VkImage dst);
+    void completeBatch();
+    uint32_t findResource(const Allocation* allocation) const;
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueue queue = VK_NULL_HANDLE;
+    DeviceAllocator* allocator = nullptr;
+    uint32_t framesInFlight = 1;
+    const VkAllocationCallbacks* allocationCallbacks = nullptr;
+    MovedCallback onMoved{};
+
+    VkDeviceSize bytesPerFrame = 16ull * 1024 * 1024;
+    double millisecondsPerFrame = 0.5;
+
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    // signalled by the graphics submission, waited on by the batch
+    VkSemaphore graphicsDone = VK_NULL_HANDLE;
+    // signalled by the batch, waited on by the next graphics submission
+    VkSemaphore movesDone = VK_NULL_HANDLE;
+
+    std::vector<Resource> resources{};
+    std::vector<Move> moves{};
+    bool recorded = false;
+    bool inFlight = false;
+    bool waitForMoves = false;
+
+    uint64_t frame = 0;
+    std::deque<Deferred> deferred{};
+
+    uint64_t movedResources = 0;
+    VkDeviceSize movedBytes = 0;
+};
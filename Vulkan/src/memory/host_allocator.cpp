@@ -0,0 +1,344 @@
+#include "pch.h"
+#include "memory/host_allocator.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+    // malloc returns at least this alignment, and every block we hand out starts on it
+    const size_t MIN_ALIGNMENT = 16;
+    const size_t ARENA_SIZE = 256 * 1024;
+    const size_t POOL_CHUNK_SIZE = 64 * 1024;
+    const size_t SMALLEST_SIZE_CLASS = 64;
+
+    enum class Source : uint32_t {
+        Heap,
+        Pool,
+        Arena
+    };
+
+    struct CommandArena {
+        char* base = nullptr;
+        size_t offset = 0;
+        uint32_t liveCount = 0;
+
+        ~CommandArena() {
+            std::free(base);
+        }
+    };
+
+    // command scope allocations are freed before the command returns, on the thread
+    // that made them, so one arena per thread needs no locking
+    thread_local CommandArena commandArena{};
+
+    struct Header {
+        // start of the backing block, and the block's size class for Source::Pool
+        void* block = nullptr;
+        size_t size = 0;
+        Source source = Source::Heap;
+        uint32_t sizeClass = 0;
+        VkSystemAllocationScope scope = VK_SYSTEM_ALLOCATION_SCOPE_COMMAND;
+    };
+
+    const size_t HEADER_SIZE = (sizeof(Header) + MIN_ALIGNMENT - 1) / MIN_ALIGNMENT * MIN_ALIGNMENT;
+
+    size_t alignUp(size_t value, size_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // bytes a block starting on MIN_ALIGNMENT needs to hold the header and an
+    // aligned allocation of size bytes
+    size_t blockSizeFor(size_t size, size_t alignment) {
+        return HEADER_SIZE + size + (alignment - MIN_ALIGNMENT);
+    }
+
+    void* place(void* block, size_t size, size_t alignment, Source source, uint32_t sizeClass, VkSystemAllocationScope scope) {
+        uintptr_t memory = alignUp(reinterpret_cast<uintptr_t>(block) + HEADER_SIZE, alignment);
+
+        Header* header = reinterpret_cast<Header*>(memory - HEADER_SIZE);
+        header->block = block;
+        header->size = size;
+        header->source = source;
+        header->sizeClass = sizeClass;
+        header->scope = scope;
+
+        return reinterpret_cast<void*>(memory);
+    }
+
+    Header* getHeader(void* memory) {
+        return reinterpret_cast<Header*>(static_cast<char*>(memory) - HEADER_SIZE);
+    }
+
+    void updateMax(std::atomic<uint64_t>& max, uint64_t value) {
+        uint64_t current = max.load(std::memory_order_relaxed);
+        while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+        }
+    }
+}
+
+const char* toString(VkSystemAllocationScope scope) {
+    switch (scope) {
+    case VK_SYSTEM_ALLOCATION_SCOPE_COMMAND:
+        return "command";
+    case VK_SYSTEM_ALLOCATION_SCOPE_OBJECT:
+        return "object";
+    case VK_SYSTEM_ALLOCATION_SCOPE_CACHE:
+        return "cache";
+    case VK_SYSTEM_ALLOCATION_SCOPE_DEVICE:
+        return "device";
+    case VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE:
+        return "instance";
+    default:
+        return "unknown";
+    }
+}
+
+HostAllocator::HostAllocator() {
+    callbacks.pUserData = this;
+    callbacks.pfnAllocation = allocationCallback;
+    callbacks.pfnReallocation = reallocationCallback;
+    callbacks.pfnFree = freeCallback;
+    callbacks.pfnInternalAllocation = internalAllocationCallback;
+    callbacks.pfnInternalFree = internalFreeCallback;
+
+    for (uint32_t i = 0; i < SIZE_CLASS_COUNT; i++) {
+        sizeClasses[i].blockSize = SMALLEST_SIZE_CLASS << i;
+    }
+}
+
+HostAllocator::~HostAllocator() {
+    for (auto& sizeClass : sizeClasses) {
+        for (void* chunk : sizeClass.chunks) {
+            std::free(chunk);
+        }
+    }
+}
+
+void* VKAPI_PTR HostAllocator::allocationCallback(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    return static_cast<HostAllocator*>(userData)->allocate(size, alignment, scope);
+}
+
+void* VKAPI_PTR HostAllocator::reallocationCallback(void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    HostAllocator* allocator = static_cast<HostAllocator*>(userData);
+
+    if (original == nullptr) {
+        return allocator->allocate(size, alignment, scope);
+    }
+
+    if (size == 0) {
+        allocator->release(original);
+        return nullptr;
+    }
+
+    // on failure the original allocation must stay valid, so release it only after
+    // the copy
+    void* memory = allocator->allocate(size, alignment, scope);
+    if (memory == nullptr) {
+        return nullptr;
+    }
+
+    std::memcpy(memory, original, std::min(size, getHeader(original)->size));
+    allocator->release(original);
+
+    return memory;
+}
+
+void VKAPI_PTR HostAllocator::freeCallback(void* userData, void* memory) {
+    if (memory != nullptr) {
+        static_cast<HostAllocator*>(userData)->release(memory);
+    }
+}
+
+void VKAPI_PTR HostAllocator::internalAllocationCallback(void* userData, size_t size, VkInternalAllocationType /*type*/, VkSystemAllocationScope scope) {
+    ScopeCounters& counters = static_cast<HostAllocator*>(userData)->scopes[scope];
+    uint64_t bytes = counters.internalBytes.fetch_add(size, std::memory_order_relaxed) + size;
+    updateMax(counters.internalPeakBytes, bytes);
+}
+
+void VKAPI_PTR HostAllocator::internalFreeCallback(void* userData, size_t size, VkInternalAllocationType /*type*/, VkSystemAllocationScope scope) {
+    static_cast<HostAllocator*>(userData)->scopes[scope].internalBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+void* HostAllocator::allocate(size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    if (size == 0) {
+        return nullptr;
+    }
+
+    alignment = std::max(alignment, MIN_ALIGNMENT);
+
+    void* memory = nullptr;
+    switch (scope) {
+    case VK_SYSTEM_ALLOCATION_SCOPE_COMMAND:
+        memory = allocateFromArena(size, alignment, scope);
+        break;
+    case VK_SYSTEM_ALLOCATION_SCOPE_OBJECT:
+        memory = allocateFromPool(size, alignment, scope);
+        break;
+    default:
+        break;
+    }
+
+    if (memory == nullptr) {
+        memory = allocateFromHeap(size, alignment, scope);
+    }
+
+    if (memory != nullptr) {
+        track(scope, size);
+    }
+
+    return memory;
+}
+
+void HostAllocator::release(void* memory) {
+    Header* header = getHeader(memory);
+    untrack(header->scope, header->size);
+
+    switch (header->source) {
+    case Source::Arena:
+        // rewind once the last allocation of the command is gone
+        if (--commandArena.liveCount == 0) {
+            commandArena.offset = 0;
+        }
+        break;
+    case Source::Pool: {
+        SizeClass& sizeClass = sizeClasses[header->sizeClass];
+        void* block = header->block;
+
+        std::lock_guard<std::mutex> lock(sizeClass.mutex);
+        *static_cast<void**>(block) = sizeClass.freeList;
+        sizeClass.freeList = block;
+        break;
+    }
+    case Source::Heap:
+        std::free(header->block);
+        break;
+    }
+}
+
+void* HostAllocator::allocateFromArena(size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    CommandArena& arena = commandArena;
+
+    if (arena.base == nullptr) {
+        arena.base = static_cast<char*>(std::malloc(ARENA_SIZE));
+        if (arena.base == nullptr) {
+            return nullptr;
+        }
+    }
+
+    size_t needed = blockSizeFor(size, alignment);
+    if (needed > ARENA_SIZE - arena.offset) {
+        return nullptr;
+    }
+
+    void* memory = place(arena.base + arena.offset, size, alignment, Source::Arena, 0, scope);
+    arena.offset = alignUp(static_cast<char*>(memory) + size - arena.base, MIN_ALIGNMENT);
+    arena.liveCount++;
+    arenaAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    return memory;
+}
+
+void* HostAllocator::allocateFromPool(size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    size_t needed = blockSizeFor(size, alignment);
+
+    uint32_t index = 0;
+    while (index < SIZE_CLASS_COUNT && sizeClasses[index].blockSize < needed) {
+        index++;
+    }
+    if (index == SIZE_CLASS_COUNT) {
+        return nullptr;
+    }
+
+    SizeClass& sizeClass = sizeClasses[index];
+    void* block = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(sizeClass.mutex);
+
+        if (sizeClass.freeList == nullptr) {
+            char* chunk = static_cast<char*>(std::malloc(POOL_CHUNK_SIZE));
+            if (chunk == nullptr) {
+                return nullptr;
+            }
+            sizeClass.chunks.push_back(chunk);
+
+            // thread the new blocks onto the free list, first block on top
+            for (size_t offset = POOL_CHUNK_SIZE; offset >= sizeClass.blockSize; offset -= sizeClass.blockSize) {
+                void* next = chunk + offset - sizeClass.blockSize;
+                *static_cast<void**>(next) = sizeClass.freeList;
+                sizeClass.freeList = next;
+            }
+        }
+
+        block = sizeClass.freeList;
+        sizeClass.freeList = *static_cast<void**>(block);
+    }
+
+    poolAllocations.fetch_add(1, std::memory_order_relaxed);
+    return place(block, size, alignment, Source::Pool, index, scope);
+}
+
+void* HostAllocator::allocateFromHeap(size_t size, size_t alignment, VkSystemAllocationScope scope) {
+    void* block = std::malloc(blockSizeFor(size, alignment));
+    if (block == nullptr) {
+        return nullptr;
+    }
+
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    return place(block, size, alignment, Source::Heap, 0, scope);
+}
+
+void HostAllocator::track(VkSystemAllocationScope scope, size_t size) {
+    ScopeCounters& counters = scopes[scope];
+    counters.allocationCount.fetch_add(1, std::memory_order_relaxed);
+    counters.liveCount.fetch_add(1, std::memory_order_relaxed);
+    uint64_t bytes = counters.liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+    updateMax(counters.peakBytes, bytes);
+}
+
+void HostAllocator::untrack(VkSystemAllocationScope scope, size_t size) {
+    ScopeCounters& counters = scopes[scope];
+    counters.liveCount.fetch_sub(1, std::memory_order_relaxed);
+    counters.liveBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+HostAllocatorStats HostAllocator::getStats() const {
+    HostAllocatorStats stats{};
+
+    for (uint32_t i = 0; i < SCOPE_COUNT; i++) {
+        const ScopeCounters& counters = scopes[i];
+        HostScopeStats& scope = stats.scopes[i];
+        scope.allocationCount = counters.allocationCount.load(std::memory_order_relaxed);
+        scope.liveCount = counters.liveCount.load(std::memory_order_relaxed);
+        scope.liveBytes = counters.liveBytes.load(std::memory_order_relaxed);
+        scope.peakBytes = counters.peakBytes.load(std::memory_order_relaxed);
+        scope.internalBytes = counters.internalBytes.load(std::memory_order_relaxed);
+        scope.internalPeakBytes = counters.internalPeakBytes.load(std::memory_order_relaxed);
+    }
+
+    stats.arenaAllocations = arenaAllocations.load(std::memory_order_relaxed);
+    stats.poolAllocations = poolAllocations.load(std::memory_order_relaxed);
+    stats.heapAllocations = heapAllocations.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
+void HostAllocator::print(std::ostream& out) const {
+    HostAllocatorStats stats = getStats();
+
+    out << "Host Memory: " << stats.arenaAllocations << " arena, " << stats.poolAllocations << " pool, "
+        << stats.heapAllocations << " heap allocations" << std::endl;
+    for (uint32_t i = 0; i < SCOPE_COUNT; i++) {
+        const HostScopeStats& scope = stats.scopes[i];
+        if (scope.allocationCount == 0 && scope.internalPeakBytes == 0) {
+            continue;
+        }
+
+        out << "\t" << toString(static_cast<VkSystemAllocationScope>(i)) << ": " << scope.allocationCount << " allocations, "
+            << scope.liveCount << " live using " << scope.liveBytes << " bytes, peak " << scope.peakBytes << " bytes";
+        if (scope.internalPeakBytes != 0) {
+            out << ", internal " << scope.internalBytes << " bytes (peak " << scope.internalPeakBytes << ")";
+        }
+        out << std::endl;
+    }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <ostream>
+
+// Host memory for the Vulkan implementation, handed out through VkAllocationCallbacks.
+//
+// Each allocation is routed by its VkSystemAllocationScope:
+//  - COMMAND: a per-thread bump arena. Command scope allocations never outlive the
+//    vkCreate*/vkAllocate* call that made them, so the arena rewinds as soon as its
+//    last allocation is freed, and threads never contend.
+//  - OBJECT: fixed size classes with their own free lists and locks, so objects
+//    created from several threads don't all serialize on the general heap.
+//  - CACHE, DEVICE, INSTANCE: few, long-lived and often large; straight to malloc.
+// Anything that doesn't fit its arena or size class falls back to malloc too.
+//
+// Every allocation carries a small header in front of it, which is what makes
+// pfnReallocation and pfnFree possible without a lookup.
+//
+// The instance, and every object created with these callbacks, must be destroyed
+// before the HostAllocator is.
+
+const char* toString(VkSystemAllocationScope scope);
+
+struct HostScopeStats {
+    // allocations made over the lifetime of the allocator
+    uint64_t allocationCount = 0;
+    uint64_t liveCount       = 0;
+    uint64_t liveBytes       = 0;
+    uint64_t peakBytes       = 0;
+    // memory the driver allocated by itself and only reported through the
+    // internal allocation notifications (e.g. executable memory)
+    uint64_t internalBytes   = 0;
+    uint64_t internalPeakBytes = 0;
+};
+
+struct HostAllocatorStats {
+    // indexed by VkSystemAllocationScope
+    HostScopeStats scopes[VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1]{};
+    uint64_t arenaAllocations = 0;
+    uint64_t poolAllocations  = 0;
+    uint64_t heapAllocations  = 0;
+};
+
+class HostAllocator {
+public:
+    HostAllocator();
+    ~HostAllocator();
+
+    HostAllocator(const HostAllocator&) = delete;
+    HostAllocator& operator=(const HostAllocator&) = delete;
+
+    // pass to every vkCreate*/vkDestroy*/vkAllocateMemory/vkFreeMemory call
+    const VkAllocationCallbacks* getCallbacks() const { return &callbacks; }
+
+    HostAllocatorStats getStats() const;
+    void print(std::ostream& out) const;
+
+private:
+    static const uint32_t SCOPE_COUNT = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
+    static const uint32_t SIZE_CLASS_COUNT = 7;
+
+    struct ScopeCounters {
+        std::atomic<uint64_t> allocationCount{ 0 };
+        std::atomic<uint64_t> liveCount{ 0 };
+        std::atomic<uint64_t> liveBytes{ 0 };
+        std::atomic<uint64_t> peakBytes{ 0 };
+        std::atomic<uint64_t> internalBytes{ 0 };
+        std::atomic<uint64_t> internalPeakBytes{ 0 };
+    };
+
+    // blocks of one size, carved out of larger chunks and never returned to the heap
+    // before the allocator is destroyed
+    struct SizeClass {
+        std::mutex mutex{};
+        size_t blockSize = 0;
+        void* freeList = nullptr;
+        std::vector<void*> chunks{};
+    };
+
+    static void* VKAPI_PTR allocationCallback(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope);
+    static void* VKAPI_PTR reallocationCallback(void* userData, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+    static void VKAPI_PTR freeCallback(void* userData, void* memory);
+    static void VKAPI_PTR internalAllocationCallback(void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+    static void VKAPI_PTR internalFreeCallback(void* userData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+
+    void* allocate(size_t size, size_t alignment, VkSystemAllocationScope scope);
+    void release(void* memory);
+
+    void* allocateFromArena(size_t size, size_t alignment, VkSystemAllocationScope scope);
+    void* allocateFromPool(size_t size, size_t alignment, VkSystemAllocationScope scope);
+    void* allocateFromHeap(size_t size, size_t alignment, VkSystemAllocationScope scope);
+
+    void track(VkSystemAllocationScope scope, size_t size);
+    void untrack(VkSystemAllocationScope scope, size_t size);
+
+    VkAllocationCallbacks callbacks{};
+
+    SizeClass sizeClasses[SIZE_CLASS_COUNT]{};
+    ScopeCounters scopes[SCOPE_COUNT]{};
+    std::atomic<uint64_t> arenaAllocations{ 0 };
+    std::atomic<uint64_t> poolAllocations{ 0 };
+    std::atomic<uint64_t> heapAllocations{ 0 };
+};
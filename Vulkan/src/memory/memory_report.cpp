@@ -0,0 +1,282 @@
+#include "pch.h"
+#include "memory/memory_report.h"
+
+#include <fstream>
+#include <algorithm>
+#include <iomanip>
+
+namespace {
+    const uint32_t CATEGORY_COUNT = static_cast<uint32_t>(MemoryCategory::Other) + 1;
+
+    std::string escape(const std::string& value) {
+        std::string escaped{};
+        for (char c : value) {
+            switch (c) {
+            case '"':
+                escaped += "\\\"";
+                break;
+            case '\\':
+                escaped += "\\\\";
+                break;
+            case '\n':
+                escaped += "\\n";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    escaped += ' ';
+                } else {
+                    escaped += c;
+                }
+                break;
+            }
+        }
+        return escaped;
+    }
+
+    // signed change between two samples, for the counters line
+    std::string delta(uint64_t current, uint64_t previous) {
+        if (current >= previous) {
+            return "+" + std::to_string(current - previous);
+        }
+        return "-" + std::to_string(previous - current);
+    }
+}
+
+const char* toString(MemoryCategory category) {
+    switch (category) {
+    case MemoryCategory::Texture:
+        return "texture";
+    case MemoryCategory::Mesh:
+        return "mesh";
+    case MemoryCategory::Attachment:
+        return "attachment";
+    case MemoryCategory::Uniform:
+        return "uniform";
+    case MemoryCategory::Staging:
+        return "staging";
+    case MemoryCategory::Other:
+        return "other";
+    default:
+        return "unknown";
+    }
+}
+
+void MemoryReport::init(const MemoryTypeCache& memoryTypes, const DeviceAllocator& allocator, const HostAllocator& hostAllocator) {
+    this->memoryTypes = &memoryTypes;
+    this->allocator = &allocator;
+    this->hostAllocator = &hostAllocator;
+}
+
+void MemoryReport::track(const Allocation* allocation, MemoryCategory category, const std::string& name, VkDeviceSize requestedSize) {
+    trackedSinceUpdate++;
+
+    for (auto& record : records) {
+        if (record.allocation == allocation) {
+            record.category = category;
+            record.name = name;
+            record.requestedSize = requestedSize;
+            return;
+        }
+    }
+
+    Record record{};
+    record.allocation = allocation;
+    record.category = category;
+    record.name = name;
+    record.requestedSize = requestedSize;
+    records.push_back(record);
+}
+
+void MemoryReport::untrack(const Allocation* allocation) {
+    for (size_t i = 0; i < records.size(); i++) {
+        if (records[i].allocation == allocation) {
+            records[i] = records.back();
+            records.pop_back();
+            untrackedSinceUpdate++;
+            return;
+        }
+    }
+}
+
+VkDeviceSize MemoryReport::getWaste(const Record& record) {
+    VkDeviceSize size = record.allocation->size;
+    return record.allocation->padding + (size > record.requestedSize ? size - record.requestedSize : 0);
+}
+
+void MemoryReport::update(uint64_t frame) {
+    counters = MemoryFrameCounters{};
+    counters.frame = frame;
+    counters.tracked = trackedSinceUpdate;
+    counters.untracked = untrackedSinceUpdate;
+    trackedSinceUpdate = 0;
+    untrackedSinceUpdate = 0;
+
+    for (const auto& record : records) {
+        counters.trackedCount++;
+        counters.trackedBytes += record.allocation->size;
+        counters.alignmentWaste += getWaste(record);
+    }
+
+    AllocatorStats stats = allocator->getStats();
+    counters.deviceMemoryCount = stats.deviceMemoryCount;
+    counters.deviceMemoryBytes = stats.total.blockBytes + stats.total.dedicatedBytes;
+
+    // per memory type, since free space in one type is no use to another
+    VkDeviceSize scattered = 0;
+    for (const auto& typeStats : stats.memoryTypes) {
+        VkDeviceSize free = typeStats.blockBytes - typeStats.usedBytes;
+        counters.blockFreeBytes += free;
+        scattered += free - std::min(free, typeStats.largestFreeRange);
+    }
+    counters.fragmentation = counters.blockFreeBytes > 0 ? static_cast<float>(scattered) / counters.blockFreeBytes : 0.0f;
+
+    HostAllocatorStats hostStats = hostAllocator->getStats();
+    for (const auto& scope : hostStats.scopes) {
+        counters.hostBytes += scope.liveBytes + scope.internalBytes;
+    }
+}
+
+void MemoryReport::printCounters(std::ostream& out) {
+    out << "memory @" << counters.frame << ": "
+        << counters.trackedCount << " tracked (" << delta(counters.trackedCount, printed.trackedCount) << "), "
+        << (counters.trackedBytes >> 10) << " KiB (" << delta(counters.trackedBytes >> 10, printed.trackedBytes >> 10) << "), "
+        << counters.deviceMemoryCount << " device memories using " << (counters.deviceMemoryBytes >> 10) << " KiB, "
+        << (counters.blockFreeBytes >> 10) << " KiB free in blocks, "
+        << std::fixed << std::setprecision(1) << counters.fragmentation * 100.0f << std::defaultfloat << "% fragmented, "
+        << "host " << (counters.hostBytes >> 10) << " KiB (" << delta(counters.hostBytes >> 10, printed.hostBytes >> 10) << ")" << std::endl;
+
+    printed = counters;
+}
+
+void MemoryReport::print(std::ostream& out) const {
+    uint32_t counts[CATEGORY_COUNT]{};
+    VkDeviceSize bytes[CATEGORY_COUNT]{};
+    VkDeviceSize waste[CATEGORY_COUNT]{};
+
+    for (const auto& record : records) {
+        uint32_t category = static_cast<uint32_t>(record.category);
+        counts[category]++;
+        bytes[category] += record.allocation->size;
+        waste[category] += getWaste(record);
+    }
+
+    out << "Memory Report: " << records.size() << " tracked allocations" << std::endl;
+    for (uint32_t i = 0; i < CATEGORY_COUNT; i++) {
+        if (counts[i] == 0) {
+            continue;
+        }
+        out << "\t" << toString(static_cast<MemoryCategory>(i)) << ": " << counts[i] << " allocations using "
+            << bytes[i] << " bytes, " << waste[i] << " bytes alignment waste" << std::endl;
+    }
+
+    // biggest first, that's usually the question
+    std::vector<const Record*> sorted{};
+    for (const auto& record : records) {
+        sorted.push_back(&record);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const Record* a, const Record* b) {
+        return a->allocation->size > b->allocation->size;
+    });
+
+    for (auto record : sorted) {
+        out << "\t\t" << record->name << " (" << toString(record->category) << "): " << record->allocation->size
+            << " bytes, type " << record->allocation->memoryTypeIndex
+            << (record->allocation->block == nullptr ? ", dedicated" : "") << std::endl;
+    }
+}
+
+void MemoryReport::printLeaks(std::ostream& out) const {
+    if (records.empty()) {
+        return;
+    }
+
+    out << "Memory Report: " << records.size() << " allocation(s) still tracked at shutdown" << std::endl;
+    for (const auto& record : records) {
+        out << "\t" << record.name << " (" << toString(record.category) << ")" << std::endl;
+    }
+}
+
+void MemoryReport::writeJson(std::ostream& out) const {
+    out << "{" << std::endl;
+    out << "  \"frame\": " << counters.frame << "," << std::endl;
+
+    out << "  \"counters\": {"
+        << "\"trackedCount\": " << counters.trackedCount
+        << ", \"trackedBytes\": " << counters.trackedBytes
+        << ", \"alignmentWaste\": " << counters.alignmentWaste
+        << ", \"deviceMemoryCount\": " << counters.deviceMemoryCount
+        << ", \"deviceMemoryBytes\": " << counters.deviceMemoryBytes
+        << ", \"blockFreeBytes\": " << counters.blockFreeBytes
+        << ", \"fragmentation\": " << counters.fragmentation
+        << ", \"hostBytes\": " << counters.hostBytes
+        << "}," << std::endl;
+
+    AllocatorStats stats = allocator->getStats();
+    const VkPhysicalDeviceMemoryProperties& properties = memoryTypes->getProperties();
+
+    out << "  \"memoryTypes\": [";
+    bool first = true;
+    for (size_t i = 0; i < stats.memoryTypes.size(); i++) {
+        const MemoryTypeStats& typeStats = stats.memoryTypes[i];
+        if (typeStats.blockCount == 0 && typeStats.dedicatedCount == 0) {
+            continue;
+        }
+
+        out << (first ? "" : ",") << std::endl << "    {"
+            << "\"index\": " << i
+            << ", \"flags\": " << properties.memoryTypes[i].propertyFlags
+            << ", \"heap\": " << properties.memoryTypes[i].heapIndex
+            << ", \"blockCount\": " << typeStats.blockCount
+            << ", \"blockBytes\": " << typeStats.blockBytes
+            << ", \"usedBytes\": " << typeStats.usedBytes
+            << ", \"largestFreeRange\": " << typeStats.largestFreeRange
+            << ", \"dedicatedCount\": " << typeStats.dedicatedCount
+            << ", \"dedicatedBytes\": " << typeStats.dedicatedBytes
+            << "}";
+        first = false;
+    }
+    out << std::endl << "  ]," << std::endl;
+
+    HostAllocatorStats hostStats = hostAllocator->getStats();
+    out << "  \"host\": [";
+    for (uint32_t i = 0; i <= VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE; i++) {
+        const HostScopeStats& scope = hostStats.scopes[i];
+        out << (i == 0 ? "" : ",") << std::endl << "    {"
+            << "\"scope\": \"" << toString(static_cast<VkSystemAllocationScope>(i)) << "\""
+            << ", \"allocationCount\": " << scope.allocationCount
+            << ", \"liveCount\": " << scope.liveCount
+            << ", \"liveBytes\": " << scope.liveBytes
+            << ", \"peakBytes\": " << scope.peakBytes
+            << ", \"internalBytes\": " << scope.internalBytes
+            << ", \"internalPeakBytes\": " << scope.internalPeakBytes
+            << "}";
+    }
+    out << std::endl << "  ]," << std::endl;
+
+    out << "  \"allocations\": [";
+    for (size_t i = 0; i < records.size(); i++) {
+        const Record& record = records[i];
+        out << (i == 0 ? "" : ",") << std::endl << "    {"
+            << "\"name\": \"" << escape(record.name) << "\""
+            << ", \"category\": \"" << toString(record.category) << "\""
+            << ", \"size\": " << record.allocation->size
+            << ", \"requestedSize\": " << record.requestedSize
+            << ", \"alignmentWaste\": " << getWaste(record)
+            << ", \"memoryType\": " << record.allocation->memoryTypeIndex
+            << ", \"offset\": " << record.allocation->offset
+            << ", \"dedicated\": " << (record.allocation->block == nullptr ? "true" : "false")
+            << "}";
+    }
+    out << std::endl << "  ]" << std::endl;
+    out << "}" << std::endl;
+}
+
+bool MemoryReport::writeJson(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    writeJson(file);
+    return file.good();
+}
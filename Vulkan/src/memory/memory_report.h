@@ -0,0 +1,97 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "memory/allocator.h"
+#include "memory/memory_types.h"
+#include "memory/host_allocator.h"
+
+// What a tracked allocation is used for, for the per-category totals.
+enum class MemoryCategory {
+    Texture,
+    Mesh,
+    Attachment,
+    Uniform,
+    Staging,
+    Other
+};
+
+const char* toString(MemoryCategory category);
+
+// Sampled once per frame by MemoryReport::update.
+struct MemoryFrameCounters {
+    uint64_t frame = 0;
+    uint32_t trackedCount = 0;
+    VkDeviceSize trackedBytes = 0;
+    VkDeviceSize alignmentWaste = 0;
+    // VkDeviceMemory objects and the bytes they hold, sub-allocated or not
+    uint32_t deviceMemoryCount = 0;
+    VkDeviceSize deviceMemoryBytes = 0;
+    // free bytes inside blocks, and how much of that is not in the largest free range
+    VkDeviceSize blockFreeBytes = 0;
+    float fragmentation = 0.0f;
+    uint64_t hostBytes = 0;
+    // track/untrack calls since the previous update
+    uint32_t tracked = 0;
+    uint32_t untracked = 0;
+};
+
+// Answers "where did the memory go".
+//
+// Every allocation made through createBuffer/createImage, the staging ring and the
+// subsystems that own device memory is tracked with a category and a debug name. The
+// Allocation is tracked by address and read whenever a report is made, so
+// defragmentation moves and buffer regrowth show up without re-tracking; it must stay
+// at that address until untracked. Tracking the same address again replaces the record,
+// which is how a resource whose requested size changes keeps its waste right.
+//
+// The report joins these records with the device allocator's per memory type stats
+// and the host allocator's per scope stats, as a text summary or a JSON snapshot.
+class MemoryReport {
+public:
+    void init(const MemoryTypeCache& memoryTypes, const DeviceAllocator& allocator, const HostAllocator& hostAllocator);
+
+    // requestedSize is what the resource actually needs (the buffer size, or the
+    // memory requirements for images); the rest of the allocation is padding
+    void track(const Allocation* allocation, MemoryCategory category, const std::string& name, VkDeviceSize requestedSize);
+    void untrack(const Allocation* allocation);
+
+    // once per frame; cheap enough to leave on in soak runs
+    void update(uint64_t frame);
+    const MemoryFrameCounters& getFrameCounters() const { return counters; }
+
+    // one line with the current counters and the change since the last call
+    void printCounters(std::ostream& out);
+    void print(std::ostream& out) const;
+    // lists the records still tracked; call right before the allocator is destroyed
+    void printLeaks(std::ostream& out) const;
+
+    void writeJson(std::ostream& out) const;
+    // returns false if the file can't be written
+    bool writeJson(const std::string& path) const;
+
+private:
+    struct Record {
+        const Allocation* allocation = nullptr;
+        MemoryCategory category = MemoryCategory::Other;
+        std::string name{};
+        VkDeviceSize requestedSize = 0;
+    };
+
+    static VkDeviceSize getWaste(const Record& record);
+
+    const MemoryTypeCache* memoryTypes = nullptr;
+    const DeviceAllocator* allocator = nullptr;
+    const HostAllocator* hostAllocator = nullptr;
+
+    std::vector<Record> records{};
+
+    MemoryFrameCounters counters{};
+    MemoryFrameCounters printed{};
+    uint32_t trackedSinceUpdate = 0;
+    uint32_t untrackedSinceUpdate = 0;
+};
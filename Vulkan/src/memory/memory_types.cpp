@@ -0,0 +1,186 @@
+#include "pch.h"
+#include "memory/memory_types.h"
+
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+    // heaps at or below this are the legacy BAR window rather than full ReBAR
+    const VkDeviceSize BAR_WINDOW_SIZE = 256ull * 1024 * 1024;
+
+    // types with any of these are never picked for the usages we know about
+    const VkMemoryPropertyFlags EXCLUDED_FLAGS =
+        VK_MEMORY_PROPERTY_PROTECTED_BIT |
+        VK_MEMORY_PROPERTY_DEVICE_COHERENT_BIT_AMD;
+
+    const int64_t UNUSABLE = -1;
+
+    bool isHostUsage(MemoryUsage usage) {
+        return usage != MemoryUsage::GpuOnly && usage != MemoryUsage::Transient;
+    }
+}
+
+const char* toString(MemoryUsage usage) {
+    switch (usage) {
+    case MemoryUsage::GpuOnly:          return "gpu-only";
+    case MemoryUsage::Upload:           return "upload";
+    case MemoryUsage::Readback:         return "readback";
+    case MemoryUsage::DynamicPerFrame:  return "dynamic-per-frame";
+    case MemoryUsage::DirectUpload:     return "direct-upload";
+    case MemoryUsage::Transient:        return "transient";
+    }
+    return "unknown";
+}
+
+void MemoryTypeCache::init(VkPhysicalDevice physicalDevice) {
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &properties);
+
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+    // some drivers for integrated GPUs still report a separate device local type
+    // without HOST_VISIBLE, so the device type decides UMA, not the memory types
+    unifiedMemory = deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU ||
+                    deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU;
+
+    VkMemoryPropertyFlags barFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    deviceLocalHostVisible = false;
+    largeDeviceLocalHostVisible = false;
+    for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+        const VkMemoryType& type = properties.memoryTypes[i];
+        if ((type.propertyFlags & barFlags) != barFlags || (type.propertyFlags & EXCLUDED_FLAGS)) {
+            continue;
+        }
+
+        deviceLocalHostVisible = true;
+        if (unifiedMemory || properties.memoryHeaps[type.heapIndex].size > BAR_WINDOW_SIZE) {
+            largeDeviceLocalHostVisible = true;
+        }
+    }
+
+    entries.clear();
+}
+
+int64_t MemoryTypeCache::score(uint32_t memoryTypeIndex, MemoryUsage usage) const {
+    VkMemoryPropertyFlags flags = getFlags(memoryTypeIndex);
+    if (flags & EXCLUDED_FLAGS) {
+        return UNUSABLE;
+    }
+
+    // lazily allocated memory can only back transient attachments
+    bool lazilyAllocated = (flags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+    if (lazilyAllocated && usage != MemoryUsage::Transient) {
+        return UNUSABLE;
+    }
+
+    if (isHostUsage(usage)) {
+        VkMemoryPropertyFlags required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        if ((flags & required) != required) {
+            return UNUSABLE;
+        }
+    }
+
+    bool deviceLocal = (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0;
+    bool hostVisible = (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+    bool hostCached = (flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) != 0;
+
+    int64_t score = 0;
+    switch (usage) {
+    case MemoryUsage::GpuOnly:
+        // VRAM first; among those, leave the host visible window to data the CPU writes
+        if (deviceLocal) score += 100;
+        if (hostVisible && !unifiedMemory) score -= 10;
+        break;
+    case MemoryUsage::Upload:
+        // staging is only read once by the copy, it doesn't need to live in VRAM, and
+        // write-combined memory is faster than cached for streaming writes
+        if (deviceLocal && !unifiedMemory) score -= 10;
+        if (hostCached) score -= 5;
+        break;
+    case MemoryUsage::Readback:
+        // CPU reads from uncached memory are painfully slow
+        if (hostCached) score += 100;
+        if (deviceLocal && !unifiedMemory) score -= 10;
+        break;
+    case MemoryUsage::DynamicPerFrame:
+        // with ReBAR/UMA the GPU reads the data from local memory instead of over PCIe
+        if (deviceLocal) score += 100;
+        if (hostCached) score -= 5;
+        break;
+    case MemoryUsage::DirectUpload:
+        // the GPU keeps reading it, so it has to be local; the CPU only ever writes it
+        if (deviceLocal) score += 100;
+        if (hostCached) score -= 5;
+        break;
+    case MemoryUsage::Transient:
+        // on tilers the attachment may never need backing memory at all
+        if (lazilyAllocated) score += 200;
+        if (deviceLocal) score += 100;
+        if (hostVisible && !unifiedMemory) score -= 10;
+        break;
+    }
+
+    return score;
+}
+
+uint32_t MemoryTypeCache::find(uint32_t typeBits, MemoryUsage usage) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& entry : entries) {
+        if (entry.typeBits == typeBits && entry.usage == usage) {
+            return entry.memoryTypeIndex;
+        }
+    }
+
+    uint32_t best = UINT32_MAX;
+    int64_t bestScore = UNUSABLE;
+    VkDeviceSize bestHeapSize = 0;
+
+    for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+        if (!(typeBits & (1u << i))) {
+            continue;
+        }
+
+        int64_t typeScore = score(i, usage);
+        if (typeScore == UNUSABLE) {
+            continue;
+        }
+
+        // on equal scores, the bigger heap is less likely to run out
+        VkDeviceSize heapSize = properties.memoryHeaps[properties.memoryTypes[i].heapIndex].size;
+        if (best == UINT32_MAX || typeScore > bestScore || (typeScore == bestScore && heapSize > bestHeapSize)) {
+            best = i;
+            bestScore = typeScore;
+            bestHeapSize = heapSize;
+        }
+    }
+
+    if (best == UINT32_MAX) {
+        std::cerr << "Error finding memory type for " << toString(usage) << " usage, type bits: " << typeBits << std::endl;
+        throw std::runtime_error("error finding suitable memory type.");
+    }
+
+    Entry entry{};
+    entry.typeBits = typeBits;
+    entry.usage = usage;
+    entry.memoryTypeIndex = best;
+    entries.push_back(entry);
+
+    return best;
+}
+
+void MemoryTypeCache::print(std::ostream& out) const {
+    out << "memory types:" << (unifiedMemory ? " unified" : "")
+        << (largeDeviceLocalHostVisible ? " rebar" : (deviceLocalHostVisible ? " bar-window" : "")) << std::endl;
+
+    for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+        const VkMemoryType& type = properties.memoryTypes[i];
+        out << "  type " << i << ": heap " << type.heapIndex
+            << " (" << (properties.memoryHeaps[type.heapIndex].size >> 20) << " MiB)"
+            << ((type.propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) ? " device-local" : "")
+            << ((type.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ? " host-visible" : "")
+            << ((type.propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ? " coherent" : "")
+            << ((type.propertyFlags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) ? " cached" : "")
+            << ((type.propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) ? " lazy" : "")
+            << std::endl;
+    }
+}
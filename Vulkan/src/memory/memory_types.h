@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <ostream>
+
+// What a resource's memory is used for. Picking memory by intent instead of by raw
+// property flags lets us take advantage of memory that is both device local and host
+// visible (resizable BAR, or any UMA device) without every call site knowing about it.
+enum class MemoryUsage {
+    // only touched by the GPU: render targets, textures, static meshes
+    GpuOnly,
+    // written once by the CPU, read by the GPU through a copy: staging buffers
+    Upload,
+    // written by the GPU, read back by the CPU
+    Readback,
+    // rewritten by the CPU every frame and read directly by the GPU: uniforms
+    DynamicPerFrame,
+    // written once by the CPU and read directly by the GPU from then on: static meshes
+    // on ReBAR/UMA, which skip the staging copy. Only device local when the device has
+    // device local host visible memory (see hasLargeDeviceLocalHostVisible)
+    DirectUpload,
+    // attachments that only live inside a render pass (VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);
+    // the only usage that may get LAZILY_ALLOCATED memory
+    Transient
+};
+
+const char* toString(MemoryUsage usage);
+
+// Memory properties of the physical device, queried once at device pick, and the
+// memory type picked for each (memoryTypeBits, usage) combination seen so far.
+//
+// Every type that has the usage's required flags gets a score from the flags it
+// prefers and the ones it should avoid; heap size breaks ties. Host visible usages
+// always require HOST_COHERENT, since we never flush or invalidate mapped ranges.
+class MemoryTypeCache {
+public:
+    void init(VkPhysicalDevice physicalDevice);
+
+    // throws if no memory type in typeBits can be used for this usage. Any thread may
+    // call it; the rest is read-only after init
+    uint32_t find(uint32_t typeBits, MemoryUsage usage);
+
+    const VkPhysicalDeviceMemoryProperties& getProperties() const { return properties; }
+    VkMemoryPropertyFlags getFlags(uint32_t memoryTypeIndex) const { return properties.memoryTypes[memoryTypeIndex].propertyFlags; }
+    bool isHostVisible(uint32_t memoryTypeIndex) const { return (getFlags(memoryTypeIndex) & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0; }
+
+    // integrated GPU or CPU implementation: all memory is system memory
+    bool isUnifiedMemory() const { return unifiedMemory; }
+    // the CPU can write device local memory directly (ReBAR, or UMA)
+    bool hasDeviceLocalHostVisible() const { return deviceLocalHostVisible; }
+    // ReBAR/UMA over the whole device local heap, not just the legacy 256 MiB window
+    bool hasLargeDeviceLocalHostVisible() const { return largeDeviceLocalHostVisible; }
+
+    void print(std::ostream& out) const;
+
+private:
+    struct Entry {
+        uint32_t typeBits = 0;
+        MemoryUsage usage = MemoryUsage::GpuOnly;
+        uint32_t memoryTypeIndex = 0;
+    };
+
+    int64_t score(uint32_t memoryTypeIndex, MemoryUsage usage) const;
+
+    VkPhysicalDeviceMemoryProperties properties{};
+    bool unifiedMemory = false;
+    bool deviceLocalHostVisible = false;
+    bool largeDeviceLocalHostVisible = false;
+
+    // there are only a handful of distinct memoryTypeBits per device, so a linear
+    // scan is cheaper than hashing. Filled in by find, under mutex
+    std::mutex mutex{};
+    std::vector<Entry> entries{};
+};
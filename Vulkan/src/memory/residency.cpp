@@ -0,0 +1,211 @@
+#include "pch.h"
+#include "memory/residency.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+    // without VK_EXT_memory_budget, assume we can use this much of each heap
+    const VkDeviceSize FALLBACK_BUDGET_PERCENT = 80;
+    // keep this fraction of the budget free; drop mips below it, restore above twice it
+    const VkDeviceSize HEADROOM_PERCENT = 10;
+    // textures not used for this many frames are evicted straight to their mip tail
+    const uint64_t EVICT_AFTER_FRAMES = 300;
+    // mip levels at or below this size in both dimensions always stay resident
+    const uint32_t MIP_TAIL_SIZE = 64;
+    // frames to wait for the budgets to catch up after a change
+    const uint64_t SETTLE_FRAMES = 8;
+
+    VkDeviceSize percentOf(VkDeviceSize value, VkDeviceSize percent) {
+        return value / 100 * percent;
+    }
+}
+
+void ResidencyManager::init(VkPhysicalDevice physicalDevice, const MemoryTypeCache& memoryTypes, const DeviceAllocator& allocator, bool memoryBudgetExtension) {
+    this->physicalDevice = physicalDevice;
+    this->memoryTypes = &memoryTypes;
+    this->allocator = &allocator;
+    this->memoryBudgetExtension = memoryBudgetExtension;
+
+    heaps.resize(memoryTypes.getProperties().memoryHeapCount);
+    updateBudgets();
+}
+
+uint32_t ResidencyManager::addTexture(uint32_t memoryTypeIndex, uint32_t width, uint32_t height, uint32_t texelSize, uint32_t mipLevels) {
+    Texture texture{};
+    texture.active = true;
+    texture.heapIndex = memoryTypes->getProperties().memoryTypes[memoryTypeIndex].heapIndex;
+    texture.width = width;
+    texture.height = height;
+    texture.texelSize = texelSize;
+    texture.mipLevels = mipLevels;
+
+    while (texture.tailMip + 1 < mipLevels &&
+           std::max(width >> texture.tailMip, height >> texture.tailMip) > MIP_TAIL_SIZE) {
+        texture.tailMip++;
+    }
+
+    if (!freeTextures.empty()) {
+        uint32_t index = freeTextures.back();
+        freeTextures.pop_back();
+        textures[index] = texture;
+        return index;
+    }
+
+    textures.push_back(texture);
+    return static_cast<uint32_t>(textures.size() - 1);
+}
+
+void ResidencyManager::removeTexture(uint32_t texture) {
+    textures[texture].active = false;
+    freeTextures.push_back(texture);
+}
+
+void ResidencyManager::touch(uint32_t texture, uint64_t frame) {
+    textures[texture].lastUsedFrame = frame;
+}
+
+void ResidencyManager::setBaseMip(uint32_t texture, uint32_t baseMip) {
+    textures[texture].baseMip = baseMip;
+}
+
+VkDeviceSize ResidencyManager::residentSize(const Texture& texture, uint32_t baseMip) const {
+    VkDeviceSize size = 0;
+    for (uint32_t level = baseMip; level < texture.mipLevels; level++) {
+        VkDeviceSize width = std::max(texture.width >> level, 1u);
+        VkDeviceSize height = std::max(texture.height >> level, 1u);
+        size += width * height * texture.texelSize;
+    }
+    return size;
+}
+
+void ResidencyManager::updateBudgets() {
+    const VkPhysicalDeviceMemoryProperties& properties = memoryTypes->getProperties();
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+    budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    if (memoryBudgetExtension) {
+        VkPhysicalDeviceMemoryProperties2 properties2{};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+        properties2.pNext = &budgetProperties;
+        vkGetPhysicalDeviceMemoryProperties2(physicalDevice, &properties2);
+    }
+
+    AllocatorStats stats = allocator->getStats();
+
+    std::vector<VkDeviceSize> tracked(heaps.size(), 0);
+    std::vector<VkDeviceSize> blockFree(heaps.size(), 0);
+    for (uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+        const MemoryTypeStats& type = stats.memoryTypes[i];
+        uint32_t heapIndex = properties.memoryTypes[i].heapIndex;
+        tracked[heapIndex] += type.blockBytes + type.dedicatedBytes;
+        blockFree[heapIndex] += type.blockBytes - type.usedBytes;
+    }
+
+    for (uint32_t i = 0; i < heaps.size(); i++) {
+        HeapBudget& heap = heaps[i];
+        if (memoryBudgetExtension) {
+            heap.budget = budgetProperties.heapBudget[i];
+            heap.usage = budgetProperties.heapUsage[i];
+        } else {
+            heap.budget = percentOf(properties.memoryHeaps[i].size, FALLBACK_BUDGET_PERCENT);
+            heap.usage = tracked[i];
+        }
+        heap.available = static_cast<int64_t>(heap.budget) - static_cast<int64_t>(heap.usage) + static_cast<int64_t>(blockFree[i]);
+    }
+}
+
+std::vector<ResidencyChange> ResidencyManager::update(uint64_t frame) {
+    std::vector<ResidencyChange> changes{};
+    if (frame < nextUpdateFrame) {
+        return changes;
+    }
+
+    updateBudgets();
+
+    // least recently used first
+    std::vector<uint32_t> order{};
+    for (uint32_t i = 0; i < textures.size(); i++) {
+        if (textures[i].active) {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return textures[a].lastUsedFrame < textures[b].lastUsedFrame;
+    });
+
+    for (uint32_t heapIndex = 0; heapIndex < heaps.size(); heapIndex++) {
+        const HeapBudget& heap = heaps[heapIndex];
+        int64_t headroom = static_cast<int64_t>(percentOf(heap.budget, HEADROOM_PERCENT));
+        int64_t available = heap.available;
+
+        if (available < headroom) {
+            // under pressure: first evict what hasn't been seen in a while, then walk
+            // the LRU list again dropping one level per texture until we're back above
+            std::vector<bool> planned(textures.size(), false);
+            for (bool evictOnly : { true, false }) {
+                for (uint32_t index : order) {
+                    if (available >= headroom) {
+                        break;
+                    }
+
+                    const Texture& texture = textures[index];
+                    if (texture.heapIndex != heapIndex || texture.baseMip >= texture.tailMip || planned[index]) {
+                        continue;
+                    }
+
+                    bool stale = frame >= texture.lastUsedFrame + EVICT_AFTER_FRAMES;
+                    if (evictOnly && !stale) {
+                        continue;
+                    }
+
+                    uint32_t baseMip = evictOnly ? texture.tailMip : texture.baseMip + 1;
+                    available += static_cast<int64_t>(residentSize(texture, texture.baseMip) - residentSize(texture, baseMip));
+                    changes.push_back({ index, baseMip });
+                    planned[index] = true;
+                }
+            }
+        } else if (available > headroom * 2) {
+            // plenty of room: bring back the full chain, most recently used first, as
+            // long as that doesn't push us back under the restore threshold
+            for (auto it = order.rbegin(); it != order.rend(); ++it) {
+                const Texture& texture = textures[*it];
+                if (texture.heapIndex != heapIndex || texture.baseMip == 0) {
+                    continue;
+                }
+
+                int64_t cost = static_cast<int64_t>(residentSize(texture, 0) - residentSize(texture, texture.baseMip));
+                if (available - cost < headroom * 2) {
+                    continue;
+                }
+
+                available -= cost;
+                changes.push_back({ *it, 0 });
+            }
+        }
+    }
+
+    if (!changes.empty()) {
+        nextUpdateFrame = frame + SETTLE_FRAMES;
+    }
+
+    return changes;
+}
+
+void ResidencyManager::print(std::ostream& out) const {
+    out << "residency: " << (memoryBudgetExtension ? "VK_EXT_memory_budget" : "tracked allocations") << std::endl;
+    for (uint32_t i = 0; i < heaps.size(); i++) {
+        out << "  heap " << i << ": " << (heaps[i].usage >> 20) << " / " << (heaps[i].budget >> 20) << " MiB"
+            << ", available " << (heaps[i].available / (1 << 20)) << " MiB" << std::endl;
+    }
+
+    for (uint32_t i = 0; i < textures.size(); i++) {
+        const Texture& texture = textures[i];
+        if (!texture.active) {
+            continue;
+        }
+        out << "  texture " << i << ": base mip " << texture.baseMip << "/" << texture.mipLevels
+            << ", " << (residentSize(texture, texture.baseMip) >> 10) << " KiB resident" << std::endl;
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+#include <ostream>
+
+#include "memory/allocator.h"
+#include "memory/memory_types.h"
+
+// Keeps device memory usage under the heaps' budgets by trading texture quality
+// for memory.
+//
+// Budget and usage per heap come from VK_EXT_memory_budget when the device has it.
+// Without it, usage is what our own allocator has handed out and the budget is a
+// fixed fraction of the heap size. Either way, free space inside our own blocks
+// counts as available, since new allocations land there before the heap grows.
+//
+// The manager only plans; the owner of the textures applies each change (drops
+// mips, reloads) and reports the new base mip back with setBaseMip.
+struct HeapBudget {
+    VkDeviceSize budget = 0;
+    VkDeviceSize usage  = 0;
+    // budget - usage + free space in our blocks; negative when over budget
+    int64_t available   = 0;
+};
+
+struct ResidencyChange {
+    uint32_t texture = 0;
+    // first mip level that should be resident; 0 restores the full chain
+    uint32_t baseMip = 0;
+};
+
+class ResidencyManager {
+public:
+    void init(VkPhysicalDevice physicalDevice, const MemoryTypeCache& memoryTypes, const DeviceAllocator& allocator, bool memoryBudgetExtension);
+
+    uint32_t addTexture(uint32_t memoryTypeIndex, uint32_t width, uint32_t height, uint32_t texelSize, uint32_t mipLevels);
+    void removeTexture(uint32_t texture);
+    void touch(uint32_t texture, uint64_t frame);
+    void setBaseMip(uint32_t texture, uint32_t baseMip);
+
+    // refreshes the heap budgets and returns the residency changes to apply this
+    // frame, if any. Under pressure, textures that haven't been used for a while are
+    // evicted down to their mip tail and recently used ones lose one level at a time,
+    // least recently used first. With enough headroom, the most recently used textures
+    // get their full chain back.
+    std::vector<ResidencyChange> update(uint64_t frame);
+
+    const HeapBudget& getHeapBudget(uint32_t heapIndex) const { return heaps[heapIndex]; }
+    bool usesMemoryBudgetExtension() const { return memoryBudgetExtension; }
+
+    void print(std::ostream& out) const;
+
+private:
+    struct Texture {
+        bool active = false;
+        uint32_t heapIndex = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t texelSize = 0;
+        uint32_t mipLevels = 0;
+        uint32_t baseMip = 0;
+        // highest base mip we will go to: the mip tail small enough to keep resident
+        uint32_t tailMip = 0;
+        uint64_t lastUsedFrame = 0;
+    };
+
+    void updateBudgets();
+    VkDeviceSize residentSize(const Texture& texture, uint32_t baseMip) const;
+
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    const MemoryTypeCache* memoryTypes = nullptr;
+    const DeviceAllocator* allocator = nullptr;
+    bool memoryBudgetExtension = false;
+
+    std::vector<HeapBudget> heaps{};
+    std::vector<Texture> textures{};
+    std::vector<uint32_t> freeTextures{};
+
+    // budgets lag behind frees and allocations for a few frames, so after
+    // changing anything we let them settle before planning again
+    uint64_t nextUpdateFrame = 0;
+};
@@ -0,0 +1,159 @@
+#include "pch.h"
+#include "memory/transient_pool.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+namespace {
+    VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+void TransientImagePool::init(VkDevice device, DeviceAllocator& allocator, MemoryTypeCache& memoryTypes) {
+    this->device = device;
+    this->allocator = &allocator;
+    this->memoryTypes = &memoryTypes;
+}
+
+void TransientImagePool::addImage(VkImage image, uint32_t firstPass, uint32_t lastPass) {
+    Entry entry{};
+    entry.image = image;
+    entry.firstPass = firstPass;
+    entry.lastPass = lastPass;
+    ResourceRequirements requirements = allocator->getImageRequirements(image);
+    entry.requirements = requirements.memory;
+    entry.requiresDedicated = requirements.requiresDedicated;
+    entry.memoryTypeIndex = memoryTypes->find(entry.requirements.memoryTypeBits, MemoryUsage::Transient);
+
+    entries.push_back(entry);
+}
+
+void TransientImagePool::bind() {
+    if (!allocations.empty()) {
+        throw std::runtime_error("transient image pool is already bound.");
+    }
+
+    // largest first, so small images fill the gaps next to big ones
+    std::vector<Entry*> order{};
+    for (auto& entry : entries) {
+        order.push_back(&entry);
+    }
+    std::sort(order.begin(), order.end(), [](const Entry* a, const Entry* b) {
+        return a->requirements.size > b->requirements.size;
+    });
+
+    std::vector<uint32_t> memoryTypeIndices{};
+    for (auto entry : order) {
+        if (entry->requiresDedicated) {
+            bindDedicated(*entry);
+        } else if (std::find(memoryTypeIndices.begin(), memoryTypeIndices.end(), entry->memoryTypeIndex) == memoryTypeIndices.end()) {
+            memoryTypeIndices.push_back(entry->memoryTypeIndex);
+        }
+    }
+
+    for (uint32_t memoryTypeIndex : memoryTypeIndices) {
+        std::vector<Entry*> placed{};
+        VkDeviceSize size = 0;
+        VkDeviceSize alignment = 1;
+
+        for (auto entry : order) {
+            if (entry->memoryTypeIndex != memoryTypeIndex || entry->requiresDedicated) {
+                continue;
+            }
+
+            // lowest offset that doesn't collide with any placed image that is live
+            // at the same time; candidates are 0 and the end of every such image
+            std::vector<Entry*> live{};
+            for (auto other : placed) {
+                if (other->firstPass <= entry->lastPass && entry->firstPass <= other->lastPass) {
+                    live.push_back(other);
+                }
+            }
+
+            VkDeviceSize best = UINT64_MAX;
+            std::vector<VkDeviceSize> candidates = { 0 };
+            for (auto other : live) {
+                candidates.push_back(other->offset + other->requirements.size);
+            }
+
+            for (VkDeviceSize candidate : candidates) {
+                VkDeviceSize offset = alignUp(candidate, entry->requirements.alignment);
+                bool collides = false;
+                for (auto other : live) {
+                    if (offset < other->offset + other->requirements.size && other->offset < offset + entry->requirements.size) {
+                        collides = true;
+                        break;
+                    }
+                }
+                if (!collides) {
+                    best = std::min(best, offset);
+                }
+            }
+
+            entry->offset = best;
+            placed.push_back(entry);
+            size = std::max(size, best + entry->requirements.size);
+            alignment = std::max(alignment, entry->requirements.alignment);
+        }
+
+        VkMemoryRequirements requirements{};
+        requirements.size = size;
+        requirements.alignment = alignment;
+        requirements.memoryTypeBits = 1u << memoryTypeIndex;
+
+        Allocation allocation = allocator->allocate(requirements, memoryTypeIndex, ResourceKind::Optimal, true);
+        allocations.push_back(allocation);
+
+        for (auto entry : placed) {
+            VkResult err = vkBindImageMemory(device, entry->image, allocation.memory, allocation.offset + entry->offset);
+            if (err != VK_SUCCESS) {
+                std::cerr << "Error binding transient image memory: " << err << std::endl;
+                throw std::runtime_error("error binding transient image memory");
+            }
+        }
+    }
+}
+
+void TransientImagePool::bindDedicated(const Entry& entry) {
+    ResourceRequirements requirements{};
+    requirements.memory = entry.requirements;
+    requirements.requiresDedicated = true;
+    requirements.image = entry.image;
+
+    Allocation allocation = allocator->allocate(requirements, entry.memoryTypeIndex, ResourceKind::Optimal);
+    allocations.push_back(allocation);
+
+    VkResult err = vkBindImageMemory(device, entry.image, allocation.memory, allocation.offset);
+    if (err != VK_SUCCESS) {
+        std::cerr << "Error binding transient image memory: " << err << std::endl;
+        throw std::runtime_error("error binding transient image memory");
+    }
+}
+
+void TransientImagePool::reset() {
+    for (auto& allocation : allocations) {
+        allocator->free(allocation);
+    }
+    allocations.clear();
+    entries.clear();
+}
+
+void TransientImagePool::print(std::ostream& out) const {
+    VkDeviceSize unaliased = 0;
+    for (const auto& entry : entries) {
+        unaliased += entry.requirements.size;
+    }
+
+    VkDeviceSize aliased = 0;
+    bool lazy = false;
+    for (const auto& allocation : allocations) {
+        aliased += allocation.size;
+        lazy |= (memoryTypes->getFlags(allocation.memoryTypeIndex) & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+    }
+
+    out << "transient attachments: " << entries.size() << " image(s), "
+        << (aliased >> 10) << " KiB (" << (unaliased >> 10) << " KiB unaliased)"
+        << (lazy ? ", lazily allocated" : "") << std::endl;
+}
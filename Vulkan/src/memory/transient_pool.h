@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+#include <ostream>
+
+#include "memory/allocator.h"
+#include "memory/memory_types.h"
+
+// Memory for attachments that only live inside render passes.
+//
+// Images are added with the range of passes they are used in; bind() then packs
+// them into one allocation per memory type, letting images whose pass ranges don't
+// overlap share the same bytes. Memory comes from MemoryUsage::Transient, so on
+// tilers that expose LAZILY_ALLOCATED memory it may never be committed at all.
+//
+// Every image must be created with VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT, and
+// since aliased contents are garbage on first use, it must start each pass in
+// VK_IMAGE_LAYOUT_UNDEFINED with LOAD_OP_CLEAR or DONT_CARE. Images the driver
+// requires a dedicated allocation for can't share memory and get their own.
+class TransientImagePool {
+public:
+    void init(VkDevice device, DeviceAllocator& allocator, MemoryTypeCache& memoryTypes);
+
+    // firstPass and lastPass are inclusive
+    void addImage(VkImage image, uint32_t firstPass, uint32_t lastPass);
+
+    // allocates memory for every image added since the last reset and binds it
+    void bind();
+
+    // frees the memory and forgets the images; destroy the images first
+    void reset();
+
+    // one per memory type plus one per dedicated image, valid from bind() until reset()
+    const std::vector<Allocation>& getAllocations() const { return allocations; }
+
+    void print(std::ostream& out) const;
+
+private:
+    struct Entry {
+        VkImage image = VK_NULL_HANDLE;
+        uint32_t firstPass = 0;
+        uint32_t lastPass = 0;
+        VkMemoryRequirements requirements{};
+        bool requiresDedicated = false;
+        uint32_t memoryTypeIndex = 0;
+        VkDeviceSize offset = 0;
+    };
+
+    void bindDedicated(const Entry& entry);
+
+    VkDevice device = VK_NULL_HANDLE;
+    DeviceAllocator* allocator = nullptr;
+    MemoryTypeCache* memoryTypes = nullptr;
+
+    std::vector<Entry> entries{};
+    std::vector<Allocation> allocations{};
+};
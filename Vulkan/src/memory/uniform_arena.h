@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "memory/allocator.h"
+
+// Linear allocator over one persistently mapped, host-coherent uniform buffer.
+//
+// There is one arena per frame in flight. Each frame resets its arena once the
+// frame's fence has signalled, then pushes its uniform data with plain stores and
+// binds it through a single UNIFORM_BUFFER_DYNAMIC descriptor with the returned
+// offset, so no map/unmap or descriptor writes happen per frame.
+struct UniformArena {
+    VkBuffer buffer         = VK_NULL_HANDLE;
+    Allocation allocation{};
+    char* mapped            = nullptr;
+    VkDeviceSize capacity   = 0;
+    // minUniformBufferOffsetAlignment
+    VkDeviceSize alignment  = 1;
+    VkDeviceSize head       = 0;
+
+    void reset() {
+        head = 0;
+    }
+
+    // copies data into the arena and returns its dynamic offset
+    uint32_t push(const void* data, VkDeviceSize size) {
+        VkDeviceSize offset = (head + alignment - 1) / alignment * alignment;
+        if (offset + size > capacity) {
+            throw std::runtime_error("uniform arena out of space.");
+        }
+
+        memcpy(mapped + offset, data, static_cast<size_t>(size));
+        head = offset + size;
+
+        return static_cast<uint32_t>(offset);
+    }
+
+    template<typename T>
+    uint32_t push(const T& value) {
+        return push(&value, sizeof(T));
+    }
+};
@@ -0,0 +1,311 @@
+#include "pch.h"
+#include "mesh/geometry_buffer.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+    // in elements; the first mesh without a reserve() gets at least this much
+    const uint32_t MIN_CAPACITY = 64 * 1024;
+}
+
+void GeometryBuffer::init(VkDevice device, DeviceAllocator& allocator, MemoryTypeCache& memoryTypes, StagingRing& stagingRing,
+    uint32_t vertexStride, VkIndexType indexType, uint32_t framesInFlight, bool directWrites,
+    const VkAllocationCallbacks* allocationCallbacks) {
+    this->device = device;
+    this->allocationCallbacks = allocationCallbacks;
+    this->allocator = &allocator;
+    this->memoryTypes = &memoryTypes;
+    this->stagingRing = &stagingRing;
+    this->framesInFlight = framesInFlight;
+    this->indexType = indexType;
+    this->directWrites = directWrites && memoryTypes.hasLargeDeviceLocalHostVisible();
+
+    // TRANSFER_SRC so the contents can be carried over when growing
+    vertices.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    vertices.elementSize = vertexStride;
+    indices.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    indices.elementSize = indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+void GeometryBuffer::destroy() {
+    for (auto& retiredBuffer : retired) {
+        release(retiredBuffer.buffer, retiredBuffer.allocation, retiredBuffer.mapped);
+    }
+    retired.clear();
+    pendingFrees.clear();
+
+    for (Arena* arena : { &vertices, &indices }) {
+        if (arena->buffer != VK_NULL_HANDLE) {
+            release(arena->buffer, arena->allocation, arena->mapped != nullptr);
+        }
+        arena->buffer = VK_NULL_HANDLE;
+        arena->mapped = nullptr;
+        arena->capacity = 0;
+        arena->used = 0;
+        arena->freeRanges.clear();
+    }
+
+    meshCount = 0;
+}
+
+void GeometryBuffer::reserve(uint32_t vertexCount, uint32_t indexCount) {
+    if (vertexCount > vertices.capacity) {
+        grow(vertices, vertexCount);
+    }
+    if (indexCount > indices.capacity) {
+        grow(indices, indexCount);
+    }
+}
+
+VkIndexType GeometryBuffer::getIndexType(uint32_t maxVertexCount) {
+    // primitive restart is off, so 0xffff is an index like any other
+    return maxVertexCount <= UINT16_MAX + 1u ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
+
+MeshHandle GeometryBuffer::addMesh(const void* vertexData, uint32_t vertexCount, const uint32_t* indexData, uint32_t indexCount) {
+    // checked before anything is allocated
+    const void* indexSource = indexData;
+    std::vector<uint16_t> narrowIndices{};
+    if (indexType == VK_INDEX_TYPE_UINT16) {
+        narrowIndices.resize(indexCount);
+        for (uint32_t i = 0; i < indexCount; i++) {
+            if (indexData[i] > UINT16_MAX) {
+                throw std::runtime_error("mesh index does not fit the geometry buffer's 16-bit indices.");
+            }
+            narrowIndices[i] = static_cast<uint16_t>(indexData[i]);
+        }
+        indexSource = narrowIndices.data();
+    }
+
+    MeshHandle mesh{};
+    mesh.vertexCount = vertexCount;
+    mesh.indexCount = indexCount;
+
+    uint32_t vertexOffset = allocateRange(vertices, vertexCount);
+    mesh.vertexOffset = static_cast<int32_t>(vertexOffset);
+    mesh.firstIndex = allocateRange(indices, indexCount);
+
+    write(vertices, vertexOffset, vertexData, vertexCount, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+    write(indices, mesh.firstIndex, indexSource, indexCount, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+
+    meshCount++;
+    return mesh;
+}
+
+void GeometryBuffer::removeMesh(const MeshHandle& mesh) {
+    PendingFree pending{};
+    pending.frame = frame;
+    pending.mesh = mesh;
+    pendingFrees.push_back(pending);
+
+    meshCount--;
+}
+
+void GeometryBuffer::update(uint64_t frame) {
+    this->frame = frame;
+
+    while (!pendingFrees.empty() && pendingFrees.front().frame + framesInFlight <= frame) {
+        const MeshHandle& mesh = pendingFrees.front().mesh;
+        freeRange(vertices, static_cast<uint32_t>(mesh.vertexOffset), mesh.vertexCount);
+        freeRange(indices, mesh.firstIndex, mesh.indexCount);
+        pendingFrees.pop_front();
+    }
+
+    while (!retired.empty() && retired.front().frame + framesInFlight <= frame) {
+        release(retired.front().buffer, retired.front().allocation, retired.front().mapped);
+        retired.pop_front();
+    }
+}
+
+void GeometryBuffer::write(Arena& arena, uint32_t offset, const void* data, uint32_t count, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask) {
+    VkDeviceSize byteOffset = static_cast<VkDeviceSize>(offset) * arena.elementSize;
+    VkDeviceSize size = static_cast<VkDeviceSize>(count) * arena.elementSize;
+
+    if (arena.mapped != nullptr) {
+        // coherent memory, and the submission drawing it makes host writes visible
+        memcpy(static_cast<char*>(arena.mapped) + byteOffset, data, static_cast<size_t>(size));
+        return;
+    }
+
+    stagingRing->uploadBuffer(arena.buffer, byteOffset, data, size);
+
+    // no-op unless the ring is on another queue family than the draws
+    stagingRing->releaseBuffer(arena.buffer, byteOffset, size, dstStageMask, dstAccessMask);
+}
+
+void GeometryBuffer::release(VkBuffer buffer, Allocation& allocation, bool mapped) {
+    vkDestroyBuffer(device, buffer, allocationCallbacks);
+    if (mapped) {
+        allocator->unmap(allocation);
+    }
+    allocator->free(allocation);
+}
+
+void GeometryBuffer::bind(VkCommandBuffer cmd) const {
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(cmd, 0, 1, &vertices.buffer, &offset);
+    vkCmdBindIndexBuffer(cmd, indices.buffer, 0, indexType);
+}
+
+void GeometryBuffer::draw(VkCommandBuffer cmd, const MeshHandle& mesh, uint32_t instanceCount) const {
+    vkCmdDrawIndexed(cmd, mesh.indexCount, instanceCount, mesh.firstIndex, mesh.vertexOffset, 0);
+}
+
+VkDrawIndexedIndirectCommand GeometryBuffer::getDrawCommand(const MeshHandle& mesh, uint32_t instanceCount) {
+    VkDrawIndexedIndirectCommand command{};
+    command.indexCount = mesh.indexCount;
+    command.instanceCount = instanceCount;
+    command.firstIndex = mesh.firstIndex;
+    command.vertexOffset = mesh.vertexOffset;
+    command.firstInstance = 0;
+    return command;
+}
+
+uint32_t GeometryBuffer::allocateRange(Arena& arena, uint32_t count) {
+    if (count == 0) {
+        return 0;
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        // best fit: leaves the big ranges for big meshes
+        auto best = arena.freeRanges.end();
+        for (auto it = arena.freeRanges.begin(); it != arena.freeRanges.end(); ++it) {
+            if (it->second >= count && (best == arena.freeRanges.end() || it->second < best->second)) {
+                best = it;
+            }
+        }
+
+        if (best != arena.freeRanges.end()) {
+            uint32_t offset = best->first;
+            uint32_t remaining = best->second - count;
+            arena.freeRanges.erase(best);
+            if (remaining > 0) {
+                arena.freeRanges[offset + count] = remaining;
+            }
+
+            arena.used += count;
+            reportUsage(arena);
+            return offset;
+        }
+
+        grow(arena, arena.used + count);
+    }
+
+    throw std::runtime_error("geometry buffer range does not fit after growing.");
+}
+
+void GeometryBuffer::freeRange(Arena& arena, uint32_t offset, uint32_t count) {
+    if (count == 0) {
+        return;
+    }
+
+    arena.used -= count;
+    insertFreeRange(arena, offset, count);
+    reportUsage(arena);
+}
+
+void GeometryBuffer::insertFreeRange(Arena& arena, uint32_t offset, uint32_t count) {
+    auto next = arena.freeRanges.lower_bound(offset);
+    if (next != arena.freeRanges.end() && offset + count == next->first) {
+        count += next->second;
+        next = arena.freeRanges.erase(next);
+    }
+
+    if (next != arena.freeRanges.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset) {
+            previous->second += count;
+            return;
+        }
+    }
+
+    arena.freeRanges[offset] = count;
+}
+
+void GeometryBuffer::grow(Arena& arena, uint32_t minCapacity) {
+    // always at least double: a fragmented arena may not fit a range even though
+    // its total free space would
+    uint64_t capacity = arena.capacity == 0 ? MIN_CAPACITY : static_cast<uint64_t>(arena.capacity) * 2;
+    while (capacity < minCapacity) {
+        capacity *= 2;
+    }
+    if (capacity > UINT32_MAX) {
+        throw std::runtime_error("geometry buffer exceeds 2^32 elements.");
+    }
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = capacity * arena.elementSize;
+    bufferInfo.usage = arena.usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkBuffer buffer;
+    VkResult err = vkCreateBuffer(device, &bufferInfo, allocationCallbacks, &buffer);
+    if (err != VK_SUCCESS) {
+        std::cerr << "Error creating geometry buffer: " << err << std::endl;
+        throw std::runtime_error("error creating geometry buffer.");
+    }
+
+    ResourceRequirements requirements = allocator->getBufferRequirements(buffer);
+
+    // direct writes only pay off in device local memory; buffers that can't have it
+    // are filled through the ring
+    uint32_t memoryTypeIndex = memoryTypes->find(requirements.memory.memoryTypeBits, MemoryUsage::GpuOnly);
+    bool direct = false;
+    if (directWrites) {
+        uint32_t directTypeIndex = memoryTypes->find(requirements.memory.memoryTypeBits, MemoryUsage::DirectUpload);
+        if (memoryTypes->getFlags(directTypeIndex) & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+            memoryTypeIndex = directTypeIndex;
+            direct = true;
+        }
+    }
+
+    Allocation allocation = allocator->allocate(requirements, memoryTypeIndex, ResourceKind::Linear);
+
+    err = vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+    if (err != VK_SUCCESS) {
+        std::cerr << "Error binding geometry buffer memory: " << err << std::endl;
+        throw std::runtime_error("error binding geometry buffer memory");
+    }
+
+    if (arena.buffer != VK_NULL_HANDLE) {
+        // the copy has to have finished before the old buffer can go, and growing is
+        // rare enough (the size doubles) that waiting for its token here is fine
+        UploadToken copied = stagingRing->copyBuffer(arena.buffer, 0, buffer, 0, static_cast<VkDeviceSize>(arena.capacity) * arena.elementSize);
+        stagingRing->wait(copied);
+
+        Retired old{};
+        old.frame = frame;
+        old.buffer = arena.buffer;
+        old.allocation = arena.allocation;
+        old.mapped = arena.mapped != nullptr;
+        retired.push_back(old);
+    }
+
+    uint32_t oldCapacity = arena.capacity;
+    arena.buffer = buffer;
+    arena.allocation = allocation;
+    arena.mapped = direct ? allocator->map(arena.allocation) : nullptr;
+    arena.capacity = static_cast<uint32_t>(capacity);
+
+    insertFreeRange(arena, oldCapacity, arena.capacity - oldCapacity);
+    reportUsage(arena);
+}
+
+void GeometryBuffer::reportUsage(const Arena& arena) {
+    if (onUsage) {
+        onUsage(arena.allocation, static_cast<VkDeviceSize>(arena.used) * arena.elementSize);
+    }
+}
+
+void GeometryBuffer::print(std::ostream& out) const {
+    out << "Geometry: " << meshCount << " mesh(es), "
+        << vertices.used << " / " << vertices.capacity << " vertices of " << vertices.elementSize << " bytes, "
+        << indices.used << " / " << indices.capacity << " " << indices.elementSize * 8 << "-bit indices, "
+        << vertices.freeRanges.size() << " + " << indices.freeRanges.size() << " free ranges"
+        << (vertices.mapped != nullptr || indices.mapped != nullptr ? ", written directly" : "") << std::endl;
+}
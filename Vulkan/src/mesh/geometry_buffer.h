@@ -0,0 +1,141 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <map>
+#include <deque>
+#include <functional>
+#include <ostream>
+
+#include "memory/allocator.h"
+#include "memory/memory_types.h"
+#include "transfer/staging_ring.h"
+
+// Where a mesh lives inside the GeometryBuffer; everything vkCmdDrawIndexed needs.
+// Indices are relative to the mesh's first vertex.
+struct MeshHandle {
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+    int32_t vertexOffset = 0;
+    uint32_t vertexCount = 0;
+};
+
+// All vertex and index data in one device local vertex buffer and one index buffer.
+//
+// Meshes get a range of each, picked best fit from a free list that merges adjacent
+// ranges, so the space of removed meshes is reused by the ones streamed in after
+// them. When a range doesn't fit, the buffer is replaced by one twice the size and
+// the old contents are copied over on the GPU; the old buffer is destroyed once the
+// frames in flight that may still bind it have finished. Freed ranges are held back
+// the same way, so a mesh is never overwritten while a frame still draws it.
+//
+// Since every mesh shares the same two buffers, a frame binds them once and then
+// issues draws (or indirect draws) using the handles' offsets.
+//
+// Indices are 16 or 32-bit for the whole buffer, since a frame binds it once; each
+// mesh's are relative to its first vertex, so 16 bits do for every mesh of up to
+// 65536 vertices whatever the total. They are always handed over as uint32_t and
+// narrowed on the way in.
+//
+// With directWrites, on devices with device local host visible memory (ReBAR or UMA),
+// the buffers live in that memory and stay mapped, and meshes are written straight
+// into their ranges: no staging copy, no GPU copy and no ownership transfer. The
+// ranges a frame in flight may still read are never handed out, so the writes need no
+// synchronization beyond the submission of the frame that first draws them. Growing
+// still copies on the GPU.
+class GeometryBuffer {
+public:
+    // called with the vertex or index Allocation whenever its buffer grows or meshes
+    // take or give back space in it, with the bytes the meshes use
+    using UsageCallback = std::function<void(const Allocation& allocation, VkDeviceSize usedBytes)>;
+
+    void init(VkDevice device, DeviceAllocator& allocator, MemoryTypeCache& memoryTypes, StagingRing& stagingRing,
+        uint32_t vertexStride, VkIndexType indexType, uint32_t framesInFlight, bool directWrites,
+        const VkAllocationCallbacks* allocationCallbacks = nullptr);
+    void destroy();
+
+    void setUsageCallback(UsageCallback callback) { onUsage = callback; }
+
+    // grows the buffers to hold at least this many vertices and indices
+    void reserve(uint32_t vertexCount, uint32_t indexCount);
+
+    // the narrowest index type that addresses meshes of up to maxVertexCount vertices
+    static VkIndexType getIndexType(uint32_t maxVertexCount);
+
+    // copies are recorded into the staging ring and released to the draw queue;
+    // flush it and record its acquires before drawing the mesh. Direct writes are
+    // done when it returns
+    MeshHandle addMesh(const void* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount);
+    void removeMesh(const MeshHandle& mesh);
+
+    // start of a frame, after its fence wait: releases ranges and buffers no frame uses anymore
+    void update(uint64_t frame);
+
+    void bind(VkCommandBuffer cmd) const;
+    void draw(VkCommandBuffer cmd, const MeshHandle& mesh, uint32_t instanceCount = 1) const;
+    static VkDrawIndexedIndirectCommand getDrawCommand(const MeshHandle& mesh, uint32_t instanceCount = 1);
+
+    VkIndexType getIndexType() const { return indexType; }
+    VkBuffer getVertexBuffer() const { return vertices.buffer; }
+    VkBuffer getIndexBuffer() const { return indices.buffer; }
+    // stay at the same address when the buffers grow
+    const Allocation& getVertexAllocation() const { return vertices.allocation; }
+    const Allocation& getIndexAllocation() const { return indices.allocation; }
+
+    void print(std::ostream& out) const;
+
+private:
+    struct Arena {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        Allocation allocation{};
+        VkBufferUsageFlags usage = 0;
+        uint32_t elementSize = 0;
+        // in elements
+        uint32_t capacity = 0;
+        uint32_t used = 0;
+        // persistently mapped, with direct writes
+        void* mapped = nullptr;
+        // offset -> count, both in elements
+        std::map<uint32_t, uint32_t> freeRanges{};
+    };
+
+    struct PendingFree {
+        uint64_t frame = 0;
+        MeshHandle mesh{};
+    };
+
+    struct Retired {
+        uint64_t frame = 0;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        Allocation allocation{};
+        bool mapped = false;
+    };
+
+    // count elements of data into the arena at offset, directly or through the ring
+    void write(Arena& arena, uint32_t offset, const void* data, uint32_t count, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask);
+    void release(VkBuffer buffer, Allocation& allocation, bool mapped);
+    uint32_t allocateRange(Arena& arena, uint32_t count);
+    void freeRange(Arena& arena, uint32_t offset, uint32_t count);
+    // merges with the neighbouring free ranges
+    void insertFreeRange(Arena& arena, uint32_t offset, uint32_t count);
+    void grow(Arena& arena, uint32_t minCapacity);
+    void reportUsage(const Arena& arena);
+
+    VkDevice device = VK_NULL_HANDLE;
+    const VkAllocationCallbacks* allocationCallbacks = nullptr;
+    DeviceAllocator* allocator = nullptr;
+    MemoryTypeCache* memoryTypes = nullptr;
+    StagingRing* stagingRing = nullptr;
+    uint32_t framesInFlight = 1;
+    bool directWrites = false;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+
+    Arena vertices{};
+    Arena indices{};
+    uint32_t meshCount = 0;
+    UsageCallback onUsage{};
+
+    uint64_t frame = 0;
+    std::deque<PendingFree> pendingFrees{};
+    std::deque<Retired> retired{};
+};
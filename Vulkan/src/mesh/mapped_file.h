@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// A whole file mapped read only into memory. Pages are read in by the OS as they are
+// first touched, so opening is cheap no matter the size, and nothing is copied into
+// a buffer of our own.
+class MappedFile {
+public:
+    // returns false, leaving the file closed, if it doesn't exist, is empty or can't be mapped
+    bool open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return mapped != nullptr; }
+    const char* getData() const { return mapped; }
+    size_t getSize() const { return size; }
+
+private:
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#else
+    int descriptor = -1;
+#endif
+    const char* mapped = nullptr;
+    size_t size = 0;
+};
@@ -0,0 +1,192 @@
+#include "pch.h"
+#include "mesh/mesh_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace {
+    // "MESH", little endian
+    const uint32_t MESH_CACHE_MAGIC = 0x4853454d;
+    const uint64_t ARRAY_ALIGNMENT = 16;
+
+    struct MeshCacheHeader {
+        uint32_t magic = MESH_CACHE_MAGIC;
+        uint32_t version = MESH_CACHE_VERSION;
+        uint64_t sourceHash = 0;
+        uint64_t settingsHash = 0;
+        uint32_t vertexStride = 0;
+        uint32_t vertexCount = 0;
+        uint32_t indexCount = 0;
+        uint32_t submeshCount = 0;
+        MeshBounds bounds{};
+        MeshQuantization quantization{};
+        // from the start of the file
+        uint64_t vertexOffset = 0;
+        uint64_t indexOffset = 0;
+        uint64_t submeshOffset = 0;
+        uint64_t fileSize = 0;
+    };
+
+    uint64_t alignUp(uint64_t value, uint64_t alignment) {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    uint64_t mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    // eight bytes per step; hundreds of MB of source hash in a fraction of the time
+    // parsing them takes. Not meant to resist anything but accidental collisions
+    uint64_t hashBytes(const char* data, size_t size, uint64_t seed) {
+        const uint64_t MULTIPLIER = 0x9e3779b97f4a7c15ull;
+
+        uint64_t h = seed ^ (size * MULTIPLIER);
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            h = (h ^ mix(word)) * MULTIPLIER;
+        }
+
+        uint64_t tail = 0;
+        memcpy(&tail, data + i, size - i);
+        return mix(h ^ tail);
+    }
+
+    uint64_t hashSettings(const MeshImportSettings& settings) {
+        uint64_t h = mix(MESH_CACHE_VERSION);
+        h = mix(h ^ settings.vertexStride);
+        h = mix(h ^ (settings.flipTexCoordV ? 1 : 2));
+        h = mix(h ^ (settings.optimize ? 1 : 2));
+
+        uint32_t thresholdBits;
+        memcpy(&thresholdBits, &settings.overdrawThreshold, sizeof(thresholdBits));
+        h = mix(h ^ thresholdBits);
+        h = mix(h ^ (settings.compactVertices ? 1 : 2));
+        return h;
+    }
+
+    bool fits(uint64_t offset, uint64_t size, uint64_t fileSize) {
+        return offset <= fileSize && size <= fileSize - offset && offset % ARRAY_ALIGNMENT == 0;
+    }
+}
+
+uint64_t MeshCache::hashSource(const std::string& sourcePath) {
+    MappedFile source{};
+    if (!source.open(sourcePath)) {
+        return 0;
+    }
+
+    uint64_t hash = hashBytes(source.getData(), source.getSize(), 0);
+    source.close();
+    return hash;
+}
+
+bool MeshCache::open(const std::string& path, uint64_t sourceHash, const MeshImportSettings& settings) {
+    close();
+
+    if (sourceHash == 0 || !file.open(path)) {
+        return false;
+    }
+
+    MeshCacheHeader header{};
+    uint64_t fileSize = file.getSize();
+    if (fileSize < sizeof(header)) {
+        close();
+        return false;
+    }
+    memcpy(&header, file.getData(), sizeof(header));
+
+    uint64_t vertexBytes = static_cast<uint64_t>(header.vertexCount) * header.vertexStride;
+    uint64_t indexBytes = static_cast<uint64_t>(header.indexCount) * sizeof(uint32_t);
+    uint64_t submeshBytes = static_cast<uint64_t>(header.submeshCount) * sizeof(Submesh);
+
+    bool valid = header.magic == MESH_CACHE_MAGIC && header.version == MESH_CACHE_VERSION &&
+        header.sourceHash == sourceHash && header.settingsHash == hashSettings(settings) &&
+        header.vertexStride == settings.vertexStride && header.fileSize == fileSize &&
+        fits(header.vertexOffset, vertexBytes, fileSize) &&
+        fits(header.indexOffset, indexBytes, fileSize) &&
+        fits(header.submeshOffset, submeshBytes, fileSize);
+    if (!valid) {
+        close();
+        return false;
+    }
+
+    const char* data = file.getData();
+    mesh.vertices = data + header.vertexOffset;
+    mesh.vertexCount = header.vertexCount;
+    mesh.vertexStride = header.vertexStride;
+    mesh.indices = reinterpret_cast<const uint32_t*>(data + header.indexOffset);
+    mesh.indexCount = header.indexCount;
+    mesh.submeshes = reinterpret_cast<const Submesh*>(data + header.submeshOffset);
+    mesh.submeshCount = header.submeshCount;
+    mesh.bounds = header.bounds;
+    mesh.quantization = header.quantization;
+    return true;
+}
+
+void MeshCache::close() {
+    file.close();
+    mesh = MeshView{};
+}
+
+bool MeshCache::write(const std::string& path, uint64_t sourceHash, const MeshImportSettings& settings, const MeshView& mesh) {
+    MeshCacheHeader header{};
+    header.sourceHash = sourceHash;
+    header.settingsHash = hashSettings(settings);
+    header.vertexStride = mesh.vertexStride;
+    header.vertexCount = mesh.vertexCount;
+    header.indexCount = mesh.indexCount;
+    header.submeshCount = mesh.submeshCount;
+    header.bounds = mesh.bounds;
+    header.quantization = mesh.quantization;
+
+    uint64_t vertexBytes = static_cast<uint64_t>(mesh.vertexCount) * mesh.vertexStride;
+    uint64_t indexBytes = static_cast<uint64_t>(mesh.indexCount) * sizeof(uint32_t);
+    uint64_t submeshBytes = static_cast<uint64_t>(mesh.submeshCount) * sizeof(Submesh);
+    header.vertexOffset = alignUp(sizeof(header), ARRAY_ALIGNMENT);
+    header.indexOffset = alignUp(header.vertexOffset + vertexBytes, ARRAY_ALIGNMENT);
+    header.submeshOffset = alignUp(header.indexOffset + indexBytes, ARRAY_ALIGNMENT);
+    header.fileSize = header.submeshOffset + submeshBytes;
+
+    std::string temporaryPath = path + ".tmp";
+    std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+
+    const char padding[ARRAY_ALIGNMENT]{};
+    auto writeArray = [&](uint64_t offset, const void* data, uint64_t size) {
+        uint64_t position = static_cast<uint64_t>(out.tellp());
+        out.write(padding, static_cast<std::streamsize>(offset - position));
+        out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    };
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writeArray(header.vertexOffset, mesh.vertices, vertexBytes);
+    writeArray(header.indexOffset, mesh.indices, indexBytes);
+    writeArray(header.submeshOffset, mesh.submeshes, submeshBytes);
+    out.close();
+
+    if (!out) {
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+
+    // rename doesn't replace an existing file everywhere
+    std::remove(path.c_str());
+    return std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+}
+
+void MeshCache::print(std::ostream& out) const {
+    out << "Mesh Cache: " << (isOpen() ? "hit" : "miss") << ", "
+        << mesh.vertexCount << " vertices, " << mesh.indexCount << " indices, "
+        << mesh.submeshCount << " submesh(es), " << (file.getSize() >> 10) << " KiB mapped" << std::endl;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <ostream>
+
+#include "mesh/mapped_file.h"
+
+// bumped whenever the file layout changes; caches of other versions are re-imported
+const uint32_t MESH_CACHE_VERSION = 2;
+
+struct MeshBounds {
+    float min[3] = { 0.0f, 0.0f, 0.0f };
+    float max[3] = { 0.0f, 0.0f, 0.0f };
+};
+
+// Maps a mesh's stored vertex attributes back to the imported values:
+// value = stored * scale + bias, with snorm and unorm attributes as the shader reads
+// them. The identity for float vertices.
+struct MeshQuantization {
+    float positionScale[3] = { 1.0f, 1.0f, 1.0f };
+    float positionBias[3] = { 0.0f, 0.0f, 0.0f };
+    float texCoordScale[2] = { 1.0f, 1.0f };
+    float texCoordBias[2] = { 0.0f, 0.0f };
+};
+
+// A range of the mesh's indices, one per shape of the source.
+struct Submesh {
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+};
+
+// What the importer does to the source. Part of the cache key, so changing any of it
+// re-imports.
+struct MeshImportSettings {
+    // sizeof the vertex the importer writes; a layout change shows up here
+    uint32_t vertexStride = 0;
+    // OBJ has the origin of texture space at the bottom, Vulkan at the top
+    bool flipTexCoordV = true;
+    // reorder triangles and vertices for the post-transform cache and vertex fetch
+    bool optimize = false;
+    // optimizeOverdraw's threshold when optimizing; 0 leaves the cache order alone
+    float overdrawThreshold = 0.0f;
+    // write CompactVertex instead of Vertex
+    bool compactVertices = false;
+};
+
+// A mesh ready for GeometryBuffer::addMesh: deduplicated vertices and the indices into
+// them. Only points at the data, which lives in a MeshCache mapping or in the
+// importer's arrays.
+struct MeshView {
+    const void* vertices = nullptr;
+    uint32_t vertexCount = 0;
+    uint32_t vertexStride = 0;
+    const uint32_t* indices = nullptr;
+    uint32_t indexCount = 0;
+    const Submesh* submeshes = nullptr;
+    uint32_t submeshCount = 0;
+    MeshBounds bounds{};
+    MeshQuantization quantization{};
+};
+
+// Binary cache of an imported mesh, so later runs skip parsing the source.
+//
+// The file is a header followed by the vertex, index and submesh arrays exactly as
+// they are uploaded, each 16 byte aligned. It is mapped rather than read, so opening
+// it costs a hash of the source and a header check, and the arrays are copied from
+// the mapping straight into the staging ring (or into device memory, with direct
+// writes). The header records the hash of the source file and of the import
+// settings; a cache that doesn't match both, or was written by another version, is
+// ignored and the caller imports and writes it again.
+//
+// Written in the machine's byte order; a cache isn't meant to move between machines.
+class MeshCache {
+public:
+    // hash of the file's contents, read through a mapping; 0 if it can't be read
+    static uint64_t hashSource(const std::string& sourcePath);
+
+    // returns false, leaving the cache closed, if the file is missing, damaged, of
+    // another version or written for another source or settings
+    bool open(const std::string& path, uint64_t sourceHash, const MeshImportSettings& settings);
+    // the mesh points into the mapping until then
+    void close();
+
+    bool isOpen() const { return file.isOpen(); }
+    const MeshView& getMesh() const { return mesh; }
+
+    // writes to a temporary file first and renames it over path, so a run that dies
+    // half way never leaves a damaged cache behind; returns false if it can't be written
+    static bool write(const std::string& path, uint64_t sourceHash, const MeshImportSettings& settings, const MeshView& mesh);
+
+    void print(std::ostream& out) const;
+
+private:
+    MappedFile file{};
+    MeshView mesh{};
+};
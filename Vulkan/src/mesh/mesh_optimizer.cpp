@@ -0,0 +1,350 @@
+#include "pch.h"
+#include "mesh/mesh_optimizer.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+namespace {
+    const uint32_t NONE = UINT32_MAX;
+
+    // Forsyth's constants; the LRU cache he scores against is bigger than the FIFO
+    // the statistics simulate, which makes the order robust to the actual size
+    const uint32_t FORSYTH_CACHE_SIZE = 32;
+    const float CACHE_DECAY_POWER = 1.5f;
+    const float LAST_TRIANGLE_SCORE = 0.75f;
+    const float VALENCE_BOOST_SCALE = 2.0f;
+    const float VALENCE_BOOST_POWER = 0.5f;
+    // more triangles left than this score the same
+    const uint32_t MAX_SCORED_VALENCE = 32;
+
+    struct ForsythScores {
+        float cache[FORSYTH_CACHE_SIZE];
+        float valence[MAX_SCORED_VALENCE + 1];
+
+        ForsythScores() {
+            for (uint32_t i = 0; i < FORSYTH_CACHE_SIZE; i++) {
+                // the last triangle's vertices score the same whatever their order, so
+                // nothing favors using one of them again right away
+                cache[i] = i < 3 ? LAST_TRIANGLE_SCORE
+                    : std::pow(1.0f - static_cast<float>(i - 3) / (FORSYTH_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+            }
+
+            valence[0] = 0.0f;
+            for (uint32_t i = 1; i <= MAX_SCORED_VALENCE; i++) {
+                // vertices with few triangles left are worth finishing off
+                valence[i] = VALENCE_BOOST_SCALE * std::pow(static_cast<float>(i), -VALENCE_BOOST_POWER);
+            }
+        }
+
+        float score(int32_t cachePosition, uint32_t liveTriangles) const {
+            if (liveTriangles == 0) {
+                // nothing left to draw with it
+                return -1.0f;
+            }
+            float score = cachePosition < 0 ? 0.0f : cache[cachePosition];
+            return score + valence[std::min(liveTriangles, MAX_SCORED_VALENCE)];
+        }
+    };
+
+    struct Float3 {
+        float x = 0.0f;
+        float y = 0.0f;
+        float z = 0.0f;
+    };
+
+    Float3 operator+(Float3 a, Float3 b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+    Float3 operator-(Float3 a, Float3 b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+    Float3 operator*(Float3 a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+    float dot(Float3 a, Float3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    Float3 cross(Float3 a, Float3 b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+
+    // FIFO cache simulation shared by the statistics and the overdraw clustering; a
+    // vertex is cached while fewer than cacheSize misses came after its own
+    class CacheSimulation {
+    public:
+        CacheSimulation(size_t vertexCount, uint32_t cacheSize)
+            : timestamps(vertexCount, 0), cacheSize(cacheSize), timestamp(cacheSize + 1) {}
+
+        bool access(uint32_t vertex) {
+            if (timestamp - timestamps[vertex] > cacheSize) {
+                timestamps[vertex] = timestamp++;
+                return true;
+            }
+            return false;
+        }
+
+        uint32_t accessTriangle(const uint32_t* triangle) {
+            uint32_t misses = 0;
+            for (uint32_t k = 0; k < 3; k++) {
+                misses += access(triangle[k]) ? 1 : 0;
+            }
+            return misses;
+        }
+
+        bool isReferenced(uint32_t vertex) const { return timestamps[vertex] != 0; }
+
+        // as if every vertex had been evicted
+        void flush() { timestamp += cacheSize + 1; }
+
+    private:
+        std::vector<uint32_t> timestamps;
+        uint32_t cacheSize;
+        uint32_t timestamp;
+    };
+}
+
+void VertexCacheStats::print(std::ostream& out) const {
+    out << "ACMR " << acmr << ", ATVR " << atvr;
+}
+
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize) {
+    VertexCacheStats stats{};
+    CacheSimulation cache(vertexCount, cacheSize);
+
+    size_t misses = 0;
+    size_t referenced = 0;
+    for (size_t i = 0; i < indexCount; i++) {
+        referenced += cache.isReferenced(indices[i]) ? 0 : 1;
+        misses += cache.access(indices[i]) ? 1 : 0;
+    }
+
+    if (indexCount >= 3) {
+        stats.acmr = static_cast<float>(misses) / static_cast<float>(indexCount / 3);
+        stats.atvr = static_cast<float>(misses) / static_cast<float>(referenced);
+    }
+    return stats;
+}
+
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount) {
+    static const ForsythScores scores{};
+
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+    std::vector<uint32_t> input(indices, indices + triangleCount * 3);
+
+    // the triangles of every vertex not emitted yet, first liveTriangles[v] entries
+    // from adjacencyOffsets[v]
+    std::vector<uint32_t> liveTriangles(vertexCount, 0);
+    for (uint32_t vertex : input) {
+        liveTriangles[vertex]++;
+    }
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++) {
+        adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+    }
+    std::vector<uint32_t> adjacency(input.size());
+    {
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t i = 0; i < input.size(); i++) {
+            adjacency[fill[input[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+    }
+
+    std::vector<int32_t> cachePositions(vertexCount, -1);
+    std::vector<float> vertexScores(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+        vertexScores[v] = scores.score(-1, liveTriangles[v]);
+    }
+
+    uint32_t best = 0;
+    std::vector<float> triangleScores(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++) {
+        const uint32_t* triangle = &input[t * 3];
+        triangleScores[t] = vertexScores[triangle[0]] + vertexScores[triangle[1]] + vertexScores[triangle[2]];
+        best = triangleScores[t] > triangleScores[best] ? static_cast<uint32_t>(t) : best;
+    }
+    std::vector<uint8_t> emitted(triangleCount, 0);
+
+    // most recently used first; the three extra entries are those pushed out by the
+    // next triangle
+    uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+    uint32_t nextCache[FORSYTH_CACHE_SIZE + 3];
+    uint32_t cacheCount = 0;
+    size_t firstUnemitted = 0;
+
+    for (size_t output = 0; output < triangleCount; output++) {
+        if (best == NONE) {
+            // nothing in the cache has triangles left; start over elsewhere
+            while (emitted[firstUnemitted]) {
+                firstUnemitted++;
+            }
+            best = static_cast<uint32_t>(firstUnemitted);
+        }
+
+        const uint32_t* triangle = &input[static_cast<size_t>(best) * 3];
+        memcpy(indices + output * 3, triangle, 3 * sizeof(uint32_t));
+        emitted[best] = 1;
+
+        uint32_t nextCount = 0;
+        for (uint32_t k = 0; k < 3; k++) {
+            uint32_t vertex = triangle[k];
+            if (std::find(nextCache, nextCache + nextCount, vertex) == nextCache + nextCount) {
+                nextCache[nextCount++] = vertex;
+            }
+
+            // once per corner, as it was added, so degenerate triangles come out even
+            uint32_t* triangles = &adjacency[adjacencyOffsets[vertex]];
+            uint32_t* last = triangles + --liveTriangles[vertex];
+            std::swap(*std::find(triangles, last, best), *last);
+        }
+        for (uint32_t i = 0; i < cacheCount; i++) {
+            if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2]) {
+                nextCache[nextCount++] = cache[i];
+            }
+        }
+
+        // rescore every vertex that moved, was pushed out or lost a triangle, and pass
+        // the difference on to the triangles it still has
+        for (uint32_t i = 0; i < nextCount; i++) {
+            uint32_t vertex = nextCache[i];
+            cachePositions[vertex] = i < FORSYTH_CACHE_SIZE ? static_cast<int32_t>(i) : -1;
+
+            float score = scores.score(cachePositions[vertex], liveTriangles[vertex]);
+            float delta = score - vertexScores[vertex];
+            vertexScores[vertex] = score;
+
+            const uint32_t* triangles = &adjacency[adjacencyOffsets[vertex]];
+            for (uint32_t j = 0; j < liveTriangles[vertex]; j++) {
+                triangleScores[triangles[j]] += delta;
+            }
+        }
+
+        cacheCount = std::min(nextCount, FORSYTH_CACHE_SIZE);
+        memcpy(cache, nextCache, cacheCount * sizeof(uint32_t));
+
+        // the next triangle comes from the cached vertices
+        best = NONE;
+        for (uint32_t i = 0; i < cacheCount; i++) {
+            const uint32_t* triangles = &adjacency[adjacencyOffsets[cache[i]]];
+            for (uint32_t j = 0; j < liveTriangles[cache[i]]; j++) {
+                if (best == NONE || triangleScores[triangles[j]] > triangleScores[best]) {
+                    best = triangles[j];
+                }
+            }
+        }
+    }
+}
+
+void optimizeOverdraw(uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount,
+    size_t positionStride, float threshold) {
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+    std::vector<uint32_t> input(indices, indices + triangleCount * 3);
+
+    // hard boundaries: triangles that miss on every vertex, where the cache order
+    // started over anyway
+    CacheSimulation cache(vertexCount, VERTEX_CACHE_SIZE);
+    std::vector<size_t> hardClusters{};
+    for (size_t t = 0; t < triangleCount; t++) {
+        if (cache.accessTriangle(&input[t * 3]) == 3 || t == 0) {
+            hardClusters.push_back(t);
+        }
+    }
+    hardClusters.push_back(triangleCount);
+
+    // soft boundaries: wherever a cluster's ACMR so far is within threshold of its hard
+    // cluster's, the triangles after it start a cluster of their own
+    std::vector<size_t> clusters{};
+    for (size_t h = 0; h + 1 < hardClusters.size(); h++) {
+        size_t begin = hardClusters[h];
+        size_t end = hardClusters[h + 1];
+
+        cache.flush();
+        uint32_t hardMisses = 0;
+        for (size_t t = begin; t < end; t++) {
+            hardMisses += cache.accessTriangle(&input[t * 3]);
+        }
+        float limit = threshold * static_cast<float>(hardMisses) / static_cast<float>(end - begin);
+
+        cache.flush();
+        clusters.push_back(begin);
+        size_t clusterBegin = begin;
+        uint32_t misses = 0;
+        for (size_t t = begin; t + 1 < end; t++) {
+            misses += cache.accessTriangle(&input[t * 3]);
+            if (static_cast<float>(misses) <= limit * static_cast<float>(t + 1 - clusterBegin)) {
+                clusterBegin = t + 1;
+                clusters.push_back(clusterBegin);
+                misses = 0;
+                cache.flush();
+            }
+        }
+    }
+    clusters.push_back(triangleCount);
+
+    auto position = [&](uint32_t vertex) {
+        const float* p = reinterpret_cast<const float*>(reinterpret_cast<const char*>(positions) + vertex * positionStride);
+        return Float3{ p[0], p[1], p[2] };
+    };
+
+    // area weighted centroid and normal (twice the area long) of every cluster
+    size_t clusterCount = clusters.size() - 1;
+    std::vector<Float3> centroids(clusterCount);
+    std::vector<Float3> normals(clusterCount);
+    std::vector<float> areas(clusterCount, 0.0f);
+    Float3 meshCentroid{};
+    float meshArea = 0.0f;
+    for (size_t c = 0; c < clusterCount; c++) {
+        for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+            Float3 a = position(input[t * 3 + 0]);
+            Float3 b = position(input[t * 3 + 1]);
+            Float3 d = position(input[t * 3 + 2]);
+
+            Float3 normal = cross(b - a, d - a);
+            float area = std::sqrt(dot(normal, normal));
+            centroids[c] = centroids[c] + (a + b + d) * (area / 3.0f);
+            normals[c] = normals[c] + normal;
+            areas[c] += area;
+        }
+        meshCentroid = meshCentroid + centroids[c];
+        meshArea += areas[c];
+    }
+    meshCentroid = meshArea > 0.0f ? meshCentroid * (1.0f / meshArea) : Float3{};
+
+    // how far out a cluster lies along the way it faces: the further, the fewer
+    // clusters can be in front of it from any direction
+    std::vector<float> keys(clusterCount, 0.0f);
+    for (size_t c = 0; c < clusterCount; c++) {
+        float length = std::sqrt(dot(normals[c], normals[c]));
+        if (areas[c] > 0.0f && length > 0.0f) {
+            keys[c] = dot(centroids[c] * (1.0f / areas[c]) - meshCentroid, normals[c] * (1.0f / length));
+        }
+    }
+
+    std::vector<uint32_t> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++) {
+        order[c] = static_cast<uint32_t>(c);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+    uint32_t* output = indices;
+    for (uint32_t c : order) {
+        size_t count = (clusters[c + 1] - clusters[c]) * 3;
+        memcpy(output, &input[clusters[c] * 3], count * sizeof(uint32_t));
+        output += count;
+    }
+}
+
+uint32_t optimizeVertexFetch(void* destination, uint32_t* indices, size_t indexCount, const void* vertices,
+    size_t vertexCount, size_t vertexSize) {
+    const char* input = static_cast<const char*>(vertices);
+    char* output = static_cast<char*>(destination);
+
+    std::vector<uint32_t> remap(vertexCount, NONE);
+    uint32_t count = 0;
+    for (size_t i = 0; i < indexCount; i++) {
+        uint32_t& vertex = remap[indices[i]];
+        if (vertex == NONE) {
+            memcpy(output + static_cast<size_t>(count) * vertexSize, input + static_cast<size_t>(indices[i]) * vertexSize, vertexSize);
+            vertex = count++;
+        }
+        indices[i] = vertex;
+    }
+    return count;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// FIFO size of the post-transform cache the statistics simulate. Hardware differs
+// (and newer GPUs batch rather than cache), but the ratios move together.
+const uint32_t VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStats {
+    // vertex shader invocations per triangle: 3 without any reuse, 0.5 for an ideal
+    // order of a large regular grid
+    float acmr = 0.0f;
+    // vertex shader invocations per vertex referenced: 1 is ideal
+    float atvr = 0.0f;
+
+    void print(std::ostream& out) const;
+};
+
+// Simulates a FIFO cache of cacheSize vertices over a triangle list.
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount,
+    uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Reorders the triangles of a triangle list, in place, for post-transform cache reuse.
+// Forsyth's "Linear-Speed Vertex Cache Optimisation": every vertex is scored by its
+// position in a simulated LRU cache and by how many triangles still use it, and the
+// next triangle is the best scoring one among those of the cached vertices, falling
+// back to the first one not yet emitted when the cache has nothing left to offer.
+// Not tuned to a cache size, so it does well on every GPU rather than best on one.
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+// Reorders the clusters of a cache optimized triangle list, in place, to draw the
+// outside of the mesh first, after Sander, Nehab and Barczak's "Fast Triangle
+// Reordering for Vertex Locality and Reduced Overdraw". The list is cut where the
+// simulated cache starts over, and again wherever a cluster's ACMR so far drops to
+// threshold times that of its hard cluster; the clusters are then sorted by how far
+// their area weighted centroid lies out from the mesh's along their average normal,
+// which doesn't depend on the view. Higher thresholds trade ACMR for smaller, better
+// sorted clusters; 1.05 costs little of it.
+//
+// positions are three floats at the start of every positionStride bytes.
+void optimizeOverdraw(uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount,
+    size_t positionStride, float threshold);
+
+// Renumbers the vertices in the order the indices first use them, so that vertex
+// fetch walks the buffer forwards; run it last, on the final triangle order. Writes
+// the referenced vertices to destination, which must not overlap vertices and have
+// room for vertexCount of them, rewrites the indices in place and returns how many
+// vertices are left.
+uint32_t optimizeVertexFetch(void* destination, uint32_t* indices, size_t indexCount, const void* vertices,
+    size_t vertexCount, size_t vertexSize);
@@ -0,0 +1,493 @@
+#include "pch.h"
+#include "mesh/obj_parser.h"
+#include "mesh/mapped_file.h"
+#include "tiny_obj_loader.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+
+namespace {
+    // below this a chunk isn't worth a thread
+    const size_t MIN_CHUNK_SIZE = 256 * 1024;
+    // chunks per thread, so a thread that finishes early picks up more work
+    const size_t CHUNKS_PER_THREAD = 4;
+
+    // components of an index_t resolved against the chunk's counts, not yet global
+    const uint8_t RELATIVE_VERTEX = 1;
+    const uint8_t RELATIVE_NORMAL = 2;
+    const uint8_t RELATIVE_TEXCOORD = 4;
+
+    // exactly representable as doubles, so one multiply or divide rounds correctly
+    const double POWERS_OF_TEN[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const uint64_t MAX_EXACT_MANTISSA = 1ull << 53;
+
+    // one run of faces of a shape; a shape can be spread over several chunks
+    struct Part {
+        // o or g; otherwise the faces belong to the shape the chunk before ended in
+        bool startsShape = false;
+        std::string name{};
+        std::vector<tinyobj::index_t> indices{};
+        // RELATIVE_* per index, from the first negative index on; empty before that
+        bool hasRelative = false;
+        std::vector<uint8_t> relative{};
+        // where the merge puts it
+        size_t shape = 0;
+        size_t offset = 0;
+    };
+
+    struct Chunk {
+        const char* begin = nullptr;
+        const char* end = nullptr;
+
+        std::vector<tinyobj::real_t> vertices{};
+        std::vector<tinyobj::real_t> colors{};
+        std::vector<tinyobj::real_t> normals{};
+        std::vector<tinyobj::real_t> texcoords{};
+        std::vector<Part> parts{};
+        std::string error{};
+
+        // elements in the chunks before this one
+        int vertexBase = 0;
+        int normalBase = 0;
+        int texcoordBase = 0;
+
+        // reused for every face
+        std::vector<tinyobj::index_t> face{};
+        std::vector<uint8_t> faceRelative{};
+    };
+
+    bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    const char* skipSpaces(const char* p, const char* end) {
+        while (p < end && isSpace(*p)) {
+            p++;
+        }
+        return p;
+    }
+
+    // the number at p, up to the next space or slash. Up to 19 significant digits
+    // and exponents up to 22 (nearly everything exporters write) are done in integer
+    // math and one correctly rounded multiply; the rest goes through strtod
+    bool parseFloat(const char*& p, const char* end, tinyobj::real_t& value) {
+        p = skipSpaces(p, end);
+        const char* start = p;
+
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            p++;
+        }
+
+        uint64_t mantissa = 0;
+        int significantDigits = 0;
+        int exponent = 0;
+        bool exact = true;
+        bool anyDigits = false;
+
+        for (; p < end && isDigit(*p); p++) {
+            anyDigits = true;
+            if (significantDigits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                significantDigits += mantissa != 0 ? 1 : 0;
+            } else {
+                exact = false;
+            }
+        }
+
+        if (p < end && *p == '.') {
+            for (p++; p < end && isDigit(*p); p++) {
+                anyDigits = true;
+                if (significantDigits < 19) {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    significantDigits += mantissa != 0 ? 1 : 0;
+                    exponent--;
+                } else {
+                    exact = false;
+                }
+            }
+        }
+
+        if (!anyDigits) {
+            p = start;
+            return false;
+        }
+
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            const char* exponentStart = p++;
+            bool negativeExponent = false;
+            if (p < end && (*p == '-' || *p == '+')) {
+                negativeExponent = *p == '-';
+                p++;
+            }
+
+            if (p < end && isDigit(*p)) {
+                int written = 0;
+                for (; p < end && isDigit(*p); p++) {
+                    written = std::min(written * 10 + (*p - '0'), 100000);
+                }
+                exponent += negativeExponent ? -written : written;
+            } else {
+                // not an exponent after all
+                p = exponentStart;
+            }
+        }
+
+        if (exact && mantissa <= MAX_EXACT_MANTISSA && exponent >= -22 && exponent <= 22) {
+            double result = static_cast<double>(mantissa);
+            result = exponent < 0 ? result / POWERS_OF_TEN[-exponent] : result * POWERS_OF_TEN[exponent];
+            value = static_cast<tinyobj::real_t>(negative ? -result : result);
+            return true;
+        }
+
+        // the mapping isn't null terminated
+        std::string text(start, p);
+        value = static_cast<tinyobj::real_t>(strtod(text.c_str(), nullptr));
+        return true;
+    }
+
+    bool parseInt(const char*& p, const char* end, int& value) {
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            p++;
+        }
+        if (p >= end || !isDigit(*p)) {
+            return false;
+        }
+
+        int64_t result = 0;
+        for (; p < end && isDigit(*p); p++) {
+            result = std::min<int64_t>(result * 10 + (*p - '0'), INT32_MAX);
+        }
+        value = static_cast<int>(negative ? -result : result);
+        return true;
+    }
+
+    // like tinyobj's fixIndex, but negative indices stay relative to the chunk
+    bool resolveIndex(int raw, int chunkCount, uint8_t relativeBit, int& index, uint8_t& relative) {
+        if (raw > 0) {
+            index = raw - 1;
+            return true;
+        }
+        if (raw < 0) {
+            index = chunkCount + raw;
+            relative |= relativeBit;
+            return true;
+        }
+        // zero is not allowed by the spec
+        return false;
+    }
+
+    Part& currentPart(Chunk& chunk) {
+        if (chunk.parts.empty()) {
+            chunk.parts.emplace_back();
+        }
+        return chunk.parts.back();
+    }
+
+    bool parseFace(Chunk& chunk, const char* p, const char* end) {
+        int vertexCount = static_cast<int>(chunk.vertices.size() / 3);
+        int normalCount = static_cast<int>(chunk.normals.size() / 3);
+        int texcoordCount = static_cast<int>(chunk.texcoords.size() / 2);
+
+        chunk.face.clear();
+        chunk.faceRelative.clear();
+        for (p = skipSpaces(p, end); p < end; p = skipSpaces(p, end)) {
+            tinyobj::index_t index{ -1, -1, -1 };
+            uint8_t relative = 0;
+            int raw = 0;
+
+            if (!parseInt(p, end, raw) || !resolveIndex(raw, vertexCount, RELATIVE_VERTEX, index.vertex_index, relative)) {
+                return false;
+            }
+            if (p < end && *p == '/') {
+                p++;
+                if (p < end && *p != '/') {
+                    if (!parseInt(p, end, raw) || !resolveIndex(raw, texcoordCount, RELATIVE_TEXCOORD, index.texcoord_index, relative)) {
+                        return false;
+                    }
+                }
+                if (p < end && *p == '/') {
+                    p++;
+                    if (!parseInt(p, end, raw) || !resolveIndex(raw, normalCount, RELATIVE_NORMAL, index.normal_index, relative)) {
+                        return false;
+                    }
+                }
+            }
+
+            chunk.face.push_back(index);
+            chunk.faceRelative.push_back(relative);
+        }
+
+        if (chunk.face.size() < 3) {
+            return true;
+        }
+
+        Part& part = currentPart(chunk);
+        bool anyRelative = std::any_of(chunk.faceRelative.begin(), chunk.faceRelative.end(), [](uint8_t relative) { return relative != 0; });
+        if (anyRelative && !part.hasRelative) {
+            part.hasRelative = true;
+            part.relative.resize(part.indices.size(), 0);
+        }
+
+        for (size_t k = 1; k + 1 < chunk.face.size(); k++) {
+            for (size_t corner : { size_t(0), k, k + 1 }) {
+                part.indices.push_back(chunk.face[corner]);
+                if (part.hasRelative) {
+                    part.relative.push_back(chunk.faceRelative[corner]);
+                }
+            }
+        }
+        return true;
+    }
+
+    // p is past the leading spaces, end before the newline
+    bool parseLine(Chunk& chunk, const char* p, const char* end) {
+        if (p >= end || *p == '#') {
+            return true;
+        }
+
+        char keyword = p[0];
+        char next = p + 1 < end ? p[1] : ' ';
+
+        if (keyword == 'v' && isSpace(next)) {
+            tinyobj::real_t x, y, z;
+            p++;
+            if (!parseFloat(p, end, x) || !parseFloat(p, end, y) || !parseFloat(p, end, z)) {
+                return false;
+            }
+            chunk.vertices.insert(chunk.vertices.end(), { x, y, z });
+
+            tinyobj::real_t r, g, b;
+            if (parseFloat(p, end, r) && parseFloat(p, end, g) && parseFloat(p, end, b)) {
+                chunk.colors.insert(chunk.colors.end(), { r, g, b });
+            } else {
+                chunk.colors.insert(chunk.colors.end(), { 1.0f, 1.0f, 1.0f });
+            }
+            return true;
+        }
+
+        if (keyword == 'v' && next == 't') {
+            tinyobj::real_t u, v = 0.0f;
+            p += 2;
+            if (!parseFloat(p, end, u)) {
+                return false;
+            }
+            parseFloat(p, end, v);
+            chunk.texcoords.insert(chunk.texcoords.end(), { u, v });
+            return true;
+        }
+
+        if (keyword == 'v' && next == 'n') {
+            tinyobj::real_t x, y, z;
+            p += 2;
+            if (!parseFloat(p, end, x) || !parseFloat(p, end, y) || !parseFloat(p, end, z)) {
+                return false;
+            }
+            chunk.normals.insert(chunk.normals.end(), { x, y, z });
+            return true;
+        }
+
+        if (keyword == 'f' && isSpace(next)) {
+            return parseFace(chunk, p + 1, end);
+        }
+
+        if ((keyword == 'o' || keyword == 'g') && isSpace(next)) {
+            const char* nameEnd = end;
+            while (nameEnd > p && isSpace(nameEnd[-1])) {
+                nameEnd--;
+            }
+
+            Part part{};
+            part.startsShape = true;
+            part.name.assign(skipSpaces(p + 1, nameEnd), nameEnd);
+            chunk.parts.push_back(std::move(part));
+        }
+
+        return true;
+    }
+
+    void parseChunk(Chunk& chunk) {
+        const char* p = chunk.begin;
+        while (p < chunk.end) {
+            const char* lineEnd = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+            if (lineEnd == nullptr) {
+                lineEnd = chunk.end;
+            }
+
+            if (!parseLine(chunk, skipSpaces(p, lineEnd), lineEnd)) {
+                chunk.error = "malformed line: " + std::string(p, std::min<size_t>(lineEnd - p, 80));
+                return;
+            }
+            p = lineEnd + 1;
+        }
+    }
+
+    // copies the chunk's part of everything into place, making its indices global
+    void mergeChunk(Chunk& chunk, tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes) {
+        std::copy(chunk.vertices.begin(), chunk.vertices.end(), attrib.vertices.begin() + 3 * static_cast<size_t>(chunk.vertexBase));
+        std::copy(chunk.colors.begin(), chunk.colors.end(), attrib.colors.begin() + 3 * static_cast<size_t>(chunk.vertexBase));
+        std::copy(chunk.normals.begin(), chunk.normals.end(), attrib.normals.begin() + 3 * static_cast<size_t>(chunk.normalBase));
+        std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), attrib.texcoords.begin() + 2 * static_cast<size_t>(chunk.texcoordBase));
+
+        int vertexCount = static_cast<int>(attrib.vertices.size() / 3);
+        int normalCount = static_cast<int>(attrib.normals.size() / 3);
+        int texcoordCount = static_cast<int>(attrib.texcoords.size() / 2);
+
+        for (const auto& part : chunk.parts) {
+            tinyobj::index_t* out = shapes[part.shape].mesh.indices.data() + part.offset;
+            for (size_t i = 0; i < part.indices.size(); i++) {
+                tinyobj::index_t index = part.indices[i];
+                if (part.hasRelative) {
+                    uint8_t relative = part.relative[i];
+                    index.vertex_index += (relative & RELATIVE_VERTEX) ? chunk.vertexBase : 0;
+                    index.normal_index += (relative & RELATIVE_NORMAL) ? chunk.normalBase : 0;
+                    index.texcoord_index += (relative & RELATIVE_TEXCOORD) ? chunk.texcoordBase : 0;
+                }
+
+                // -1 is a missing component, anything else has to exist
+                bool valid = index.vertex_index >= 0 && index.vertex_index < vertexCount &&
+                    index.normal_index >= -1 && index.normal_index < normalCount &&
+                    index.texcoord_index >= -1 && index.texcoord_index < texcoordCount;
+                if (!valid) {
+                    chunk.error = "face index out of range in shape '" + shapes[part.shape].name + "'";
+                    return;
+                }
+                out[i] = index;
+            }
+        }
+    }
+
+    // calls fn(i) for every i in [0, count) on up to threadCount threads, the calling
+    // one included
+    template<typename Fn>
+    void parallelFor(size_t count, uint32_t threadCount, Fn fn) {
+        std::atomic<size_t> next{ 0 };
+        auto worker = [&]() {
+            for (size_t i = next++; i < count; i = next++) {
+                fn(i);
+            }
+        };
+
+        std::vector<std::thread> threads{};
+        for (uint32_t t = 1; t < std::min<size_t>(threadCount, count); t++) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+}
+
+bool loadObjParallel(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes, std::string* err,
+    const std::string& path, uint32_t threadCount) {
+    *attrib = tinyobj::attrib_t{};
+    shapes->clear();
+
+    MappedFile file{};
+    if (!file.open(path)) {
+        *err = "Cannot open file [" + path + "]";
+        return false;
+    }
+
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // chunk boundaries move forward to the next line start
+    const char* data = file.getData();
+    size_t size = file.getSize();
+    size_t chunkCount = std::max<size_t>(1, std::min(size / MIN_CHUNK_SIZE, threadCount * CHUNKS_PER_THREAD));
+
+    std::vector<Chunk> chunks(chunkCount);
+    const char* begin = data;
+    for (size_t i = 0; i < chunkCount; i++) {
+        const char* end = data + size * (i + 1) / chunkCount;
+        if (i + 1 < chunkCount) {
+            const char* newline = static_cast<const char*>(memchr(end, '\n', data + size - end));
+            end = newline != nullptr ? newline + 1 : data + size;
+        }
+        chunks[i].begin = begin;
+        chunks[i].end = std::max(begin, end);
+        begin = chunks[i].end;
+    }
+
+    parallelFor(chunkCount, threadCount, [&](size_t i) {
+        parseChunk(chunks[i]);
+    });
+
+    for (const auto& chunk : chunks) {
+        if (!chunk.error.empty()) {
+            *err = path + ": " + chunk.error;
+            file.close();
+            return false;
+        }
+    }
+
+    // the element counts before each chunk, and where each part of a shape goes
+    size_t vertexCount = 0;
+    size_t normalCount = 0;
+    size_t texcoordCount = 0;
+    for (auto& chunk : chunks) {
+        chunk.vertexBase = static_cast<int>(vertexCount);
+        chunk.normalBase = static_cast<int>(normalCount);
+        chunk.texcoordBase = static_cast<int>(texcoordCount);
+        vertexCount += chunk.vertices.size() / 3;
+        normalCount += chunk.normals.size() / 3;
+        texcoordCount += chunk.texcoords.size() / 2;
+
+        for (auto& part : chunk.parts) {
+            if (part.startsShape || shapes->empty()) {
+                shapes->emplace_back();
+                shapes->back().name = part.name;
+            }
+            part.shape = shapes->size() - 1;
+            part.offset = shapes->back().mesh.indices.size();
+            shapes->back().mesh.indices.resize(part.offset + part.indices.size());
+        }
+    }
+
+    attrib->vertices.resize(3 * vertexCount);
+    attrib->colors.resize(3 * vertexCount);
+    attrib->normals.resize(3 * normalCount);
+    attrib->texcoords.resize(2 * texcoordCount);
+
+    parallelFor(chunkCount, threadCount, [&](size_t i) {
+        mergeChunk(chunks[i], *attrib, *shapes);
+    });
+    file.close();
+
+    for (const auto& chunk : chunks) {
+        if (!chunk.error.empty()) {
+            *err = path + ": " + chunk.error;
+            return false;
+        }
+    }
+
+    // LoadObj leaves out shapes without faces
+    shapes->erase(std::remove_if(shapes->begin(), shapes->end(), [](const tinyobj::shape_t& shape) {
+        return shape.mesh.indices.empty();
+    }), shapes->end());
+
+    for (auto& shape : *shapes) {
+        size_t faceCount = shape.mesh.indices.size() / 3;
+        shape.mesh.num_face_vertices.assign(faceCount, 3);
+        shape.mesh.material_ids.assign(faceCount, -1);
+        shape.mesh.smoothing_group_ids.assign(faceCount, 0);
+    }
+
+    return true;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// tiny_obj_loader.h carries its implementation, which main.cpp includes; only the
+// types are needed here
+namespace tinyobj {
+    struct attrib_t;
+    struct shape_t;
+}
+
+// Parallel alternative to tinyobj::LoadObj for the geometry of an OBJ file.
+//
+// The file is mapped and cut into line aligned chunks that worker threads parse on
+// their own, with a float parser that handles the common short decimals without
+// strtod. Each chunk counts its own v/vt/vn, so positive face indices are final right
+// away and negative (relative) ones are resolved against the chunk's counts; the
+// merge adds the number of elements in the chunks before it, in parallel again, so
+// the result is the same as a parse from the start of the file.
+//
+// Fills the same attrib_t and shape_t as LoadObj with triangulate on, minus what the
+// importer doesn't use:
+// - v (with optional vertex colors, white otherwise), vt and vn; no weights or w
+// - f, triangulated as a fan, which matches ear clipping for the convex faces
+//   exporters write; faces with fewer than 3 vertices are skipped
+// - shapes start at o and g; usemtl doesn't split them, and material ids are -1
+//   and smoothing groups 0, since materials aren't loaded
+// - l, p and everything else is ignored
+//
+// threadCount 0 uses every hardware thread. Small files are parsed on the calling
+// thread. Returns false with err set for unreadable files and out of range indices.
+bool loadObjParallel(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes, std::string* err,
+    const std::string& path, uint32_t threadCount = 0);
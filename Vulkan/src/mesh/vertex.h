@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstddef>
+#include <cstdint>
+
+// for the std::hash specializations of the glm types
+#ifndef GLM_ENABLE_EXPERIMENTAL
+#define GLM_ENABLE_EXPERIMENTAL
+#endif
+#include <glm/glm.hpp>
+#include <glm/gtx/hash.hpp>
+
+#include "mesh/vertex_format.h"
+
+// Vertex layout of the meshes as imported. Nothing but 32-bit floats, which
+// weldVertices relies on.
+struct Vertex {
+    glm::vec3 pos;
+    glm::vec3 color;
+    glm::vec2 texCoord;
+
+    typedef VertexFormat<
+        VertexAttribute<0, VK_FORMAT_R32G32B32_SFLOAT, glm::vec3>,
+        VertexAttribute<1, VK_FORMAT_R32G32B32_SFLOAT, glm::vec3>,
+        VertexAttribute<2, VK_FORMAT_R32G32_SFLOAT, glm::vec2>> Format;
+
+    bool operator==(const Vertex& other) const {
+        return pos == other.pos && color == other.color && texCoord == other.texCoord;
+    }
+};
+
+static_assert(sizeof(Vertex) == Vertex::Format::STRIDE, "Vertex doesn't match its format");
+static_assert(offsetof(Vertex, color) == Vertex::Format::getOffset(1), "Vertex doesn't match its format");
+static_assert(offsetof(Vertex, texCoord) == Vertex::Format::getOffset(2), "Vertex doesn't match its format");
+
+// What the graphics pipeline draws with the compact vertex shader: 12 bytes instead
+// of 32. Positions are snorm16 within the mesh's bounds and texture coordinates
+// unorm16 within their range, both mapped back by the mesh's MeshQuantization; the
+// color, white for every imported vertex, is left to the shader.
+struct CompactVertex {
+    // w is padding: few devices fetch three component 16-bit formats
+    int16_t pos[4];
+    uint16_t texCoord[2];
+
+    typedef VertexFormat<
+        VertexAttribute<0, VK_FORMAT_R16G16B16A16_SNORM, int16_t[4]>,
+        VertexAttribute<1, VK_FORMAT_R16G16_UNORM, uint16_t[2]>> Format;
+};
+
+static_assert(sizeof(CompactVertex) == CompactVertex::Format::STRIDE, "CompactVertex doesn't match its format");
+static_assert(offsetof(CompactVertex, texCoord) == CompactVertex::Format::getOffset(1), "CompactVertex doesn't match its format");
+
+namespace std {
+    template<> struct hash<Vertex> {
+        size_t operator()(Vertex const& vertex) const {
+            return ((hash<glm::vec3>()(vertex.pos) ^
+                (hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
+                    (hash<glm::vec2>()(vertex.texCoord) << 1);
+        }
+    };
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// bytes per element of the formats vertex attributes use; 0 for the others, which
+// VertexAttribute rejects until they are added here
+constexpr uint32_t getVertexFormatSize(VkFormat format) {
+    switch (format) {
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+        return 16;
+    case VK_FORMAT_R32G32B32_SFLOAT:
+        return 12;
+    case VK_FORMAT_R32G32_SFLOAT:
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+    case VK_FORMAT_R16G16B16A16_SNORM:
+    case VK_FORMAT_R16G16B16A16_UNORM:
+        return 8;
+    case VK_FORMAT_R32_SFLOAT:
+    case VK_FORMAT_R16G16_SFLOAT:
+    case VK_FORMAT_R16G16_SNORM:
+    case VK_FORMAT_R16G16_UNORM:
+    case VK_FORMAT_R8G8B8A8_SNORM:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+// One attribute of a vertex format: the shader location it feeds, its Vulkan format
+// and the C++ type it is stored as.
+template<uint32_t Location, VkFormat Format, typename T>
+struct VertexAttribute {
+    static constexpr uint32_t LOCATION = Location;
+    static constexpr VkFormat FORMAT = Format;
+    typedef T Type;
+
+    static_assert(getVertexFormatSize(Format) != 0, "vertex attribute format missing from getVertexFormatSize");
+    static_assert(getVertexFormatSize(Format) == sizeof(T), "vertex attribute type doesn't match its format");
+};
+
+// A vertex layout as a compile-time list of attributes, packed in the order given
+// into one interleaved binding. The binding and attribute descriptions are generated
+// from it, so a vertex struct declares its layout once:
+//
+//  struct V {
+//      glm::vec3 pos;
+//      uint16_t texCoord[2];
+//      typedef VertexFormat<VertexAttribute<0, VK_FORMAT_R32G32B32_SFLOAT, glm::vec3>,
+//          VertexAttribute<1, VK_FORMAT_R16G16_UNORM, uint16_t[2]>> Format;
+//  };
+//
+// The struct has to match: static_assert its size against STRIDE, which rules out
+// padding, and its members' offsets against getOffset.
+template<typename... Attributes>
+struct VertexFormat {
+    static constexpr uint32_t ATTRIBUTE_COUNT = sizeof...(Attributes);
+    static constexpr uint32_t STRIDE = (0 + ... + static_cast<uint32_t>(sizeof(typename Attributes::Type)));
+
+    static_assert(ATTRIBUTE_COUNT > 0, "a vertex format needs at least one attribute");
+
+    // byte offset of attribute i within the vertex
+    static constexpr uint32_t getOffset(uint32_t i) {
+        constexpr uint32_t sizes[] = { static_cast<uint32_t>(sizeof(typename Attributes::Type))... };
+        uint32_t offset = 0;
+        for (uint32_t a = 0; a < i; a++) {
+            offset += sizes[a];
+        }
+        return offset;
+    }
+
+    // every attribute at a multiple of its component size, as vertex fetch needs
+    static constexpr bool isAligned() {
+        constexpr uint32_t alignments[] = { static_cast<uint32_t>(alignof(typename Attributes::Type))... };
+        for (uint32_t a = 0; a < ATTRIBUTE_COUNT; a++) {
+            if (getOffset(a) % alignments[a] != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static VkVertexInputBindingDescription getBindingDescription(uint32_t binding = 0) {
+        VkVertexInputBindingDescription desc{};
+        desc.binding = binding;
+        desc.stride = STRIDE;
+        desc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        return desc;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, ATTRIBUTE_COUNT> getAttributeDescriptions(uint32_t binding = 0) {
+        static_assert(isAligned(), "vertex attribute not aligned to its type; order the attributes by size");
+        return { { makeAttribute<Attributes>(binding, getOffset(indexOf<Attributes>()))... } };
+    }
+
+private:
+    template<typename Attribute>
+    static VkVertexInputAttributeDescription makeAttribute(uint32_t binding, uint32_t offset) {
+        VkVertexInputAttributeDescription attr{};
+        attr.binding = binding;
+        attr.location = Attribute::LOCATION;
+        attr.format = Attribute::FORMAT;
+        attr.offset = offset;
+
+        return attr;
+    }
+
+    template<typename Attribute>
+    static constexpr uint32_t indexOf() {
+        constexpr bool matches[] = { std::is_same<Attribute, Attributes>::value... };
+        for (uint32_t a = 0; a < ATTRIBUTE_COUNT; a++) {
+            if (matches[a]) {
+                return a;
+            }
+        }
+        return ATTRIBUTE_COUNT;
+    }
+};
@@ -0,0 +1,63 @@
+#include "pch.h"
+#include "mesh/vertex_quantize.h"
+
+#include <cmath>
+#include <algorithm>
+
+int16_t quantizeSnorm16(float value) {
+    value = std::min(std::max(value, -1.0f), 1.0f);
+    return static_cast<int16_t>(std::lround(value * 32767.0f));
+}
+
+uint16_t quantizeUnorm16(float value) {
+    value = std::min(std::max(value, 0.0f), 1.0f);
+    return static_cast<uint16_t>(std::lround(value * 65535.0f));
+}
+
+MeshQuantization quantizeVertices(const Vertex* vertices, size_t count, CompactVertex* compactVertices) {
+    MeshQuantization quantization{};
+    if (count == 0) {
+        return quantization;
+    }
+
+    glm::vec3 positionMin = vertices[0].pos;
+    glm::vec3 positionMax = vertices[0].pos;
+    glm::vec2 texCoordMin = vertices[0].texCoord;
+    glm::vec2 texCoordMax = vertices[0].texCoord;
+    for (size_t i = 1; i < count; i++) {
+        positionMin = glm::min(positionMin, vertices[i].pos);
+        positionMax = glm::max(positionMax, vertices[i].pos);
+        texCoordMin = glm::min(texCoordMin, vertices[i].texCoord);
+        texCoordMax = glm::max(texCoordMax, vertices[i].texCoord);
+    }
+
+    // a flat axis stores 0 and gets all of its value from the bias
+    float positionInverse[3];
+    for (int a = 0; a < 3; a++) {
+        float halfExtent = (positionMax[a] - positionMin[a]) * 0.5f;
+        quantization.positionScale[a] = halfExtent;
+        quantization.positionBias[a] = positionMin[a] + halfExtent;
+        positionInverse[a] = halfExtent > 0.0f ? 1.0f / halfExtent : 0.0f;
+    }
+
+    float texCoordInverse[2];
+    for (int a = 0; a < 2; a++) {
+        float extent = texCoordMax[a] - texCoordMin[a];
+        quantization.texCoordScale[a] = extent;
+        quantization.texCoordBias[a] = texCoordMin[a];
+        texCoordInverse[a] = extent > 0.0f ? 1.0f / extent : 0.0f;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        CompactVertex& compact = compactVertices[i];
+        for (int a = 0; a < 3; a++) {
+            compact.pos[a] = quantizeSnorm16((vertices[i].pos[a] - quantization.positionBias[a]) * positionInverse[a]);
+        }
+        compact.pos[3] = 0;
+
+        for (int a = 0; a < 2; a++) {
+            compact.texCoord[a] = quantizeUnorm16((vertices[i].texCoord[a] - quantization.texCoordBias[a]) * texCoordInverse[a]);
+        }
+    }
+    return quantization;
+}
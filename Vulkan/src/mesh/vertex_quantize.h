@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mesh/mesh_cache.h"
+#include "mesh/vertex.h"
+
+// rounded to nearest, clamped to [-1, 1] and [0, 1]; the shader reads back
+// value / 32767 and value / 65535
+int16_t quantizeSnorm16(float value);
+uint16_t quantizeUnorm16(float value);
+
+// Writes the CompactVertex of each of count vertices and returns the quantization
+// that maps them back. Positions are scaled per axis into [-1, 1] around the center
+// of their bounds and texture coordinates into [0, 1] from their minimum, so the
+// step is 1/65534 of the mesh's extent on every axis whatever its size or place,
+// and texture coordinates outside [0, 1] (tiling) survive.
+MeshQuantization quantizeVertices(const Vertex* vertices, size_t count, CompactVertex* compactVertices);
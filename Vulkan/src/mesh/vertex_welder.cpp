@@ -0,0 +1,178 @@
+#include "pch.h"
+#include "mesh/vertex_welder.h"
+
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+namespace {
+    const uint32_t EMPTY = UINT32_MAX;
+    // input vertices per thread below which threads cost more than they save
+    const size_t MIN_VERTICES_PER_THREAD = 64 * 1024;
+
+    struct Slot {
+        // the hash bits the slot index doesn't already hold
+        uint32_t tag = 0;
+        uint32_t index = EMPTY;
+    };
+
+    // a table at most 2/3 full when every vertex is distinct
+    size_t tableSize(size_t count) {
+        size_t size = 16;
+        while (size < count + count / 2) {
+            size *= 2;
+        }
+        return size;
+    }
+
+    uint64_t hashVertex(const char* vertex, uint32_t wordCount) {
+        uint64_t h = 0x9e3779b97f4a7c15ull;
+        for (uint32_t i = 0; i < wordCount; i++) {
+            uint32_t bits;
+            memcpy(&bits, vertex + i * sizeof(uint32_t), sizeof(bits));
+            // -0 compares equal to 0, so it has to hash the same
+            bits = (bits & 0x7fffffff) == 0 ? 0 : bits;
+
+            h ^= bits;
+            h *= 0xff51afd7ed558ccdull;
+            h ^= h >> 32;
+        }
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 29;
+        return h;
+    }
+
+    bool equalVertices(const char* a, const char* b, uint32_t wordCount) {
+        for (uint32_t i = 0; i < wordCount; i++) {
+            float x, y;
+            memcpy(&x, a + i * sizeof(float), sizeof(x));
+            memcpy(&y, b + i * sizeof(float), sizeof(y));
+            if (!(x == y)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // a table over some of the input vertices; index is the first input vertex with
+    // that value, looked up in place rather than copied
+    class WeldTable {
+    public:
+        explicit WeldTable(size_t capacity) : slots(tableSize(capacity)), mask(slots.size() - 1) {}
+
+        // the slot of the first vertex equal to input vertex i, filling it if there's none
+        Slot& find(const char* input, uint32_t vertexSize, uint32_t i, uint64_t hash) {
+            uint32_t wordCount = vertexSize / sizeof(float);
+            uint32_t tag = static_cast<uint32_t>(hash >> 32);
+
+            for (size_t slot = static_cast<size_t>(hash) & mask;; slot = (slot + 1) & mask) {
+                Slot& entry = slots[slot];
+                if (entry.index == EMPTY) {
+                    entry.tag = tag;
+                    entry.index = i;
+                    return entry;
+                }
+                if (entry.tag == tag && equalVertices(input + static_cast<size_t>(entry.index) * vertexSize, input + static_cast<size_t>(i) * vertexSize, wordCount)) {
+                    return entry;
+                }
+            }
+        }
+
+    private:
+        std::vector<Slot> slots;
+        size_t mask;
+    };
+
+    template<typename Fn>
+    void parallelFor(uint32_t count, Fn fn) {
+        std::vector<std::thread> threads{};
+        for (uint32_t i = 1; i < count; i++) {
+            threads.emplace_back(fn, i);
+        }
+        fn(0);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    uint32_t weldSerial(const char* input, size_t count, uint32_t vertexSize, char* output, uint32_t* indices) {
+        uint32_t wordCount = vertexSize / sizeof(float);
+        WeldTable table(count);
+
+        uint32_t uniqueCount = 0;
+        for (size_t i = 0; i < count; i++) {
+            const char* vertex = input + i * vertexSize;
+            uint32_t firstUse = table.find(input, vertexSize, static_cast<uint32_t>(i), hashVertex(vertex, wordCount)).index;
+            if (firstUse == i) {
+                memcpy(output + static_cast<size_t>(uniqueCount) * vertexSize, vertex, vertexSize);
+                indices[i] = uniqueCount++;
+            } else {
+                indices[i] = indices[firstUse];
+            }
+        }
+        return uniqueCount;
+    }
+
+    uint32_t weldSharded(const char* input, size_t count, uint32_t vertexSize, char* output, uint32_t* indices, uint32_t threadCount) {
+        uint32_t wordCount = vertexSize / sizeof(float);
+
+        // one shard per thread, picked by the high hash bits; the slots use the low ones
+        uint32_t shardCount = threadCount;
+        auto shardOf = [&](uint64_t hash) { return static_cast<uint32_t>(((hash >> 32) * shardCount) >> 32); };
+
+        // hashes, and how many vertices each range puts into each shard
+        std::vector<uint64_t> hashes(count);
+        std::vector<size_t> shardSizes(static_cast<size_t>(threadCount) * shardCount, 0);
+        parallelFor(threadCount, [&](uint32_t t) {
+            size_t begin = count * t / threadCount;
+            size_t end = count * (t + 1) / threadCount;
+            size_t* sizes = shardSizes.data() + static_cast<size_t>(t) * shardCount;
+            for (size_t i = begin; i < end; i++) {
+                hashes[i] = hashVertex(input + i * vertexSize, wordCount);
+                sizes[shardOf(hashes[i])]++;
+            }
+        });
+
+        // every input vertex is mapped to the first equal one; shards never share a
+        // vertex value, so their threads write disjoint entries
+        std::vector<uint32_t> firstUse(count);
+        parallelFor(shardCount, [&](uint32_t shard) {
+            size_t size = 0;
+            for (uint32_t t = 0; t < threadCount; t++) {
+                size += shardSizes[static_cast<size_t>(t) * shardCount + shard];
+            }
+
+            WeldTable table(size);
+            for (size_t i = 0; i < count; i++) {
+                if (shardOf(hashes[i]) == shard) {
+                    firstUse[i] = table.find(input, vertexSize, static_cast<uint32_t>(i), hashes[i]).index;
+                }
+            }
+        });
+
+        // numbered in order of first use, like the serial weld; a first use always
+        // comes before the vertices that map to it
+        uint32_t uniqueCount = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (firstUse[i] == i) {
+                memcpy(output + static_cast<size_t>(uniqueCount) * vertexSize, input + i * vertexSize, vertexSize);
+                indices[i] = uniqueCount++;
+            } else {
+                indices[i] = indices[firstUse[i]];
+            }
+        }
+        return uniqueCount;
+    }
+}
+
+uint32_t weldVertices(const void* vertices, size_t count, uint32_t vertexSize, void* uniqueVertices, uint32_t* indices, uint32_t threadCount) {
+    const char* input = static_cast<const char*>(vertices);
+    char* output = static_cast<char*>(uniqueVertices);
+
+    threadCount = static_cast<uint32_t>(std::min<size_t>(std::max(threadCount, 1u), std::max<size_t>(count / MIN_VERTICES_PER_THREAD, 1)));
+    if (threadCount == 1) {
+        return weldSerial(input, count, vertexSize, output, indices);
+    }
+    return weldSharded(input, count, vertexSize, output, indices, threadCount);
+}
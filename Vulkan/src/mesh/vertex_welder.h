@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Merges equal vertices of a mesh given as one vertex per index (what an OBJ import
+// produces before deduplication). Writes each distinct vertex once to uniqueVertices,
+// in order of first use, and the index of every input vertex's copy to indices;
+// returns the number of distinct vertices. The result is the same as inserting the
+// vertices one by one into an unordered_map from vertex to index, as long as there
+// are no NaNs.
+//
+// Vertices are vertexSize bytes of 32-bit floats and compare equal when all their
+// floats do, so 0 and -0 are the same and NaNs never match. They are hashed on
+// their bits, with -0 folded into 0, into an open addressing table sized from count
+// up front: linear probing over 8 byte slots that keep part of the hash, so most
+// probes are rejected without touching the vertices, and nothing is allocated per
+// vertex.
+//
+// With threadCount above 1 the hashes are computed in parallel and the vertices are
+// split by hash into one table per shard, each filled by its own thread; a last
+// serial pass numbers them in order of first use.
+//
+// uniqueVertices needs room for count vertices, and indices for count indices.
+uint32_t weldVertices(const void* vertices, size_t count, uint32_t vertexSize, void* uniqueVertices, uint32_t* indices,
+    uint32_t threadCount = 1);
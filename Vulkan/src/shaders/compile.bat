@@ -1,4 +1,6 @@
 #!/bin/bash
 
 glslc.exe -fshader-stage=vertex shader.vert.glsl -o vert.spv
-glslc.exe -fshader-stage=fragment shader.frag.glsl -o frag.spv
\ No newline at end of file
+glslc.exe -fshader-stage=vertex shader_compact.vert.glsl -o vert_compact.spv
+glslc.exe -fshader-stage=fragment shader.frag.glsl -o frag.spv
+glslc.exe -fshader-stage=compute mipgen.comp.glsl -o mipgen.spv
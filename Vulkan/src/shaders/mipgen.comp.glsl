@@ -0,0 +1,124 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Writes up to 6 mip levels below the source level in one dispatch. Every workgroup
+// reduces a 64x64 texel tile of the source: the first two levels in registers, the
+// others through shared memory, so nothing is read back from the image.
+//
+// Odd extents clamp the second texel of a pair to the last one, like the CPU mip
+// generator does. sRGB images are bound through UNORM views; their color channels
+// are averaged in linear space.
+layout(local_size_x = 16, local_size_y = 16) in;
+
+layout(binding = 0, rgba8) uniform readonly image2D srcLevel;
+layout(binding = 1, rgba8) uniform writeonly image2D dstLevels[6];
+
+layout(push_constant) uniform Params {
+    ivec2 srcExtent;
+    // levels to write below the source, 1 to 6
+    int levelCount;
+    int srgb;
+} params;
+
+// the workgroup's texels of the last level written, linear
+shared vec4 tile[16][16];
+
+vec4 toLinear(vec4 c) {
+    if (params.srgb == 0) {
+        return c;
+    }
+    vec3 low = c.rgb / 12.92;
+    vec3 high = pow((c.rgb + 0.055) / 1.055, vec3(2.4));
+    return vec4(mix(high, low, lessThanEqual(c.rgb, vec3(0.04045))), c.a);
+}
+
+vec4 toSrgb(vec4 l) {
+    if (params.srgb == 0) {
+        return l;
+    }
+    vec3 low = l.rgb * 12.92;
+    vec3 high = 1.055 * pow(l.rgb, vec3(1.0 / 2.4)) - 0.055;
+    return vec4(mix(high, low, lessThanEqual(l.rgb, vec3(0.0031308))), l.a);
+}
+
+// level 0 is the source
+ivec2 levelExtent(int level) {
+    return max(params.srcExtent >> level, ivec2(1));
+}
+
+vec4 loadSource(ivec2 p) {
+    return toLinear(imageLoad(srcLevel, min(p, params.srcExtent - 1)));
+}
+
+// the array is indexed with constants only, so no dynamic indexing feature is needed
+void store(int level, ivec2 p, vec4 value) {
+    if (any(greaterThanEqual(p, levelExtent(level)))) {
+        return;
+    }
+
+    vec4 c = toSrgb(value);
+    switch (level) {
+    case 1: imageStore(dstLevels[0], p, c); break;
+    case 2: imageStore(dstLevels[1], p, c); break;
+    case 3: imageStore(dstLevels[2], p, c); break;
+    case 4: imageStore(dstLevels[3], p, c); break;
+    case 5: imageStore(dstLevels[4], p, c); break;
+    case 6: imageStore(dstLevels[5], p, c); break;
+    }
+}
+
+// texel p of the level in tile, whose group texels start at base. A group past the
+// level's edge (a 65 wide source has two groups but a 16 wide level 2) would index
+// before the tile; its texels aren't stored, so any texel of the tile will do
+vec4 loadTile(ivec2 base, ivec2 p, ivec2 extent) {
+    ivec2 local = max(min(base + p, extent - 1) - base, ivec2(0));
+    return tile[local.y][local.x];
+}
+
+void main() {
+    ivec2 group = ivec2(gl_WorkGroupID.xy);
+    ivec2 p2 = group * 16 + ivec2(gl_LocalInvocationID.xy);
+
+    // a 2x2 quad of level 1 from a 4x4 block of the source
+    vec4 quad[4];
+    for (int i = 0; i < 4; i++) {
+        ivec2 p1 = p2 * 2 + ivec2(i & 1, i >> 1);
+        ivec2 p0 = p1 * 2;
+        quad[i] = 0.25 * (loadSource(p0) + loadSource(p0 + ivec2(1, 0)) + loadSource(p0 + ivec2(0, 1)) + loadSource(p0 + ivec2(1, 1)));
+        store(1, p1, quad[i]);
+    }
+
+    if (params.levelCount < 2) {
+        return;
+    }
+
+    // the quad holds every level 1 texel this level 2 texel needs, clamped or not
+    ivec2 extent1 = levelExtent(1);
+    int dx = p2.x * 2 + 1 < extent1.x ? 1 : 0;
+    int dy = p2.y * 2 + 1 < extent1.y ? 2 : 0;
+    vec4 value = 0.25 * (quad[0] + quad[dx] + quad[dy] + quad[dx + dy]);
+    store(2, p2, value);
+    tile[gl_LocalInvocationID.y][gl_LocalInvocationID.x] = value;
+    barrier();
+
+    int index = int(gl_LocalInvocationIndex);
+    for (int level = 3, size = 8; level <= params.levelCount; level++, size >>= 1) {
+        bool active = index < size * size;
+        ivec2 local = ivec2(index % size, index / size);
+
+        if (active) {
+            ivec2 extent = levelExtent(level - 1);
+            ivec2 base = group * size * 2;
+            ivec2 p = local * 2;
+            value = 0.25 * (loadTile(base, p, extent) + loadTile(base, p + ivec2(1, 0), extent) +
+                loadTile(base, p + ivec2(0, 1), extent) + loadTile(base, p + ivec2(1, 1), extent));
+            store(level, group * size + local, value);
+        }
+        barrier();
+
+        if (active) {
+            tile[local.y][local.x] = value;
+        }
+        barrier();
+    }
+}
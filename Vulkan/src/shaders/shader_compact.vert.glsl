@@ -0,0 +1,27 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(binding = 0) uniform MVP {
+    mat4 view;
+    mat4 proj;
+} mvp;
+
+// the model matrix maps the snorm16 positions back to the mesh's bounds
+layout(push_constant) uniform Model {
+    mat4 model;
+    // xy scale, zw bias
+    vec4 texCoordScaleBias;
+} model;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec2 inTexCoord;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+
+void main() {
+    gl_Position = mvp.proj * mvp.view * model.model * vec4(inPosition, 1.0);
+    // the color every imported vertex has; not worth a vertex attribute
+    fragColor = vec3(1.0);
+    fragTexCoord = inTexCoord * model.texCoordScaleBias.xy + model.texCoordScaleBias.zw;
+}
@@ -0,0 +1,399 @@
+#include "pch.h"
+#include "sync/state_tracker.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+namespace {
+    const VkAccessFlags2 WRITE_ACCESS =
+        VK_ACCESS_2_SHADER_WRITE_BIT |
+        VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_2_TRANSFER_WRITE_BIT |
+        VK_ACCESS_2_HOST_WRITE_BIT |
+        VK_ACCESS_2_MEMORY_WRITE_BIT |
+        VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+    bool sameBarrier(const VkImageMemoryBarrier2& a, const VkImageMemoryBarrier2& b) {
+        return a.image == b.image &&
+            a.srcStageMask == b.srcStageMask && a.srcAccessMask == b.srcAccessMask &&
+            a.dstStageMask == b.dstStageMask && a.dstAccessMask == b.dstAccessMask &&
+            a.oldLayout == b.oldLayout && a.newLayout == b.newLayout &&
+            a.srcQueueFamilyIndex == b.srcQueueFamilyIndex && a.dstQueueFamilyIndex == b.dstQueueFamilyIndex &&
+            a.subresourceRange.baseArrayLayer == b.subresourceRange.baseArrayLayer &&
+            a.subresourceRange.layerCount == b.subresourceRange.layerCount;
+    }
+
+    // the level right after the previous barrier's range, going the same way, extends it
+    void appendBarrier(std::vector<VkImageMemoryBarrier2>& barriers, const VkImageMemoryBarrier2& barrier) {
+        if (!barriers.empty()) {
+            VkImageMemoryBarrier2& last = barriers.back();
+            if (sameBarrier(last, barrier) && last.subresourceRange.baseMipLevel + last.subresourceRange.levelCount == barrier.subresourceRange.baseMipLevel) {
+                last.subresourceRange.levelCount += barrier.subresourceRange.levelCount;
+                return;
+            }
+        }
+        barriers.push_back(barrier);
+    }
+}
+
+void ResourceStateTracker::addImage(VkImage image, VkImageAspectFlags aspectMask, uint32_t mipLevels, uint32_t arrayLayers, const ResourceState& state) {
+    SubresourceState initial{};
+    initial.layout = state.layout;
+    if (state.accessMask & WRITE_ACCESS) {
+        initial.writeStages = state.stageMask;
+        initial.writeAccess = state.accessMask & WRITE_ACCESS;
+    } else {
+        initial.readStages = state.stageMask;
+        initial.readAccess = state.accessMask;
+    }
+
+    TrackedImage tracked{};
+    tracked.aspectMask = aspectMask;
+    tracked.mipLevels = mipLevels;
+    tracked.arrayLayers = arrayLayers;
+    tracked.subresources.assign(static_cast<size_t>(mipLevels) * arrayLayers, initial);
+    images[image] = tracked;
+}
+
+void ResourceStateTracker::addBuffer(VkBuffer buffer, const ResourceState& state) {
+    SubresourceState initial{};
+    if (state.accessMask & WRITE_ACCESS) {
+        initial.writeStages = state.stageMask;
+        initial.writeAccess = state.accessMask & WRITE_ACCESS;
+    } else {
+        initial.readStages = state.stageMask;
+        initial.readAccess = state.accessMask;
+    }
+    buffers[buffer] = initial;
+}
+
+void ResourceStateTracker::removeImage(VkImage image) {
+    images.erase(image);
+}
+
+void ResourceStateTracker::removeBuffer(VkBuffer buffer) {
+    buffers.erase(buffer);
+}
+
+bool ResourceStateTracker::transition(SubresourceState& current, const ResourceState& next,
+    VkPipelineStageFlags2& srcStageMask, VkAccessFlags2& srcAccessMask, VkImageLayout& oldLayout) {
+    bool writes = (next.accessMask & WRITE_ACCESS) != 0;
+    bool layoutChange = next.layout != current.layout;
+    oldLayout = current.layout;
+
+    if (!writes && !layoutChange) {
+        // another read: only needs the last write made visible to it, once
+        bool visible = (current.readStages & next.stageMask) == next.stageMask &&
+            (current.readAccess & next.accessMask) == next.accessMask;
+        if (visible || current.writeStages == VK_PIPELINE_STAGE_2_NONE) {
+            current.readStages |= next.stageMask;
+            current.readAccess |= next.accessMask;
+            return false;
+        }
+
+        srcStageMask = current.writeStages;
+        srcAccessMask = current.writeAccess;
+        current.readStages |= next.stageMask;
+        current.readAccess |= next.accessMask;
+        return true;
+    }
+
+    // a write or a layout transition has to wait for the reads too; the reads need no
+    // memory dependency, only the write does
+    srcStageMask = current.writeStages | current.readStages;
+    srcAccessMask = current.writeAccess;
+
+    current.layout = next.layout;
+    if (writes) {
+        current.writeStages = next.stageMask;
+        current.writeAccess = next.accessMask & WRITE_ACCESS;
+        current.readStages = VK_PIPELINE_STAGE_2_NONE;
+        current.readAccess = VK_ACCESS_2_NONE;
+    } else {
+        // the transition is visible to these reads; later readers chain onto their stages
+        current.writeStages = next.stageMask;
+        current.writeAccess = VK_ACCESS_2_NONE;
+        current.readStages = next.stageMask;
+        current.readAccess = next.accessMask;
+    }
+    return true;
+}
+
+void ResourceStateTracker::useImage(VkCommandBuffer cmd, VkImage image, const ResourceState& state) {
+    useImage(cmd, image, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS, state);
+}
+
+ResourceStateTracker::TrackedImage& ResourceStateTracker::findRange(VkCommandBuffer cmd, VkImage image, uint32_t baseMipLevel, uint32_t& levelCount,
+    uint32_t baseArrayLayer, uint32_t& layerCount) {
+    auto it = images.find(image);
+    if (it == images.end()) {
+        throw std::runtime_error("image used without being added to the state tracker.");
+    }
+    TrackedImage& tracked = it->second;
+
+    if (levelCount == VK_REMAINING_MIP_LEVELS) {
+        levelCount = tracked.mipLevels - baseMipLevel;
+    }
+    if (layerCount == VK_REMAINING_ARRAY_LAYERS) {
+        layerCount = tracked.arrayLayers - baseArrayLayer;
+    }
+    if (baseMipLevel + levelCount > tracked.mipLevels || baseArrayLayer + layerCount > tracked.arrayLayers) {
+        throw std::runtime_error("image range is outside the tracked image.");
+    }
+
+    // a subresource can only take part in one barrier per call
+    for (uint32_t layer = baseArrayLayer; layer < baseArrayLayer + layerCount; layer++) {
+        for (uint32_t level = baseMipLevel; level < baseMipLevel + levelCount; level++) {
+            if (tracked.subresources[layer * tracked.mipLevels + level].pending) {
+                flush(cmd);
+                return tracked;
+            }
+        }
+    }
+    return tracked;
+}
+
+void ResourceStateTracker::setPending(VkImage image, SubresourceState& current) {
+    if (!current.pending) {
+        current.pending = true;
+        if (pendingImages.empty() || pendingImages.back() != image) {
+            pendingImages.push_back(image);
+        }
+    }
+}
+
+void ResourceStateTracker::useImage(VkCommandBuffer cmd, VkImage image, uint32_t baseMipLevel, uint32_t levelCount, uint32_t baseArrayLayer, uint32_t layerCount, const ResourceState& state) {
+    TrackedImage& tracked = findRange(cmd, image, baseMipLevel, levelCount, baseArrayLayer, layerCount);
+
+    for (uint32_t layer = baseArrayLayer; layer < baseArrayLayer + layerCount; layer++) {
+        for (uint32_t level = baseMipLevel; level < baseMipLevel + levelCount; level++) {
+            SubresourceState& current = tracked.subresources[layer * tracked.mipLevels + level];
+
+            VkImageMemoryBarrier2 barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+            if (!transition(current, state, barrier.srcStageMask, barrier.srcAccessMask, barrier.oldLayout)) {
+                stats.elided++;
+                continue;
+            }
+
+            barrier.dstStageMask = state.stageMask;
+            barrier.dstAccessMask = state.accessMask;
+            barrier.newLayout = state.layout;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = image;
+            barrier.subresourceRange.aspectMask = tracked.aspectMask;
+            barrier.subresourceRange.baseMipLevel = level;
+            barrier.subresourceRange.levelCount = 1;
+            barrier.subresourceRange.baseArrayLayer = layer;
+            barrier.subresourceRange.layerCount = 1;
+
+            setPending(image, current);
+            appendBarrier(imageBarriers, barrier);
+        }
+    }
+}
+
+void ResourceStateTracker::useBuffer(VkCommandBuffer cmd, VkBuffer buffer, const ResourceState& state) {
+    auto it = buffers.find(buffer);
+    if (it == buffers.end()) {
+        throw std::runtime_error("buffer used without being added to the state tracker.");
+    }
+    if (it->second.pending) {
+        flush(cmd);
+    }
+    SubresourceState& current = it->second;
+
+    VkBufferMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+    VkImageLayout unused = VK_IMAGE_LAYOUT_UNDEFINED;
+    ResourceState next = state;
+    next.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    if (!transition(current, next, barrier.srcStageMask, barrier.srcAccessMask, unused)) {
+        stats.elided++;
+        return;
+    }
+
+    barrier.dstStageMask = state.stageMask;
+    barrier.dstAccessMask = state.accessMask;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    bufferBarriers.push_back(barrier);
+
+    current.pending = true;
+    pendingBuffers.push_back(buffer);
+}
+
+ResourceStateTracker::SubresourceState ResourceStateTracker::visibleTo(const ResourceState& next) {
+    // as after a layout transition: later readers chain onto these stages
+    SubresourceState state{};
+    state.layout = next.layout;
+    state.writeStages = next.stageMask;
+    state.readStages = next.stageMask;
+    state.readAccess = next.accessMask;
+    return state;
+}
+
+void ResourceStateTracker::releaseImage(VkCommandBuffer cmd, VkImage image, uint32_t baseMipLevel, uint32_t levelCount,
+    uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex, const ResourceState& state, std::vector<VkImageMemoryBarrier2>& acquires) {
+    uint32_t baseArrayLayer = 0;
+    uint32_t layerCount = VK_REMAINING_ARRAY_LAYERS;
+    TrackedImage& tracked = findRange(cmd, image, baseMipLevel, levelCount, baseArrayLayer, layerCount);
+    bool transfer = srcQueueFamilyIndex != dstQueueFamilyIndex;
+
+    for (uint32_t layer = baseArrayLayer; layer < baseArrayLayer + layerCount; layer++) {
+        for (uint32_t level = baseMipLevel; level < baseMipLevel + levelCount; level++) {
+            SubresourceState& current = tracked.subresources[layer * tracked.mipLevels + level];
+
+            // both halves carry the same layouts; the transition happens once, between them
+            VkImageMemoryBarrier2 release{};
+            release.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+            release.srcStageMask = current.writeStages | current.readStages;
+            release.srcAccessMask = current.writeAccess;
+            release.oldLayout = current.layout;
+            release.newLayout = state.layout;
+            release.srcQueueFamilyIndex = transfer ? srcQueueFamilyIndex : VK_QUEUE_FAMILY_IGNORED;
+            release.dstQueueFamilyIndex = transfer ? dstQueueFamilyIndex : VK_QUEUE_FAMILY_IGNORED;
+            release.image = image;
+            release.subresourceRange.aspectMask = tracked.aspectMask;
+            release.subresourceRange.baseMipLevel = level;
+            release.subresourceRange.levelCount = 1;
+            release.subresourceRange.baseArrayLayer = layer;
+            release.subresourceRange.layerCount = 1;
+
+            VkImageMemoryBarrier2 acquire = release;
+            acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+            acquire.srcAccessMask = VK_ACCESS_2_NONE;
+            acquire.dstStageMask = state.stageMask;
+            acquire.dstAccessMask = state.accessMask;
+            if (!transfer) {
+                // the layout changes on this side already
+                acquire.oldLayout = state.layout;
+            }
+            appendBarrier(acquires, acquire);
+
+            // within a family, the semaphore waits for the writes; only a new layout needs a barrier
+            current = SubresourceState{};
+            current.layout = state.layout;
+            if (!transfer && release.oldLayout == release.newLayout) {
+                stats.elided++;
+                continue;
+            }
+
+            setPending(image, current);
+            appendBarrier(imageBarriers, release);
+        }
+    }
+}
+
+void ResourceStateTracker::acquireImage(VkCommandBuffer cmd, const VkImageMemoryBarrier2& barrier) {
+    bool transfer = barrier.srcQueueFamilyIndex != barrier.dstQueueFamilyIndex;
+
+    auto it = images.find(barrier.image);
+    if (it != images.end()) {
+        uint32_t levelCount = barrier.subresourceRange.levelCount;
+        uint32_t layerCount = barrier.subresourceRange.layerCount;
+        TrackedImage& tracked = findRange(cmd, barrier.image, barrier.subresourceRange.baseMipLevel, levelCount,
+            barrier.subresourceRange.baseArrayLayer, layerCount);
+
+        ResourceState next{ barrier.dstStageMask, barrier.dstAccessMask, barrier.newLayout };
+        for (uint32_t layer = barrier.subresourceRange.baseArrayLayer; layer < barrier.subresourceRange.baseArrayLayer + layerCount; layer++) {
+            for (uint32_t level = barrier.subresourceRange.baseMipLevel; level < barrier.subresourceRange.baseMipLevel + levelCount; level++) {
+                SubresourceState& current = tracked.subresources[layer * tracked.mipLevels + level];
+                current = visibleTo(next);
+                if (transfer) {
+                    setPending(barrier.image, current);
+                }
+            }
+        }
+    }
+
+    if (transfer) {
+        appendBarrier(imageBarriers, barrier);
+    }
+}
+
+void ResourceStateTracker::acquireBuffer(VkCommandBuffer cmd, const VkBufferMemoryBarrier2& barrier) {
+    bool transfer = barrier.srcQueueFamilyIndex != barrier.dstQueueFamilyIndex;
+
+    auto it = buffers.find(barrier.buffer);
+    if (it != buffers.end()) {
+        if (it->second.pending) {
+            flush(cmd);
+        }
+        it->second = visibleTo({ barrier.dstStageMask, barrier.dstAccessMask, VK_IMAGE_LAYOUT_UNDEFINED });
+        if (transfer) {
+            it->second.pending = true;
+            pendingBuffers.push_back(barrier.buffer);
+        }
+    }
+
+    if (transfer) {
+        bufferBarriers.push_back(barrier);
+    }
+}
+
+uint32_t ResourceStateTracker::flush(VkCommandBuffer cmd) {
+    if (imageBarriers.empty() && bufferBarriers.empty()) {
+        return 0;
+    }
+
+    VkDependencyInfo dependencyInfo{};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.bufferMemoryBarrierCount = static_cast<uint32_t>(bufferBarriers.size());
+    dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+    dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size());
+    dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+    vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+    stats.barrierCalls++;
+    stats.imageBarriers += static_cast<uint32_t>(imageBarriers.size());
+    stats.bufferBarriers += static_cast<uint32_t>(bufferBarriers.size());
+    imageBarriers.clear();
+    bufferBarriers.clear();
+
+    for (VkImage image : pendingImages) {
+        auto it = images.find(image);
+        if (it != images.end()) {
+            for (auto& subresource : it->second.subresources) {
+                subresource.pending = false;
+            }
+        }
+    }
+    pendingImages.clear();
+
+    for (VkBuffer buffer : pendingBuffers) {
+        auto it = buffers.find(buffer);
+        if (it != buffers.end()) {
+            it->second.pending = false;
+        }
+    }
+    pendingBuffers.clear();
+
+    return 1;
+}
+
+ResourceState ResourceStateTracker::getImageState(VkImage image, uint32_t mipLevel, uint32_t arrayLayer) const {
+    auto it = images.find(image);
+    if (it == images.end()) {
+        throw std::runtime_error("image is not tracked.");
+    }
+    const SubresourceState& current = it->second.subresources[arrayLayer * it->second.mipLevels + mipLevel];
+
+    ResourceState state{};
+    state.layout = current.layout;
+    state.stageMask = current.writeStages | current.readStages;
+    state.accessMask = current.writeAccess | current.readAccess;
+    return state;
+}
+
+void ResourceStateTracker::print(std::ostream& out) const {
+    out << "State Tracker: " << images.size() << " image(s), " << buffers.size() << " buffer(s), "
+        << stats.barrierCalls << " barrier call(s) with " << stats.imageBarriers << " image and "
+        << stats.bufferBarriers << " buffer barrier(s), " << stats.elided << " use(s) without a barrier" << std::endl;
+}
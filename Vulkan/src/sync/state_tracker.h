@@ -0,0 +1,124 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <ostream>
+
+// How a resource is about to be used: the stages and accesses of the next commands
+// touching it and, for images, the layout they need.
+struct ResourceState {
+    VkPipelineStageFlags2 stageMask = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 accessMask = VK_ACCESS_2_NONE;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+};
+
+// Barrier counts, for seeing what the merging saves.
+struct StateTrackerStats {
+    uint32_t barrierCalls = 0;
+    uint32_t imageBarriers = 0;
+    uint32_t bufferBarriers = 0;
+    // uses that needed no barrier at all (reads after reads)
+    uint32_t elided = 0;
+};
+
+// Tracks the layout and pending accesses of every subresource (mip level and array
+// layer) of the images and buffers added to it, on one queue.
+//
+// Callers only declare the state the next commands need with useImage/useBuffer. The
+// tracker works out which barriers that takes: none for another read of data that is
+// already visible to it, an execution dependency for a write after reads, a memory
+// dependency from the last write otherwise, and a layout transition whenever the
+// layout changes. Barriers wait only on the stages that actually touched the
+// subresource, and subresources with the same transition are merged into one range.
+// Nothing is recorded until flush, which issues everything declared since the last
+// flush with a single vkCmdPipelineBarrier2, so declare all the uses of the next
+// commands before flushing.
+//
+// Declaring two dependent uses of the same subresource without a flush in between
+// flushes the first one into cmd right there, since barriers in the same call are
+// unordered. All uses between two flushes go into the same command buffer, and the
+// tracker assumes command buffers are submitted in the order they were recorded: keep
+// one tracker per command stream, for as long as the stream and its resources live.
+//
+// A resource going to another command stream is released by the tracker of one and
+// acquired by the tracker of the other. Across queue families that is an ownership
+// transfer, and the acquire barrier is recorded on the other side; within a family only
+// the state changes hands, and the semaphore between the two submissions makes the
+// writes visible.
+class ResourceStateTracker {
+public:
+    // every subresource starts in state, as if the commands it describes had just run
+    void addImage(VkImage image, VkImageAspectFlags aspectMask, uint32_t mipLevels, uint32_t arrayLayers, const ResourceState& state = {});
+    void addBuffer(VkBuffer buffer, const ResourceState& state = {});
+    void removeImage(VkImage image);
+    void removeBuffer(VkBuffer buffer);
+
+    void useImage(VkCommandBuffer cmd, VkImage image, const ResourceState& state);
+    // levelCount and layerCount may be VK_REMAINING_MIP_LEVELS/VK_REMAINING_ARRAY_LAYERS
+    void useImage(VkCommandBuffer cmd, VkImage image, uint32_t baseMipLevel, uint32_t levelCount, uint32_t baseArrayLayer, uint32_t layerCount, const ResourceState& state);
+    void useBuffer(VkCommandBuffer cmd, VkBuffer buffer, const ResourceState& state);
+
+    // hands levels [baseMipLevel, baseMipLevel + levelCount) of every layer over to
+    // another stream that uses them in state. The release barrier goes out with the next
+    // flush, and acquires gets the barriers for the other side's acquireImage. The levels
+    // stay tracked here, in state.layout, but must not be used again.
+    void releaseImage(VkCommandBuffer cmd, VkImage image, uint32_t baseMipLevel, uint32_t levelCount,
+        uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex, const ResourceState& state, std::vector<VkImageMemoryBarrier2>& acquires);
+    // the other half: the barrier goes out with the next flush if it transfers ownership,
+    // and the resource, if tracked here, takes on the state it was released in
+    void acquireImage(VkCommandBuffer cmd, const VkImageMemoryBarrier2& barrier);
+    void acquireBuffer(VkCommandBuffer cmd, const VkBufferMemoryBarrier2& barrier);
+
+    // records the barriers declared since the last flush; returns the number of
+    // barrier calls recorded, 0 or 1
+    uint32_t flush(VkCommandBuffer cmd);
+
+    ResourceState getImageState(VkImage image, uint32_t mipLevel, uint32_t arrayLayer = 0) const;
+
+    const StateTrackerStats& getStats() const { return stats; }
+    void print(std::ostream& out) const;
+
+private:
+    // what has happened to a subresource since its last write
+    struct SubresourceState {
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        // the last write (or the stages after a layout transition), not yet visible to every stage
+        VkPipelineStageFlags2 writeStages = VK_PIPELINE_STAGE_2_NONE;
+        VkAccessFlags2 writeAccess = VK_ACCESS_2_NONE;
+        // reads since then, which the write has been made visible to
+        VkPipelineStageFlags2 readStages = VK_PIPELINE_STAGE_2_NONE;
+        VkAccessFlags2 readAccess = VK_ACCESS_2_NONE;
+        // has a barrier waiting for the next flush
+        bool pending = false;
+    };
+
+    struct TrackedImage {
+        VkImageAspectFlags aspectMask = 0;
+        uint32_t mipLevels = 1;
+        uint32_t arrayLayers = 1;
+        // layer-major
+        std::vector<SubresourceState> subresources{};
+    };
+
+    // the barrier taking a subresource from its state to next, if one is needed; the
+    // state is updated either way. Returns false when no barrier is needed.
+    bool transition(SubresourceState& current, const ResourceState& next, VkPipelineStageFlags2& srcStageMask, VkAccessFlags2& srcAccessMask, VkImageLayout& oldLayout);
+    // the state of a subresource right after a barrier made it visible to next
+    static SubresourceState visibleTo(const ResourceState& next);
+    // flushes if any of the range has a barrier waiting; levelCount and layerCount are resolved
+    TrackedImage& findRange(VkCommandBuffer cmd, VkImage image, uint32_t baseMipLevel, uint32_t& levelCount, uint32_t baseArrayLayer, uint32_t& layerCount);
+    void setPending(VkImage image, SubresourceState& current);
+
+    std::unordered_map<VkImage, TrackedImage> images{};
+    std::unordered_map<VkBuffer, SubresourceState> buffers{};
+
+    std::vector<VkImageMemoryBarrier2> imageBarriers{};
+    std::vector<VkBufferMemoryBarrier2> bufferBarriers{};
+    // images and buffers with pending subresources, cleared by flush
+    std::vector<VkImage> pendingImages{};
+    std::vector<VkBuffer> pendingBuffers{};
+
+    StateTrackerStats stats{};
+};
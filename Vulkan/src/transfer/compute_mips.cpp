@@ -0,0 +1,324 @@
+#include "pch.h"
+#include "transfer/compute_mips.h"
+#include "transfer/upload_batch.h"
+#include "sync/state_tracker.h"
+
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+namespace {
+    // what one dispatch writes, and the source texels one workgroup reduces per side;
+    // both fixed by the shader
+    const uint32_t LEVELS_PER_PASS = 6;
+    const uint32_t TILE_SIZE = 64;
+    const uint32_t SETS_PER_POOL = 32;
+
+    struct PushConstants {
+        int32_t srcWidth;
+        int32_t srcHeight;
+        int32_t levelCount;
+        int32_t srgb;
+    };
+
+    uint32_t mipExtent(uint32_t extent, uint32_t level) {
+        return std::max(extent >> level, 1u);
+    }
+}
+
+bool ComputeMipGenerator::init(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& shaderPath, uint32_t framesInFlight,
+    const VkAllocationCallbacks* allocationCallbacks) {
+    this->device = device;
+    this->allocationCallbacks = allocationCallbacks;
+    this->framesInFlight = framesInFlight;
+
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProperties);
+    if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)) {
+        std::cout << "compute mips: no RGBA8 storage images, mips are blitted" << std::endl;
+        return false;
+    }
+
+    std::ifstream file(shaderPath, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "compute mips: " << shaderPath << " not found, mips are blitted" << std::endl;
+        return false;
+    }
+    std::vector<char> code(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(code.data(), code.size());
+    file.close();
+
+    VkDescriptorSetLayoutBinding bindings[2]{};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[1].descriptorCount = LEVELS_PER_PASS;
+    bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo{};
+    setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutInfo.bindingCount = 2;
+    setLayoutInfo.pBindings = bindings;
+
+    VkResult err = vkCreateDescriptorSetLayout(device, &setLayoutInfo, allocationCallbacks, &setLayout);
+    if (err != VK_SUCCESS) {
+        std::cerr << "Error creating compute mip descriptor set layout: " << err << std::endl;
+        throw std::runtime_error("error creating compute mip descriptor set layout.");
+    }
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(PushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &setLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    err = vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocationCallbacks, &pipelineLayout);
+    if (err != VK_SUCCESS) {
+        std::cerr << "Error creating compute mip pipeline layout: " << err << std::endl;
+        throw std::runtime_error("error creating compute mip pipeline layout.");
+    }
+
+    VkShaderModuleCreateInfo moduleInfo{};
+    moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    moduleInfo.codeSize = code.size();
+    moduleInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+    VkShaderModule shaderModule;
+    err = vkCreateShaderModule(device, &moduleInfo, allocationCallbacks, &shaderModule);
+    if (err != VK_SUCCESS) {
+        std::cerr << "Error creating compute mip shader module: " << err << std::endl;
+        throw std::runtime_error("error creating compute mip shader module.");
+    }
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = shaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = pipelineLayout;
+
+    err = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, allocationCallbacks, &pipeline);
+    vkDestroyShaderModule(device, shaderModule, allocationCallbacks);
+    if (err != VK_SUCCESS) {
+        std::cerr << "Error creating compute mip pipeline: " << err << std::endl;
+        throw std::runtime_error("error creating compute mip pipeline.");
+    }
+
+    return true;
+}
+
+void ComputeMipGenerator::destroy() {
+    // the device is idle, nothing recorded is in flight anymore
+    for (auto& entry : retired) {
+        for (VkImageView view : entry.views) {
+            vkDestroyImageView(device, view, allocationCallbacks);
+        }
+    }
+    retired.clear();
+
+    for (VkDescriptorPool pool : pools) {
+        vkDestroyDescriptorPool(device, pool, allocationCallbacks);
+    }
+    pools.clear();
+
+    if (pipeline != VK_NULL_HANDLE) {
+        vkDestroyPipeline(device, pipeline, allocationCallbacks);
+        pipeline = VK_NULL_HANDLE;
+    }
+    if (pipelineLayout != VK_NULL_HANDLE) {
+        vkDestroyPipelineLayout(device, pipelineLayout, allocationCallbacks);
+        pipelineLayout = VK_NULL_HANDLE;
+    }
+    if (setLayout != VK_NULL_HANDLE) {
+        vkDestroyDescriptorSetLayout(device, setLayout, allocationCallbacks);
+        setLayout = VK_NULL_HANDLE;
+    }
+}
+
+bool ComputeMipGenerator::supports(VkFormat format) const {
+    return isAvailable() && (format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB);
+}
+
+VkImageView ComputeMipGenerator::createLevelView(VkImage image, uint32_t level) {
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    // sRGB formats can't be storage images; the shader does the conversion
+    viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = level;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    VkImageView view;
+    VkResult err = vkCreateImageView(device, &viewInfo, allocationCallbacks, &view);
+    if (err != VK_SUCCESS) {
+        std::cerr << "Error creating compute mip level view: " << err << std::endl;
+        throw std::runtime_error("error creating compute mip level view.");
+    }
+    return view;
+}
+
+VkDescriptorSet ComputeMipGenerator::allocateSet(VkDescriptorPool& pool) {
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &setLayout;
+
+    VkDescriptorSet set = VK_NULL_HANDLE;
+    for (VkDescriptorPool candidate : pools) {
+        allocInfo.descriptorPool = candidate;
+        if (vkAllocateDescriptorSets(device, &allocInfo, &set) == VK_SUCCESS) {
+            pool = candidate;
+            return set;
+        }
+    }
+
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSize.descriptorCount = SETS_PER_POOL * (1 + LEVELS_PER_PASS);
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    poolInfo.maxSets = SETS_PER_POOL;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+
+    VkResult err = vkCreateDescriptorPool(device, &poolInfo, allocationCallbacks, &pool);
+    if (err != VK_SUCCESS) {
+        std::cerr << "Error creating compute mip descriptor pool: " << err << std::endl;
+        throw std::runtime_error("error creating compute mip descriptor pool.");
+    }
+    pools.push_back(pool);
+
+    allocInfo.descriptorPool = pool;
+    err = vkAllocateDescriptorSets(device, &allocInfo, &set);
+    if (err != VK_SUCCESS) {
+        std::cerr << "Error allocating compute mip descriptor set: " << err << std::endl;
+        throw std::runtime_error("error allocating compute mip descriptor set.");
+    }
+    return set;
+}
+
+uint32_t ComputeMipGenerator::record(VkCommandBuffer cmd, ResourceStateTracker& states, const std::vector<MipChain>& chains, VkPipelineStageFlags dstStageMask) {
+    if (chains.empty()) {
+        return 0;
+    }
+
+    const ResourceState storageRead{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_IMAGE_LAYOUT_GENERAL };
+    const ResourceState storageWrite{ VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL };
+    const ResourceState sampled{ static_cast<VkPipelineStageFlags2>(dstStageMask), VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+    uint32_t maxLevels = 0;
+    for (const auto& chain : chains) {
+        maxLevels = std::max(maxLevels, chain.mipLevels);
+    }
+
+    uint32_t calls = 0;
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+
+    for (uint32_t baseLevel = 0; baseLevel + 1 < maxLevels; baseLevel += LEVELS_PER_PASS) {
+        // the previous pass's last level becomes this pass's source
+        for (const auto& chain : chains) {
+            if (baseLevel + 1 < chain.mipLevels) {
+                uint32_t levelCount = std::min(LEVELS_PER_PASS, chain.mipLevels - 1 - baseLevel);
+                states.useImage(cmd, chain.image, baseLevel, 1, 0, 1, storageRead);
+                states.useImage(cmd, chain.image, baseLevel + 1, levelCount, 0, 1, storageWrite);
+            }
+        }
+        calls += states.flush(cmd);
+
+        for (const auto& chain : chains) {
+            if (baseLevel + 1 >= chain.mipLevels) {
+                continue;
+            }
+            uint32_t levelCount = std::min(LEVELS_PER_PASS, chain.mipLevels - 1 - baseLevel);
+
+            Retired entry{};
+            entry.frame = frame;
+            entry.set = allocateSet(entry.pool);
+            for (uint32_t i = 0; i <= levelCount; i++) {
+                entry.views.push_back(createLevelView(chain.image, baseLevel + i));
+            }
+
+            // every array element has to be valid; the unused ones repeat the last
+            // level, which the shader never writes past
+            VkDescriptorImageInfo imageInfos[1 + LEVELS_PER_PASS]{};
+            for (uint32_t i = 0; i <= LEVELS_PER_PASS; i++) {
+                imageInfos[i].imageView = entry.views[std::min(i, levelCount)];
+                imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+            }
+
+            VkWriteDescriptorSet writes[2]{};
+            writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[0].dstSet = entry.set;
+            writes[0].dstBinding = 0;
+            writes[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            writes[0].descriptorCount = 1;
+            writes[0].pImageInfo = &imageInfos[0];
+            writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[1].dstSet = entry.set;
+            writes[1].dstBinding = 1;
+            writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            writes[1].descriptorCount = LEVELS_PER_PASS;
+            writes[1].pImageInfo = &imageInfos[1];
+            vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+
+            PushConstants constants{};
+            constants.srcWidth = static_cast<int32_t>(mipExtent(chain.width, baseLevel));
+            constants.srcHeight = static_cast<int32_t>(mipExtent(chain.height, baseLevel));
+            constants.levelCount = static_cast<int32_t>(levelCount);
+            constants.srgb = chain.storageFormat == VK_FORMAT_R8G8B8A8_SRGB ? 1 : 0;
+
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &entry.set, 0, nullptr);
+            vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &constants);
+            vkCmdDispatch(cmd, (constants.srcWidth + TILE_SIZE - 1) / TILE_SIZE, (constants.srcHeight + TILE_SIZE - 1) / TILE_SIZE, 1);
+
+            retired.push_back(std::move(entry));
+            dispatchCount++;
+        }
+    }
+
+    for (const auto& chain : chains) {
+        states.useImage(cmd, chain.image, sampled);
+    }
+    calls += states.flush(cmd);
+
+    chainCount += static_cast<uint32_t>(chains.size());
+    barrierCalls += calls;
+    return calls;
+}
+
+void ComputeMipGenerator::update(uint64_t frame) {
+    this->frame = frame;
+
+    while (!retired.empty() && retired.front().frame + framesInFlight <= frame) {
+        Retired& entry = retired.front();
+        vkFreeDescriptorSets(device, entry.pool, 1, &entry.set);
+        for (VkImageView view : entry.views) {
+            vkDestroyImageView(device, view, allocationCallbacks);
+        }
+        retired.pop_front();
+    }
+}
+
+void ComputeMipGenerator::print(std::ostream& out) const {
+    out << "Compute Mips: " << (isAvailable() ? "on" : "off") << ", " << chainCount << " chain(s), "
+        << dispatchCount << " dispatch(es), " << barrierCalls << " barrier call(s), "
+        << retired.size() << " set(s) in flight" << std::endl;
+}
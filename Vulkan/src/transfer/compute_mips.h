@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <ostream>
+
+struct MipChain;
+class ResourceStateTracker;
+
+// Mip chains generated by a compute shader (shaders/mipgen.comp.glsl) instead of one
+// blit per level.
+//
+// Each dispatch writes up to 6 levels below its source level, so a chain of up to 13
+// levels takes at most two dispatches, and the dispatches of every chain recorded
+// together share their barriers: one to start, one between the passes and one to hand
+// the images to the shaders. Filtering is done in the shader, so it works for formats
+// that can't be blitted with VK_FILTER_LINEAR, and sRGB images are averaged in linear
+// space. Only needs a compute capable queue.
+//
+// The images are bound as storage images through single level RGBA8_UNORM views, so
+// they need STORAGE usage and, when sRGB, MUTABLE_FORMAT and EXTENDED_USAGE; see
+// MipChain::storageFormat. The views and descriptor sets recorded in a frame are
+// destroyed once that frame can no longer be in flight.
+class ComputeMipGenerator {
+public:
+    // returns false, leaving the generator unavailable, when the shader hasn't been
+    // compiled or the device can't write RGBA8 storage images; chains are blitted then
+    bool init(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& shaderPath, uint32_t framesInFlight,
+        const VkAllocationCallbacks* allocationCallbacks = nullptr);
+    void destroy();
+
+    bool isAvailable() const { return pipeline != VK_NULL_HANDLE; }
+    // formats it can generate; the image's format, not the view's
+    bool supports(VkFormat format) const;
+
+    // the chains have level 0 written and are tracked by states, as for
+    // recordMipChains, and end up in SHADER_READ_ONLY_OPTIMAL for dstStageMask.
+    // Returns the number of barrier calls recorded.
+    uint32_t record(VkCommandBuffer cmd, ResourceStateTracker& states, const std::vector<MipChain>& chains, VkPipelineStageFlags dstStageMask);
+
+    // start of a frame, after its fence wait: frees what no frame in flight uses anymore
+    void update(uint64_t frame);
+
+    void print(std::ostream& out) const;
+
+private:
+    struct Retired {
+        uint64_t frame = 0;
+        VkDescriptorPool pool = VK_NULL_HANDLE;
+        VkDescriptorSet set = VK_NULL_HANDLE;
+        std::vector<VkImageView> views{};
+    };
+
+    VkImageView createLevelView(VkImage image, uint32_t level);
+    VkDescriptorSet allocateSet(VkDescriptorPool& pool);
+
+    VkDevice device = VK_NULL_HANDLE;
+    const VkAllocationCallbacks* allocationCallbacks = nullptr;
+    uint32_t framesInFlight = 1;
+
+    VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    // sets are freed one by one; a pool is added whenever the others are full
+    std::vector<VkDescriptorPool> pools{};
+
+    uint64_t frame = 0;
+    std::deque<Retired> retired{};
+
+    uint32_t chainCount = 0;
+    uint32_t dispatchCount = 0;
+    uint32_t barrierCalls = 0;
+};
@@ -0,0 +1,155 @@
+#include "pch.h"
+#include "transfer/host_image_copy.h"
+#include "transfer/mip_generator.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+void HostImageCopy::query(VkPhysicalDevice physicalDevice, const MemoryTypeCache& memoryTypes) {
+    this->physicalDevice = physicalDevice;
+    available = false;
+
+    // on discrete GPUs without ReBAR the driver would stage the copy itself, through
+    // memory it manages less well than the ring does
+    if (!memoryTypes.isUnifiedMemory() && !memoryTypes.hasLargeDeviceLocalHostVisible()) {
+        return;
+    }
+
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+
+    bool extensionSupported = false;
+    for (const auto& extension : extensions) {
+        if (strcmp(extension.extensionName, VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME) == 0) {
+            extensionSupported = true;
+            break;
+        }
+    }
+    if (!extensionSupported) {
+        return;
+    }
+
+    features = {};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT;
+
+    VkPhysicalDeviceFeatures2 deviceFeatures{};
+    deviceFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    deviceFeatures.pNext = &features;
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &deviceFeatures);
+    if (!features.hostImageCopy) {
+        return;
+    }
+
+    // textures are copied straight into the layout the shaders sample them in, which
+    // the device doesn't have to allow
+    VkPhysicalDeviceHostImageCopyPropertiesEXT copyProperties{};
+    copyProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT;
+
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &copyProperties;
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+    std::vector<VkImageLayout> dstLayouts(copyProperties.copyDstLayoutCount);
+    copyProperties.pCopyDstLayouts = dstLayouts.data();
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+    available = std::find(dstLayouts.begin(), dstLayouts.end(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) != dstLayouts.end();
+}
+
+void HostImageCopy::enable(std::vector<const char*>& extensions, void** pNext) {
+    if (!available) {
+        return;
+    }
+
+    extensions.push_back(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME);
+
+    features.hostImageCopy = VK_TRUE;
+    features.pNext = *pNext;
+    *pNext = &features;
+}
+
+void HostImageCopy::load(VkDevice device) {
+    this->device = device;
+    if (!available) {
+        return;
+    }
+
+    copyMemoryToImage = (PFN_vkCopyMemoryToImageEXT)vkGetDeviceProcAddr(device, "vkCopyMemoryToImageEXT");
+    transitionImageLayout = (PFN_vkTransitionImageLayoutEXT)vkGetDeviceProcAddr(device, "vkTransitionImageLayoutEXT");
+    if (copyMemoryToImage == nullptr || transitionImageLayout == nullptr) {
+        available = false;
+    }
+}
+
+bool HostImageCopy::supports(VkFormat format, VkImageUsageFlags usage) const {
+    if (!available) {
+        return false;
+    }
+
+    // fails for formats without VK_FORMAT_FEATURE_2_HOST_IMAGE_TRANSFER_BIT_EXT
+    VkImageFormatProperties properties{};
+    VkResult err = vkGetPhysicalDeviceImageFormatProperties(physicalDevice, format, VK_IMAGE_TYPE_2D, VK_IMAGE_TILING_OPTIMAL,
+        usage | VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT, 0, &properties);
+    return err == VK_SUCCESS;
+}
+
+void HostImageCopy::uploadMipChain(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t texelSize, const void* data) {
+    VkHostImageLayoutTransitionInfoEXT transition{};
+    transition.sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT;
+    transition.image = image;
+    transition.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    transition.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    transition.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    transition.subresourceRange.baseMipLevel = 0;
+    transition.subresourceRange.levelCount = mipLevels;
+    transition.subresourceRange.baseArrayLayer = 0;
+    transition.subresourceRange.layerCount = 1;
+
+    VkResult err = transitionImageLayout(device, 1, &transition);
+    if (err != VK_SUCCESS) {
+        std::cerr << "Error transitioning image layout on the host: " << err << std::endl;
+        throw std::runtime_error("error transitioning image layout on the host.");
+    }
+
+    std::vector<VkMemoryToImageCopyEXT> regions(mipLevels);
+    for (uint32_t level = 0; level < mipLevels; level++) {
+        VkMemoryToImageCopyEXT& region = regions[level];
+        region.sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT;
+        region.pHostPointer = static_cast<const char*>(data) + mipLevelOffset(width, height, level, texelSize);
+        // tightly packed
+        region.memoryRowLength = 0;
+        region.memoryImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = level;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = { 0, 0, 0 };
+        region.imageExtent = { std::max(width >> level, 1u), std::max(height >> level, 1u), 1 };
+    }
+
+    VkCopyMemoryToImageInfoEXT copyInfo{};
+    copyInfo.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT;
+    copyInfo.dstImage = image;
+    copyInfo.dstImageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    copyInfo.regionCount = mipLevels;
+    copyInfo.pRegions = regions.data();
+
+    err = copyMemoryToImage(device, &copyInfo);
+    if (err != VK_SUCCESS) {
+        std::cerr << "Error copying memory to image: " << err << std::endl;
+        throw std::runtime_error("error copying memory to image.");
+    }
+
+    imageCount++;
+    copiedBytes += mipChainSize(width, height, mipLevels, texelSize);
+}
+
+void HostImageCopy::print(std::ostream& out) const {
+    out << "Host Image Copy: " << (available ? "on" : "off") << ", " << imageCount << " image(s), "
+        << (copiedBytes >> 10) << " KiB copied" << std::endl;
+}
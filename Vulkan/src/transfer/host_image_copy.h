@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+#include <ostream>
+
+#include "memory/memory_types.h"
+
+// Texture uploads written by the CPU straight into the image (VK_EXT_host_image_copy),
+// with no staging buffer and no GPU copy.
+//
+// Only worth it where the image memory is memory the CPU can reach at full speed: UMA
+// devices and ReBAR. Everywhere else, and whenever the device lacks the extension,
+// textures keep going through the staging ring.
+//
+// query runs before the device is created and decides whether the path is used; the
+// feature struct then goes into the device create info, and load fetches the entry
+// points once the device exists.
+class HostImageCopy {
+public:
+    void query(VkPhysicalDevice physicalDevice, const MemoryTypeCache& memoryTypes);
+    // the extension is enabled on the device and copies are worth doing on the host
+    bool isAvailable() const { return available; }
+
+    // adds the extension and chains the feature in front of *pNext, if available
+    void enable(std::vector<const char*>& extensions, void** pNext);
+    void load(VkDevice device);
+
+    // images of this format and usage can be created with HOST_TRANSFER usage
+    bool supports(VkFormat format, VkImageUsageFlags usage) const;
+
+    // moves all levels of image (created with VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT and
+    // never used yet) to SHADER_READ_ONLY_OPTIMAL and copies in a mip chain packed
+    // level after level, see mip_generator.h. Done when it returns.
+    void uploadMipChain(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t texelSize, const void* data);
+
+    void print(std::ostream& out) const;
+
+private:
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    bool available = false;
+    VkPhysicalDeviceHostImageCopyFeaturesEXT features{};
+
+    PFN_vkCopyMemoryToImageEXT copyMemoryToImage = nullptr;
+    PFN_vkTransitionImageLayoutEXT transitionImageLayout = nullptr;
+
+    uint32_t imageCount = 0;
+    VkDeviceSize copiedBytes = 0;
+};
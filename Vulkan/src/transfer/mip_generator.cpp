@@ -0,0 +1,316 @@
+#include "pch.h"
+#include "transfer/mip_generator.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define MIP_GENERATOR_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC compiles AVX2 intrinsics without /arch:AVX2
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+    const uint32_t TEXEL_SIZE = 4;
+    // resolution of the linear -> sRGB table
+    const uint32_t LINEAR_STEPS = 4096;
+    // levels smaller than this aren't worth starting threads for
+    const uint64_t PARALLEL_TEXELS = 64 * 1024;
+    const uint32_t MIN_ROWS_PER_THREAD = 16;
+
+    struct SrgbTables {
+        // sRGB -> linear for the color channels, then the identity for alpha, so a
+        // texel decodes with a single table and a per channel offset
+        float toLinear[512];
+        uint8_t toSrgb[LINEAR_STEPS + 1];
+
+        SrgbTables() {
+            for (uint32_t i = 0; i < 256; i++) {
+                float c = i / 255.0f;
+                toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+                toLinear[256 + i] = static_cast<float>(i);
+            }
+            for (uint32_t i = 0; i <= LINEAR_STEPS; i++) {
+                float l = static_cast<float>(i) / LINEAR_STEPS;
+                float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+                toSrgb[i] = static_cast<uint8_t>(std::min(c * 255.0f + 0.5f, 255.0f));
+            }
+        }
+    };
+
+    const SrgbTables& srgbTables() {
+        static const SrgbTables tables{};
+        return tables;
+    }
+
+    uint32_t levelExtent(uint32_t extent, uint32_t level) {
+        return std::max(extent >> level, 1u);
+    }
+
+    // one level's source and destination, and the rows of the destination to fill
+    struct Downsample {
+        const uint8_t* src = nullptr;
+        uint32_t srcWidth = 0;
+        uint32_t srcHeight = 0;
+        uint8_t* dst = nullptr;
+        uint32_t dstWidth = 0;
+        uint32_t dstHeight = 0;
+        bool srgb = false;
+    };
+
+    // dst texel x of a row from the four source texels; the reference every SIMD path
+    // matches bit for bit
+    void downsampleTexel(const uint8_t* row0, const uint8_t* row1, uint32_t srcWidth, uint32_t x, uint8_t* out, bool srgb) {
+        const SrgbTables& tables = srgbTables();
+
+        // odd extents fold the last column into the one before
+        uint32_t x0 = std::min(x * 2, srcWidth - 1);
+        uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1);
+        const uint8_t* texels[4] = {
+            row0 + x0 * TEXEL_SIZE,
+            row0 + x1 * TEXEL_SIZE,
+            row1 + x0 * TEXEL_SIZE,
+            row1 + x1 * TEXEL_SIZE,
+        };
+
+        for (uint32_t c = 0; c < TEXEL_SIZE; c++) {
+            // alpha is never sRGB encoded
+            if (srgb && c < 3) {
+                float sum = 0.0f;
+                for (const uint8_t* texel : texels) {
+                    sum += tables.toLinear[texel[c]];
+                }
+                out[c] = tables.toSrgb[static_cast<uint32_t>(sum * 0.25f * LINEAR_STEPS + 0.5f)];
+            } else {
+                uint32_t sum = 0;
+                for (const uint8_t* texel : texels) {
+                    sum += texel[c];
+                }
+                out[c] = static_cast<uint8_t>((sum + 2) / 4);
+            }
+        }
+    }
+
+#ifdef MIP_GENERATOR_SIMD
+    bool detectAvx2() {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) {
+            return false;
+        }
+        // the OS has to save the YMM registers too
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+
+    bool hasAvx2() {
+        static const bool supported = detectAvx2();
+        return supported;
+    }
+
+    // four dst texels at a time, all channels in 16 bit
+    uint32_t downsampleUnormSse2(const uint8_t* row0, const uint8_t* row1, uint8_t* out, uint32_t count) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i two = _mm_set1_epi16(2);
+
+        uint32_t x = 0;
+        for (; x + 4 <= count; x += 4) {
+            __m128 a0 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8)));
+            __m128 b0 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8 + 16)));
+            __m128 a1 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8)));
+            __m128 b1 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8 + 16)));
+
+            // the left and right texel of each pair
+            __m128i left0 = _mm_castps_si128(_mm_shuffle_ps(a0, b0, _MM_SHUFFLE(2, 0, 2, 0)));
+            __m128i right0 = _mm_castps_si128(_mm_shuffle_ps(a0, b0, _MM_SHUFFLE(3, 1, 3, 1)));
+            __m128i left1 = _mm_castps_si128(_mm_shuffle_ps(a1, b1, _MM_SHUFFLE(2, 0, 2, 0)));
+            __m128i right1 = _mm_castps_si128(_mm_shuffle_ps(a1, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+
+            __m128i low = _mm_add_epi16(
+                _mm_add_epi16(_mm_unpacklo_epi8(left0, zero), _mm_unpacklo_epi8(right0, zero)),
+                _mm_add_epi16(_mm_unpacklo_epi8(left1, zero), _mm_unpacklo_epi8(right1, zero)));
+            __m128i high = _mm_add_epi16(
+                _mm_add_epi16(_mm_unpackhi_epi8(left0, zero), _mm_unpackhi_epi8(right0, zero)),
+                _mm_add_epi16(_mm_unpackhi_epi8(left1, zero), _mm_unpackhi_epi8(right1, zero)));
+
+            low = _mm_srli_epi16(_mm_add_epi16(low, two), 2);
+            high = _mm_srli_epi16(_mm_add_epi16(high, two), 2);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * TEXEL_SIZE), _mm_packus_epi16(low, high));
+        }
+        return x;
+    }
+
+    // one dst texel at a time, its four channels in one vector; the table lookups stay scalar
+    uint32_t downsampleSrgbSse2(const uint8_t* row0, const uint8_t* row1, uint8_t* out, uint32_t count) {
+        const SrgbTables& tables = srgbTables();
+        const float* toLinear = tables.toLinear;
+        // the color channels index the sRGB table, alpha rounds to the nearest integer
+        const __m128 scale = _mm_set_ps(0.25f, 0.25f * LINEAR_STEPS, 0.25f * LINEAR_STEPS, 0.25f * LINEAR_STEPS);
+        const __m128 half = _mm_set1_ps(0.5f);
+
+        auto decode = [toLinear](const uint8_t* t) {
+            return _mm_set_ps(toLinear[256 + t[3]], toLinear[t[2]], toLinear[t[1]], toLinear[t[0]]);
+        };
+
+        alignas(16) int32_t indices[4];
+        for (uint32_t x = 0; x < count; x++) {
+            const uint8_t* p0 = row0 + x * 8;
+            const uint8_t* p1 = row1 + x * 8;
+            __m128 sum = _mm_add_ps(_mm_add_ps(_mm_add_ps(decode(p0), decode(p0 + 4)), decode(p1)), decode(p1 + 4));
+
+            _mm_store_si128(reinterpret_cast<__m128i*>(indices), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(sum, scale), half)));
+            uint8_t* texel = out + x * TEXEL_SIZE;
+            texel[0] = tables.toSrgb[indices[0]];
+            texel[1] = tables.toSrgb[indices[1]];
+            texel[2] = tables.toSrgb[indices[2]];
+            texel[3] = static_cast<uint8_t>(indices[3]);
+        }
+        return count;
+    }
+
+    // two dst texels at a time, decoded with gathers
+    TARGET_AVX2 uint32_t downsampleSrgbAvx2(const uint8_t* row0, const uint8_t* row1, uint8_t* out, uint32_t count) {
+        const SrgbTables& tables = srgbTables();
+        const __m256i alphaOffset = _mm256_set_epi32(256, 0, 0, 0, 256, 0, 0, 0);
+        const __m256 scale = _mm256_set_ps(0.25f, 0.25f * LINEAR_STEPS, 0.25f * LINEAR_STEPS, 0.25f * LINEAR_STEPS,
+            0.25f, 0.25f * LINEAR_STEPS, 0.25f * LINEAR_STEPS, 0.25f * LINEAR_STEPS);
+        const __m256 half = _mm256_set1_ps(0.5f);
+
+        alignas(32) int32_t indices[8];
+        uint32_t x = 0;
+        for (; x + 2 <= count; x += 2) {
+            // texels 0 1 2 3 -> 0 2 | 1 3: the left and right texel of both pairs
+            __m128i r0 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8)), _MM_SHUFFLE(3, 1, 2, 0));
+            __m128i r1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8)), _MM_SHUFFLE(3, 1, 2, 0));
+
+            __m256 left0 = _mm256_i32gather_ps(tables.toLinear, _mm256_add_epi32(_mm256_cvtepu8_epi32(r0), alphaOffset), 4);
+            __m256 right0 = _mm256_i32gather_ps(tables.toLinear, _mm256_add_epi32(_mm256_cvtepu8_epi32(_mm_srli_si128(r0, 8)), alphaOffset), 4);
+            __m256 left1 = _mm256_i32gather_ps(tables.toLinear, _mm256_add_epi32(_mm256_cvtepu8_epi32(r1), alphaOffset), 4);
+            __m256 right1 = _mm256_i32gather_ps(tables.toLinear, _mm256_add_epi32(_mm256_cvtepu8_epi32(_mm_srli_si128(r1, 8)), alphaOffset), 4);
+
+            // same order as the scalar sum, so the results are identical
+            __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(left0, right0), left1), right1);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(indices), _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(sum, scale), half)));
+
+            uint8_t* texel = out + x * TEXEL_SIZE;
+            for (uint32_t i = 0; i < 8; i += 4) {
+                texel[i + 0] = tables.toSrgb[indices[i + 0]];
+                texel[i + 1] = tables.toSrgb[indices[i + 1]];
+                texel[i + 2] = tables.toSrgb[indices[i + 2]];
+                texel[i + 3] = static_cast<uint8_t>(indices[i + 3]);
+            }
+        }
+        return x;
+    }
+#endif
+
+    void downsampleRows(const Downsample& level, uint32_t firstRow, uint32_t endRow) {
+        // dst texels whose source pair doesn't need clamping
+        uint32_t unclamped = std::min(level.srcWidth / 2, level.dstWidth);
+
+        for (uint32_t y = firstRow; y < endRow; y++) {
+            // odd extents fold the last row into the one before
+            uint32_t y0 = std::min(y * 2, level.srcHeight - 1);
+            uint32_t y1 = std::min(y * 2 + 1, level.srcHeight - 1);
+            const uint8_t* row0 = level.src + static_cast<size_t>(y0) * level.srcWidth * TEXEL_SIZE;
+            const uint8_t* row1 = level.src + static_cast<size_t>(y1) * level.srcWidth * TEXEL_SIZE;
+            uint8_t* out = level.dst + static_cast<size_t>(y) * level.dstWidth * TEXEL_SIZE;
+
+            uint32_t x = 0;
+#ifdef MIP_GENERATOR_SIMD
+            if (!level.srgb) {
+                x = downsampleUnormSse2(row0, row1, out, unclamped);
+            } else if (hasAvx2()) {
+                x = downsampleSrgbAvx2(row0, row1, out, unclamped);
+            } else {
+                x = downsampleSrgbSse2(row0, row1, out, unclamped);
+            }
+#endif
+            for (; x < level.dstWidth; x++) {
+                downsampleTexel(row0, row1, level.srcWidth, x, out + x * TEXEL_SIZE, level.srgb);
+            }
+        }
+    }
+
+    void downsample(const Downsample& level, uint32_t threadCount) {
+        uint64_t texels = static_cast<uint64_t>(level.dstWidth) * level.dstHeight;
+        uint32_t threads = texels < PARALLEL_TEXELS ? 1 : std::min(threadCount, level.dstHeight / MIN_ROWS_PER_THREAD);
+        if (threads <= 1) {
+            downsampleRows(level, 0, level.dstHeight);
+            return;
+        }
+
+        // contiguous bands of rows; this thread takes the last one
+        std::vector<std::thread> workers{};
+        uint32_t rowsPerThread = (level.dstHeight + threads - 1) / threads;
+        uint32_t firstRow = 0;
+        for (uint32_t i = 0; i + 1 < threads; i++) {
+            uint32_t endRow = firstRow + rowsPerThread;
+            workers.emplace_back(downsampleRows, std::cref(level), firstRow, endRow);
+            firstRow = endRow;
+        }
+        downsampleRows(level, firstRow, level.dstHeight);
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+}
+
+VkDeviceSize mipChainSize(uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t texelSize) {
+    return mipLevelOffset(width, height, mipLevels, texelSize);
+}
+
+VkDeviceSize mipLevelOffset(uint32_t width, uint32_t height, uint32_t level, uint32_t texelSize) {
+    VkDeviceSize offset = 0;
+    for (uint32_t i = 0; i < level; i++) {
+        offset += static_cast<VkDeviceSize>(levelExtent(width, i)) * levelExtent(height, i) * texelSize;
+    }
+    return offset;
+}
+
+void generateMipLevels(std::vector<char>& data, uint32_t width, uint32_t height, uint32_t mipLevels, bool srgb, uint32_t threadCount) {
+    if (data.size() < mipLevelOffset(width, height, 1, TEXEL_SIZE)) {
+        throw std::runtime_error("mip generation source is smaller than level 0.");
+    }
+    data.resize(static_cast<size_t>(mipChainSize(width, height, mipLevels, TEXEL_SIZE)));
+
+    for (uint32_t level = 1; level < mipLevels; level++) {
+        Downsample pass{};
+        pass.src = reinterpret_cast<const uint8_t*>(data.data() + mipLevelOffset(width, height, level - 1, TEXEL_SIZE));
+        pass.srcWidth = levelExtent(width, level - 1);
+        pass.srcHeight = levelExtent(height, level - 1);
+        pass.dst = reinterpret_cast<uint8_t*>(data.data() + mipLevelOffset(width, height, level, TEXEL_SIZE));
+        pass.dstWidth = levelExtent(width, level);
+        pass.dstHeight = levelExtent(height, level);
+        pass.srgb = srgb;
+
+        downsample(pass, std::max(threadCount, 1u));
+    }
+}
+
+const char* getMipGeneratorPath() {
+#ifdef MIP_GENERATOR_SIMD
+    return hasAvx2() ? "avx2" : "sse2";
+#else
+    return "scalar";
+#endif
+}
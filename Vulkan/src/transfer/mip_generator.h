@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+
+// Mip levels generated on the CPU, for uploads that can't blit them from level 0 on
+// the GPU: progressive streaming sends the smallest levels first, and a transfer-only
+// queue can't blit at all. A chain is its levels packed one after the other, level 0
+// first. RGBA8 only.
+//
+// Rows are filtered with SSE2, sRGB rows with AVX2 gathers where the CPU has them, and
+// the results are bit for bit those of the scalar code the other CPUs run.
+
+// bytes of levels [0, mipLevels)
+VkDeviceSize mipChainSize(uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t texelSize);
+// where a level starts within the chain
+VkDeviceSize mipLevelOffset(uint32_t width, uint32_t height, uint32_t level, uint32_t texelSize);
+
+// data holds level 0; appends the other levels, each a 2x2 box filter of the one
+// before. With srgb the color channels are averaged in linear space, like a linear
+// blit of an sRGB image does. Large levels are split into bands of rows, one per
+// thread, up to threadCount threads.
+void generateMipLevels(std::vector<char>& data, uint32_t width, uint32_t height, uint32_t mipLevels, bool srgb, uint32_t threadCount = 1);
+
+// "avx2", "sse2" or "scalar"
+const char* getMipGeneratorPath();
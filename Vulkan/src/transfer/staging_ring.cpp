@@ -0,0 +1,616 @@
+#include "pch.h"
+#include "transfer/staging_ring.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    // offsets handed out by the ring are aligned to at least this, which keeps
+    // buffer->image copies valid on transfer-only queues (multiple of 4)
+    const VkDeviceSize MIN_ALIGNMENT = 16;
+
+    VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+void StagingRing::init(VkDevice device, VkQueue queue, uint32_t queueFamilyIndex, VkQueue dstQueue, uint32_t dstQueueFamilyIndex,
+    VkBuffer buffer, void* mapped, VkDeviceSize capacity, const VkAllocationCallbacks* allocationCallbacks) {
+    this->device = device;
+    this->allocationCallbacks = allocationCallbacks;
+    this->queue = queue;
+    this->queueFamilyIndex = queueFamilyIndex;
+    this->dstQueue = dstQueue;
+    this->dstQueueFamilyIndex = dstQueueFamilyIndex;
+    this->buffer = buffer;
+    this->mapped = static_cast<char*>(mapped);
+    this->capacity = capacity;
+
+    // half the ring per chunk, so the CPU can fill one chunk while the GPU copies the other
+    maxChunkSize = std::max(capacity / 2 / MIN_ALIGNMENT * MIN_ALIGNMENT, MIN_ALIGNMENT);
+
+    VkCommandPoolCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    createInfo.queueFamilyIndex = queueFamilyIndex;
+    createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+    VkResult err = vkCreateCommandPool(device, &createInfo, allocationCallbacks, &commandPool);
+    if (err != VK_SUCCESS) {
+        std::cerr << "error creating staging command pool: " << err << std::endl;
+        throw std::runtime_error("Error creating staging command pool.");
+    }
+
+    if (needsOwnershipTransfer()) {
+        createInfo.queueFamilyIndex = dstQueueFamilyIndex;
+
+        err = vkCreateCommandPool(device, &createInfo, allocationCallbacks, &dstCommandPool);
+        if (err != VK_SUCCESS) {
+            std::cerr << "error creating staging command pool: " << err << std::endl;
+            throw std::runtime_error("Error creating staging command pool.");
+        }
+    }
+
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+
+    err = vkCreateSemaphore(device, &semaphoreInfo, allocationCallbacks, &semaphore);
+    if (err != VK_SUCCESS) {
+        std::cerr << "error creating staging timeline semaphore: " << err << std::endl;
+        throw std::runtime_error("Error creating staging timeline semaphore.");
+    }
+}
+
+void StagingRing::destroy() {
+    waitIdle();
+
+    available.clear();
+    availableDst.clear();
+    releases.clear();
+    acquires.clear();
+    states = ResourceStateTracker{};
+
+    vkDestroySemaphore(device, semaphore, allocationCallbacks);
+    semaphore = VK_NULL_HANDLE;
+    vkDestroyCommandPool(device, commandPool, allocationCallbacks);
+    commandPool = VK_NULL_HANDLE;
+    if (dstCommandPool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(device, dstCommandPool, allocationCallbacks);
+        dstCommandPool = VK_NULL_HANDLE;
+    }
+}
+
+VkCommandBuffer StagingRing::getCommandBuffer() {
+    if (recording.commandBuffer != VK_NULL_HANDLE) {
+        return recording.commandBuffer;
+    }
+
+    if (!available.empty()) {
+        recording = available.back();
+        available.pop_back();
+    } else {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        VkResult err = vkAllocateCommandBuffers(device, &allocInfo, &recording.commandBuffer);
+        if (err != VK_SUCCESS) {
+            std::cerr << "error allocating staging command buffer: " << err << std::endl;
+            throw std::runtime_error("Error allocating staging command buffer.");
+        }
+    }
+
+    recording.id = nextSubmissionId++;
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(recording.commandBuffer, &beginInfo);
+
+    return recording.commandBuffer;
+}
+
+VkDeviceSize StagingRing::acquire(VkDeviceSize size, VkDeviceSize alignment) {
+    alignment = std::max(alignment, MIN_ALIGNMENT);
+
+    for (;;) {
+        if (regions.empty()) {
+            head = 0;
+            wrapped = false;
+        }
+
+        VkDeviceSize offset = alignUp(head, alignment);
+        bool fits = false;
+
+        if (!wrapped) {
+            if (offset + size <= capacity) {
+                fits = true;
+            } else {
+                // wrap around to the front, in front of the oldest region still in use
+                VkDeviceSize tail = regions.empty() ? capacity : regions.front().begin;
+                if (size <= tail) {
+                    offset = 0;
+                    wrapped = true;
+                    fits = true;
+                }
+            }
+        } else if (offset + size <= regions.front().begin) {
+            fits = true;
+        }
+
+        if (fits) {
+            getCommandBuffer();
+
+            if (!regions.empty() && regions.back().submission == recording.id && regions.back().end <= offset) {
+                regions.back().end = offset + size;
+            } else {
+                Region region{};
+                region.begin = offset;
+                region.end = offset + size;
+                region.submission = recording.id;
+                regions.push_back(region);
+            }
+
+            head = offset + size;
+            return offset;
+        }
+
+        // out of space: push what we have to the GPU and wait for the oldest copy
+        if (recording.commandBuffer != VK_NULL_HANDLE) {
+            flush();
+        }
+        if (inFlight.empty()) {
+            throw std::runtime_error("staging ring is too small for upload chunk.");
+        }
+        retireOldest();
+    }
+}
+
+UploadToken StagingRing::uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+    const char* src = static_cast<const char*>(data);
+
+    while (size > 0) {
+        VkDeviceSize chunk = std::min(size, maxChunkSize);
+        VkDeviceSize offset = acquire(chunk, MIN_ALIGNMENT);
+
+        memcpy(mapped + offset, src, static_cast<size_t>(chunk));
+        uploadedBytes += chunk;
+
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = offset;
+        copyRegion.dstOffset = dstOffset;
+        copyRegion.size = chunk;
+        vkCmdCopyBuffer(getCommandBuffer(), buffer, dst, 1, &copyRegion);
+
+        src += chunk;
+        dstOffset += chunk;
+        size -= chunk;
+    }
+
+    return getToken();
+}
+
+UploadToken StagingRing::copyBuffer(VkBuffer src, VkDeviceSize srcOffset, VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size) {
+    if (needsOwnershipTransfer()) {
+        return copyBufferOnDstQueue(src, srcOffset, dst, dstOffset, size);
+    }
+
+    VkCommandBuffer cmd = getCommandBuffer();
+
+    // uploads don't overlap each other, but a copy may read or overwrite what they wrote;
+    // buffers aren't tracked, since uploads to them need no barriers between them
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+
+    VkDependencyInfo dependencyInfo{};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.memoryBarrierCount = 1;
+    dependencyInfo.pMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+    VkBufferCopy copyRegion{};
+    copyRegion.srcOffset = srcOffset;
+    copyRegion.dstOffset = dstOffset;
+    copyRegion.size = size;
+    vkCmdCopyBuffer(cmd, src, dst, 1, &copyRegion);
+
+    vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+    return getToken();
+}
+
+UploadToken StagingRing::uploadImage(VkImage dst, uint32_t mipLevel, uint32_t width, uint32_t height, uint32_t texelSize, const void* data) {
+    return uploadImage(dst, mipLevel, width, 0, height, texelSize, data);
+}
+
+UploadToken StagingRing::uploadImage(VkImage dst, uint32_t mipLevel, uint32_t width, uint32_t firstRow, uint32_t rowCount, uint32_t texelSize, const void* data) {
+    const char* src = static_cast<const char*>(data);
+    VkDeviceSize rowPitch = static_cast<VkDeviceSize>(width) * texelSize;
+    if (rowPitch > maxChunkSize) {
+        throw std::runtime_error("image row does not fit in the staging ring.");
+    }
+
+    // copies into a level already declared for them need no barriers between them,
+    // they write other rows
+    ResourceState current = states.getImageState(dst, mipLevel);
+    if (current.layout != UPLOAD_DST.layout || current.stageMask != UPLOAD_DST.stageMask || current.accessMask != UPLOAD_DST.accessMask) {
+        states.useImage(getCommandBuffer(), dst, mipLevel, 1, 0, 1, UPLOAD_DST);
+    }
+
+    // chunks are whole rows, copied into horizontal bands of the image
+    uint32_t rowsPerChunk = static_cast<uint32_t>(maxChunkSize / rowPitch);
+    uint32_t endRow = firstRow + rowCount;
+    for (uint32_t y = firstRow; y < endRow; y += rowsPerChunk) {
+        uint32_t rows = std::min(rowsPerChunk, endRow - y);
+        VkDeviceSize chunk = rowPitch * rows;
+        VkDeviceSize offset = acquire(chunk, static_cast<VkDeviceSize>(texelSize) * 4);
+
+        memcpy(mapped + offset, src + rowPitch * y, static_cast<size_t>(chunk));
+        uploadedBytes += chunk;
+        // the barriers go into the batch the copy lands in
+        states.flush(getCommandBuffer());
+
+        VkBufferImageCopy region{};
+        region.bufferOffset = offset;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = mipLevel;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+
+        region.imageOffset = { 0, static_cast<int32_t>(y), 0 };
+        region.imageExtent = { width, rows, 1 };
+
+        vkCmdCopyBufferToImage(getCommandBuffer(), buffer, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    }
+
+    return getToken();
+}
+
+UploadToken StagingRing::copyBufferOnDstQueue(VkBuffer src, VkDeviceSize srcOffset, VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size) {
+    // the uploads recorded so far go first, and the copy waits for them
+    UploadToken uploaded = flush();
+
+    Submission submission{};
+    if (!availableDst.empty()) {
+        submission = availableDst.back();
+        availableDst.pop_back();
+    } else {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = dstCommandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        VkResult err = vkAllocateCommandBuffers(device, &allocInfo, &submission.commandBuffer);
+        if (err != VK_SUCCESS) {
+            std::cerr << "error allocating staging command buffer: " << err << std::endl;
+            throw std::runtime_error("Error allocating staging command buffer.");
+        }
+    }
+    submission.id = nextSubmissionId++;
+    submission.onDstQueue = true;
+
+    VkCommandBuffer cmd = submission.commandBuffer;
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(cmd, &beginInfo);
+
+    // the source may still have uploads waiting to be acquired, and earlier copies on
+    // this queue may have written either buffer
+    OwnershipAcquires taken = takeBufferAcquires();
+
+    VkMemoryBarrier2 barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+
+    VkDependencyInfo dependencyInfo{};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.memoryBarrierCount = 1;
+    dependencyInfo.pMemoryBarriers = &barrier;
+    dependencyInfo.bufferMemoryBarrierCount = static_cast<uint32_t>(taken.buffers.size());
+    dependencyInfo.pBufferMemoryBarriers = taken.buffers.data();
+    vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+    VkBufferCopy copyRegion{};
+    copyRegion.srcOffset = srcOffset;
+    copyRegion.dstOffset = dstOffset;
+    copyRegion.size = size;
+    vkCmdCopyBuffer(cmd, src, dst, 1, &copyRegion);
+
+    // later work on this queue uses the destination without waiting on the ring
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+    dependencyInfo.bufferMemoryBarrierCount = 0;
+    dependencyInfo.pBufferMemoryBarriers = nullptr;
+    vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+
+    vkEndCommandBuffer(cmd);
+
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = 1;
+    timelineInfo.pWaitSemaphoreValues = &uploaded;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &submission.id;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = uploaded > 0 ? 1 : 0;
+    submitInfo.pWaitSemaphores = &semaphore;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmd;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &semaphore;
+
+    submit(dstQueue, submitInfo);
+
+    inFlight.push_back(submission);
+    dstSubmission = submission.id;
+
+    return submission.id;
+}
+
+void StagingRing::releaseBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, VkPipelineStageFlags2 dstStageMask, VkAccessFlags2 dstAccessMask) {
+    if (!needsOwnershipTransfer() || size == 0) {
+        return;
+    }
+    getCommandBuffer();
+
+    Transfer transfer{};
+    transfer.submission = recording.id;
+
+    VkBufferMemoryBarrier2& barrier = transfer.bufferBarrier;
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+    barrier.dstStageMask = dstStageMask;
+    barrier.dstAccessMask = dstAccessMask;
+    barrier.srcQueueFamilyIndex = queueFamilyIndex;
+    barrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+
+    releases.push_back(transfer);
+}
+
+void StagingRing::releaseImage(VkImage image, uint32_t baseMipLevel, uint32_t levelCount, const ResourceState& state) {
+    VkCommandBuffer cmd = getCommandBuffer();
+
+    std::vector<VkImageMemoryBarrier2> barriers{};
+    states.releaseImage(cmd, image, baseMipLevel, levelCount, queueFamilyIndex, dstQueueFamilyIndex, state, barriers);
+
+    for (const auto& barrier : barriers) {
+        Transfer transfer{};
+        transfer.submission = recording.id;
+        transfer.isImage = true;
+        transfer.imageBarrier = barrier;
+        acquires.push_back(transfer);
+    }
+}
+
+void StagingRing::recordReleases() {
+    // the release half of the buffers: the same barrier without the destination's use
+    std::vector<VkBufferMemoryBarrier2> bufferBarriers{};
+    for (auto& transfer : releases) {
+        bufferBarriers.push_back(transfer.bufferBarrier);
+        bufferBarriers.back().srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+        bufferBarriers.back().srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        bufferBarriers.back().dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+        bufferBarriers.back().dstAccessMask = VK_ACCESS_2_NONE;
+        acquires.push_back(transfer);
+    }
+    releases.clear();
+
+    if (!bufferBarriers.empty()) {
+        VkDependencyInfo dependencyInfo{};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        dependencyInfo.bufferMemoryBarrierCount = static_cast<uint32_t>(bufferBarriers.size());
+        dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+        vkCmdPipelineBarrier2(recording.commandBuffer, &dependencyInfo);
+    }
+
+    // the images' releases, and whatever else was declared for this batch
+    states.flush(recording.commandBuffer);
+}
+
+void OwnershipAcquires::record(VkCommandBuffer cmd, ResourceStateTracker& states) const {
+    // the semaphore wait on token orders this after the release
+    for (const auto& barrier : buffers) {
+        states.acquireBuffer(cmd, barrier);
+    }
+    for (const auto& barrier : images) {
+        states.acquireImage(cmd, barrier);
+    }
+    states.flush(cmd);
+}
+
+UploadToken StagingRing::recordAcquires(VkCommandBuffer cmd, ResourceStateTracker& states) {
+    OwnershipAcquires taken = takeAcquires();
+    taken.record(cmd, states);
+    return taken.token;
+}
+
+OwnershipAcquires StagingRing::takeAcquires() {
+    OwnershipAcquires taken{};
+    for (auto& transfer : acquires) {
+        if (transfer.isImage) {
+            taken.images.push_back(transfer.imageBarrier);
+        } else {
+            taken.buffers.push_back(transfer.bufferBarrier);
+        }
+        taken.token = std::max(taken.token, transfer.submission);
+    }
+    acquires.clear();
+
+    return taken;
+}
+
+OwnershipAcquires StagingRing::takeBufferAcquires() {
+    OwnershipAcquires taken{};
+    std::deque<Transfer> images{};
+    for (auto& transfer : acquires) {
+        if (transfer.isImage) {
+            images.push_back(transfer);
+            continue;
+        }
+        // the copy reads or overwrites them first
+        taken.buffers.push_back(transfer.bufferBarrier);
+        taken.buffers.back().dstStageMask |= VK_PIPELINE_STAGE_2_COPY_BIT;
+        taken.buffers.back().dstAccessMask |= VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        taken.token = std::max(taken.token, transfer.submission);
+    }
+    acquires.swap(images);
+
+    return taken;
+}
+
+void StagingRing::submit(VkQueue target, const VkSubmitInfo& submitInfo) {
+    std::unique_lock<std::mutex> lock{};
+    if (queueMutex != nullptr) {
+        lock = std::unique_lock<std::mutex>(*queueMutex);
+    }
+
+    VkResult err = vkQueueSubmit(target, 1, &submitInfo, VK_NULL_HANDLE);
+    if (err != VK_SUCCESS) {
+        std::cerr << "Error submitting staging copies: " << err << std::endl;
+        throw std::runtime_error("error submitting staging copies.");
+    }
+}
+
+UploadToken StagingRing::flush() {
+    if (recording.commandBuffer == VK_NULL_HANDLE) {
+        return getToken();
+    }
+
+    recordReleases();
+    vkEndCommandBuffer(recording.commandBuffer);
+
+    // after a copy on the destination queue, so the timeline is reached in order
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = dstSubmission > 0 ? 1 : 0;
+    timelineInfo.pWaitSemaphoreValues = &dstSubmission;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &recording.id;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = dstSubmission > 0 ? 1 : 0;
+    submitInfo.pWaitSemaphores = &semaphore;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &recording.commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &semaphore;
+
+    submit(queue, submitInfo);
+
+    UploadToken token = recording.id;
+    inFlight.push_back(recording);
+    recording = Submission{};
+    dstSubmission = 0;
+
+    return token;
+}
+
+UploadToken StagingRing::getToken() const {
+    if (recording.commandBuffer != VK_NULL_HANDLE) {
+        return recording.id;
+    }
+    return nextSubmissionId - 1;
+}
+
+bool StagingRing::isComplete(UploadToken token) {
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(device, semaphore, &value);
+    return value >= token;
+}
+
+void StagingRing::wait(UploadToken token) {
+    if (recording.commandBuffer != VK_NULL_HANDLE && token >= recording.id) {
+        flush();
+    }
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &semaphore;
+    waitInfo.pValues = &token;
+    vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+
+    retire();
+}
+
+void StagingRing::popRegions(uint64_t submission) {
+    while (!regions.empty() && regions.front().submission == submission) {
+        VkDeviceSize begin = regions.front().begin;
+        regions.pop_front();
+
+        // the next region starting behind the one we freed means we passed the wrap point
+        if (!regions.empty() && regions.front().begin < begin) {
+            wrapped = false;
+        }
+    }
+}
+
+void StagingRing::retireOldest() {
+    Submission submission = inFlight.front();
+    inFlight.pop_front();
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &semaphore;
+    waitInfo.pValues = &submission.id;
+    vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+
+    popRegions(submission.id);
+    if (submission.onDstQueue) {
+        availableDst.push_back(submission);
+    } else {
+        available.push_back(submission);
+    }
+}
+
+void StagingRing::retire() {
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(device, semaphore, &value);
+
+    while (!inFlight.empty() && inFlight.front().id <= value) {
+        retireOldest();
+    }
+}
+
+void StagingRing::waitIdle() {
+    flush();
+    while (!inFlight.empty()) {
+        retireOldest();
+    }
+}
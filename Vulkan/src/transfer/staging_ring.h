@@ -0,0 +1,192 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <mutex>
+
+#include "sync/state_tracker.h"
+
+// Completion of an upload batch: the value the ring's timeline semaphore reaches
+// once the batch has finished on the GPU. Tokens only grow, so a later token
+// completing implies every earlier one has. 0 is always complete.
+typedef uint64_t UploadToken;
+
+// The state images are uploaded in. Declaring it for a whole image with the ring's
+// tracker before the first upload moves every level to TRANSFER_DST_OPTIMAL with one
+// barrier; uploadImage declares it for the levels that aren't in it yet.
+const ResourceState UPLOAD_DST{ VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL };
+
+// The acquire half of what a StagingRing released, taken out of the ring so it can be
+// recorded later or by another thread.
+struct OwnershipAcquires {
+    // the submission recording these waits on the ring's semaphore at this value
+    UploadToken token = 0;
+    std::vector<VkBufferMemoryBarrier2> buffers{};
+    std::vector<VkImageMemoryBarrier2> images{};
+
+    bool empty() const { return buffers.empty() && images.empty(); }
+    // hands everything to the tracker of cmd's command stream, which records the acquire
+    // barriers; the images it tracks take on the state they were released in
+    void record(VkCommandBuffer cmd, ResourceStateTracker& states) const;
+};
+
+// Fixed-size, persistently mapped staging ring that every upload goes through.
+//
+// Uploads are copied into the ring and the matching vkCmdCopy* is recorded into
+// the ring's current command buffer. flush() submits that command buffer, signalling
+// the ring's timeline semaphore with the batch's token; the ring space it used is
+// recycled once the semaphore has reached it. Uploads bigger than the ring are
+// split into chunks, so the ring never has to hold a whole resource at once.
+//
+// Nothing here blocks unless the ring runs out of space: callers poll or wait on
+// the token, or have a queue submission wait on getSemaphore() at the token's value.
+//
+// The ring's command stream tracks the images uploaded through it with a
+// ResourceStateTracker: add them to getStateTracker() before their first upload, and
+// remove them once they have been released.
+//
+// The ring's queue may be in a different family (a dedicated transfer queue) than the
+// destination queue the resources are used on. Resources stay EXCLUSIVE, so uploads
+// are handed over with queue family ownership transfers: release* records the release
+// half at the end of the batch, and recordAcquires records the matching acquire half
+// into a command buffer of the destination queue. With a shared family buffers need
+// neither, and images only hand their state over to the destination's tracker.
+class StagingRing {
+public:
+    void init(VkDevice device, VkQueue queue, uint32_t queueFamilyIndex, VkQueue dstQueue, uint32_t dstQueueFamilyIndex,
+        VkBuffer buffer, void* mapped, VkDeviceSize capacity, const VkAllocationCallbacks* allocationCallbacks = nullptr);
+    void destroy();
+
+    // held around queue submissions, when other threads submit to the same queues.
+    // A ring itself is used by one thread at a time.
+    void setQueueMutex(std::mutex* mutex) { queueMutex = mutex; }
+
+    // returns the token of the batch the copies were recorded into
+    UploadToken uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+
+    // GPU side copy, ordered after every upload recorded before it and before every
+    // upload recorded after it. The source is owned by the destination family, so
+    // across families the copy runs on the destination queue, which acquires everything
+    // released so far first; the destination buffer ends up owned by it too.
+    UploadToken copyBuffer(VkBuffer src, VkDeviceSize srcOffset, VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size);
+
+    // the image must be tracked by getStateTracker()
+    UploadToken uploadImage(VkImage dst, uint32_t mipLevel, uint32_t width, uint32_t height, uint32_t texelSize, const void* data);
+    // rows [firstRow, firstRow + rowCount) of the level; data points at the whole level
+    UploadToken uploadImage(VkImage dst, uint32_t mipLevel, uint32_t width, uint32_t firstRow, uint32_t rowCount, uint32_t texelSize, const void* data);
+
+    // true when the ring's queue family differs from the destination queue's
+    bool needsOwnershipTransfer() const { return queueFamilyIndex != dstQueueFamilyIndex; }
+    // hand what the batch wrote over to the destination family; dstStageMask and
+    // dstAccessMask are the first use there
+    void releaseBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, VkPipelineStageFlags2 dstStageMask, VkAccessFlags2 dstAccessMask);
+    // hands levels of a tracked image over to the destination queue, where state is
+    // their first use; the ring's tracker knows the state they leave in
+    void releaseImage(VkImage image, uint32_t baseMipLevel, uint32_t levelCount, const ResourceState& state);
+    // records the acquire half of every release submitted so far into cmd, through the
+    // tracker of its command stream; cmd must be submitted to the destination queue
+    // waiting on getSemaphore() at the returned token
+    UploadToken recordAcquires(VkCommandBuffer cmd, ResourceStateTracker& states);
+    // the same, for recording somewhere else
+    OwnershipAcquires takeAcquires();
+
+    // the batch being recorded, for commands that have to run in order with the
+    // uploads (layout transitions, mip generation); see getToken for its token
+    VkCommandBuffer getCommandBuffer();
+    // the tracker of the command buffers getCommandBuffer returns
+    ResourceStateTracker& getStateTracker() { return states; }
+    // token of the batch being recorded, or of the last one submitted
+    UploadToken getToken() const;
+
+    // submits everything recorded so far; returns the token of the last batch
+    UploadToken flush();
+    // recycles space of submissions that have completed, without blocking
+    void retire();
+    // blocks until every submission has completed
+    void waitIdle();
+
+    bool isComplete(UploadToken token);
+    // submits the token's batch first if it's still being recorded
+    void wait(UploadToken token);
+    // timeline semaphore signalled with each batch's token, for chaining submissions
+    VkSemaphore getSemaphore() const { return semaphore; }
+
+    VkDeviceSize getCapacity() const { return capacity; }
+    // bytes copied through the ring since init
+    VkDeviceSize getUploadedBytes() const { return uploadedBytes; }
+
+private:
+    struct Submission {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        // also the timeline value the submission signals
+        uint64_t id = 0;
+        // submitted to dstQueue by copyBuffer
+        bool onDstQueue = false;
+    };
+
+    // the acquire half of a release; buffers are released when their batch is flushed,
+    // images by the tracker
+    struct Transfer {
+        uint64_t submission = 0;
+        bool isImage = false;
+        VkBufferMemoryBarrier2 bufferBarrier{};
+        VkImageMemoryBarrier2 imageBarrier{};
+    };
+
+    // a range of the ring in use by one submission
+    struct Region {
+        VkDeviceSize begin = 0;
+        VkDeviceSize end = 0;
+        uint64_t submission = 0;
+    };
+
+    VkDeviceSize acquire(VkDeviceSize size, VkDeviceSize alignment);
+    void recordReleases();
+    // only the buffers, which a copy on the destination queue may read or overwrite
+    OwnershipAcquires takeBufferAcquires();
+    void submit(VkQueue target, const VkSubmitInfo& submitInfo);
+    UploadToken copyBufferOnDstQueue(VkBuffer src, VkDeviceSize srcOffset, VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size);
+    void retireOldest();
+    void popRegions(uint64_t submission);
+
+    VkDevice device = VK_NULL_HANDLE;
+    const VkAllocationCallbacks* allocationCallbacks = nullptr;
+    VkQueue queue = VK_NULL_HANDLE;
+    uint32_t queueFamilyIndex = 0;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkQueue dstQueue = VK_NULL_HANDLE;
+    uint32_t dstQueueFamilyIndex = 0;
+    // only created across families
+    VkCommandPool dstCommandPool = VK_NULL_HANDLE;
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    std::mutex* queueMutex = nullptr;
+    // of the ring's queue; copies on the destination queue only use global barriers
+    ResourceStateTracker states{};
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    char* mapped = nullptr;
+    VkDeviceSize capacity = 0;
+    VkDeviceSize maxChunkSize = 0;
+    VkDeviceSize uploadedBytes = 0;
+
+    // next write position; when wrapped the free range is [head, oldest region)
+    VkDeviceSize head = 0;
+    bool wrapped = false;
+    std::deque<Region> regions{};
+
+    // the submission currently being recorded, if any
+    Submission recording{};
+    uint64_t nextSubmissionId = 1;
+    std::deque<Submission> inFlight{};
+    std::vector<Submission> available{};
+    std::vector<Submission> availableDst{};
+    // the last submission on dstQueue; the next batch waits for it, so the timeline
+    // values are reached in order
+    uint64_t dstSubmission = 0;
+
+    // buffers released in the batch being recorded / everything released but not acquired yet
+    std::vector<Transfer> releases{};
+    std::deque<Transfer> acquires{};
+};
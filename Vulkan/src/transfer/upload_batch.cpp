@@ -0,0 +1,284 @@
+#include "pch.h"
+#include "transfer/upload_batch.h"
+#include "sync/state_tracker.h"
+#include "transfer/mip_generator.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+namespace {
+    int32_t mipExtent(uint32_t extent, uint32_t level) {
+        return static_cast<int32_t>(std::max(extent >> level, 1u));
+    }
+
+    ResourceState sampledState(VkPipelineStageFlags dstStageMask) {
+        return { static_cast<VkPipelineStageFlags2>(dstStageMask), VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+    }
+
+    uint32_t recordBlits(VkCommandBuffer cmd, ResourceStateTracker& states, const std::vector<MipChain>& chains, VkPipelineStageFlags dstStageMask) {
+        const ResourceState blitSource{ VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL };
+        const ResourceState blitDestination{ VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL };
+        const ResourceState sampled = sampledState(dstStageMask);
+
+        uint32_t maxLevels = 0;
+        for (const auto& chain : chains) {
+            maxLevels = std::max(maxLevels, chain.mipLevels);
+        }
+
+        uint32_t barrierCalls = 0;
+        for (uint32_t level = 1; level < maxLevels; level++) {
+            // goes out together with the previous level's hand-over to the shaders
+            for (const auto& chain : chains) {
+                if (level < chain.mipLevels) {
+                    states.useImage(cmd, chain.image, level - 1, 1, 0, 1, blitSource);
+                    states.useImage(cmd, chain.image, level, 1, 0, 1, blitDestination);
+                }
+            }
+            barrierCalls += states.flush(cmd);
+
+            for (const auto& chain : chains) {
+                if (level >= chain.mipLevels) {
+                    continue;
+                }
+
+                VkImageBlit blit{};
+                blit.srcOffsets[0] = { 0, 0, 0 };
+                blit.srcOffsets[1] = { mipExtent(chain.width, level - 1), mipExtent(chain.height, level - 1), 1 };
+                blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                blit.srcSubresource.mipLevel = level - 1;
+                blit.srcSubresource.baseArrayLayer = 0;
+                blit.srcSubresource.layerCount = 1;
+                blit.dstOffsets[0] = { 0, 0, 0 };
+                blit.dstOffsets[1] = { mipExtent(chain.width, level), mipExtent(chain.height, level), 1 };
+                blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                blit.dstSubresource.mipLevel = level;
+                blit.dstSubresource.baseArrayLayer = 0;
+                blit.dstSubresource.layerCount = 1;
+
+                vkCmdBlitImage(
+                    cmd,
+                    chain.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    chain.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    1, &blit,
+                    VK_FILTER_LINEAR);
+
+                states.useImage(cmd, chain.image, level - 1, 1, 0, 1, sampled);
+            }
+        }
+
+        // the last level of every image was only ever written
+        for (const auto& chain : chains) {
+            states.useImage(cmd, chain.image, chain.mipLevels - 1, 1, 0, 1, sampled);
+        }
+        barrierCalls += states.flush(cmd);
+
+        return barrierCalls;
+    }
+}
+
+uint32_t recordMipChains(VkCommandBuffer cmd, ResourceStateTracker& states, const std::vector<MipChain>& chains, VkPipelineStageFlags dstStageMask,
+    ComputeMipGenerator* compute) {
+    std::vector<MipChain> computeChains{};
+    std::vector<MipChain> blitChains{};
+    for (const auto& chain : chains) {
+        if (compute != nullptr && compute->supports(chain.storageFormat)) {
+            computeChains.push_back(chain);
+        } else {
+            blitChains.push_back(chain);
+        }
+    }
+
+    uint32_t barrierCalls = 0;
+    if (!computeChains.empty()) {
+        barrierCalls += compute->record(cmd, states, computeChains, dstStageMask);
+    }
+    if (!blitChains.empty()) {
+        barrierCalls += recordBlits(cmd, states, blitChains, dstStageMask);
+    }
+    return barrierCalls;
+}
+
+void UploadBatch::init(StagingRing& stagingRing, VkPipelineStageFlags dstStageMask, bool serial) {
+    this->stagingRing = &stagingRing;
+    this->dstStageMask = dstStageMask;
+    this->serial = serial;
+}
+
+void UploadBatch::begin() {
+    if (!images.empty()) {
+        throw std::runtime_error("upload batch begun before the previous one was submitted.");
+    }
+
+    // whatever was recorded before belongs to someone else; keep it out of this batch
+    firstToken = stagingRing->flush();
+
+    stats = UploadBatchStats{};
+    beginBytes = stagingRing->getUploadedBytes();
+    beginTime = Clock::now();
+    pending = false;
+}
+
+void UploadBatch::addImage(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t texelSize, const void* data,
+    VkFormat storageFormat) {
+    Image entry{};
+    entry.chain.image = image;
+    entry.chain.width = width;
+    entry.chain.height = height;
+    entry.chain.mipLevels = mipLevels;
+    entry.chain.storageFormat = storageFormat;
+    entry.texelSize = texelSize;
+    entry.data = data;
+    images.push_back(entry);
+
+    stagingRing->getStateTracker().addImage(image, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels, 1);
+
+    stats.images++;
+}
+
+void UploadBatch::addImageChain(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t texelSize, const void* data) {
+    addImage(image, width, height, mipLevels, texelSize, data);
+    images.back().fullChain = true;
+}
+
+UploadToken UploadBatch::submit() {
+    if (serial) {
+        // what was recorded straight into the ring (buffers) goes first, on its own
+        roundTrip();
+        for (const auto& image : images) {
+            recordTransitions(&image, 1);
+            roundTrip();
+            recordCopies(&image, 1);
+            roundTrip();
+            if (image.fullChain) {
+                recordFullChains(&image, 1);
+            } else {
+                if (!stagingRing->needsOwnershipTransfer()) {
+                    stats.barrierCalls += recordMipChains(stagingRing->getCommandBuffer(), stagingRing->getStateTracker(), { image.chain }, dstStageMask, computeMips);
+                }
+                recordReleases(&image, 1);
+            }
+            roundTrip();
+        }
+    } else {
+        recordTransitions(images.data(), images.size());
+        recordCopies(images.data(), images.size());
+        recordFullChains(images.data(), images.size());
+        if (!stagingRing->needsOwnershipTransfer()) {
+            std::vector<MipChain> chains{};
+            for (const auto& image : images) {
+                if (!image.fullChain) {
+                    chains.push_back(image.chain);
+                }
+            }
+            if (!chains.empty()) {
+                stats.barrierCalls += recordMipChains(stagingRing->getCommandBuffer(), stagingRing->getStateTracker(), chains, dstStageMask, computeMips);
+            }
+        }
+        recordReleases(images.data(), images.size());
+    }
+
+    token = stagingRing->flush();
+    images.clear();
+
+    submitTime = Clock::now();
+    stats.submissions = static_cast<uint32_t>(token - firstToken);
+    stats.bytes = stagingRing->getUploadedBytes() - beginBytes;
+    stats.recordMilliseconds = std::chrono::duration<double, std::milli>(submitTime - beginTime).count();
+    pending = true;
+
+    return token;
+}
+
+void UploadBatch::recordGraphics(VkCommandBuffer cmd, ResourceStateTracker& states) {
+    if (released.empty()) {
+        return;
+    }
+
+    stats.barrierCalls += recordMipChains(cmd, states, released, dstStageMask, computeMips);
+    released.clear();
+}
+
+bool UploadBatch::poll() {
+    // the mips of released images aren't recorded yet
+    if (!pending || !released.empty() || !stagingRing->isComplete(token)) {
+        return false;
+    }
+
+    stats.completeMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - submitTime).count();
+    pending = false;
+    return true;
+}
+
+void UploadBatch::recordTransitions(const Image* images, size_t count) {
+    VkCommandBuffer cmd = stagingRing->getCommandBuffer();
+    ResourceStateTracker& states = stagingRing->getStateTracker();
+
+    // the images are new; whatever they held before doesn't matter
+    for (size_t i = 0; i < count; i++) {
+        states.useImage(cmd, images[i].chain.image, UPLOAD_DST);
+    }
+
+    stats.barrierCalls += states.flush(cmd);
+}
+
+void UploadBatch::recordCopies(const Image* images, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const MipChain& chain = images[i].chain;
+        uint32_t levels = images[i].fullChain ? chain.mipLevels : 1;
+        for (uint32_t level = 0; level < levels; level++) {
+            const char* data = static_cast<const char*>(images[i].data) + mipLevelOffset(chain.width, chain.height, level, images[i].texelSize);
+            stagingRing->uploadImage(chain.image, level, mipExtent(chain.width, level), mipExtent(chain.height, level), images[i].texelSize, data);
+        }
+    }
+}
+
+void UploadBatch::recordReleases(const Image* images, size_t count) {
+    ResourceStateTracker& states = stagingRing->getStateTracker();
+    bool transfer = stagingRing->needsOwnershipTransfer();
+
+    for (size_t i = 0; i < count; i++) {
+        const MipChain& chain = images[i].chain;
+        if (images[i].fullChain) {
+            continue;
+        }
+
+        // the blits read level 0 and write the rest
+        stagingRing->releaseImage(chain.image, 0, chain.mipLevels, transfer ? MIP_SOURCE : sampledState(dstStageMask));
+        states.removeImage(chain.image);
+
+        if (transfer) {
+            released.push_back(chain);
+        }
+    }
+
+    stats.barrierCalls += states.flush(stagingRing->getCommandBuffer());
+}
+
+void UploadBatch::recordFullChains(const Image* images, size_t count) {
+    ResourceStateTracker& states = stagingRing->getStateTracker();
+
+    for (size_t i = 0; i < count; i++) {
+        const MipChain& chain = images[i].chain;
+        if (!images[i].fullChain) {
+            continue;
+        }
+
+        // the layout changes on the way over
+        stagingRing->releaseImage(chain.image, 0, chain.mipLevels, sampledState(dstStageMask));
+        states.removeImage(chain.image);
+    }
+
+    stats.barrierCalls += states.flush(stagingRing->getCommandBuffer());
+}
+
+void UploadBatch::roundTrip() {
+    stagingRing->wait(stagingRing->flush());
+}
+
+void UploadBatch::print(std::ostream& out) const {
+    out << "Upload Batch (" << (serial ? "serial" : "batched") << "): "
+        << stats.images << " image(s), " << (stats.bytes >> 10) << " KiB, "
+        << stats.barrierCalls << " barrier call(s), " << stats.submissions << " submission(s), "
+        << stats.recordMilliseconds << " ms to submit, " << stats.completeMilliseconds << " ms more to complete" << std::endl;
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+#include <chrono>
+#include <ostream>
+
+#include "transfer/staging_ring.h"
+#include "transfer/compute_mips.h"
+#include "sync/state_tracker.h"
+
+// What one batch cost, for comparing batched and serial uploads.
+struct UploadBatchStats {
+    uint32_t images = 0;
+    // everything copied through the staging ring between begin and submit,
+    // including uploads recorded straight into the ring (meshes)
+    VkDeviceSize bytes = 0;
+    uint32_t barrierCalls = 0;
+    uint32_t submissions = 0;
+    // CPU time from begin to the end of submit: loading, staging copies, recording,
+    // and in serial mode the waits
+    double recordMilliseconds = 0.0;
+    // from submit until poll saw the batch complete; only as precise as the polling
+    double completeMilliseconds = 0.0;
+};
+
+// An image whose level 0 is written, for recordMipChains.
+struct MipChain {
+    VkImage image = VK_NULL_HANDLE;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mipLevels = 1;
+    // the image's format, if it was created for ComputeMipGenerator (STORAGE usage,
+    // plus MUTABLE_FORMAT and EXTENDED_USAGE when sRGB); VK_FORMAT_UNDEFINED blits
+    VkFormat storageFormat = VK_FORMAT_UNDEFINED;
+};
+
+// How recordMipChains first uses a chain: the state to hand images over in to the
+// command stream that generates their mips.
+const ResourceState MIP_SOURCE{ VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL };
+
+// Generates the remaining levels of every chain and leaves the images in
+// SHADER_READ_ONLY_OPTIMAL for dstStageMask. Chains compute can do go to compute, if
+// given and available; the others are blitted, each level of all chains behind one
+// barrier. The images must be tracked by states, the tracker of cmd's command stream,
+// which merges levels going the same way into one range. Blits need a graphics queue.
+// Returns the number of barrier calls recorded.
+uint32_t recordMipChains(VkCommandBuffer cmd, ResourceStateTracker& states, const std::vector<MipChain>& chains, VkPipelineStageFlags dstStageMask,
+    ComputeMipGenerator* compute = nullptr);
+
+// Gathers the texture uploads of a load (or of init) and records them into the
+// staging ring as one batch with merged barriers.
+//
+// Images are queued with addImage and recorded by submit: one barrier moves every
+// image to TRANSFER_DST, level 0 of each is copied in, then each mip level of all
+// images is blitted from the previous one behind a single barrier, and one last
+// barrier hands everything to the shaders. So the barrier count grows with the
+// deepest mip chain rather than with the number of images, and the whole load is a
+// single submission (more only if the ring fills up).
+//
+// Blits need a graphics queue. When the staging ring is on a dedicated transfer
+// family, the batch only copies level 0 there and releases the images to the
+// destination family; the mips and the final barrier are recorded by recordGraphics
+// into a command buffer of the destination queue, after the ring's acquires. Either
+// way the images are handed over to the destination queue's tracker by the ring's
+// acquires, so they have to be added to that tracker as well.
+//
+// Images added with addImageChain come with all their levels, generated on the CPU;
+// every level is copied in and they skip the mip generation, so on a transfer family
+// they are released straight in SHADER_READ_ONLY_OPTIMAL.
+//
+// Serial mode records the same work per image, submitting and waiting after every
+// step like a loader without batching does; it exists to measure the difference.
+class UploadBatch {
+public:
+    void init(StagingRing& stagingRing, VkPipelineStageFlags dstStageMask, bool serial = false);
+    // generates the mip chains of images added with a storage format
+    void setComputeMips(ComputeMipGenerator* generator) { computeMips = generator; }
+
+    // starts a new batch and its stats; the previous one must have been submitted
+    void begin();
+
+    // image is new, with TRANSFER_SRC and TRANSFER_DST usage
+    // and a format that supports linear blits, or a storageFormat (see MipChain); level
+    // 0 is uploaded from data, the other levels are generated. data has to stay valid
+    // until submit.
+    void addImage(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t texelSize, const void* data,
+        VkFormat storageFormat = VK_FORMAT_UNDEFINED);
+    // the same, but data holds every level packed as by generateMipLevels, and they
+    // are all uploaded; nothing is generated on the GPU, so it works on any queue and
+    // for any format
+    void addImageChain(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t texelSize, const void* data);
+
+    // records and flushes everything queued; images end up in SHADER_READ_ONLY_OPTIMAL
+    UploadToken submit();
+    // across queue families: records the mip generation of submitted images; call
+    // right after StagingRing::recordAcquires on the same command buffer and tracker
+    void recordGraphics(VkCommandBuffer cmd, ResourceStateTracker& states);
+
+    // returns true once, when the last submitted batch has completed
+    bool poll();
+
+    const UploadBatchStats& getStats() const { return stats; }
+    void print(std::ostream& out) const;
+
+private:
+    struct Image {
+        MipChain chain{};
+        uint32_t texelSize = 4;
+        const void* data = nullptr;
+        // data holds every level; see addImageChain
+        bool fullChain = false;
+    };
+
+    typedef std::chrono::high_resolution_clock Clock;
+
+    void recordTransitions(const Image* images, size_t count);
+    void recordCopies(const Image* images, size_t count);
+    // hands images with generated levels to the destination queue: across families to
+    // generate them there, otherwise once generated
+    void recordReleases(const Image* images, size_t count);
+    // hands images uploaded with every level to the destination queue, for the shaders
+    void recordFullChains(const Image* images, size_t count);
+    // submits what is recorded so far and blocks until it is done
+    void roundTrip();
+
+    StagingRing* stagingRing = nullptr;
+    // where the images are used after the batch
+    VkPipelineStageFlags dstStageMask = 0;
+    bool serial = false;
+    ComputeMipGenerator* computeMips = nullptr;
+
+    std::vector<Image> images{};
+    // released to the destination family, waiting for recordGraphics
+    std::vector<MipChain> released{};
+
+    UploadBatchStats stats{};
+    UploadToken firstToken = 0;
+    UploadToken token = 0;
+    VkDeviceSize beginBytes = 0;
+    Clock::time_point beginTime{};
+    Clock::time_point submitTime{};
+    bool pending = false;
+};
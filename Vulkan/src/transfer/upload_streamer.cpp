@@ -0,0 +1,355 @@
+#include "pch.h"
+#include "transfer/upload_streamer.h"
+#include "transfer/mip_generator.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+void UploadStreamer::init(VkDevice device, VkQueue queue, uint32_t queueFamilyIndex, VkQueue dstQueue, uint32_t dstQueueFamilyIndex, std::mutex& queueMutex,
+    VkBuffer buffer, void* mapped, VkDeviceSize capacity, VkDeviceSize bytesPerFrame, VkPipelineStageFlags imageDstStageMask,
+    const VkAllocationCallbacks* allocationCallbacks) {
+    this->device = device;
+    this->bytesPerFrame = bytesPerFrame;
+    this->imageDstStageMask = imageDstStageMask;
+    // the ring copies images in chunks of whole rows, at most half of it at once
+    maxRowPitch = capacity / 2;
+
+    ring.init(device, queue, queueFamilyIndex, dstQueue, dstQueueFamilyIndex, buffer, mapped, capacity, allocationCallbacks);
+    ring.setQueueMutex(&queueMutex);
+    semaphore = ring.getSemaphore();
+
+    stopping = false;
+    thread = std::thread([this]() { run(); });
+}
+
+void UploadStreamer::destroy() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_one();
+    if (thread.joinable()) {
+        thread.join();
+    }
+
+    requests = {};
+    submitted.clear();
+    ready.clear();
+    active = Request{};
+    hasActive = false;
+
+    ring.destroy();
+    semaphore = VK_NULL_HANDLE;
+}
+
+StreamId UploadStreamer::requestBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size,
+    VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask, int priority, StreamSource source) {
+    Request request{};
+    request.priority = priority;
+    request.source = std::move(source);
+    request.buffer = dst;
+    request.offset = dstOffset;
+    request.size = size;
+    request.dstStageMask = dstStageMask;
+    request.dstAccessMask = dstAccessMask;
+    return push(std::move(request));
+}
+
+StreamId UploadStreamer::requestImage(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t texelSize, int priority, StreamSource source,
+    VkFormat storageFormat) {
+    if (width == 0 || height == 0) {
+        throw std::runtime_error("streamed image is empty.");
+    }
+
+    if (static_cast<VkDeviceSize>(width) * texelSize > maxRowPitch) {
+        throw std::runtime_error("streamed image row does not fit in the stream ring.");
+    }
+
+    Request request{};
+    request.priority = priority;
+    request.source = std::move(source);
+    request.isImage = true;
+    request.chain.image = image;
+    request.chain.width = width;
+    request.chain.height = height;
+    request.chain.mipLevels = mipLevels;
+    request.chain.storageFormat = storageFormat;
+    request.texelSize = texelSize;
+    request.size = static_cast<VkDeviceSize>(width) * height * texelSize;
+    return push(std::move(request));
+}
+
+StreamId UploadStreamer::requestProgressiveImage(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels, bool srgb, int priority, StreamSource source) {
+    const uint32_t texelSize = 4;
+    if (width == 0 || height == 0) {
+        throw std::runtime_error("streamed image is empty.");
+    }
+    if (static_cast<VkDeviceSize>(width) * texelSize > maxRowPitch) {
+        throw std::runtime_error("streamed image row does not fit in the stream ring.");
+    }
+
+    Request request{};
+    request.priority = priority;
+    request.source = std::move(source);
+    request.isImage = true;
+    request.progressive = true;
+    request.srgb = srgb;
+    request.chain.image = image;
+    request.chain.width = width;
+    request.chain.height = height;
+    request.chain.mipLevels = mipLevels;
+    request.texelSize = texelSize;
+    // the source only provides level 0; the rest is generated before uploading
+    request.size = static_cast<VkDeviceSize>(width) * height * texelSize;
+    request.level = mipLevels - 1;
+    return push(std::move(request));
+}
+
+StreamId UploadStreamer::push(Request request) {
+    std::lock_guard<std::mutex> lock(mutex);
+    request.id = nextId++;
+    StreamId id = request.id;
+    requests.push(std::move(request));
+    requestCount++;
+
+    // the thread picks it up with the next frame's budget
+    return id;
+}
+
+std::vector<StreamProgress> UploadStreamer::update(std::vector<StreamId>* failed) {
+    std::vector<StreamProgress> progress{};
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // budget the thread didn't use is gone; it doesn't pile up into a burst
+        allowance = bytesPerFrame;
+
+        while (!submitted.empty() && isComplete(submitted.front().token)) {
+            Batch& batch = submitted.front();
+            for (const auto& entry : batch.progress) {
+                progress.push_back(entry);
+                completedCount += entry.complete ? 1 : 0;
+            }
+            ready.push_back(std::move(batch));
+            submitted.pop_front();
+        }
+
+        if (failed != nullptr) {
+            failed->insert(failed->end(), failedIds.begin(), failedIds.end());
+        }
+        failedIds.clear();
+    }
+    wakeup.notify_one();
+
+    return progress;
+}
+
+UploadToken UploadStreamer::recordGraphics(VkCommandBuffer cmd, ResourceStateTracker& states) {
+    UploadToken token = 0;
+    std::vector<MipChain> chains{};
+    for (const auto& batch : ready) {
+        batch.acquires.record(cmd, states);
+        chains.insert(chains.end(), batch.chains.begin(), batch.chains.end());
+        token = std::max(token, batch.token);
+    }
+    ready.clear();
+
+    if (!chains.empty()) {
+        recordMipChains(cmd, states, chains, imageDstStageMask, computeMips);
+    }
+    return token;
+}
+
+bool UploadStreamer::isComplete(UploadToken token) const {
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(device, semaphore, &value);
+    return value >= token;
+}
+
+void UploadStreamer::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;) {
+        wakeup.wait(lock, [this]() {
+            return stopping || (allowance > 0 && (hasActive || !requests.empty()));
+        });
+        if (stopping) {
+            return;
+        }
+
+        VkDeviceSize budget = allowance;
+        allowance = 0;
+
+        Batch batch{};
+        std::vector<StreamId> failures{};
+        VkDeviceSize recorded = 0;
+
+        while (recorded < budget) {
+            if (!hasActive) {
+                if (requests.empty()) {
+                    break;
+                }
+                active = requests.top();
+                requests.pop();
+                hasActive = true;
+
+                lock.unlock();
+                bool loaded = active.source(active.data) && active.data.size() >= active.size;
+                active.source = nullptr;
+                if (loaded && active.progressive) {
+                    generateMipLevels(active.data, active.chain.width, active.chain.height, active.chain.mipLevels, active.srgb);
+                    active.size = active.data.size();
+                }
+                lock.lock();
+
+                if (!loaded) {
+                    std::cerr << "Error streaming request " << active.id << ": source has no data" << std::endl;
+                    failures.push_back(active.id);
+                    active = Request{};
+                    hasActive = false;
+                    continue;
+                }
+            }
+
+            lock.unlock();
+            recorded += uploadPart(budget - recorded, batch);
+            lock.lock();
+
+            if (active.uploaded == active.size) {
+                active = Request{};
+                hasActive = false;
+            }
+        }
+
+        // the slice goes out as one submission; an unfinished request goes on next frame
+        lock.unlock();
+        ring.retire();
+        batch.token = ring.flush();
+        batch.acquires = ring.takeAcquires();
+        lock.lock();
+
+        streamedBytes += recorded;
+        failedIds.insert(failedIds.end(), failures.begin(), failures.end());
+        failedCount += failures.size();
+        if (!batch.progress.empty()) {
+            submitted.push_back(std::move(batch));
+        }
+    }
+}
+
+VkDeviceSize UploadStreamer::uploadPart(VkDeviceSize budget, Batch& batch) {
+    Request& request = active;
+    VkDeviceSize bytes = 0;
+
+    if (!request.isImage) {
+        bytes = std::min(budget, request.size - request.uploaded);
+        ring.uploadBuffer(request.buffer, request.offset + request.uploaded, request.data.data() + request.uploaded, bytes);
+        request.uploaded += bytes;
+
+        if (request.uploaded == request.size) {
+            ring.releaseBuffer(request.buffer, request.offset, request.size, request.dstStageMask, request.dstAccessMask);
+        }
+    } else if (request.progressive) {
+        return uploadLevelPart(budget, batch);
+    } else {
+        const MipChain& chain = request.chain;
+        VkDeviceSize rowPitch = static_cast<VkDeviceSize>(chain.width) * request.texelSize;
+
+        if (request.uploaded == 0) {
+            recordTransferDst(chain);
+        }
+
+        // whole rows; at least one, so a tight budget still makes progress
+        uint32_t firstRow = static_cast<uint32_t>(request.uploaded / rowPitch);
+        uint32_t rows = static_cast<uint32_t>(std::max<VkDeviceSize>(budget / rowPitch, 1));
+        rows = std::min(rows, chain.height - firstRow);
+
+        ring.uploadImage(chain.image, 0, chain.width, firstRow, rows, request.texelSize, request.data.data());
+        bytes = rowPitch * rows;
+        request.uploaded += bytes;
+
+        if (request.uploaded == request.size) {
+            // the mips are generated on the destination queue
+            ring.releaseImage(chain.image, 0, chain.mipLevels, MIP_SOURCE);
+            ring.getStateTracker().removeImage(chain.image);
+            batch.chains.push_back(chain);
+        }
+    }
+
+    if (request.uploaded == request.size) {
+        reportProgress(batch, 0, true);
+    }
+
+    return bytes;
+}
+
+VkDeviceSize UploadStreamer::uploadLevelPart(VkDeviceSize budget, Batch& batch) {
+    Request& request = active;
+    const MipChain& chain = request.chain;
+
+    if (request.uploaded == 0) {
+        recordTransferDst(chain);
+    }
+
+    uint32_t width = std::max(chain.width >> request.level, 1u);
+    uint32_t height = std::max(chain.height >> request.level, 1u);
+    VkDeviceSize rowPitch = static_cast<VkDeviceSize>(width) * request.texelSize;
+
+    uint32_t firstRow = static_cast<uint32_t>(request.levelUploaded / rowPitch);
+    uint32_t rows = static_cast<uint32_t>(std::max<VkDeviceSize>(budget / rowPitch, 1));
+    rows = std::min(rows, height - firstRow);
+
+    const char* level = request.data.data() + mipLevelOffset(chain.width, chain.height, request.level, request.texelSize);
+    ring.uploadImage(chain.image, request.level, width, firstRow, rows, request.texelSize, level);
+
+    VkDeviceSize bytes = rowPitch * rows;
+    request.uploaded += bytes;
+    request.levelUploaded += bytes;
+    if (request.levelUploaded < rowPitch * height) {
+        return bytes;
+    }
+
+    // the level is complete: it goes to the shaders by itself
+    ring.releaseImage(chain.image, request.level, 1,
+        { static_cast<VkPipelineStageFlags2>(imageDstStageMask), VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL });
+    if (request.level == 0) {
+        ring.getStateTracker().removeImage(chain.image);
+    }
+
+    reportProgress(batch, request.level, request.level == 0);
+    if (request.level > 0) {
+        request.level--;
+        request.levelUploaded = 0;
+    }
+
+    return bytes;
+}
+
+void UploadStreamer::recordTransferDst(const MipChain& chain) {
+    ResourceStateTracker& states = ring.getStateTracker();
+    states.addImage(chain.image, VK_IMAGE_ASPECT_COLOR_BIT, chain.mipLevels, 1);
+    states.useImage(ring.getCommandBuffer(), chain.image, UPLOAD_DST);
+}
+
+void UploadStreamer::reportProgress(Batch& batch, uint32_t baseMipLevel, bool complete) {
+    // the tail lands several levels per slice; only the finest counts
+    if (!batch.progress.empty() && batch.progress.back().id == active.id) {
+        batch.progress.back().baseMipLevel = baseMipLevel;
+        batch.progress.back().complete = complete;
+        return;
+    }
+
+    StreamProgress progress{};
+    progress.id = active.id;
+    progress.baseMipLevel = baseMipLevel;
+    progress.complete = complete;
+    batch.progress.push_back(progress);
+}
+
+void UploadStreamer::print(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    out << "Upload Streamer: " << requestCount << " request(s), " << completedCount << " completed, "
+        << failedCount << " failed, " << requests.size() + (hasActive ? 1 : 0) << " pending, "
+        << (streamedBytes >> 10) << " KiB streamed at up to " << (bytesPerFrame >> 10) << " KiB per frame" << std::endl;
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <ostream>
+
+#include "transfer/staging_ring.h"
+#include "transfer/upload_batch.h"
+
+// Identifies a request to an UploadStreamer; 0 is never handed out.
+typedef uint64_t StreamId;
+
+// Produces the bytes of a request (reads and decodes a file, ...). Runs on the upload
+// thread; returns false when the data can't be had, which fails the request.
+typedef std::function<bool(std::vector<char>& data)> StreamSource;
+
+// What update() reports about a request.
+struct StreamProgress {
+    StreamId id = 0;
+    // progressive images: the finest level that can be sampled now, with every
+    // coarser one; the levels above it are still in TRANSFER_DST_OPTIMAL
+    uint32_t baseMipLevel = 0;
+    bool complete = false;
+};
+
+// Uploads buffers and textures on demand from a thread of its own.
+//
+// Requests are queued with a priority and handed to the upload thread, which loads
+// their data through their source and copies it through a staging ring of its own
+// (with its own command pools and timeline semaphore) to the transfer queue. The thread
+// only moves as many bytes per frame as update() grants it, so streaming never takes
+// more than a fixed slice of the transfer bandwidth, however much is queued; large
+// resources are spread over several frames.
+//
+// Once a resource is completely copied it is released to the destination family, and
+// the render thread picks it up: update() returns the requests whose copies have
+// finished, and recordGraphics records their acquires and mip chains at the start of
+// that frame's command buffer. From then on the resource can be swapped in; nothing on
+// either thread waits for the copies.
+//
+// Progressive images go coarse to fine instead: their mip chain is generated on the
+// upload thread and sent smallest level first, each level handed over as soon as it
+// has landed. The tail of the chain fits into the first frame's budget, so the image
+// can be sampled right away through a view that starts at the finest level in, and
+// the view moves down a level whenever update() reports one more.
+//
+// The thread submits to the transfer queue, which may be the render thread's queue, so
+// every submission to the device's queues has to hold queueMutex.
+class UploadStreamer {
+public:
+    void init(VkDevice device, VkQueue queue, uint32_t queueFamilyIndex, VkQueue dstQueue, uint32_t dstQueueFamilyIndex, std::mutex& queueMutex,
+        VkBuffer buffer, void* mapped, VkDeviceSize capacity, VkDeviceSize bytesPerFrame, VkPipelineStageFlags imageDstStageMask,
+        const VkAllocationCallbacks* allocationCallbacks = nullptr);
+    // drops the requests still queued and waits for the thread and the copies in flight
+    void destroy();
+    // render thread only, like recordGraphics, which records the mip chains
+    void setComputeMips(ComputeMipGenerator* generator) { computeMips = generator; }
+
+    // higher priority goes first, then first come first served. The source fills in
+    // exactly size bytes for dst at dstOffset; dstStageMask and dstAccessMask are the
+    // first use on the destination queue.
+    StreamId requestBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size,
+        VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask, int priority, StreamSource source);
+    // image is as for UploadBatch::addImage; the source fills in level 0. It ends up in
+    // SHADER_READ_ONLY_OPTIMAL.
+    StreamId requestImage(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels, uint32_t texelSize, int priority, StreamSource source,
+        VkFormat storageFormat = VK_FORMAT_UNDEFINED);
+    // an RGBA8 image with TRANSFER_DST and SAMPLED usage; the source fills in level 0.
+    // The levels end up in SHADER_READ_ONLY_OPTIMAL one by one, see StreamProgress.
+    StreamId requestProgressiveImage(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels, bool srgb, int priority, StreamSource source);
+
+    // once per frame on the render thread: grants the thread the frame's byte budget
+    // and returns the progress that became visible; failed requests go to failed
+    std::vector<StreamProgress> update(std::vector<StreamId>* failed = nullptr);
+    // records the hand-over of everything update() returned into a command buffer of the
+    // destination queue, outside a render pass, through the tracker of its command
+    // stream; the images requested have to be added to it. The submission waits on
+    // getSemaphore() at the returned token
+    UploadToken recordGraphics(VkCommandBuffer cmd, ResourceStateTracker& states);
+
+    VkSemaphore getSemaphore() const { return semaphore; }
+    bool isComplete(UploadToken token) const;
+
+    void print(std::ostream& out);
+
+private:
+    struct Request {
+        StreamId id = 0;
+        int priority = 0;
+        StreamSource source{};
+
+        bool isImage = false;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        VkPipelineStageFlags dstStageMask = 0;
+        VkAccessFlags dstAccessMask = 0;
+        MipChain chain{};
+        uint32_t texelSize = 0;
+        bool progressive = false;
+        bool srgb = false;
+
+        // upload thread only
+        std::vector<char> data{};
+        VkDeviceSize uploaded = 0;
+        // progressive: the level being uploaded and how much of it is in
+        uint32_t level = 0;
+        VkDeviceSize levelUploaded = 0;
+    };
+
+    struct Later {
+        bool operator()(const Request& a, const Request& b) const {
+            return a.priority != b.priority ? a.priority < b.priority : a.id > b.id;
+        }
+    };
+
+    // the copies submitted in one slice
+    struct Batch {
+        UploadToken token = 0;
+        OwnershipAcquires acquires{};
+        std::vector<MipChain> chains{};
+        std::vector<StreamProgress> progress{};
+    };
+
+    StreamId push(Request request);
+    void run();
+    // records up to budget bytes of the active request (at least a row of an image);
+    // returns the bytes recorded. The request is complete once uploaded reaches size.
+    VkDeviceSize uploadPart(VkDeviceSize budget, Batch& batch);
+    VkDeviceSize uploadLevelPart(VkDeviceSize budget, Batch& batch);
+    // the first part of an image adds it to the ring's tracker and moves all of it to
+    // TRANSFER_DST_OPTIMAL
+    void recordTransferDst(const MipChain& chain);
+    void reportProgress(Batch& batch, uint32_t baseMipLevel, bool complete);
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkSemaphore semaphore = VK_NULL_HANDLE;
+    VkDeviceSize bytesPerFrame = 0;
+    VkPipelineStageFlags imageDstStageMask = 0;
+    VkDeviceSize maxRowPitch = 0;
+
+    // upload thread only, after init
+    StagingRing ring{};
+    Request active{};
+
+    std::thread thread{};
+    std::mutex mutex{};
+    std::condition_variable wakeup{};
+
+    // guarded by mutex
+    bool stopping = false;
+    // active holds a request
+    bool hasActive = false;
+    VkDeviceSize allowance = 0;
+    StreamId nextId = 1;
+    std::priority_queue<Request, std::vector<Request>, Later> requests{};
+    std::deque<Batch> submitted{};
+    std::vector<StreamId> failedIds{};
+    uint64_t requestCount = 0;
+    uint64_t completedCount = 0;
+    uint64_t failedCount = 0;
+    VkDeviceSize streamedBytes = 0;
+
+    // render thread only: ready, waiting for recordGraphics
+    std::vector<Batch> ready{};
+    ComputeMipGenerator* computeMips = nullptr;
+};
@@ -67,4 +67,136 @@ project "Vulkan"
 
     filter "system:windows"
         cppdialect "C++17"
-        systemversion "latest"
\ No newline at end of file
+        systemversion "latest"
+
+-- headless upload benchmark: the engine's upload code without the window or main.cpp
+project "UploadBench"
+    location "Vulkan"
+    kind "ConsoleApp"
+    language "C++"
+    cppdialect "C++17"
+    staticruntime "on"
+
+    targetdir ("bin/"..outputdir.."/%{prj.name}")
+    objdir ("bin-int/"..outputdir.."/%{prj.name}")
+
+    pchheader "pch.h"
+    pchsource "Vulkan/src/pch.cpp"
+
+    files
+    {
+        "Vulkan/bench/upload_bench.cpp",
+        "Vulkan/src/pch.cpp",
+        "Vulkan/src/memory/**.h",
+        "Vulkan/src/memory/**.cpp",
+        "Vulkan/src/sync/**.h",
+        "Vulkan/src/sync/**.cpp",
+        "Vulkan/src/transfer/**.h",
+        "Vulkan/src/transfer/**.cpp"
+    }
+
+    defines
+    {
+        "_CRT_SECURE_NO_WARNINGS"
+    }
+
+    includedirs
+    {
+        "Vulkan/src",
+        "%{IncludeDir.Vulkan}"
+    }
+
+    filter "system:windows"
+        systemversion "latest"
+        links
+        {
+            "$(VULKAN_SDK)/lib/vulkan-1.lib"
+        }
+
+    -- CI runners, against lavapipe or whatever ICD is installed
+    filter "system:linux"
+        links
+        {
+            "vulkan",
+            "pthread"
+        }
+
+-- vertex deduplication microbenchmark, no GPU needed
+project "WeldBench"
+    location "Vulkan"
+    kind "ConsoleApp"
+    language "C++"
+    cppdialect "C++17"
+    staticruntime "on"
+
+    targetdir ("bin/"..outputdir.."/%{prj.name}")
+    objdir ("bin-int/"..outputdir.."/%{prj.name}")
+
+    pchheader "pch.h"
+    pchsource "Vulkan/src/pch.cpp"
+
+    files
+    {
+        "Vulkan/bench/weld_bench.cpp",
+        "Vulkan/src/pch.cpp",
+        "Vulkan/src/mesh/vertex.h",
+        "Vulkan/src/mesh/vertex_format.h",
+        "Vulkan/src/mesh/vertex_welder.h",
+        "Vulkan/src/mesh/vertex_welder.cpp"
+    }
+
+    defines
+    {
+        "_CRT_SECURE_NO_WARNINGS"
+    }
+
+    includedirs
+    {
+        "Vulkan/src",
+        "%{IncludeDir.glm}",
+        "%{IncludeDir.Vulkan}"
+    }
+
+    filter "system:windows"
+        systemversion "latest"
+
+    filter "system:linux"
+        links
+        {
+            "pthread"
+        }
+
+-- mesh optimizer passes on synthetic meshes, no GPU needed
+project "MeshOptimizerBench"
+    location "Vulkan"
+    kind "ConsoleApp"
+    language "C++"
+    cppdialect "C++17"
+    staticruntime "on"
+
+    targetdir ("bin/"..outputdir.."/%{prj.name}")
+    objdir ("bin-int/"..outputdir.."/%{prj.name}")
+
+    pchheader "pch.h"
+    pchsource "Vulkan/src/pch.cpp"
+
+    files
+    {
+        "Vulkan/bench/mesh_optimizer_bench.cpp",
+        "Vulkan/src/pch.cpp",
+        "Vulkan/src/mesh/mesh_optimizer.h",
+        "Vulkan/src/mesh/mesh_optimizer.cpp"
+    }
+
+    defines
+    {
+        "_CRT_SECURE_NO_WARNINGS"
+    }
+
+    includedirs
+    {
+        "Vulkan/src"
+    }
+
+    filter "system:windows"
+        systemversion "latest"